@@ -17,42 +17,40 @@
  */
 
 #include <config.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <errno.h>
 
 #include "ios.h"
 #include "ios-dev.h"
+#include "ios-buffer.h"
 
-#define IOB_CHUNK_SIZE          2048
-#define IOB_BUCKET_COUNT        8
-
-#define IOB_CHUNK_OFFSET(offset)        \
-  ((offset) % IOB_CHUNK_SIZE)
-
-#define IOB_CHUNK_NO(offset)            \
-  ((offset) / IOB_CHUNK_SIZE)
+/* The buffer is a ring of CAPACITY bytes holding the stream data in
+   [begin_offset,end_offset).  The byte at offset OFFSET lives at
+   BYTES[OFFSET % CAPACITY], so any offset is found in constant
+   time.
 
-#define IOB_BUCKET_NO(chunk_no)         \
-  ((chunk_no) % IOB_BUCKET_COUNT)
+   The ring starts small and grows as data is read into it, until it
+   can hold WINDOW bytes plus some room, so it doesn't grow on every
+   read.  From then on, reading more data forgets the oldest bytes in
+   the ring.  The ring may grow further only to hold the data of a
+   single read bigger than the window.
 
-struct ios_buffer_chunk
-{
-  uint8_t bytes[IOB_CHUNK_SIZE];
-  int chunk_no;
-  struct ios_buffer_chunk *next;
-};
+   begin_offset is the first offset that's not yet forgotten,
+   initialized as 0.  end_offset is the next byte to read to.  */
 
-/* begin_offset is the first offset that's not yet flushed, initilized as 0.
-   end_offset of an instream is the next byte to read to.  end_offset of an
-   outstream is the successor of the greatest offset that is written to.  */
+#define IOB_CHUNK_SIZE          2048
+#define IOB_MIN_CAPACITY        (64 * 1024)
 
 struct ios_buffer
 {
-  struct ios_buffer_chunk* chunks[IOB_BUCKET_COUNT];
+  uint8_t *bytes;
+  size_t capacity;
+  size_t window;
   ios_dev_off begin_offset;
   ios_dev_off end_offset;
-  int next_chunk_no;
 };
 
 ios_dev_off
@@ -66,74 +64,77 @@ ios_buffer_get_end_offset (struct ios_buffer *buffer) {
 }
 
 struct ios_buffer *
-ios_buffer_init ()
+ios_buffer_init (size_t window)
 {
   struct ios_buffer *bio = calloc (1, sizeof (struct ios_buffer));
+
+  if (bio)
+    bio->window = window;
   return bio;
 }
 
 void
 ios_buffer_free (struct ios_buffer *buffer)
 {
-  struct ios_buffer_chunk *chunk, *chunk_next;
-
   if (buffer == NULL)
     return;
 
-  for (int i = 0; i < IOB_BUCKET_COUNT; i++)
-    {
-      chunk = buffer->chunks[i];
-      while (chunk)
-        {
-          chunk_next = chunk->next;
-          free (chunk);
-          chunk = chunk_next;
-        }
-    }
-
+  free (buffer->bytes);
   free (buffer);
   return;
 }
 
-struct ios_buffer_chunk*
-ios_buffer_get_chunk (struct ios_buffer *buffer, int chunk_no)
+void
+ios_buffer_set_window (struct ios_buffer *buffer, size_t window)
 {
-  int bucket_no = IOB_BUCKET_NO (chunk_no);
-  struct ios_buffer_chunk *chunk = buffer->chunks[bucket_no];
+  buffer->window = window;
+}
 
-  for ( ; chunk; chunk = chunk->next)
-    if (chunk->chunk_no == chunk_no)
-      return chunk;
+/* Copy COUNT bytes at OFFSET out of the ring of BUFFER into BUF.  */
 
-  return NULL;
+static void
+ios_buffer_copy_out (struct ios_buffer *buffer, void *buf, size_t count,
+                     ios_dev_off offset)
+{
+  size_t pos = offset % buffer->capacity;
+  size_t n = buffer->capacity - pos < count ? buffer->capacity - pos : count;
+
+  memcpy (buf, buffer->bytes + pos, n);
+  memcpy ((uint8_t *) buf + n, buffer->bytes, count - n);
 }
 
-int
-ios_buffer_allocate_new_chunk (struct ios_buffer *buffer, int final_chunk_no,
-                               struct ios_buffer_chunk **final_chunk)
+/* Make the ring of BUFFER big enough to hold CAPACITY bytes, keeping
+   its contents.  */
+
+static int
+ios_buffer_grow (struct ios_buffer *buffer, size_t capacity)
 {
-  struct ios_buffer_chunk *chunk;
-  int bucket_no;
+  size_t new_capacity = buffer->capacity ? buffer->capacity : IOB_MIN_CAPACITY;
+  size_t count = buffer->end_offset - buffer->begin_offset;
+  uint8_t *bytes;
 
-  assert (buffer->next_chunk_no <= final_chunk_no);
+  while (new_capacity < capacity)
+    new_capacity *= 2;
+  if (new_capacity == buffer->capacity)
+    return IOD_OK;
 
-  do
+  bytes = malloc (new_capacity);
+  if (!bytes)
+    return IOD_ENOMEM;
+
+  if (count > 0)
     {
-      chunk = calloc (1, sizeof (struct ios_buffer_chunk));
-      if (!chunk)
-        return IOD_ERROR;
-      /* Place the new chunk into the buffer.  */
-      chunk->chunk_no = buffer->next_chunk_no;
-      bucket_no = IOB_BUCKET_NO (chunk->chunk_no);
-      chunk->next = buffer->chunks[bucket_no];
-      buffer->chunks[bucket_no] = chunk;
-      buffer->next_chunk_no++;
+      size_t pos = buffer->begin_offset % new_capacity;
+      size_t n = new_capacity - pos < count ? new_capacity - pos : count;
+
+      ios_buffer_copy_out (buffer, bytes + pos, n, buffer->begin_offset);
+      ios_buffer_copy_out (buffer, bytes, count - n,
+                           buffer->begin_offset + n);
     }
-  while (buffer->next_chunk_no <= final_chunk_no);
 
-  /* end_offset is updated as the buffer is written to. Therefore, it is not
-     updated here, but in ios_buffer_pwrite.  */
-  *final_chunk = chunk;
+  free (buffer->bytes);
+  buffer->bytes = bytes;
+  buffer->capacity = new_capacity;
   return IOD_OK;
 }
 
@@ -145,85 +146,68 @@ int
 ios_buffer_pread (struct ios_buffer *buffer, void *buf, size_t count,
                   ios_dev_off offset)
 {
-  int chunk_no;
-  struct ios_buffer_chunk *chunk;
-  ios_dev_off chunk_offset;
-  size_t already_read_count = 0,
-         to_be_read_count = 0;
-
-  chunk_no = IOB_CHUNK_NO (offset);
-  chunk_offset = IOB_CHUNK_OFFSET (offset);
-  chunk = ios_buffer_get_chunk (buffer, chunk_no);
-  if (!chunk && ios_buffer_allocate_new_chunk (buffer, chunk_no, &chunk))
-    return IOD_ERROR;
-
-  /* The amount we read from this chunk is the maximum of
-     the COUNT requested and the size of the rest of this chunk. */
-  to_be_read_count = IOB_CHUNK_SIZE - chunk_offset > count
-                     ? count
-                     : IOB_CHUNK_SIZE - chunk_offset;
-
-  memcpy (buf, (void *) chunk + chunk_offset, to_be_read_count);
-
-  while ((already_read_count += to_be_read_count) < count)
-    {
-      to_be_read_count = count - already_read_count > IOB_CHUNK_SIZE
-                         ? IOB_CHUNK_SIZE
-                         : count - already_read_count;
-
-      chunk = ios_buffer_get_chunk (buffer, ++chunk_no);
-      if (!chunk && ios_buffer_allocate_new_chunk (buffer, chunk_no, &chunk))
-        return IOD_ERROR;
-      memcpy (buf + already_read_count, chunk, to_be_read_count);
-    };
+  assert (offset >= buffer->begin_offset
+          && offset + count <= buffer->end_offset);
 
+  if (count > 0)
+    ios_buffer_copy_out (buffer, buf, count, offset);
   return IOD_OK;
 }
 
-/* Since ios_dev_stream_pwrite already needs to check begin_offset, this
-   function does not.  It assumes the given range is not discarded.  It also
-   allocates new chunks when necessary.  */
-
 int
-ios_buffer_pwrite (struct ios_buffer *buffer, const void *buf, size_t count,
-                   ios_dev_off offset)
+ios_buffer_fill (struct ios_buffer *buffer, FILE *file, ios_dev_off keep,
+                 ios_dev_off offset)
 {
-  int chunk_no;
-  struct ios_buffer_chunk *chunk;
-  ios_dev_off chunk_offset;
-  size_t already_written_count = 0,
-         to_be_written_count = 0;
-
-  chunk_no = IOB_CHUNK_NO (offset);
-  chunk_offset = IOB_CHUNK_OFFSET (offset);
-  chunk = ios_buffer_get_chunk (buffer, chunk_no);
-  if (!chunk && ios_buffer_allocate_new_chunk (buffer, chunk_no, &chunk))
-    return IOD_ERROR;
-
-  /* The amount we write to this chunk is the maximum of the COUNT requested
-     and the size of the rest of this chunk. */
-  to_be_written_count = IOB_CHUNK_SIZE - chunk_offset > count
-                        ? count
-                        : IOB_CHUNK_SIZE - chunk_offset;
-
-  memcpy ((void *) chunk + chunk_offset, buf, to_be_written_count);
-
-  while ((already_written_count += to_be_written_count) < count)
+  ios_dev_off protect;
+  size_t needed;
+  int ret;
+
+  /* The data past KEEP, and the last WINDOW bytes before OFFSET, are
+     not to be forgotten.  */
+  protect = offset > buffer->window ? offset - buffer->window : 0;
+  if (protect > keep)
+    protect = keep;
+  if (protect < buffer->begin_offset)
+    protect = buffer->begin_offset;
+
+  /* The ring holds everything from PROTECT up to OFFSET, so reading
+     never overwrites protected data.  Leave some room past OFFSET, so
+     the ring doesn't grow on every read.  */
+  needed = offset - protect + IOB_MIN_CAPACITY;
+  if (needed > buffer->capacity)
     {
-      to_be_written_count = count - already_written_count > IOB_CHUNK_SIZE
-                            ? IOB_CHUNK_SIZE
-                            : count - already_written_count;
-
-      chunk = ios_buffer_get_chunk (buffer, ++chunk_no);
-      if (!chunk && ios_buffer_allocate_new_chunk (buffer, chunk_no, &chunk))
-        return IOD_ERROR;
-      memcpy (chunk, buf + already_written_count, to_be_written_count);
-    };
+      ret = ios_buffer_grow (buffer, needed);
+      if (ret != IOD_OK)
+        return ret;
+    }
 
-  /* Lastly, keep track of the greatest offset we wrote to in the buffer.
-     (In fact, end_offset is the least offset we have not written to yet.)  */
-  if (buffer->end_offset < offset + count)
-    buffer->end_offset = offset + count;
+  while (buffer->end_offset < offset)
+    {
+      size_t pos = buffer->end_offset % buffer->capacity;
+      size_t count = buffer->capacity - pos;
+      size_t nread;
+
+      /* Read only what is needed.  fread waits until it gets all of
+         it, so reading more could block on interactive streams.  FILE
+         buffers the data, so reads are still big.  */
+      if (count > offset - buffer->end_offset)
+        count = offset - buffer->end_offset;
+
+      nread = fread (buffer->bytes + pos, 1, count, file);
+      buffer->end_offset += nread;
+      if (buffer->end_offset - buffer->begin_offset > buffer->capacity)
+        buffer->begin_offset = buffer->end_offset - buffer->capacity;
+
+      if (nread < count)
+        {
+          if (ferror (file) && errno == EINTR)
+            {
+              clearerr (file);
+              continue;
+            }
+          return ferror (file) ? IOD_ERROR : IOD_EOF;
+        }
+    }
 
   return IOD_OK;
 }
@@ -231,28 +215,11 @@ ios_buffer_pwrite (struct ios_buffer *buffer, const void *buf, size_t count,
 int
 ios_buffer_forget_till (struct ios_buffer *buffer, ios_dev_off offset)
 {
-  struct ios_buffer_chunk *chunk, *chunk_next;
-  int chunk_no = IOB_CHUNK_NO (offset);
+  ios_dev_off begin_offset = offset - offset % IOB_CHUNK_SIZE;
 
-  for (int i = 0; i < IOB_BUCKET_COUNT; i++)
-    {
-      chunk = buffer->chunks[i];
-      buffer->chunks[i] = NULL;
-      while (chunk)
-        {
-          chunk_next = chunk->next;
-          if (chunk->chunk_no >= chunk_no)
-            {
-              chunk->next = buffer->chunks[i];
-              buffer->chunks[i] = chunk;
-            }
-          else
-            free (chunk);
-          chunk = chunk_next;
-        }
-    }
+  if (begin_offset > buffer->begin_offset)
+    buffer->begin_offset = begin_offset;
 
-  buffer->begin_offset = chunk_no * IOB_CHUNK_SIZE;
   assert (buffer->end_offset >= buffer->begin_offset);
   assert (buffer->begin_offset <= offset);
   return IOD_OK;
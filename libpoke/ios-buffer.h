@@ -18,25 +18,29 @@
 
 struct ios_buffer;
 
-struct ios_buffer *ios_buffer_init ();
+/* Create a buffer keeping at least the last WINDOW bytes read into
+   it.  */
+
+struct ios_buffer *ios_buffer_init (size_t window);
 
 void ios_buffer_free (struct ios_buffer *buffer);
 
+void ios_buffer_set_window (struct ios_buffer *buffer, size_t window);
+
 ios_dev_off ios_buffer_get_begin_offset (struct ios_buffer *buffer);
 
 ios_dev_off ios_buffer_get_end_offset (struct ios_buffer *buffer);
 
-struct ios_buffer_chunk *ios_buffer_get_chunk (struct ios_buffer *buffer,
-                                               int chunk_no);
-
-int ios_buffer_allocate_new_chunk (struct ios_buffer *buffer,
-                                   int final_chunk_no,
-                                   struct ios_buffer_chunk **final_chunk);
-
 int ios_buffer_pread (struct ios_buffer *buffer, void *buf, size_t count,
                       ios_dev_off offset);
 
-int ios_buffer_pwrite (struct ios_buffer *buffer, const void *buf,
-                       size_t count, ios_dev_off offset);
+/* Read data from FILE into BUFFER until its end offset reaches
+   OFFSET.  The data is read through FILE, so any data already
+   buffered in it is not lost.  The data at KEEP and past it is not
+   forgotten.  Return IOD_EOF if the end of the file is reached
+   before OFFSET.  */
+
+int ios_buffer_fill (struct ios_buffer *buffer, FILE *file,
+                     ios_dev_off keep, ios_dev_off offset);
 
 int ios_buffer_forget_till (struct ios_buffer *buffer, ios_dev_off offset);
@@ -0,0 +1,633 @@
+/* ios-cache.c - Page cache for IO spaces.  */
+
+/* Copyright (C) 2026 Free Software Foundation, Inc. */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "ios.h"
+#include "ios-dev.h"
+#include "ios-cache.h"
+
+/* A cached page.
+
+   PAGE_NO is the number of the page in the device, i.e. the byte
+   offset of its first byte divided by the page size.
+
+   DIRTY is non-zero if the page has been written to and not yet
+   written back to the device.
+
+   HNEXT links the pages living in the same hash bucket.
+
+   PREV and NEXT link the pages in the LRU list, which is ordered from
+   most recently used to least recently used.
+
+   DATA holds the contents of the page.  */
+
+struct ios_cache_page
+{
+  ios_dev_off page_no;
+  int dirty;
+  struct ios_cache_page *hnext;
+  struct ios_cache_page *prev;
+  struct ios_cache_page *next;
+  uint8_t data[];
+};
+
+/* DEV_IF and DEV identify the cached device.
+
+   PAGE_SIZE is the size of every page, in bytes.
+
+   MAX_PAGES is the maximum number of pages that can be allocated at
+   any time.  NPAGES is the number of currently allocated pages.
+
+   BUCKETS is a hash table of NBUCKETS entries, indexed by page
+   number.  NBUCKETS is always a power of two.
+
+   LRU_HEAD and LRU_TAIL are the most recently and least recently
+   used pages, respectively.
+
+   WRITE_BACK is non-zero if the cache uses a write-back policy.
+
+   NEXT_PAGE is the page following the last range of pages read from
+   the device.  A miss on that page means the device is being read
+   sequentially, in which case the following RA_PAGES pages are read
+   from the device along with it, in a single operation.  RA_PAGES
+   doubles on every sequential miss, up to MAX_RA_PAGES, and is reset
+   to zero on any other miss.  RA_BUF is a buffer big enough to hold
+   MAX_RA_PAGES pages, or NULL if it hasn't been needed yet.  */
+
+struct ios_cache
+{
+  struct ios_dev_if *dev_if;
+  void *dev;
+  size_t page_size;
+  size_t max_pages;
+  size_t npages;
+  struct ios_cache_page **buckets;
+  size_t nbuckets;
+  struct ios_cache_page *lru_head;
+  struct ios_cache_page *lru_tail;
+  int write_back;
+  ios_dev_off next_page;
+  size_t ra_pages;
+  size_t max_ra_pages;
+  uint8_t *ra_buf;
+};
+
+#define IOS_CACHE_BUCKET(cache, page_no)        \
+  ((page_no) & ((cache)->nbuckets - 1))
+
+struct ios_cache *
+ios_cache_new (struct ios_dev_if *dev_if, void *dev,
+               size_t page_size, size_t budget, int write_back)
+{
+  struct ios_cache *cache;
+
+  assert (page_size > 0);
+
+  cache = calloc (1, sizeof (struct ios_cache));
+  if (!cache)
+    return NULL;
+
+  cache->dev_if = dev_if;
+  cache->dev = dev;
+  cache->page_size = page_size;
+  cache->max_pages = budget / page_size;
+  if (cache->max_pages == 0)
+    cache->max_pages = 1;
+  cache->write_back = write_back;
+
+  /* Reading ahead more than a fraction of the cache would evict the
+     pages read ahead before they are used.  */
+  cache->max_ra_pages = IOS_READAHEAD_MAX / page_size;
+  if (cache->max_ra_pages > cache->max_pages / 4)
+    cache->max_ra_pages = cache->max_pages / 4;
+
+  cache->nbuckets = 1;
+  while (cache->nbuckets < cache->max_pages)
+    cache->nbuckets <<= 1;
+
+  cache->buckets = calloc (cache->nbuckets, sizeof (struct ios_cache_page *));
+  if (!cache->buckets)
+    {
+      free (cache);
+      return NULL;
+    }
+
+  return cache;
+}
+
+void
+ios_cache_free (struct ios_cache *cache)
+{
+  struct ios_cache_page *page, *next;
+
+  if (cache == NULL)
+    return;
+
+  for (page = cache->lru_head; page; page = next)
+    {
+      next = page->next;
+      free (page);
+    }
+
+  free (cache->ra_buf);
+  free (cache->buckets);
+  free (cache);
+}
+
+/* Return the cached page PAGE_NO, or NULL if the page is not in the
+   cache.  */
+
+static struct ios_cache_page *
+ios_cache_lookup (struct ios_cache *cache, ios_dev_off page_no)
+{
+  struct ios_cache_page *page;
+
+  for (page = cache->buckets[IOS_CACHE_BUCKET (cache, page_no)];
+       page;
+       page = page->hnext)
+    if (page->page_no == page_no)
+      return page;
+
+  return NULL;
+}
+
+/* Unlink PAGE from the LRU list.  */
+
+static void
+ios_cache_lru_unlink (struct ios_cache *cache, struct ios_cache_page *page)
+{
+  if (page->prev)
+    page->prev->next = page->next;
+  else
+    cache->lru_head = page->next;
+
+  if (page->next)
+    page->next->prev = page->prev;
+  else
+    cache->lru_tail = page->prev;
+
+  page->prev = page->next = NULL;
+}
+
+/* Make PAGE the most recently used page.  */
+
+static void
+ios_cache_lru_touch (struct ios_cache *cache, struct ios_cache_page *page)
+{
+  if (cache->lru_head == page)
+    return;
+
+  if (page->prev || page->next || cache->lru_tail == page)
+    ios_cache_lru_unlink (cache, page);
+
+  page->next = cache->lru_head;
+  if (cache->lru_head)
+    cache->lru_head->prev = page;
+  cache->lru_head = page;
+  if (cache->lru_tail == NULL)
+    cache->lru_tail = page;
+}
+
+/* Remove PAGE from the hash table.  */
+
+static void
+ios_cache_unhash (struct ios_cache *cache, struct ios_cache_page *page)
+{
+  struct ios_cache_page **p
+    = &cache->buckets[IOS_CACHE_BUCKET (cache, page->page_no)];
+
+  for (; *p; p = &(*p)->hnext)
+    if (*p == page)
+      {
+        *p = page->hnext;
+        break;
+      }
+
+  page->hnext = NULL;
+}
+
+/* Write PAGE back to the device if it is dirty.  */
+
+static int
+ios_cache_writeback_page (struct ios_cache *cache,
+                          struct ios_cache_page *page)
+{
+  int ret;
+
+  if (!page->dirty)
+    return IOD_OK;
+
+  ret = cache->dev_if->pwrite (cache->dev, page->data, cache->page_size,
+                               page->page_no * cache->page_size);
+  if (ret != IOD_OK)
+    return ret;
+
+  page->dirty = 0;
+  return IOD_OK;
+}
+
+/* Get a page structure suitable to hold a new page, either by
+   allocating a new one or by evicting the least recently used page.
+   The returned page is not linked in the hash table nor in the LRU
+   list.  */
+
+static int
+ios_cache_get_page (struct ios_cache *cache, struct ios_cache_page **ret_page)
+{
+  struct ios_cache_page *page;
+
+  if (cache->npages < cache->max_pages)
+    {
+      page = malloc (sizeof (struct ios_cache_page) + cache->page_size);
+      if (!page)
+        return IOD_ENOMEM;
+      cache->npages++;
+    }
+  else
+    {
+      int ret;
+
+      page = cache->lru_tail;
+      assert (page != NULL);
+
+      ret = ios_cache_writeback_page (cache, page);
+      if (ret != IOD_OK)
+        return ret;
+
+      ios_cache_lru_unlink (cache, page);
+      ios_cache_unhash (cache, page);
+    }
+
+  page->dirty = 0;
+  page->hnext = page->prev = page->next = NULL;
+  *ret_page = page;
+  return IOD_OK;
+}
+
+/* Put PAGE, which is not linked anywhere, back in the pool.  */
+
+static void
+ios_cache_release_page (struct ios_cache *cache, struct ios_cache_page *page)
+{
+  free (page);
+  cache->npages--;
+}
+
+/* Hash PAGE as the page PAGE_NO and make it the most recently used
+   page.  */
+
+static void
+ios_cache_insert (struct ios_cache *cache, struct ios_cache_page *page,
+                  ios_dev_off page_no)
+{
+  size_t bucket = IOS_CACHE_BUCKET (cache, page_no);
+
+  page->page_no = page_no;
+  page->hnext = cache->buckets[bucket];
+  cache->buckets[bucket] = page;
+  ios_cache_lru_touch (cache, page);
+}
+
+/* Read the page PAGE_NO from the device and put it in the cache.  If
+   the page is incomplete, i.e. it goes past the end of the device,
+   IOD_EOF is returned and nothing is cached.  */
+
+static int
+ios_cache_fill (struct ios_cache *cache, ios_dev_off page_no,
+                struct ios_cache_page **ret_page)
+{
+  struct ios_cache_page *page;
+  int ret;
+
+  ret = ios_cache_get_page (cache, &page);
+  if (ret != IOD_OK)
+    return ret;
+
+  ret = cache->dev_if->pread (cache->dev, page->data, cache->page_size,
+                              page_no * cache->page_size);
+  if (ret != IOD_OK)
+    {
+      ios_cache_release_page (cache, page);
+      return ret;
+    }
+
+  ios_cache_insert (cache, page, page_no);
+  *ret_page = page;
+  return IOD_OK;
+}
+
+/* Read the page PAGE_NO from the device and put it in the cache, like
+   ios_cache_fill, reading ahead the pages following it if the device
+   is being read sequentially.  */
+
+static int
+ios_cache_fill_ahead (struct ios_cache *cache, ios_dev_off page_no,
+                      struct ios_cache_page **ret_page)
+{
+  size_t npages, i;
+  ios_dev_off dev_pages;
+  int ret;
+
+  if (page_no != cache->next_page || cache->max_ra_pages < 2)
+    {
+      cache->ra_pages = 0;
+      cache->next_page = page_no + 1;
+      return ios_cache_fill (cache, page_no, ret_page);
+    }
+
+  cache->ra_pages = cache->ra_pages ? cache->ra_pages * 2 : 2;
+  if (cache->ra_pages > cache->max_ra_pages)
+    cache->ra_pages = cache->max_ra_pages;
+
+  /* Don't read ahead past the end of the device, nor over pages that
+     are already cached.  */
+  npages = cache->ra_pages;
+  dev_pages = cache->dev_if->size (cache->dev) / cache->page_size;
+  if (page_no >= dev_pages)
+    npages = 1;
+  else if (dev_pages - page_no < npages)
+    npages = dev_pages - page_no;
+  for (i = 1; i < npages; ++i)
+    if (ios_cache_lookup (cache, page_no + i))
+      break;
+  npages = i;
+
+  cache->next_page = page_no + npages;
+  if (npages < 2)
+    return ios_cache_fill (cache, page_no, ret_page);
+
+  if (!cache->ra_buf)
+    {
+      cache->ra_buf = malloc (cache->max_ra_pages * cache->page_size);
+      if (!cache->ra_buf)
+        return ios_cache_fill (cache, page_no, ret_page);
+    }
+
+  /* If reading the whole range fails, let ios_cache_fill figure out
+     what is wrong with the requested page.  */
+  ret = cache->dev_if->pread (cache->dev, cache->ra_buf,
+                              npages * cache->page_size,
+                              page_no * cache->page_size);
+  if (ret != IOD_OK)
+    {
+      cache->ra_pages = 0;
+      return ios_cache_fill (cache, page_no, ret_page);
+    }
+
+  /* Cache the pages in reverse order, so the requested page ends up
+     being the most recently used one.  */
+  for (i = npages; i > 0; --i)
+    {
+      struct ios_cache_page *page;
+
+      ret = ios_cache_get_page (cache, &page);
+      if (ret != IOD_OK)
+        return ret;
+
+      memcpy (page->data, cache->ra_buf + (i - 1) * cache->page_size,
+              cache->page_size);
+      ios_cache_insert (cache, page, page_no + i - 1);
+      *ret_page = page;
+    }
+
+  return IOD_OK;
+}
+
+int
+ios_cache_pread (struct ios_cache *cache, void *buf, size_t count,
+                 ios_dev_off offset)
+{
+  uint8_t *p = buf;
+
+  /* Reads bigger than the whole cache would only thrash it.  Serve
+     them from the device, after making sure it is up to date.  */
+  if (count >= cache->max_pages * cache->page_size)
+    {
+      int ret = ios_cache_sync (cache, offset, count);
+
+      if (ret != IOD_OK)
+        return ret;
+      return cache->dev_if->pread (cache->dev, buf, count, offset);
+    }
+
+  while (count > 0)
+    {
+      ios_dev_off page_no = offset / cache->page_size;
+      size_t page_offset = offset % cache->page_size;
+      size_t n = cache->page_size - page_offset;
+      struct ios_cache_page *page;
+
+      if (n > count)
+        n = count;
+
+      page = ios_cache_lookup (cache, page_no);
+      if (page)
+        ios_cache_lru_touch (cache, page);
+      else
+        {
+          int ret = ios_cache_fill_ahead (cache, page_no, &page);
+
+          /* The page is incomplete.  Since no page past this one can
+             be in the cache, read the rest from the device.  */
+          if (ret == IOD_EOF)
+            return cache->dev_if->pread (cache->dev, p, count, offset);
+          if (ret != IOD_OK)
+            return ret;
+        }
+
+      memcpy (p, page->data + page_offset, n);
+      p += n;
+      offset += n;
+      count -= n;
+    }
+
+  return IOD_OK;
+}
+
+int
+ios_cache_pwrite (struct ios_cache *cache, const void *buf, size_t count,
+                  ios_dev_off offset)
+{
+  const uint8_t *p = buf;
+
+  /* Writes are propagated to the device right away in write-through
+     mode.  This is also done for writes bigger than the whole cache,
+     which would only thrash it.  */
+  if (!cache->write_back
+      || count >= cache->max_pages * cache->page_size)
+    {
+      int ret = cache->dev_if->pwrite (cache->dev, buf, count, offset);
+
+      if (ret != IOD_OK)
+        return ret;
+      ios_cache_update (cache, buf, count, offset);
+      return IOD_OK;
+    }
+
+  while (count > 0)
+    {
+      ios_dev_off page_no = offset / cache->page_size;
+      size_t page_offset = offset % cache->page_size;
+      size_t n = cache->page_size - page_offset;
+      struct ios_cache_page *page;
+
+      if (n > count)
+        n = count;
+
+      page = ios_cache_lookup (cache, page_no);
+      if (page)
+        ios_cache_lru_touch (cache, page);
+      else
+        {
+          int ret = ios_cache_fill (cache, page_no, &page);
+
+          /* The page is incomplete, so it cannot be cached.  Write
+             the rest directly to the device.  */
+          if (ret == IOD_EOF)
+            return cache->dev_if->pwrite (cache->dev, p, count, offset);
+          if (ret != IOD_OK)
+            return ret;
+        }
+
+      memcpy (page->data + page_offset, p, n);
+      page->dirty = 1;
+      p += n;
+      offset += n;
+      count -= n;
+    }
+
+  return IOD_OK;
+}
+
+int
+ios_cache_sync (struct ios_cache *cache, ios_dev_off offset, size_t count)
+{
+  ios_dev_off first, last;
+  struct ios_cache_page *page;
+
+  if (!cache->write_back || count == 0)
+    return IOD_OK;
+
+  first = offset / cache->page_size;
+  last = (offset + count - 1) / cache->page_size;
+
+  /* Walk whichever is shorter: the range or the list of pages.  */
+  if (last - first < cache->npages)
+    {
+      ios_dev_off page_no;
+
+      for (page_no = first; page_no <= last; page_no++)
+        {
+          page = ios_cache_lookup (cache, page_no);
+          if (page)
+            {
+              int ret = ios_cache_writeback_page (cache, page);
+
+              if (ret != IOD_OK)
+                return ret;
+            }
+        }
+    }
+  else
+    {
+      for (page = cache->lru_head; page; page = page->next)
+        if (page->page_no >= first && page->page_no <= last)
+          {
+            int ret = ios_cache_writeback_page (cache, page);
+
+            if (ret != IOD_OK)
+              return ret;
+          }
+    }
+
+  return IOD_OK;
+}
+
+int
+ios_cache_flush (struct ios_cache *cache)
+{
+  struct ios_cache_page *page;
+
+  if (!cache->write_back)
+    return IOD_OK;
+
+  for (page = cache->lru_head; page; page = page->next)
+    {
+      int ret = ios_cache_writeback_page (cache, page);
+
+      if (ret != IOD_OK)
+        return ret;
+    }
+
+  return IOD_OK;
+}
+
+void
+ios_cache_update (struct ios_cache *cache, const void *buf, size_t count,
+                  ios_dev_off offset)
+{
+  const uint8_t *p = buf;
+
+  while (count > 0)
+    {
+      ios_dev_off page_no = offset / cache->page_size;
+      size_t page_offset = offset % cache->page_size;
+      size_t n = cache->page_size - page_offset;
+      struct ios_cache_page *page;
+
+      if (n > count)
+        n = count;
+
+      page = ios_cache_lookup (cache, page_no);
+      if (page)
+        memcpy (page->data + page_offset, p, n);
+
+      p += n;
+      offset += n;
+      count -= n;
+    }
+}
+
+void
+ios_cache_invalidate (struct ios_cache *cache, ios_dev_off offset,
+                      size_t count)
+{
+  ios_dev_off first, last;
+  struct ios_cache_page *page, *next;
+
+  if (count == 0)
+    return;
+
+  first = offset / cache->page_size;
+  last = (offset + count - 1) / cache->page_size;
+
+  for (page = cache->lru_head; page; page = next)
+    {
+      next = page->next;
+      if (page->page_no >= first && page->page_no <= last)
+        {
+          ios_cache_lru_unlink (cache, page);
+          ios_cache_unhash (cache, page);
+          ios_cache_release_page (cache, page);
+        }
+    }
+}
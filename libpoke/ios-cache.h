@@ -0,0 +1,99 @@
+/* ios-cache.h - Page cache for IO spaces.  */
+
+/* Copyright (C) 2026 Free Software Foundation, Inc. */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* An IOS cache sits between an IO space and the device it operates.
+   It keeps copies of fixed-size, page-aligned ranges of the device
+   ("pages") in memory, so small reads and writes of neighbouring
+   data don't result in a device operation each.
+
+   Pages are evicted in least-recently-used order once the memory
+   budget of the cache is exhausted.
+
+   When pages are missed in ascending order the device is assumed to
+   be read sequentially, and the pages following the missed one are
+   read ahead in growing windows of up to IOS_READAHEAD_MAX bytes.
+
+   In write-through mode every write is immediately propagated to the
+   device, and cached pages are merely updated.  In write-back mode
+   writes only update the cached pages, which are marked as dirty and
+   written to the device when they are evicted or when the cache is
+   flushed.
+
+   The last page of a device is usually incomplete.  Incomplete pages
+   are never cached: accesses to them are served directly by the
+   device.  */
+
+struct ios_cache;
+
+/* Create a new cache for the device DEV, which is operated using the
+   interface DEV_IF.  PAGE_SIZE is the size of the cache pages in
+   bytes.  BUDGET is the maximum number of bytes of page data to keep
+   in memory.  WRITE_BACK selects the write-back policy if non-zero,
+   write-through otherwise.
+
+   Return NULL if there is not enough memory.  */
+
+struct ios_cache *ios_cache_new (struct ios_dev_if *dev_if, void *dev,
+                                 size_t page_size, size_t budget,
+                                 int write_back);
+
+/* Free all the resources used by CACHE.  Note that dirty pages are
+   not written back: call ios_cache_flush first if that is
+   desired.  */
+
+void ios_cache_free (struct ios_cache *cache);
+
+/* Read COUNT bytes at the byte OFFSET of the cached device into
+   BUF.  Return an IOD_* status code.  */
+
+int ios_cache_pread (struct ios_cache *cache, void *buf, size_t count,
+                     ios_dev_off offset);
+
+/* Write COUNT bytes from BUF at the byte OFFSET of the cached device.
+   Return an IOD_* status code.  */
+
+int ios_cache_pwrite (struct ios_cache *cache, const void *buf,
+                      size_t count, ios_dev_off offset);
+
+/* Write back the dirty pages overlapping with the range
+   [OFFSET,OFFSET+COUNT) to the device.  Return an IOD_* status
+   code.  */
+
+int ios_cache_sync (struct ios_cache *cache, ios_dev_off offset,
+                    size_t count);
+
+/* Write back all the dirty pages in CACHE to the device.  Return an
+   IOD_* status code.  */
+
+int ios_cache_flush (struct ios_cache *cache);
+
+/* Update the copies of the range [OFFSET,OFFSET+COUNT) held in CACHE
+   with the contents of BUF.  This is to be used after writing to the
+   device directly, bypassing the cache.  */
+
+void ios_cache_update (struct ios_cache *cache, const void *buf,
+                       size_t count, ios_dev_off offset);
+
+/* Drop the copies of the range [OFFSET,OFFSET+COUNT) held in CACHE,
+   discarding any changes to them not written back yet.  This is to
+   be used after the contents of the device have been changed by
+   other means than the cache and the device interface, like the
+   kernel copying data between files.  */
+
+void ios_cache_invalidate (struct ios_cache *cache, ios_dev_off offset,
+                           size_t count);
@@ -32,13 +32,32 @@
 #include "ios.h"
 #include "ios-dev.h"
 
-/* State associated with a file device.  */
+/* When the file is accessed with direct IO, transfers to and from
+   the file shall be aligned to this number of bytes, both in memory
+   and in the file.  4096 is suitable for the vast majority of block
+   devices and file systems.  */
+
+#define IOS_DEV_FILE_DIRECT_ALIGN 4096
+
+/* State associated with a file device.
+
+   FD is the file descriptor of the file.
+
+   FILENAME is the name of the file.
+
+   FLAGS are the flags of the device.
+
+   BOUNCE is a buffer suitably aligned for direct IO, of size
+   BOUNCE_SIZE.  It is NULL if the file is not accessed with direct
+   IO or if no transfer has been performed yet.  */
 
 struct ios_dev_file
 {
-  FILE *file;
+  int fd;
   char *filename;
   uint64_t flags;
+  uint8_t *bounce;
+  size_t bounce_size;
 };
 
 static const char *
@@ -63,56 +82,97 @@ ios_dev_file_handler_normalize (const char *handler, uint64_t flags, int* error)
   return new_handler;
 }
 
-/* Returns 0 when the flags are inconsistent.  */
+/* Returns -1 when the flags are inconsistent.  */
 static inline int
-ios_dev_file_convert_flags (int mode_flags, char **mode_for_fdopen)
+ios_dev_file_convert_flags (int mode_flags)
 {
   int flags_for_open = 0;
 
   if ((mode_flags & IOS_F_READ)
       && (mode_flags & IOS_F_WRITE))
-    {
-      flags_for_open |= O_RDWR;
-      *mode_for_fdopen = "r+b";
-    }
+    flags_for_open |= O_RDWR;
   else if (mode_flags & IOS_F_READ)
-    {
-      flags_for_open |= O_RDONLY;
-      *mode_for_fdopen = "rb";
-    }
+    flags_for_open |= O_RDONLY;
   else if (mode_flags & IOS_F_WRITE)
-    {
-      flags_for_open |= O_WRONLY;
-      *mode_for_fdopen = "wb";
-    }
+    flags_for_open |= O_WRONLY;
   else
     /* Cannot open a file neither to write nor to read.  */
     return -1;
 
   if (mode_flags & IOS_F_CREATE)
     flags_for_open |= O_CREAT;
+  if (mode_flags & IOS_F_TRUNCATE)
+    {
+      /* A file can't be truncated without writing to it.  */
+      if (!(mode_flags & IOS_F_WRITE))
+        return -1;
+      flags_for_open |= O_TRUNC;
+    }
 
   return flags_for_open;
 }
 
+/* Apply the access pattern hints and the direct IO request in FLAGS
+   to the file descriptor FD.  Return the flags that are actually in
+   effect, or -1 if the flags are inconsistent.
+
+   The hints are just that, hints, and they are silently ignored if
+   the system doesn't support them.  Likewise, IOS_F_DIRECT is
+   removed from the returned flags if the system or the file system
+   where the file resides doesn't support direct IO.  */
+
+static int64_t
+ios_dev_file_apply_hints (int fd, uint64_t flags)
+{
+  if ((flags & IOS_F_SEQUENTIAL) && (flags & IOS_F_RANDOM))
+    return -1;
+
+#if defined HAVE_POSIX_FADVISE
+  if (flags & IOS_F_SEQUENTIAL)
+    (void) posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  if (flags & IOS_F_RANDOM)
+    (void) posix_fadvise (fd, 0, 0, POSIX_FADV_RANDOM);
+  if (flags & IOS_F_WILLNEED)
+    (void) posix_fadvise (fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+
+  if (flags & IOS_F_DIRECT)
+    {
+      int direct_p = 0;
+
+#if defined O_DIRECT
+      {
+        int fl = fcntl (fd, F_GETFL);
+
+        direct_p = (fl != -1
+                    && fcntl (fd, F_SETFL, fl | O_DIRECT) != -1);
+      }
+#elif defined F_NOCACHE
+      direct_p = (fcntl (fd, F_NOCACHE, 1) != -1);
+#endif
+      if (!direct_p)
+        flags &= ~IOS_F_DIRECT;
+    }
+
+  return flags;
+}
+
 static void *
 ios_dev_file_open (const char *handler, uint64_t flags, int *error,
                    void *data __attribute__ ((unused)))
 {
   struct ios_dev_file *fio = NULL;
-  FILE *f = NULL;
   int internal_error = IOD_ERROR;
 
   uint8_t mode_flags = flags & IOS_FLAGS_MODE;
-  char *mode_for_fdopen = NULL;
   int flags_for_open = 0;
-  int fd;
+  int64_t actual_flags;
+  int fd = -1;
 
   if (mode_flags != 0)
     {
       /* Decide what mode to use to open the file.  */
-      flags_for_open
-        = ios_dev_file_convert_flags (mode_flags, &mode_for_fdopen);
+      flags_for_open = ios_dev_file_convert_flags (mode_flags);
       if (flags_for_open == -1)
         {
           internal_error = IOD_EFLAGS;
@@ -121,39 +181,36 @@ ios_dev_file_open (const char *handler, uint64_t flags, int *error,
       fd = open (handler, flags_for_open, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
       if (fd == -1)
         goto err;
-      f = fdopen (fd, mode_for_fdopen);
     }
   else
     {
       /* Try read-write initially.
          If that fails, then try read-only.
          If that fails, then try write-only.  */
-      const char *mode_for_fdopen;
-
       fd = open (handler, O_RDWR, 0);
       flags |= (IOS_F_READ | IOS_F_WRITE);
-      mode_for_fdopen = "r+b";
       if (fd == -1)
         {
           fd = open (handler, O_RDONLY, 0);
           if (fd != -1)
             flags &= ~IOS_F_WRITE;
-          mode_for_fdopen = "rb";
         }
       if (fd == -1)
         {
           fd = open (handler, O_WRONLY, 0);
           if (fd != -1)
             flags &= ~IOS_F_READ;
-          mode_for_fdopen = "wb";
         }
       if (fd == -1)
         goto err;
-      f = fdopen (fd, mode_for_fdopen);
     }
 
-  if (!f)
-    goto err;
+  actual_flags = ios_dev_file_apply_hints (fd, flags);
+  if (actual_flags == -1)
+    {
+      internal_error = IOD_EFLAGS;
+      goto err;
+    }
 
   fio = malloc (sizeof (struct ios_dev_file));
   if (!fio)
@@ -163,8 +220,10 @@ ios_dev_file_open (const char *handler, uint64_t flags, int *error,
   if (!fio->filename)
     goto err;
 
-  fio->file = f;
-  fio->flags = flags;
+  fio->fd = fd;
+  fio->flags = actual_flags;
+  fio->bounce = NULL;
+  fio->bounce_size = 0;
 
   if (error)
     *error = IOD_OK;
@@ -175,8 +234,8 @@ err:
     free (fio->filename);
   free (fio);
 
-  if (f)
-    fclose (f);
+  if (fd != -1)
+    close (fd);
 
   if (error)
     {
@@ -197,20 +256,18 @@ static int
 ios_dev_file_close (void *iod)
 {
   struct ios_dev_file *fio = iod;
+  int ret = IOD_OK;
 
-  if (fclose (fio->file) == 0)
-    {
-      free (fio->filename);
-      free (fio);
-      return IOD_OK;
-    }
-  else
+  if (close (fio->fd) == -1)
     {
       perror (fio->filename);
-      free (fio->filename);
-      free (fio);
-      return IOD_ERROR;
+      ret = IOD_ERROR;
     }
+
+  free (fio->bounce);
+  free (fio->filename);
+  free (fio);
+  return ret;
 }
 
 static uint64_t
@@ -221,30 +278,175 @@ ios_dev_file_get_flags (void *iod)
   return fio->flags;
 }
 
+/* Read up to COUNT bytes at OFFSET into BUF, retrying on short reads.
+   Return the number of bytes read, which is less than COUNT only if
+   the end of the file is reached, or -1 on error.  */
+
+static ssize_t
+ios_dev_file_pread_full (int fd, void *buf, size_t count, off_t offset)
+{
+  size_t done = 0;
+
+  while (done < count)
+    {
+      ssize_t ret = pread (fd, (uint8_t *) buf + done, count - done,
+                           offset + done);
+
+      if (ret == -1)
+        {
+          if (errno == EINTR)
+            continue;
+          return -1;
+        }
+      if (ret == 0)
+        break;
+      done += ret;
+    }
+
+  return done;
+}
+
+/* Write COUNT bytes from BUF at OFFSET, retrying on short writes.
+   Return 0 on success, -1 on error.  */
 
 static int
-ios_dev_file_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
+ios_dev_file_pwrite_full (int fd, const void *buf, size_t count,
+                          off_t offset)
 {
-  struct ios_dev_file *fio = iod;
-  size_t ret;
+  size_t done = 0;
+
+  while (done < count)
+    {
+      ssize_t ret = pwrite (fd, (const uint8_t *) buf + done,
+                            count - done, offset + done);
+
+      if (ret == -1)
+        {
+          if (errno == EINTR)
+            continue;
+          return -1;
+        }
+      done += ret;
+    }
+
+  return 0;
+}
+
+/* Make sure the bounce buffer of FIO can hold at least SIZE bytes.
+   Return an IOD_* status code.  */
 
-  /* We are using FILE* for buffering, rather than low-level fd, so we
-     have to fake low-level pread by using fseeko.  */
-  if (fseeko (fio->file, offset, SEEK_SET) == -1)
+static int
+ios_dev_file_bounce (struct ios_dev_file *fio, size_t size)
+{
+  void *bounce;
+
+  if (size <= fio->bounce_size)
+    return IOD_OK;
+
+  if (posix_memalign (&bounce, IOS_DEV_FILE_DIRECT_ALIGN, size) != 0)
+    return IOD_ENOMEM;
+
+  free (fio->bounce);
+  fio->bounce = bounce;
+  fio->bounce_size = size;
+  return IOD_OK;
+}
+
+/* Direct IO requires the file offsets, the transfer sizes and the
+   memory buffers to be aligned.  The following functions transfer
+   whole aligned blocks between the file and the bounce buffer, and
+   copy the requested bytes from or to there.  */
+
+#define IOS_DEV_FILE_ALIGN_DOWN(x)                      \
+  ((x) & ~((ios_dev_off) IOS_DEV_FILE_DIRECT_ALIGN - 1))
+#define IOS_DEV_FILE_ALIGN_UP(x)                                        \
+  IOS_DEV_FILE_ALIGN_DOWN ((x) + IOS_DEV_FILE_DIRECT_ALIGN - 1)
+
+static int
+ios_dev_file_pread_direct (struct ios_dev_file *fio, void *buf,
+                           size_t count, ios_dev_off offset)
+{
+  ios_dev_off start = IOS_DEV_FILE_ALIGN_DOWN (offset);
+  ios_dev_off end = IOS_DEV_FILE_ALIGN_UP (offset + count);
+  ssize_t ret;
+
+  if (ios_dev_file_bounce (fio, end - start) != IOD_OK)
+    return IOD_ENOMEM;
+
+  ret = ios_dev_file_pread_full (fio->fd, fio->bounce, end - start, start);
+  if (ret == -1)
+    return IOD_ERROR;
+  if ((size_t) ret < offset - start + count)
     return IOD_EOF;
-  ret = fread (buf, 1, count, fio->file);
 
-  if (ferror (fio->file))
+  memcpy (buf, fio->bounce + (offset - start), count);
+  return IOD_OK;
+}
+
+static int
+ios_dev_file_pwrite_direct (struct ios_dev_file *fio, const void *buf,
+                            size_t count, ios_dev_off offset)
+{
+  ios_dev_off start = IOS_DEV_FILE_ALIGN_DOWN (offset);
+  ios_dev_off end = IOS_DEV_FILE_ALIGN_UP (offset + count);
+  ssize_t ret;
+  struct stat st;
+
+  if (ios_dev_file_bounce (fio, end - start) != IOD_OK)
+    return IOD_ENOMEM;
+
+  /* Read the blocks to update, if possible.  Parts of them may lie
+     past the end of the file, in which case they are zeroed.  */
+  ret = 0;
+  if (fio->flags & IOS_F_READ)
     {
-      clearerr (fio->file);
-      return IOD_ERROR;
+      ret = ios_dev_file_pread_full (fio->fd, fio->bounce, end - start,
+                                     start);
+      if (ret == -1)
+        return IOD_ERROR;
+    }
+  else if (offset != start || (offset + count) != end)
+    /* Partial blocks can't be updated in a write-only file.  */
+    return IOD_ERROR;
+  memset (fio->bounce + ret, 0, (end - start) - ret);
+
+  if (fstat (fio->fd, &st) == -1)
+    return IOD_ERROR;
+
+  memcpy (fio->bounce + (offset - start), buf, count);
+  if (ios_dev_file_pwrite_full (fio->fd, fio->bounce, end - start,
+                                start) == -1)
+    return IOD_ERROR;
+
+  /* Writing whole blocks may have extended the file past the written
+     data.  Trim the excess.  */
+  if (end > (ios_dev_off) st.st_size)
+    {
+      ios_dev_off size = st.st_size;
+
+      if (offset + count > size)
+        size = offset + count;
+      if (ftruncate (fio->fd, size) == -1)
+        return IOD_ERROR;
     }
 
-  /* XXX As long as count <= 9 because the ios layer reads at most an
-     unaligned uint64_t, we are unlikely to hit short reads.  But if
-     future code adds in large buffer reads, we may want to retry on
-     short reads rather than giving up right away. */
-  return ret == count ? IOD_OK : IOD_EOF;
+  return IOD_OK;
+}
+
+static int
+ios_dev_file_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
+{
+  struct ios_dev_file *fio = iod;
+  ssize_t ret;
+
+  if (fio->flags & IOS_F_DIRECT)
+    return ios_dev_file_pread_direct (fio, buf, count, offset);
+
+  ret = ios_dev_file_pread_full (fio->fd, buf, count, offset);
+  if (ret == -1)
+    return errno == EINVAL ? IOD_EOF : IOD_ERROR;
+
+  return (size_t) ret == count ? IOD_OK : IOD_EOF;
 }
 
 static int
@@ -252,22 +454,19 @@ ios_dev_file_pwrite (void *iod, const void *buf, size_t count,
                      ios_dev_off offset)
 {
   struct ios_dev_file *fio = iod;
-  size_t ret;
 
-  /* We are using FILE* for buffering, rather than low-level fd, so we
-     have to fake low-level pread by using fseeko.  */
-  if (fseeko (fio->file, offset, SEEK_SET))
-    return IOD_EOF;
-  ret = fwrite (buf, 1, count, fio->file);
+  if (fio->flags & IOS_F_DIRECT)
+    return ios_dev_file_pwrite_direct (fio, buf, count, offset);
 
-  if (ferror (fio->file))
+  if (ios_dev_file_pwrite_full (fio->fd, buf, count, offset) == -1)
     {
+      if (errno == EINVAL)
+        return IOD_EOF;
       perror ("write: ");
-      clearerr (fio->file);
       return IOD_ERROR;
     }
 
-  return ret == count ? IOD_OK : IOD_EOF;
+  return IOD_OK;
 }
 
 static ios_dev_off
@@ -276,7 +475,7 @@ ios_dev_file_size (void *iod)
   struct stat st;
   struct ios_dev_file *fio = iod;
 
-  fstat (fileno (fio->file), &st);
+  fstat (fio->fd, &st);
   return st.st_size;
 }
 
@@ -286,6 +485,55 @@ ios_dev_file_flush (void *iod, ios_dev_off offset)
   return IOS_OK;
 }
 
+/* Find the extents of data with SEEK_DATA and SEEK_HOLE, in the
+   systems and file systems that support them.  Otherwise the whole
+   file is data.  */
+
+static int
+ios_dev_file_next_data (void *iod, ios_dev_off offset,
+                        ios_dev_off *begin, ios_dev_off *end)
+{
+  struct ios_dev_file *fio = iod;
+  ios_dev_off size;
+
+#if defined SEEK_DATA && defined SEEK_HOLE
+  off_t data = lseek (fio->fd, offset, SEEK_DATA);
+
+  if (data != -1)
+    {
+      off_t hole = lseek (fio->fd, data, SEEK_HOLE);
+
+      if (hole != -1)
+        {
+          *begin = data;
+          *end = hole;
+          return IOD_OK;
+        }
+    }
+  else if (errno == ENXIO)
+    return IOD_EOF;
+#endif
+
+  size = ios_dev_file_size (iod);
+  if (offset >= size)
+    return IOD_EOF;
+
+  *begin = offset;
+  *end = size;
+  return IOD_OK;
+}
+
+/* Files opened for direct IO can only be accessed in aligned blocks,
+   which the users of the descriptor don't know about.  */
+
+static int
+ios_dev_file_get_fd (void *iod)
+{
+  struct ios_dev_file *fio = iod;
+
+  return (fio->flags & IOS_F_DIRECT) ? -1 : fio->fd;
+}
+
 struct ios_dev_if ios_dev_file =
   {
    .get_if_name = ios_dev_file_get_if_name,
@@ -296,5 +544,7 @@ struct ios_dev_if ios_dev_file =
    .pwrite = ios_dev_file_pwrite,
    .get_flags = ios_dev_file_get_flags,
    .size = ios_dev_file_size,
-   .flush = ios_dev_file_flush
+   .flush = ios_dev_file_flush,
+   .next_data = ios_dev_file_next_data,
+   .get_fd = ios_dev_file_get_fd,
   };
@@ -24,16 +24,30 @@
 #include "ios.h"
 #include "ios-dev.h"
 
-/* State asociated with a memory device.  */
+/* State asociated with a memory device.
+
+   The contents of the device are stored in chunks of MEM_CHUNK_SIZE
+   bytes.  CHUNKS is a table of NUM_CHUNKS pointers to them, which
+   grows geometrically.  Chunks are allocated the first time some
+   non-zero data is written into them; until then, they read as
+   zeroes.
+
+   SIZE is the size of the device.  Writes can start at most MEM_STEP
+   bytes past its end, and then it grows by as many MEM_STEP bytes as
+   needed to hold the written data.  USAGE is the number of bytes
+   allocated for chunks.  */
 
 struct ios_dev_mem
 {
-  char *pointer;
+  char **chunks;
+  size_t num_chunks;
   size_t size;
+  size_t usage;
   uint64_t flags;
 };
 
 #define MEM_STEP (512 * 8)
+#define MEM_CHUNK_SIZE (64 * 1024)
 
 static const char *
 ios_dev_mem_get_if_name () {
@@ -68,13 +82,9 @@ ios_dev_mem_open (const char *handler, uint64_t flags, int *error,
       goto err;
     }
 
-  mio->pointer = calloc (MEM_STEP, 1);
-  if (!mio->pointer)
-    {
-      internal_error = IOD_ENOMEM;
-      goto err;
-    }
-
+  mio->chunks = NULL;
+  mio->num_chunks = 0;
+  mio->usage = 0;
   mio->size = MEM_STEP;
   mio->flags = IOS_F_READ | IOS_F_WRITE;
 
@@ -93,8 +103,11 @@ static int
 ios_dev_mem_close (void *iod)
 {
   struct ios_dev_mem *mio = iod;
+  size_t i;
 
-  free (mio->pointer);
+  for (i = 0; i < mio->num_chunks; ++i)
+    free (mio->chunks[i]);
+  free (mio->chunks);
   free (mio);
 
   return IOD_OK;
@@ -112,41 +125,121 @@ static int
 ios_dev_mem_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
 {
   struct ios_dev_mem *mio = iod;
+  char *p = buf;
 
   if (offset + count > mio->size)
     return IOD_EOF;
 
-  memcpy (buf, &mio->pointer[offset], count);
+  while (count > 0)
+    {
+      size_t index = offset / MEM_CHUNK_SIZE;
+      size_t chunk_offset = offset % MEM_CHUNK_SIZE;
+      size_t n = MEM_CHUNK_SIZE - chunk_offset;
+
+      if (n > count)
+        n = count;
+
+      if (index < mio->num_chunks && mio->chunks[index])
+        memcpy (p, mio->chunks[index] + chunk_offset, n);
+      else
+        memset (p, 0, n);
+
+      p += n;
+      offset += n;
+      count -= n;
+    }
+
   return 0;
 }
 
+/* Return whether the COUNT bytes at BUF are all zero.  */
+
+static int
+ios_dev_mem_zero_p (const char *buf, size_t count)
+{
+  return count == 0 || (buf[0] == 0 && memcmp (buf, buf + 1, count - 1) == 0);
+}
+
 static int
 ios_dev_mem_pwrite (void *iod, const void *buf, size_t count,
                     ios_dev_off offset)
 
 {
   struct ios_dev_mem *mio = iod;
+  size_t size = mio->size;
+  size_t index, last;
+  const char *p;
 
-  if (offset + count > mio->size + MEM_STEP)
+  if (offset >= mio->size + MEM_STEP)
     return IOD_EOF;
 
   if (offset + count > mio->size)
+    size += ((offset + count - mio->size + MEM_STEP - 1)
+             / MEM_STEP * MEM_STEP);
+
+  if (count == 0)
+    goto done;
+
+  /* Make room in the table for the chunks covering the data.  */
+  last = (offset + count - 1) / MEM_CHUNK_SIZE;
+  if (last >= mio->num_chunks)
+    {
+      size_t num_chunks = mio->num_chunks ? mio->num_chunks : 16;
+      char **chunks;
+
+      while (num_chunks <= last)
+        num_chunks *= 2;
+
+      chunks = realloc (mio->chunks, num_chunks * sizeof (char *));
+      if (!chunks)
+        return IOD_ERROR;
+      memset (chunks + mio->num_chunks, 0,
+              (num_chunks - mio->num_chunks) * sizeof (char *));
+      mio->chunks = chunks;
+      mio->num_chunks = num_chunks;
+    }
+
+  /* Allocate the missing chunks before writing anything, so a failed
+     write leaves the device untouched.  Chunks that would only get
+     zeroes are not needed.  */
+  p = buf;
+  for (index = offset / MEM_CHUNK_SIZE; index <= last; ++index)
     {
-      void *pointer_bak = mio->pointer;
+      ios_dev_off start = index * MEM_CHUNK_SIZE;
+      ios_dev_off end = start + MEM_CHUNK_SIZE;
+
+      if (start < offset)
+        start = offset;
+      if (end > offset + count)
+        end = offset + count;
 
-      mio->pointer = realloc (mio->pointer, mio->size + MEM_STEP);
-      if (!mio->pointer)
+      if (!mio->chunks[index]
+          && !ios_dev_mem_zero_p (p + (start - offset), end - start))
         {
-          /* Restore pointer after failed realloc and return error. */
-          mio->pointer = pointer_bak;
-          return IOD_ERROR;
+          mio->chunks[index] = calloc (MEM_CHUNK_SIZE, 1);
+          if (!mio->chunks[index])
+            return IOD_ERROR;
+          mio->usage += MEM_CHUNK_SIZE;
         }
+    }
+
+  for (index = offset / MEM_CHUNK_SIZE; index <= last; ++index)
+    {
+      ios_dev_off start = index * MEM_CHUNK_SIZE;
+      ios_dev_off end = start + MEM_CHUNK_SIZE;
 
-      memset (&mio->pointer[mio->size], 0, MEM_STEP);
-      mio->size += MEM_STEP;
+      if (start < offset)
+        start = offset;
+      if (end > offset + count)
+        end = offset + count;
+
+      if (mio->chunks[index])
+        memcpy (mio->chunks[index] + (start - index * MEM_CHUNK_SIZE),
+                p + (start - offset), end - start);
     }
 
-  memcpy (&mio->pointer[offset], buf, count);
+ done:
+  mio->size = size;
   return 0;
 }
 
@@ -157,12 +250,54 @@ ios_dev_mem_size (void *iod)
   return mio->size;
 }
 
+/* This is called by ios.c to get the memory used by the device.  */
+
+size_t
+ios_dev_mem_usage (void *iod)
+{
+  struct ios_dev_mem *mio = iod;
+
+  return (mio->usage + mio->num_chunks * sizeof (char *)
+          + sizeof (struct ios_dev_mem));
+}
+
 static int
 ios_dev_mem_flush (void *iod, ios_dev_off offset)
 {
   return IOS_OK;
 }
 
+/* The data of the device are the runs of allocated chunks.  */
+
+static int
+ios_dev_mem_next_data (void *iod, ios_dev_off offset,
+                       ios_dev_off *begin, ios_dev_off *end)
+{
+  struct ios_dev_mem *mio = iod;
+  size_t index = offset / MEM_CHUNK_SIZE;
+
+  if (offset >= mio->size)
+    return IOD_EOF;
+
+  while (index < mio->num_chunks && !mio->chunks[index])
+    ++index;
+  if (index >= mio->num_chunks
+      || (ios_dev_off) index * MEM_CHUNK_SIZE >= mio->size)
+    return IOD_EOF;
+
+  *begin = (ios_dev_off) index * MEM_CHUNK_SIZE;
+  if (*begin < offset)
+    *begin = offset;
+
+  while (index < mio->num_chunks && mio->chunks[index])
+    ++index;
+  *end = (ios_dev_off) index * MEM_CHUNK_SIZE;
+  if (*end > mio->size)
+    *end = mio->size;
+
+  return IOD_OK;
+}
+
 struct ios_dev_if ios_dev_mem =
   {
    .get_if_name = ios_dev_mem_get_if_name,
@@ -174,4 +309,5 @@ struct ios_dev_if ios_dev_mem =
    .get_flags = ios_dev_mem_get_flags,
    .size = ios_dev_mem_size,
    .flush = ios_dev_mem_flush,
+   .next_data = ios_dev_mem_next_data,
   };
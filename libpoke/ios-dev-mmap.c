@@ -0,0 +1,382 @@
+/* ios-dev-mmap.c - Memory mapped file IO devices.  */
+
+/* Copyright (C) 2026 Free Software Foundation, Inc. */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This IOD operates on regular files that are mapped in memory, and
+   is selected by passing IOS_F_MMAP to ios_open.  It is an
+   alternative to the file IOD for big files that are accessed at
+   random: reads and writes are served directly from the mapped pages
+   and never involve a system call.  Flushing or closing the device
+   waits for the modified pages to be written back to the file.
+
+   Anything that is not a regular file (pipes, character devices,
+   etc) is left to the file IOD, which is the last one tried.
+
+   Note that the contents of the IO space are undefined if the
+   underlying file gets truncated by some other process while it is
+   mapped.  */
+
+#include <config.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+/* We want 64-bit file offsets in all systems.  */
+#define _FILE_OFFSET_BITS 64
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+
+#include "ios.h"
+#include "ios-dev.h"
+
+/* State associated with a mmap device.
+
+   FD is the file descriptor of the mapped file.
+
+   BASE is the address where the file is mapped, or NULL if the file
+   is empty.  SIZE is the size of the mapping in bytes, which is also
+   the size of the file.
+
+   FLAGS are the flags of the device.  */
+
+struct ios_dev_mmap
+{
+  int fd;
+  uint8_t *base;
+  ios_dev_off size;
+  uint64_t flags;
+};
+
+static const char *
+ios_dev_mmap_get_if_name ()
+{
+  return "MMAP";
+}
+
+static char *
+ios_dev_mmap_handler_normalize (const char *handler, uint64_t flags,
+                                int *error)
+{
+  char *new_handler = NULL;
+  struct stat st;
+
+  if (error)
+    *error = IOD_OK;
+
+  /* Memory mapping has to be requested explicitly.  */
+  if (!(flags & IOS_F_MMAP))
+    return NULL;
+
+  /* A file can't be mapped for writing only.  */
+  if ((flags & IOS_FLAGS_MODE) != 0 && !(flags & IOS_F_READ))
+    return NULL;
+
+  /* Only regular files can be mapped.  Files that don't exist yet
+     will be regular files once created.  */
+  if (stat (handler, &st) == 0)
+    {
+      if (!S_ISREG (st.st_mode))
+        return NULL;
+    }
+  else if (!(flags & IOS_F_CREATE))
+    return NULL;
+
+  IOS_FILE_HANDLER_NORMALIZE (handler, new_handler);
+  if (new_handler == NULL && error)
+    *error = IOD_ENOMEM;
+
+  return new_handler;
+}
+
+/* Map SIZE bytes of the file operated by MIO, replacing the current
+   mapping if any.  Return an IOD_* status code.  */
+
+static int
+ios_dev_mmap_remap (struct ios_dev_mmap *mio, ios_dev_off size)
+{
+  void *base;
+  int prot = PROT_READ;
+
+  if (mio->base)
+    {
+      munmap (mio->base, mio->size);
+      mio->base = NULL;
+      mio->size = 0;
+    }
+
+  /* Empty files cannot be mapped.  */
+  if (size == 0)
+    return IOD_OK;
+
+  if (size > SIZE_MAX)
+    return IOD_ENOMEM;
+
+  if (mio->flags & IOS_F_WRITE)
+    prot |= PROT_WRITE;
+
+  base = mmap (NULL, size, prot, MAP_SHARED, mio->fd, 0);
+  if (base == MAP_FAILED)
+    return errno == ENOMEM ? IOD_ENOMEM : IOD_ERROR;
+
+  mio->base = base;
+  mio->size = size;
+  return IOD_OK;
+}
+
+static void *
+ios_dev_mmap_open (const char *handler, uint64_t flags, int *error,
+                   void *data __attribute__ ((unused)))
+{
+  struct ios_dev_mmap *mio = NULL;
+  uint8_t mode_flags = flags & IOS_FLAGS_MODE;
+  int internal_error = IOD_ERROR;
+  int fd = -1;
+  struct stat st;
+
+  if (mode_flags != 0)
+    {
+      int flags_for_open
+        = (mode_flags & IOS_F_WRITE) ? O_RDWR : O_RDONLY;
+
+      if (mode_flags & IOS_F_CREATE)
+        flags_for_open |= O_CREAT;
+      if (mode_flags & IOS_F_TRUNCATE)
+        {
+          /* A file can't be truncated without writing to it.  */
+          if (!(mode_flags & IOS_F_WRITE))
+            {
+              internal_error = IOD_EFLAGS;
+              goto err;
+            }
+          flags_for_open |= O_TRUNC;
+        }
+
+      fd = open (handler, flags_for_open,
+                 S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    }
+  else
+    {
+      /* Try read-write initially, then read-only.  */
+      fd = open (handler, O_RDWR, 0);
+      flags |= (IOS_F_READ | IOS_F_WRITE);
+      if (fd == -1)
+        {
+          fd = open (handler, O_RDONLY, 0);
+          flags &= ~IOS_F_WRITE;
+        }
+    }
+
+  if (fd == -1)
+    goto err;
+
+  /* The file may have been replaced after the handler got
+     normalized.  */
+  if (fstat (fd, &st) == -1)
+    goto err;
+  if (!S_ISREG (st.st_mode))
+    {
+      internal_error = IOD_EINVAL;
+      goto err;
+    }
+
+  mio = malloc (sizeof (struct ios_dev_mmap));
+  if (!mio)
+    {
+      internal_error = IOD_ENOMEM;
+      goto err;
+    }
+
+  mio->fd = fd;
+  mio->base = NULL;
+  mio->size = 0;
+  mio->flags = flags;
+
+  internal_error = ios_dev_mmap_remap (mio, st.st_size);
+  if (internal_error != IOD_OK)
+    goto err;
+
+  if (error)
+    *error = IOD_OK;
+  return mio;
+
+ err:
+  free (mio);
+  if (fd != -1)
+    close (fd);
+
+  if (error)
+    {
+      if (internal_error != IOD_ERROR)
+        *error = internal_error;
+      else if (errno == ENOMEM)
+        *error = IOD_ENOMEM;
+      else if (errno == EINVAL)
+        *error = IOD_EINVAL;
+      else
+        *error = IOD_ERROR;
+    }
+  return NULL;
+}
+
+static int
+ios_dev_mmap_close (void *iod)
+{
+  struct ios_dev_mmap *mio = iod;
+  int ret = IOD_OK;
+
+  if (mio->base)
+    {
+      if ((mio->flags & IOS_F_WRITE)
+          && msync (mio->base, mio->size, MS_SYNC) == -1)
+        ret = IOD_ERROR;
+      munmap (mio->base, mio->size);
+    }
+  if (close (mio->fd) == -1)
+    ret = IOD_ERROR;
+
+  free (mio);
+  return ret;
+}
+
+static uint64_t
+ios_dev_mmap_get_flags (void *iod)
+{
+  struct ios_dev_mmap *mio = iod;
+
+  return mio->flags;
+}
+
+static int
+ios_dev_mmap_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
+{
+  struct ios_dev_mmap *mio = iod;
+
+  if (offset > mio->size || count > mio->size - offset)
+    return IOD_EOF;
+
+  memcpy (buf, mio->base + offset, count);
+  return IOD_OK;
+}
+
+static int
+ios_dev_mmap_pwrite (void *iod, const void *buf, size_t count,
+                     ios_dev_off offset)
+{
+  struct ios_dev_mmap *mio = iod;
+
+  if (!(mio->flags & IOS_F_WRITE))
+    return IOD_ERROR;
+
+  /* Writing past the end of the file extends it, and the mapping
+     with it.  */
+  if (offset > mio->size || count > mio->size - offset)
+    {
+      ios_dev_off new_size = offset + count;
+      int ret;
+
+      if (ftruncate (mio->fd, new_size) == -1)
+        return IOD_ERROR;
+
+      ret = ios_dev_mmap_remap (mio, new_size);
+      if (ret != IOD_OK)
+        return ret;
+    }
+
+  memcpy (mio->base + offset, buf, count);
+  return IOD_OK;
+}
+
+static ios_dev_off
+ios_dev_mmap_size (void *iod)
+{
+  struct ios_dev_mmap *mio = iod;
+
+  return mio->size;
+}
+
+static int
+ios_dev_mmap_flush (void *iod, ios_dev_off offset)
+{
+  struct ios_dev_mmap *mio = iod;
+
+  if (mio->base && (mio->flags & IOS_F_WRITE)
+      && msync (mio->base, mio->size, MS_SYNC) == -1)
+    return IOD_ERROR;
+  return IOD_OK;
+}
+
+static void *
+ios_dev_mmap_get_mem (void *iod, ios_dev_off *size)
+{
+  struct ios_dev_mmap *mio = iod;
+
+  *size = mio->size;
+  return mio->base;
+}
+
+/* Find the extents of data of the mapped file like file devices
+   do.  */
+
+static int
+ios_dev_mmap_next_data (void *iod, ios_dev_off offset,
+                        ios_dev_off *begin, ios_dev_off *end)
+{
+  struct ios_dev_mmap *mio = iod;
+
+  if (offset >= mio->size)
+    return IOD_EOF;
+
+#if defined SEEK_DATA && defined SEEK_HOLE
+  {
+    off_t data = lseek (mio->fd, offset, SEEK_DATA);
+    off_t hole = data == -1 ? -1 : lseek (mio->fd, data, SEEK_HOLE);
+
+    if (data == -1 && errno == ENXIO)
+      return IOD_EOF;
+    if (hole != -1)
+      {
+        *begin = data;
+        *end = hole < mio->size ? hole : mio->size;
+        return *begin < *end ? IOD_OK : IOD_EOF;
+      }
+  }
+#endif
+
+  *begin = offset;
+  *end = mio->size;
+  return IOD_OK;
+}
+
+struct ios_dev_if ios_dev_mmap =
+  {
+   .get_if_name = ios_dev_mmap_get_if_name,
+   .handler_normalize = ios_dev_mmap_handler_normalize,
+   .open = ios_dev_mmap_open,
+   .close = ios_dev_mmap_close,
+   .pread = ios_dev_mmap_pread,
+   .pwrite = ios_dev_mmap_pwrite,
+   .get_flags = ios_dev_mmap_get_flags,
+   .size = ios_dev_mmap_size,
+   .flush = ios_dev_mmap_flush,
+   .get_mem = ios_dev_mmap_get_mem,
+   .next_data = ios_dev_mmap_next_data,
+  };
@@ -28,14 +28,81 @@
 #include "ios.h"
 #include "ios-dev.h"
 
-/* State associated with an NBD device.  */
+/* Reads are served from a cache of NBD blocks of
+   IOS_DEV_NBD_BLOCK_SIZE bytes each, aligned to their size.  Blocks
+   missing in the cache are requested with the asynchronous API of
+   libnbd, so all the blocks needed to satisfy a read are in flight at
+   the same time, and while reading sequentially the next
+   IOS_DEV_NBD_READAHEAD blocks are requested before they are needed.
+
+   Reads bigger than IOS_DEV_NBD_DIRECT_READ bytes bypass the cache
+   and are split in blocks which are read straight into the user's
+   buffer, with up to IOS_DEV_NBD_MAX_IN_FLIGHT requests in flight.
+
+   If the device is read-only and the server supports it, up to
+   IOS_DEV_NBD_MAX_CONNS connections are opened to the server and
+   requests are distributed among them.  */
+
+#define IOS_DEV_NBD_BLOCK_SIZE (128 * 1024)
+#define IOS_DEV_NBD_NUM_BLOCKS 32
+#define IOS_DEV_NBD_READAHEAD 8
+#define IOS_DEV_NBD_DIRECT_READ \
+  (IOS_DEV_NBD_NUM_BLOCKS / 2 * IOS_DEV_NBD_BLOCK_SIZE)
+#define IOS_DEV_NBD_MAX_IN_FLIGHT 16
+#define IOS_DEV_NBD_MAX_CONNS 4
+
+/* A block in the cache of an NBD device.
+
+   STATE is one of the IOS_DEV_NBD_BLOCK_* values below.
+
+   OFFSET is the offset of the block in the device and COUNT is the
+   number of bytes in it, which is less than the block size only for
+   the last block of the device.
+
+   If the block is in flight, COOKIE identifies the read command and
+   NBD is the connection where it was issued.
+
+   STAMP is used to find the least recently used block.  */
+
+#define IOS_DEV_NBD_BLOCK_FREE 0
+#define IOS_DEV_NBD_BLOCK_IN_FLIGHT 1
+#define IOS_DEV_NBD_BLOCK_READY 2
+
+struct ios_dev_nbd_block
+{
+  int state;
+  ios_dev_off offset;
+  size_t count;
+  struct nbd_handle *nbd;
+  int64_t cookie;
+  uint64_t stamp;
+  uint8_t *data;
+};
+
+/* State associated with an NBD device.
+
+   NBD is the connection to the server.  CONNS contains NUM_CONNS
+   connections to use for reads, the first of which is NBD.
+   NEXT_CONN is the connection where the next read is issued.
+
+   CLOCK is advanced by two with every read: the blocks holding the
+   requested data are stamped with it, and the blocks read ahead with
+   the previous value.  NEXT is the offset following the last byte
+   read.  They are used to manage the block
+   cache BLOCKS.  */
 
 struct ios_dev_nbd
 {
   struct nbd_handle *nbd;
+  struct nbd_handle *conns[IOS_DEV_NBD_MAX_CONNS];
+  int num_conns;
+  int next_conn;
   char *uri;
   ios_dev_off size;
   uint64_t flags;
+  uint64_t clock;
+  ios_dev_off next;
+  struct ios_dev_nbd_block blocks[IOS_DEV_NBD_NUM_BLOCKS];
 };
 
 static bool
@@ -99,7 +166,7 @@ ios_dev_nbd_open (const char *handler, uint64_t flags, int *error,
   if (size < 0)
     goto err;
 
-  nio = malloc (sizeof *nio);
+  nio = calloc (1, sizeof *nio);
   if (!nio)
     {
       internal_error = IOD_ENOMEM;
@@ -116,6 +183,27 @@ ios_dev_nbd_open (const char *handler, uint64_t flags, int *error,
   nio->nbd = nbd;
   nio->size = size;
   nio->flags = flags;
+  nio->conns[0] = nbd;
+  nio->num_conns = 1;
+
+  /* Reads may be spread among several connections if the server
+     guarantees that they are consistent with each other.  This is not
+     done for writable devices, since writes would then have to be
+     flushed to become visible in the other connections.  */
+  if (!(flags & IOS_F_WRITE) && nbd_can_multi_conn (nbd) == 1)
+    while (nio->num_conns < IOS_DEV_NBD_MAX_CONNS)
+      {
+        struct nbd_handle *conn = nbd_create ();
+
+        if (conn == NULL)
+          break;
+        if (nbd_connect_uri (conn, handler) == -1)
+          {
+            nbd_close (conn);
+            break;
+          }
+        nio->conns[nio->num_conns++] = conn;
+      }
 
   if (error)
     *error = IOD_OK;
@@ -137,9 +225,15 @@ static int
 ios_dev_nbd_close (void *iod)
 {
   struct ios_dev_nbd *nio = iod;
-
-  /* Should this flush when possible?  */
-  nbd_close (nio->nbd);
+  int i;
+
+  /* Closing the connections retires the commands in flight, so it has
+     to be done before freeing the blocks they read into.  Should this
+     flush when possible?  */
+  for (i = 0; i < nio->num_conns; ++i)
+    nbd_close (nio->conns[i]);
+  for (i = 0; i < IOS_DEV_NBD_NUM_BLOCKS; ++i)
+    free (nio->blocks[i].data);
   free (nio->uri);
   free (nio);
 
@@ -154,12 +248,226 @@ ios_dev_nbd_get_flags (void *iod)
   return nio->flags;
 }
 
+/* Return the connection of NIO where the next read is to be
+   issued.  */
+
+static struct nbd_handle *
+ios_dev_nbd_conn (struct ios_dev_nbd *nio)
+{
+  struct nbd_handle *nbd = nio->conns[nio->next_conn];
+
+  nio->next_conn = (nio->next_conn + 1) % nio->num_conns;
+  return nbd;
+}
+
+/* Wait for the completion of the read command COOKIE issued in the
+   connection NBD.  Return 0 if the command succeeded, -1
+   otherwise.  */
+
+static int
+ios_dev_nbd_wait (struct nbd_handle *nbd, int64_t cookie)
+{
+  while (1)
+    {
+      switch (nbd_aio_command_completed (nbd, cookie))
+        {
+        case 1:
+          return 0;
+        case 0:
+          break;
+        default:
+          return -1;
+        }
+
+      /* If the connection fails, the commands in flight are retired
+         with an error, and there is nothing else to wait for.  */
+      if (nbd_poll (nbd, -1) == -1)
+        return -1;
+    }
+}
+
+/* Wait for the block B to be read and update its state.  Return 0 if
+   it has been read successfully, -1 otherwise.  */
+
+static int
+ios_dev_nbd_block_wait (struct ios_dev_nbd_block *b)
+{
+  if (b->state == IOS_DEV_NBD_BLOCK_IN_FLIGHT)
+    b->state = (ios_dev_nbd_wait (b->nbd, b->cookie) == 0
+                ? IOS_DEV_NBD_BLOCK_READY : IOS_DEV_NBD_BLOCK_FREE);
+
+  return b->state == IOS_DEV_NBD_BLOCK_READY ? 0 : -1;
+}
+
+/* Return the block of NIO holding the data at OFFSET, which is aligned
+   to the block size, requesting it to the server if it is not cached
+   already.  STAMP is recorded in the block.  Blocks used in the current
+   read are not evicted to make room for it.  Return NULL if the block
+   can't be requested.  */
+
+static struct ios_dev_nbd_block *
+ios_dev_nbd_block (struct ios_dev_nbd *nio, ios_dev_off offset,
+                   uint64_t stamp)
+{
+  struct ios_dev_nbd_block *b, *victim = NULL;
+  int i;
+
+  for (i = 0; i < IOS_DEV_NBD_NUM_BLOCKS; ++i)
+    {
+      b = &nio->blocks[i];
+
+      if (b->state == IOS_DEV_NBD_BLOCK_FREE)
+        {
+          if (victim == NULL || victim->state != IOS_DEV_NBD_BLOCK_FREE)
+            victim = b;
+          continue;
+        }
+
+      if (b->offset == offset)
+        {
+          b->stamp = stamp;
+          return b;
+        }
+
+      if (b->stamp < nio->clock - 1
+          && (victim == NULL
+              || (victim->state != IOS_DEV_NBD_BLOCK_FREE
+                  && b->stamp < victim->stamp)))
+        victim = b;
+    }
+
+  if (victim == NULL)
+    return NULL;
+
+  /* The buffer of a block can't be reused while the server is still
+     sending data into it.  */
+  b = victim;
+  if (b->state == IOS_DEV_NBD_BLOCK_IN_FLIGHT)
+    ios_dev_nbd_block_wait (b);
+
+  if (b->data == NULL)
+    {
+      b->data = malloc (IOS_DEV_NBD_BLOCK_SIZE);
+      if (b->data == NULL)
+        return NULL;
+    }
+
+  b->state = IOS_DEV_NBD_BLOCK_FREE;
+  b->offset = offset;
+  b->count = (nio->size - offset < IOS_DEV_NBD_BLOCK_SIZE
+              ? nio->size - offset : IOS_DEV_NBD_BLOCK_SIZE);
+  b->stamp = stamp;
+  b->nbd = ios_dev_nbd_conn (nio);
+  b->cookie = nbd_aio_pread (b->nbd, b->data, b->count, offset,
+                             NBD_NULL_COMPLETION, 0);
+  if (b->cookie == -1)
+    return NULL;
+
+  b->state = IOS_DEV_NBD_BLOCK_IN_FLIGHT;
+  return b;
+}
+
+/* Read COUNT bytes at OFFSET straight into BUF, with several requests
+   in flight.  */
+
+static int
+ios_dev_nbd_pread_direct (struct ios_dev_nbd *nio, void *buf, size_t count,
+                          ios_dev_off offset)
+{
+  struct nbd_handle *nbds[IOS_DEV_NBD_MAX_IN_FLIGHT];
+  int64_t cookies[IOS_DEV_NBD_MAX_IN_FLIGHT];
+  size_t issued = 0, done = 0;
+  int ret = IOD_OK;
+
+  /* Keep waiting for the requests in flight after a failure, since
+     they are reading into BUF.  */
+  while (done < issued || (issued * IOS_DEV_NBD_BLOCK_SIZE < count
+                           && ret == IOD_OK))
+    {
+      if (issued * IOS_DEV_NBD_BLOCK_SIZE < count && ret == IOD_OK
+          && issued - done < IOS_DEV_NBD_MAX_IN_FLIGHT)
+        {
+          size_t off = issued * IOS_DEV_NBD_BLOCK_SIZE;
+          size_t len = (count - off < IOS_DEV_NBD_BLOCK_SIZE
+                        ? count - off : IOS_DEV_NBD_BLOCK_SIZE);
+          size_t slot = issued % IOS_DEV_NBD_MAX_IN_FLIGHT;
+
+          nbds[slot] = ios_dev_nbd_conn (nio);
+          cookies[slot] = nbd_aio_pread (nbds[slot], (uint8_t *) buf + off,
+                                         len, offset + off,
+                                         NBD_NULL_COMPLETION, 0);
+          if (cookies[slot] == -1)
+            ret = IOD_EOF;
+          else
+            issued++;
+          continue;
+        }
+
+      if (ios_dev_nbd_wait (nbds[done % IOS_DEV_NBD_MAX_IN_FLIGHT],
+                            cookies[done % IOS_DEV_NBD_MAX_IN_FLIGHT]) == -1)
+        ret = IOD_EOF;
+      done++;
+    }
+
+  return ret;
+}
+
 static int
 ios_dev_nbd_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
 {
   struct ios_dev_nbd *nio = iod;
+  struct ios_dev_nbd_block *b;
+  ios_dev_off first, last, block;
+  uint64_t stamp;
+  int sequential_p;
+
+  if (offset > nio->size || count > nio->size - offset)
+    return IOD_EOF;
+  if (count == 0)
+    return IOD_OK;
+
+  sequential_p = (offset == nio->next);
+  nio->next = offset + count;
+
+  if (count > IOS_DEV_NBD_DIRECT_READ)
+    return ios_dev_nbd_pread_direct (nio, buf, count, offset);
+
+  /* Request all the blocks covering the data, and then the ones
+     following them if reading sequentially, before waiting for any
+     of them.  */
+  nio->clock += 2;
+  stamp = nio->clock;
+  first = offset - offset % IOS_DEV_NBD_BLOCK_SIZE;
+  last = (offset + count - 1) - (offset + count - 1) % IOS_DEV_NBD_BLOCK_SIZE;
+
+  for (block = first; block <= last; block += IOS_DEV_NBD_BLOCK_SIZE)
+    if (ios_dev_nbd_block (nio, block, stamp) == NULL)
+      return nbd_pread (nio->nbd, buf, count, offset, 0) == -1 ? IOD_EOF : 0;
+
+  if (sequential_p)
+    for (block = last + IOS_DEV_NBD_BLOCK_SIZE;
+         block < nio->size
+           && block <= last + IOS_DEV_NBD_READAHEAD * IOS_DEV_NBD_BLOCK_SIZE;
+         block += IOS_DEV_NBD_BLOCK_SIZE)
+      if (ios_dev_nbd_block (nio, block, stamp - 1) == NULL)
+        break;
+
+  for (block = first; block <= last; block += IOS_DEV_NBD_BLOCK_SIZE)
+    {
+      ios_dev_off start = block > offset ? block : offset;
+      ios_dev_off end = block + IOS_DEV_NBD_BLOCK_SIZE;
+
+      if (end > offset + count)
+        end = offset + count;
 
-  return nbd_pread (nio->nbd, buf, count, offset, 0) == -1 ? IOD_EOF : 0;
+      b = ios_dev_nbd_block (nio, block, stamp);
+      if (b == NULL || ios_dev_nbd_block_wait (b) == -1)
+        return IOD_EOF;
+      memcpy ((uint8_t *) buf + (start - offset),
+              b->data + (start - block), end - start);
+    }
+
+  return IOD_OK;
 }
 
 static int
@@ -167,8 +475,39 @@ ios_dev_nbd_pwrite (void *iod, const void *buf, size_t count,
                     ios_dev_off offset)
 {
   struct ios_dev_nbd *nio = iod;
+  int i;
+
+  if (nbd_pwrite (nio->nbd, buf, count, offset, 0) == -1)
+    return IOD_EOF;
 
-  return nbd_pwrite (nio->nbd, buf, count, offset, 0) == -1 ? IOD_EOF : 0;
+  /* Update the cached blocks with the new data.  Blocks in flight may
+     have been read by the server before the write, so they are
+     dropped.  */
+  for (i = 0; i < IOS_DEV_NBD_NUM_BLOCKS; ++i)
+    {
+      struct ios_dev_nbd_block *b = &nio->blocks[i];
+      ios_dev_off start, end;
+
+      if (b->state == IOS_DEV_NBD_BLOCK_FREE
+          || b->offset >= offset + count
+          || b->offset + b->count <= offset)
+        continue;
+
+      if (b->state == IOS_DEV_NBD_BLOCK_IN_FLIGHT)
+        {
+          ios_dev_nbd_block_wait (b);
+          b->state = IOS_DEV_NBD_BLOCK_FREE;
+          continue;
+        }
+
+      start = b->offset > offset ? b->offset : offset;
+      end = b->offset + b->count < offset + count
+        ? b->offset + b->count : offset + count;
+      memcpy (b->data + (start - b->offset),
+              (const uint8_t *) buf + (start - offset), end - start);
+    }
+
+  return IOD_OK;
 }
 
 static ios_dev_off
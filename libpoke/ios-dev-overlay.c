@@ -0,0 +1,561 @@
+/* ios-dev-overlay.c - Copy-on-write overlay IO devices.  */
+
+/* Copyright (C) 2026 Free Software Foundation, Inc. */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file implements an IO device that shows the contents of some
+   other IO space, the base, but keeps the data written to it in a
+   journal instead of writing it to the base.
+
+   The journal is a sorted array of non-overlapping and non-adjacent
+   extents, each holding the data written at some range of offsets.
+   Reads take the data from the journal where there is some, and from
+   the base elsewhere.  Committing the overlay writes the extents to
+   the base in order, and discarding it forgets about them.  */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ios.h"
+#include "ios-dev.h"
+
+/* An extent of the journal.  DATA holds the SIZE bytes written at
+   OFFSET, and has room for ALLOCATED bytes.  */
+
+struct ios_dev_overlay_extent
+{
+  ios_dev_off offset;
+  size_t size;
+  size_t allocated;
+  uint8_t *data;
+};
+
+/* State associated with an overlay pseudo-device.
+
+   BASE_IOS is the IO space operating the base device, or NULL if it
+   has been closed.
+
+   EXTENTS contains NUM_EXTENTS extents, sorted by offset, and there
+   is room in it for ALLOCATED of them.  */
+
+struct ios_dev_overlay
+{
+  int base_ios_id;
+  ios base_ios;
+  char *name;
+  uint64_t flags;
+
+  struct ios_dev_overlay_extent *extents;
+  size_t num_extents;
+  size_t allocated;
+};
+
+static const char *
+ios_dev_overlay_get_if_name () {
+  return "OVERLAY";
+}
+
+static char *
+ios_dev_overlay_handler_normalize (const char *handler, uint64_t flags,
+                                   int *error)
+{
+  char *new_handler = NULL;
+
+  if (strncmp (handler, "overlay://", 10) == 0 && handler[10] != '\0')
+    {
+      new_handler = strdup (handler);
+      if (new_handler == NULL && error)
+        {
+          *error = IOD_ENOMEM;
+          return NULL;
+        }
+    }
+
+  if (error)
+    *error = IOD_OK;
+  return new_handler;
+}
+
+static void *
+ios_dev_overlay_open (const char *handler, uint64_t flags, int *error,
+                      void *data)
+{
+  struct ios_dev_overlay *ovl;
+  const char *p;
+  char *end;
+
+  /* Flags: only IOS_F_READ and IOS_F_WRITE are allowed.  The overlay
+     is writable even if its base is not, but it must be possible to
+     read the base.  */
+  if (flags == 0)
+    flags = IOS_F_READ | IOS_F_WRITE;
+  if (flags & ~(IOS_F_READ | IOS_F_WRITE))
+    {
+      if (error)
+        *error = IOD_EFLAGS;
+      return NULL;
+    }
+
+  ovl = calloc (1, sizeof (struct ios_dev_overlay));
+  if (ovl == NULL)
+    {
+      if (error)
+        *error = IOD_ENOMEM;
+      return NULL;
+    }
+  ovl->flags = flags;
+
+  /* Format of handler:
+     overlay://IOS/NAME  */
+
+  /* Skip the overlay:// */
+  p = handler + 10;
+
+  /* Parse the Id of the base IOS.  This is an integer.  */
+  ovl->base_ios_id = strtol (p, &end, 0);
+  if (*p == '\0' || *end != '/')
+    goto error;
+  p = end + 1;
+
+  /* The rest of the string is the name, which may be empty.  */
+  ovl->name = strdup (p);
+  if (ovl->name == NULL)
+    {
+      free (ovl);
+      if (error)
+        *error = IOD_ENOMEM;
+      return NULL;
+    }
+
+  /* The referred IOS should exist and be readable.  DATA is the IO
+     context where the overlay is being opened.  */
+  ovl->base_ios = ios_search_by_id ((ios_context) data, ovl->base_ios_id);
+  if (ovl->base_ios == NULL)
+    goto error;
+  if (!(ios_flags (ovl->base_ios) & IOS_F_READ))
+    {
+      free (ovl->name);
+      free (ovl);
+      if (error)
+        *error = IOD_EFLAGS;
+      return NULL;
+    }
+
+  if (error)
+    *error = IOD_OK;
+  return ovl;
+
+ error:
+  free (ovl->name);
+  free (ovl);
+  if (error)
+    *error = IOD_ERROR;
+  return NULL;
+}
+
+/* This is called by ios.c to discard the changes in an overlay.  */
+
+void
+ios_dev_overlay_discard (void *iod)
+{
+  struct ios_dev_overlay *ovl = iod;
+  size_t i;
+
+  for (i = 0; i < ovl->num_extents; ++i)
+    free (ovl->extents[i].data);
+  ovl->num_extents = 0;
+}
+
+static int
+ios_dev_overlay_close (void *iod)
+{
+  struct ios_dev_overlay *ovl = iod;
+
+  ios_dev_overlay_discard (ovl);
+  free (ovl->extents);
+  free (ovl->name);
+  free (ovl);
+  return IOD_OK;
+}
+
+static uint64_t
+ios_dev_overlay_get_flags (void *iod)
+{
+  struct ios_dev_overlay *ovl = iod;
+
+  return ovl->flags;
+}
+
+/* This is called by ios.c when the IO space BASE is closed.  */
+
+void
+ios_dev_overlay_base_closed (void *iod, ios base)
+{
+  struct ios_dev_overlay *ovl = iod;
+
+  if (ovl->base_ios == base)
+    ovl->base_ios = NULL;
+}
+
+/* This is called by ios.c to write the changes in an overlay to its
+   base.  The journal is emptied once all of it is written.  */
+
+int
+ios_dev_overlay_commit (void *iod)
+{
+  struct ios_dev_overlay *ovl = iod;
+  size_t i;
+  int ret;
+
+  if (ovl->base_ios == NULL)
+    return IOD_ERROR;
+
+  for (i = 0; i < ovl->num_extents; ++i)
+    {
+      struct ios_dev_overlay_extent *ext = &ovl->extents[i];
+
+      ret = ios_pwrite (ovl->base_ios, 0 /* flags */, ext->data,
+                        ext->size, ext->offset);
+      if (ret != IOD_OK)
+        return ret;
+    }
+
+  ret = ios_flush (ovl->base_ios, 0);
+  if (ret != IOS_OK)
+    return ret;
+
+  ios_dev_overlay_discard (ovl);
+  return IOD_OK;
+}
+
+/* Return the index of the first extent of OVL ending after OFFSET, or
+   the number of extents if there is none.  */
+
+static size_t
+ios_dev_overlay_search (struct ios_dev_overlay *ovl, ios_dev_off offset)
+{
+  size_t lo = 0, hi = ovl->num_extents;
+
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      struct ios_dev_overlay_extent *ext = &ovl->extents[mid];
+
+      if (ext->offset + ext->size <= offset)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  return lo;
+}
+
+static ios_dev_off
+ios_dev_overlay_size (void *iod)
+{
+  struct ios_dev_overlay *ovl = iod;
+  ios_dev_off size = ovl->base_ios ? ios_size (ovl->base_ios) : 0;
+
+  if (ovl->num_extents > 0)
+    {
+      struct ios_dev_overlay_extent *last
+        = &ovl->extents[ovl->num_extents - 1];
+
+      if (last->offset + last->size > size)
+        size = last->offset + last->size;
+    }
+
+  return size;
+}
+
+static int
+ios_dev_overlay_pread (void *iod, void *buf, size_t count,
+                       ios_dev_off offset)
+{
+  struct ios_dev_overlay *ovl = iod;
+  ios_dev_off base_size;
+  uint8_t *p = buf;
+  size_t i;
+
+  if (ovl->base_ios == NULL || !(ovl->flags & IOS_F_READ))
+    return IOD_ERROR;
+
+  if (offset > ios_dev_overlay_size (ovl)
+      || count > ios_dev_overlay_size (ovl) - offset)
+    return IOD_EOF;
+
+  base_size = ios_size (ovl->base_ios);
+  i = ios_dev_overlay_search (ovl, offset);
+  while (count > 0)
+    {
+      struct ios_dev_overlay_extent *ext
+        = i < ovl->num_extents ? &ovl->extents[i] : NULL;
+      size_t n;
+
+      if (ext && ext->offset <= offset)
+        {
+          /* The data is in the journal.  */
+          n = ext->offset + ext->size - offset;
+          if (n > count)
+            n = count;
+          memcpy (p, ext->data + (offset - ext->offset), n);
+          i++;
+        }
+      else
+        {
+          /* The data is in the base, up to the next extent.  Past the
+             end of the base there are only the holes left between
+             extents written beyond it.  */
+          n = count;
+          if (ext && ext->offset - offset < n)
+            n = ext->offset - offset;
+
+          if (offset >= base_size)
+            memset (p, 0, n);
+          else
+            {
+              size_t m = n;
+              int ret;
+
+              if (base_size - offset < m)
+                m = base_size - offset;
+              ret = ios_pread (ovl->base_ios, 0 /* flags */, p, m, offset);
+              if (ret != IOD_OK)
+                return ret;
+              memset (p + m, 0, n - m);
+            }
+        }
+
+      p += n;
+      offset += n;
+      count -= n;
+    }
+
+  return IOD_OK;
+}
+
+/* Make sure EXT has room for SIZE bytes.  */
+
+static int
+ios_dev_overlay_reserve (struct ios_dev_overlay_extent *ext, size_t size)
+{
+  size_t allocated = ext->allocated ? ext->allocated : 64;
+  uint8_t *data;
+
+  if (size <= ext->allocated)
+    return IOD_OK;
+
+  while (allocated < size)
+    allocated *= 2;
+  data = realloc (ext->data, allocated);
+  if (data == NULL)
+    return IOD_ENOMEM;
+
+  ext->data = data;
+  ext->allocated = allocated;
+  return IOD_OK;
+}
+
+static int
+ios_dev_overlay_pwrite (void *iod, const void *buf, size_t count,
+                        ios_dev_off offset)
+{
+  struct ios_dev_overlay *ovl = iod;
+  ios_dev_off end = offset + count;
+  struct ios_dev_overlay_extent *ext;
+  size_t first, last, i;
+
+  if (ovl->base_ios == NULL || !(ovl->flags & IOS_F_WRITE))
+    return IOD_ERROR;
+
+  if (count == 0)
+    return IOD_OK;
+
+  /* Find the extents overlapping or adjacent to the written range,
+     which are in [FIRST,LAST).  */
+  first = ios_dev_overlay_search (ovl, offset);
+  if (first > 0
+      && ovl->extents[first - 1].offset + ovl->extents[first - 1].size
+         == offset)
+    first--;
+  for (last = first;
+       last < ovl->num_extents && ovl->extents[last].offset <= end;
+       ++last)
+    ;
+
+  if (first == last)
+    {
+      /* Insert a new extent.  */
+      if (ovl->num_extents == ovl->allocated)
+        {
+          size_t allocated = ovl->allocated ? ovl->allocated * 2 : 16;
+          struct ios_dev_overlay_extent *extents
+            = realloc (ovl->extents, allocated * sizeof (*extents));
+
+          if (extents == NULL)
+            return IOD_ENOMEM;
+          ovl->extents = extents;
+          ovl->allocated = allocated;
+        }
+
+      memmove (&ovl->extents[first + 1], &ovl->extents[first],
+               (ovl->num_extents - first) * sizeof (*ovl->extents));
+      ovl->num_extents++;
+
+      ext = &ovl->extents[first];
+      memset (ext, 0, sizeof (*ext));
+      ext->offset = offset;
+      if (ios_dev_overlay_reserve (ext, count) != IOD_OK)
+        {
+          memmove (&ovl->extents[first], &ovl->extents[first + 1],
+                   (ovl->num_extents - first - 1) * sizeof (*ovl->extents));
+          ovl->num_extents--;
+          return IOD_ENOMEM;
+        }
+      ext->size = count;
+      memcpy (ext->data, buf, count);
+      return IOD_OK;
+    }
+
+  /* Merge the written data and the extents in [FIRST,LAST) into the
+     first of them, which usually only needs to grow at its end.  */
+  ext = &ovl->extents[first];
+  {
+    struct ios_dev_overlay_extent *prev_last = &ovl->extents[last - 1];
+    ios_dev_off new_offset = offset < ext->offset ? offset : ext->offset;
+    ios_dev_off new_end = prev_last->offset + prev_last->size;
+    size_t shift = ext->offset - new_offset;
+
+    if (end > new_end)
+      new_end = end;
+
+    if (ios_dev_overlay_reserve (ext, new_end - new_offset) != IOD_OK)
+      return IOD_ENOMEM;
+
+    if (shift > 0)
+      memmove (ext->data + shift, ext->data, ext->size);
+    ext->offset = new_offset;
+
+    for (i = first + 1; i < last; ++i)
+      {
+        struct ios_dev_overlay_extent *next = &ovl->extents[i];
+
+        memcpy (ext->data + (next->offset - new_offset), next->data,
+                next->size);
+        free (next->data);
+      }
+    ext->size = new_end - new_offset;
+    memcpy (ext->data + (offset - new_offset), buf, count);
+  }
+
+  memmove (&ovl->extents[first + 1], &ovl->extents[last],
+           (ovl->num_extents - last) * sizeof (*ovl->extents));
+  ovl->num_extents -= last - first - 1;
+  return IOD_OK;
+}
+
+static int
+ios_dev_overlay_flush (void *iod, ios_dev_off offset)
+{
+  return IOD_OK;
+}
+
+/* The data of the overlay are the data of the base plus the extents
+   of the journal.  Extents of both which are adjacent or overlap are
+   coalesced.  */
+
+static int
+ios_dev_overlay_next_data (void *iod, ios_dev_off offset,
+                           ios_dev_off *begin, ios_dev_off *end)
+{
+  struct ios_dev_overlay *ovl = iod;
+  ios_dev_off base_begin, base_end;
+  int found = 0, extended;
+  size_t i;
+  int ret;
+
+  if (ovl->base_ios == NULL || !(ovl->flags & IOS_F_READ))
+    return IOD_ERROR;
+
+  /* First find the earliest extent of either the journal or the
+   base.  */
+  i = ios_dev_overlay_search (ovl, offset);
+  if (i < ovl->num_extents)
+    {
+      struct ios_dev_overlay_extent *ext = &ovl->extents[i];
+
+      *begin = ext->offset < offset ? offset : ext->offset;
+      *end = ext->offset + ext->size;
+      found = 1;
+    }
+
+  ret = ios_seek_data (ovl->base_ios, offset, &base_begin, &base_end);
+  if (ret == IOD_OK)
+    {
+      if (!found || base_begin < *begin)
+        {
+          *begin = base_begin;
+          *end = base_end;
+        }
+      found = 1;
+    }
+  else if (ret != IOD_EOF)
+    return ret;
+
+  if (!found)
+    return IOD_EOF;
+
+  /* Then extend it with whatever data follows it immediately.  */
+  do
+    {
+      extended = 0;
+
+      i = ios_dev_overlay_search (ovl, *end);
+      if (i < ovl->num_extents && ovl->extents[i].offset <= *end)
+        {
+          *end = ovl->extents[i].offset + ovl->extents[i].size;
+          extended = 1;
+        }
+
+      ret = ios_seek_data (ovl->base_ios, *end, &base_begin, &base_end);
+      if (ret == IOD_OK && base_begin == *end)
+        {
+          *end = base_end;
+          extended = 1;
+        }
+      else if (ret != IOD_OK && ret != IOD_EOF)
+        return ret;
+    }
+  while (extended);
+
+  return IOD_OK;
+}
+
+struct ios_dev_if ios_dev_overlay =
+  {
+   .get_if_name = ios_dev_overlay_get_if_name,
+   .handler_normalize = ios_dev_overlay_handler_normalize,
+   .open = ios_dev_overlay_open,
+   .close = ios_dev_overlay_close,
+   .pread = ios_dev_overlay_pread,
+   .pwrite = ios_dev_overlay_pwrite,
+   .get_flags = ios_dev_overlay_get_flags,
+   .size = ios_dev_overlay_size,
+   .flush = ios_dev_overlay_flush,
+   .next_data = ios_dev_overlay_next_data,
+  };
@@ -22,6 +22,8 @@
 #include <config.h>
 
 #include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 #include <sys/types.h>
 
@@ -172,6 +174,53 @@ ios_dev_proc_flush (void *iod, ios_dev_off offset)
   return IOS_OK;
 }
 
+/* The data of the device are the readable mappings of the process,
+   as listed in /proc/PID/maps.  Mappings that are contiguous in the
+   address space are coalesced into a single extent.  */
+
+static int
+ios_dev_proc_next_data (void *iod, ios_dev_off offset,
+                        ios_dev_off *begin, ios_dev_off *end)
+{
+  struct ios_dev_proc *proc = iod;
+  char maps_path[64];
+  char line[512];
+  FILE *maps;
+  int found = 0;
+
+  snprintf (maps_path, sizeof maps_path, "/proc/%ld/maps", (long) proc->pid);
+  maps = fopen (maps_path, "r");
+  if (maps == NULL)
+    return IOD_ERROR;
+
+  while (fgets (line, sizeof line, maps) != NULL)
+    {
+      uintmax_t map_begin, map_end;
+      char perms[5];
+
+      /* Lines too long for the buffer are continued in the next
+         fgets, which doesn't start with an address range.  */
+      if (sscanf (line, "%jx-%jx %4s", &map_begin, &map_end, perms) != 3)
+        continue;
+      if (perms[0] != 'r' || map_end <= offset)
+        continue;
+
+      if (!found)
+        {
+          *begin = map_begin < offset ? offset : map_begin;
+          *end = map_end;
+          found = 1;
+        }
+      else if (map_begin == *end)
+        *end = map_end;
+      else
+        break;
+    }
+
+  fclose (maps);
+  return found ? IOD_OK : IOD_EOF;
+}
+
 struct ios_dev_if ios_dev_proc =
   {
    .get_if_name = ios_dev_proc_get_if_name,
@@ -182,5 +231,6 @@ struct ios_dev_if ios_dev_proc =
    .pwrite = ios_dev_proc_pwrite,
    .get_flags = ios_dev_proc_get_flags,
    .size = ios_dev_proc_size,
-   .flush = ios_dev_proc_flush
+   .flush = ios_dev_proc_flush,
+   .next_data = ios_dev_proc_next_data,
   };
@@ -32,7 +32,19 @@
 #define IOS_STDOUT_HANDLER      ("<stdout>")
 #define IOS_STDERR_HANDLER      ("<stderr>")
 
-/* State associated with a stream device.  */
+/* Writes to the standard output are collected in a buffer of
+   IOS_STREAM_WBUF_SIZE bytes and written out in one go when it gets
+   full, when the space is flushed and when it is closed.  Until then,
+   the pending bytes can be overwritten.  */
+
+#define IOS_STREAM_WBUF_SIZE (64 * 1024)
+
+/* State associated with a stream device.
+
+   Input streams keep the data read from them in BUFFER.
+
+   WRITE_OFFSET is the offset following the last byte written to an
+   output stream, including the WBUF_COUNT bytes pending in WBUF.  */
 
 struct ios_dev_stream
 {
@@ -42,7 +54,12 @@ struct ios_dev_stream
   union
     {
       struct ios_buffer *buffer;
-      uint64_t write_offset;
+      struct
+        {
+          uint64_t write_offset;
+          char *wbuf;
+          size_t wbuf_count;
+        };
     };
 };
 
@@ -94,7 +111,7 @@ ios_dev_stream_open (const char *handler, uint64_t flags, int *error,
     {
       sio->file = stdin;
       sio->flags = IOS_F_READ;
-      sio->buffer = ios_buffer_init ();
+      sio->buffer = ios_buffer_init (IOS_STREAM_DEFAULT_WINDOW);
       if (!sio->buffer)
         {
           internal_error = IOD_ENOMEM;
@@ -106,12 +123,21 @@ ios_dev_stream_open (const char *handler, uint64_t flags, int *error,
       sio->file = stdout;
       sio->flags = IOS_F_WRITE;
       sio->write_offset = 0;
+      sio->wbuf_count = 0;
+      sio->wbuf = malloc (IOS_STREAM_WBUF_SIZE);
+      if (!sio->wbuf)
+        {
+          internal_error = IOD_ENOMEM;
+          goto err;
+        }
     }
   else if (STREQ (handler, IOS_STDERR_HANDLER))
     {
       sio->file = stderr;
       sio->flags = IOS_F_WRITE;
       sio->write_offset = 0;
+      sio->wbuf = NULL;
+      sio->wbuf_count = 0;
     }
   else
     goto err;
@@ -130,6 +156,19 @@ err:
   return NULL;
 }
 
+/* Write out the pending data of the output stream SIO.  */
+
+static int
+ios_dev_stream_write_out (struct ios_dev_stream *sio)
+{
+  size_t count = sio->wbuf_count;
+
+  sio->wbuf_count = 0;
+  if (count > 0 && fwrite (sio->wbuf, count, 1, sio->file) != 1)
+    return IOD_ERROR;
+  return IOD_OK;
+}
+
 static int
 ios_dev_stream_close (void *iod)
 {
@@ -140,6 +179,12 @@ ios_dev_stream_close (void *iod)
 
   if (sio->flags & IOS_F_READ)
     ios_buffer_free (sio->buffer);
+  else
+    {
+      ios_dev_stream_write_out (sio);
+      fflush (sio->file);
+      free (sio->wbuf);
+    }
   free (sio->handler);
   free (sio);
 
@@ -158,8 +203,7 @@ ios_dev_stream_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
 {
   struct ios_dev_stream *sio = iod;
   struct ios_buffer *buffer = sio->buffer;
-  size_t read_count, total_read_count = 0, read_from_buffer_count = 0;
-  int potential_error;
+  int ret;
 
   if (sio->flags & IOS_F_WRITE)
     return IOD_ERROR;
@@ -168,46 +212,15 @@ ios_dev_stream_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
   if (ios_buffer_get_begin_offset (buffer) > offset)
     return IOD_EOF;
 
-  /* If the requsted range is in the buffer, return it. */
-  if (ios_buffer_get_end_offset (buffer) >= offset + count)
-    return ios_buffer_pread (buffer, buf, count, offset);
-
-  /* What was last read into the buffer may be before or after the
-     offset that this function is provided with.  */
-  if (ios_buffer_get_end_offset (buffer) > offset)
+  /* Read the data past the end of the buffer from the stream.  */
+  if (ios_buffer_get_end_offset (buffer) < offset + count)
     {
-      /* Read from the buffer what's already avaılable.  */
-      read_from_buffer_count = ios_buffer_get_end_offset (buffer) - offset;
-      potential_error = ios_buffer_pread (buffer, buf,
-                                          read_from_buffer_count, offset);
-      if (potential_error != IOD_OK)
-        return potential_error;
-      total_read_count = read_count = read_from_buffer_count;
+      ret = ios_buffer_fill (buffer, sio->file, offset, offset + count);
+      if (ret != IOD_OK)
+        return ret;
     }
 
-  /* Read the rest from the stream.  */
-  do
-    {
-      read_count = fread (buf + total_read_count,
-                          1,
-                          count - total_read_count,
-                          sio->file);
-      total_read_count += read_count;
-    }
-  while (total_read_count < count && read_count);
-
-  /* Write back to the buffer.  */
-  potential_error = ios_buffer_pwrite (buffer,
-                                       buf + read_from_buffer_count,
-                                       count - read_from_buffer_count,
-                                       ios_buffer_get_end_offset (buffer));
-  if (potential_error != IOD_OK)
-    return potential_error;
-
-  if (total_read_count < count)
-    return IOD_EOF;
-
-  return IOD_OK;
+  return ios_buffer_pread (buffer, buf, count, offset);
 }
 
 static int
@@ -215,21 +228,74 @@ ios_dev_stream_pwrite (void *iod, const void *buf, size_t count,
                        ios_dev_off offset)
 {
   struct ios_dev_stream *sio = iod;
+  size_t zeroes;
 
   if (sio->flags & IOS_F_READ)
     return IOD_ERROR;
 
   /* If the offset we want to write to is already written out,
      we return an error.  */
-  if (sio->write_offset > offset)
+  if (sio->write_offset - sio->wbuf_count > offset)
     return IOD_EOF;
 
-  if (offset > sio->write_offset)
-    /* TODO: Write this more efficiently. */
-    for (int i=0; i < (offset - sio->write_offset); i++)
-      fputc (0,  sio->file);
+  /* Data still pending in the buffer can be overwritten.  */
+  if (sio->write_offset > offset)
+    {
+      size_t n = sio->write_offset - offset;
+
+      if (n > count)
+        n = count;
+      memcpy (sio->wbuf + sio->wbuf_count - (sio->write_offset - offset),
+              buf, n);
+      buf = (const char *) buf + n;
+      count -= n;
+      offset += n;
+      if (count == 0)
+        return IOS_OK;
+    }
+
+  /* Unbuffered streams.  */
+  if (!sio->wbuf)
+    {
+      for (zeroes = offset - sio->write_offset; zeroes > 0; --zeroes)
+        fputc (0, sio->file);
+
+      fwrite (buf, count, 1, sio->file);
+      sio->write_offset = offset + count;
+      return IOS_OK;
+    }
+
+  /* Fill the gap, if any, with zeroes.  */
+  for (zeroes = offset - sio->write_offset; zeroes > 0;)
+    {
+      size_t n = IOS_STREAM_WBUF_SIZE - sio->wbuf_count;
+
+      if (n > zeroes)
+        n = zeroes;
+      memset (sio->wbuf + sio->wbuf_count, 0, n);
+      sio->wbuf_count += n;
+      zeroes -= n;
+      if (sio->wbuf_count == IOS_STREAM_WBUF_SIZE
+          && ios_dev_stream_write_out (sio) != IOD_OK)
+        return IOD_ERROR;
+    }
+
+  if (sio->wbuf_count + count > IOS_STREAM_WBUF_SIZE)
+    {
+      if (ios_dev_stream_write_out (sio) != IOD_OK)
+        return IOD_ERROR;
+
+      /* Big writes are not worth buffering.  */
+      if (count >= IOS_STREAM_WBUF_SIZE)
+        {
+          fwrite (buf, count, 1, sio->file);
+          sio->write_offset = offset + count;
+          return IOS_OK;
+        }
+    }
 
-  fwrite (buf, count, 1, sio->file);
+  memcpy (sio->wbuf + sio->wbuf_count, buf, count);
+  sio->wbuf_count += count;
   sio->write_offset = offset + count;
 
   return IOS_OK;
@@ -249,6 +315,15 @@ static int
 ios_dev_stream_flush (void *iod, ios_dev_off offset)
 {
   struct ios_dev_stream *sio = iod;
+
+  if (sio->flags & IOS_F_WRITE)
+    {
+      int ret = ios_dev_stream_write_out (sio);
+
+      fflush (sio->file);
+      return ret;
+    }
+
   if (sio->flags & IOS_F_READ
       && offset > ios_buffer_get_begin_offset (sio->buffer)
       && offset <= ios_buffer_get_end_offset (sio->buffer))
@@ -257,6 +332,21 @@ ios_dev_stream_flush (void *iod, ios_dev_off offset)
     return IOS_OK;
 }
 
+/* This is called by ios.c to set the retention window of an input
+   stream.  */
+
+int
+ios_dev_stream_set_window (void *iod, size_t window)
+{
+  struct ios_dev_stream *sio = iod;
+
+  if (!(sio->flags & IOS_F_READ))
+    return IOD_EINVAL;
+
+  ios_buffer_set_window (sio->buffer, window);
+  return IOD_OK;
+}
+
 struct ios_dev_if ios_dev_stream =
   {
    .get_if_name = ios_dev_stream_get_dev_if_name,
@@ -28,11 +28,15 @@
 #include "ios-dev.h"
 #include "pk-utils.h"
 
-/* State associated with a subrange pseudo-device.  */
+/* State associated with a subrange pseudo-device.
+
+   BASE_IOS is the IO space operating the base device, or NULL if it
+   has been closed.  */
 
 struct ios_dev_sub
 {
   int base_ios_id;
+  ios base_ios;
   ios_dev_off base;
   ios_dev_off size;
   char *name;
@@ -145,15 +149,16 @@ ios_dev_sub_open (const char *handler, uint64_t flags, int *error, void *data)
     ios_dev_off base_ios_size;
     uint64_t iflags;
 
-    /* The referred IOS should exist.  */
-    base_ios = ios_search_by_id (sub->base_ios_id);
+    /* The referred IOS should exist.  DATA is the IO context where
+       the sub-space is being opened.  */
+    base_ios = ios_search_by_id ((ios_context) data, sub->base_ios_id);
     if (base_ios == NULL)
       goto error;
+    sub->base_ios = base_ios;
 
     /* The interval [base,base+size) should be in range in the base
        IOS. */
-    base_ios_size
-      = ios_get_dev_if (base_ios)->size (ios_get_dev (base_ios));
+    base_ios_size = ios_size (base_ios);
     if (sub->base >= base_ios_size
         || sub->base + sub->size > base_ios_size)
       goto error;
@@ -201,26 +206,30 @@ ios_dev_sub_get_flags (void *iod)
   return sub->flags;
 }
 
-/* XXX search_by_id to get the base IOS in pread and pwrite is slow as
-   shit.  It would be good to cache the IOS at open time, but then we
-   have to make ios.c aware of subios so it will mark all sub-ios of a
-   given IOS when the later is closed.  */
+/* This is called by ios.c when the IO space BASE is closed.  */
+
+void
+ios_dev_sub_base_closed (void *iod, ios base)
+{
+  struct ios_dev_sub *sub = iod;
+
+  if (sub->base_ios == base)
+    sub->base_ios = NULL;
+}
 
 static int
 ios_dev_sub_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
 {
   struct ios_dev_sub *sub = iod;
-  ios ios = ios_search_by_id (sub->base_ios_id);
+  ios ios = sub->base_ios;
 
   if (ios == NULL || !(sub->flags & IOS_F_READ))
     return IOD_ERROR;
 
-  if (offset >= sub->size)
+  if (offset >= sub->size || count > sub->size - offset)
     return IOD_EOF;
 
-  return ios_get_dev_if (ios)->pread (ios_get_dev (ios),
-                                      buf, count,
-                                      sub->base + offset);
+  return ios_pread (ios, 0 /* flags */, buf, count, sub->base + offset);
 }
 
 static int
@@ -228,18 +237,16 @@ ios_dev_sub_pwrite (void *iod, const void *buf, size_t count,
                     ios_dev_off offset)
 {
   struct ios_dev_sub *sub = iod;
-  ios ios = ios_search_by_id (sub->base_ios_id);
+  ios ios = sub->base_ios;
 
   if (ios == NULL || !(sub->flags & IOS_F_WRITE))
     return IOD_ERROR;
 
   /* Sub-range IOS dot accept writes past the end of the IOS.  */
-  if (offset >= sub->size)
+  if (offset >= sub->size || count > sub->size - offset)
     return IOD_EOF;
 
-  return ios_get_dev_if (ios)->pwrite (ios_get_dev (ios),
-                                       buf, count,
-                                       sub->base + offset);
+  return ios_pwrite (ios, 0 /* flags */, buf, count, sub->base + offset);
 }
 
 static ios_dev_off
@@ -255,6 +262,34 @@ ios_dev_sub_flush (void *iod, ios_dev_off offset)
   return IOS_OK;
 }
 
+/* The data of the sub-range are the data of the base IOS falling in
+   it.  */
+
+static int
+ios_dev_sub_next_data (void *iod, ios_dev_off offset,
+                       ios_dev_off *begin, ios_dev_off *end)
+{
+  struct ios_dev_sub *sub = iod;
+  ios ios = sub->base_ios;
+  int ret;
+
+  if (ios == NULL || !(sub->flags & IOS_F_READ))
+    return IOD_ERROR;
+
+  if (offset >= sub->size)
+    return IOD_EOF;
+
+  ret = ios_seek_data (ios, sub->base + offset, begin, end);
+  if (ret != IOD_OK)
+    return ret;
+  if (*begin >= sub->base + sub->size)
+    return IOD_EOF;
+
+  *begin -= sub->base;
+  *end = (*end < sub->base + sub->size ? *end - sub->base : sub->size);
+  return IOD_OK;
+}
+
 struct ios_dev_if ios_dev_sub =
   {
    .get_if_name = ios_dev_sub_get_if_name,
@@ -265,5 +300,6 @@ struct ios_dev_if ios_dev_sub =
    .pwrite = ios_dev_sub_pwrite,
    .get_flags = ios_dev_sub_get_flags,
    .size = ios_dev_sub_size,
-   .flush = ios_dev_sub_flush
+   .flush = ios_dev_sub_flush,
+   .next_data = ios_dev_sub_next_data,
   };
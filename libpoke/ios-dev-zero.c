@@ -105,6 +105,14 @@ ios_dev_zero_flush (void *iod, ios_dev_off offset)
   return IOS_OK;
 }
 
+static int
+ios_dev_zero_next_data (void *iod, ios_dev_off offset,
+                        ios_dev_off *begin, ios_dev_off *end)
+{
+  /* The whole device is a hole.  */
+  return IOD_EOF;
+}
+
 struct ios_dev_if ios_dev_zero =
   {
    .get_if_name = ios_dev_zero_get_if_name,
@@ -116,6 +124,7 @@ struct ios_dev_if ios_dev_zero =
    .get_flags = ios_dev_zero_get_flags,
    .size = ios_dev_zero_size,
    .flush = ios_dev_zero_flush,
+   .next_data = ios_dev_zero_next_data,
   };
 
 /* Handler: <zero> */
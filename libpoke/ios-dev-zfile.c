@@ -0,0 +1,1465 @@
+/* ios-dev-zfile.c - Compressed file IO devices.  */
+
+/* Copyright (C) 2026 Free Software Foundation, Inc. */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file implements read-only IO devices exposing the decompressed
+   contents of gzip, xz and zstd files, whose handlers are
+   gzip://PATH, xz://PATH and zstd://PATH respectively.
+
+   When the device is opened, an index of checkpoints is built for the
+   file.  A checkpoint is a position in the decompressed data where
+   decompression can start without decompressing anything before it:
+
+   - gzip checkpoints are placed every IOS_DEV_ZFILE_SPAN bytes of
+     decompressed data, at deflate block boundaries, and at the start
+     of every gzip member.  They record the 32 KiB of data preceding
+     them, which is used as the dictionary to resume decompression,
+     as explained in zran.c in the zlib distribution.
+
+   - xz checkpoints are the blocks listed in the index of the file.
+
+   - zstd checkpoints are the frames in the file.
+
+   Reading some data decompresses from the nearest checkpoint
+   preceding it, or from the current position of the decompressor if
+   that is closer.  Decompressed data is kept in a cache of
+   IOS_DEV_ZFILE_NUM_PAGES pages.
+
+   The index is loaded from PATH.pkidx if that file exists and it
+   matches the compressed file: it must have the same size and
+   modification time, and the same checksum of its first and last
+   IOS_DEV_ZFILE_TAG_SIZE bytes.  If IOS_F_SAVE_INDEX is passed when
+   opening the device, a new index is saved there, so the next time
+   the device is opened the index doesn't need to be built again.  */
+
+#include <config.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* We want 64-bit file offsets in all systems.  */
+#define _FILE_OFFSET_BITS 64
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_ZLIB
+# include <zlib.h>
+#endif
+#ifdef HAVE_LIBLZMA
+# include <lzma.h>
+#endif
+#ifdef HAVE_LIBZSTD
+# include <zstd.h>
+#endif
+
+#include "stat-time.h"
+#include "crc.h"
+
+#include "ios.h"
+#include "ios-dev.h"
+
+#define IOS_DEV_ZFILE_SPAN (1024 * 1024)
+#define IOS_DEV_ZFILE_WINDOW_SIZE 32768
+#define IOS_DEV_ZFILE_IN_SIZE (64 * 1024)
+#define IOS_DEV_ZFILE_PAGE_SIZE (64 * 1024)
+#define IOS_DEV_ZFILE_NUM_PAGES 64
+#define IOS_DEV_ZFILE_TAG_SIZE 4096
+
+/* A checkpoint in the compressed file.
+
+   UOFFSET is the offset in the decompressed data, and COFFSET the
+   offset in the compressed file where decompression starts.
+
+   AUX depends on the format.  For gzip, it is the number of bits of
+   the byte before COFFSET that belong to the first deflate block, or
+   -1 if the checkpoint is at the start of a gzip member.  For xz, it
+   is the type of the integrity check of the block.
+
+   WINDOW is the dictionary of gzip checkpoints not at the start of a
+   member, NULL otherwise.  */
+
+struct ios_dev_zfile_point
+{
+  ios_dev_off uoffset;
+  ios_dev_off coffset;
+  int aux;
+  uint8_t *window;
+};
+
+/* A page of decompressed data in the cache.  */
+
+struct ios_dev_zfile_page
+{
+  int valid_p;
+  ios_dev_off offset;
+  uint64_t stamp;
+  uint8_t *data;
+};
+
+struct ios_dev_zfile;
+
+/* Each compression format implements the following operations.
+
+   INDEX scans the compressed file and fills in the checkpoints and
+   the decompressed size of the device.
+
+   START sets the decompressor at the given checkpoint.
+
+   DECODE decompresses the next COUNT bytes into BUF.
+
+   END releases the decompressor, if it is started.
+
+   All of them return an IOD_* status code.  ID identifies the format
+   in saved indexes.  MIN_AUX and MAX_AUX are the range of the AUX
+   values of the checkpoints built by INDEX.  */
+
+struct ios_dev_zfile_format
+{
+  int id;
+  const char *prefix;
+  int min_aux;
+  int max_aux;
+  int (*index) (struct ios_dev_zfile *zio);
+  int (*start) (struct ios_dev_zfile *zio, size_t point);
+  int (*decode) (struct ios_dev_zfile *zio, uint8_t *buf, size_t count);
+  void (*end) (struct ios_dev_zfile *zio);
+};
+
+/* State associated with a compressed file device.
+
+   FD is the file descriptor of the compressed file, whose size is
+   CSIZE and whose modification time is MTIME, in nanoseconds since
+   the epoch.  TAG is the checksum of its first and last
+   IOS_DEV_ZFILE_TAG_SIZE bytes.  SIZE is the size of the
+   decompressed data.
+
+   POINTS contains NUM_POINTS checkpoints, with strictly increasing
+   offsets, and there is room in it for ALLOCATED of them.  The first
+   one is always at offset 0.
+
+   If STARTED_P is set, the decompressor is started and the next byte
+   it produces is the one at DOFFSET, after decompressing from the
+   checkpoint POINT.  It reads compressed data at IN_OFFSET into IN,
+   where IN_NEXT and IN_AVAIL are its data yet to be consumed.  DEC
+   is the state of the decompressor, which depends on the format.
+
+   PAGES is the cache of decompressed pages, and CLOCK is used to
+   find the least recently used page.  */
+
+struct ios_dev_zfile
+{
+  const struct ios_dev_zfile_format *format;
+  int fd;
+  char *path;
+  uint64_t flags;
+  ios_dev_off csize;
+  int64_t mtime;
+  uint64_t tag;
+  ios_dev_off size;
+
+  struct ios_dev_zfile_point *points;
+  size_t num_points;
+  size_t allocated;
+
+  int started_p;
+  ios_dev_off doffset;
+  size_t point;
+  ios_dev_off in_offset;
+  uint8_t *in;
+  const uint8_t *in_next;
+  size_t in_avail;
+  union
+    {
+#ifdef HAVE_ZLIB
+      struct
+      {
+        z_stream strm;
+        int raw_p;
+        size_t trailer;
+      } gz;
+#endif
+#ifdef HAVE_LIBLZMA
+      struct
+      {
+        lzma_stream strm;
+        lzma_block block;
+      } xz;
+#endif
+#ifdef HAVE_LIBZSTD
+      ZSTD_DStream *zstd;
+#endif
+      int dummy;
+    } dec;
+
+  struct ios_dev_zfile_page pages[IOS_DEV_ZFILE_NUM_PAGES];
+  uint64_t clock;
+};
+
+/* Append a checkpoint to the index of ZIO.  WINDOW, if not NULL, is
+   copied.  */
+
+static int
+ios_dev_zfile_add_point (struct ios_dev_zfile *zio, ios_dev_off uoffset,
+                         ios_dev_off coffset, int aux, const uint8_t *window)
+{
+  struct ios_dev_zfile_point *point;
+
+  if (zio->num_points == zio->allocated)
+    {
+      size_t allocated = zio->allocated ? zio->allocated * 2 : 16;
+      struct ios_dev_zfile_point *points
+        = realloc (zio->points, allocated * sizeof (*points));
+
+      if (!points)
+        return IOD_ENOMEM;
+      zio->points = points;
+      zio->allocated = allocated;
+    }
+
+  point = &zio->points[zio->num_points];
+  point->uoffset = uoffset;
+  point->coffset = coffset;
+  point->aux = aux;
+  point->window = NULL;
+  if (window)
+    {
+      point->window = malloc (IOS_DEV_ZFILE_WINDOW_SIZE);
+      if (!point->window)
+        return IOD_ENOMEM;
+      memcpy (point->window, window, IOS_DEV_ZFILE_WINDOW_SIZE);
+    }
+
+  zio->num_points++;
+  return IOD_OK;
+}
+
+static void
+ios_dev_zfile_free_points (struct ios_dev_zfile *zio)
+{
+  size_t i;
+
+  for (i = 0; i < zio->num_points; ++i)
+    free (zio->points[i].window);
+  free (zio->points);
+  zio->points = NULL;
+  zio->num_points = 0;
+  zio->allocated = 0;
+}
+
+/* Make the compressed data at OFFSET the next input of the
+   decompressor of ZIO.  */
+
+static void
+ios_dev_zfile_seek_input (struct ios_dev_zfile *zio, ios_dev_off offset)
+{
+  zio->in_offset = offset;
+  zio->in_next = zio->in;
+  zio->in_avail = 0;
+}
+
+/* Read more compressed data into the input buffer of ZIO, which
+   should be empty.  Return IOD_EOF at the end of the file.  */
+
+static int
+ios_dev_zfile_read_input (struct ios_dev_zfile *zio)
+{
+  ssize_t nread;
+
+  nread = pread (zio->fd, zio->in, IOS_DEV_ZFILE_IN_SIZE, zio->in_offset);
+  if (nread == -1)
+    return IOD_ERROR;
+  if (nread == 0)
+    return IOD_EOF;
+
+  zio->in_next = zio->in;
+  zio->in_avail = nread;
+  zio->in_offset += nread;
+  return IOD_OK;
+}
+
+/* Read exactly COUNT bytes at OFFSET in the compressed file.  */
+
+static int
+ios_dev_zfile_pread_exact (struct ios_dev_zfile *zio, void *buf,
+                           size_t count, ios_dev_off offset)
+{
+  ssize_t nread = pread (zio->fd, buf, count, offset);
+
+  if (nread == -1)
+    return IOD_ERROR;
+  return (size_t) nread == count ? IOD_OK : IOD_EOF;
+}
+
+#ifdef HAVE_ZLIB
+
+/* gzip files.  */
+
+static int
+ios_dev_gzip_index (struct ios_dev_zfile *zio)
+{
+  z_stream strm;
+  uint8_t *window, *window_copy;
+  ios_dev_off totin = 0, totout = 0, last = 0;
+  int ret, member_p = 1, members = 0;
+
+  window = malloc (IOS_DEV_ZFILE_WINDOW_SIZE);
+  window_copy = malloc (IOS_DEV_ZFILE_WINDOW_SIZE);
+  if (!window || !window_copy)
+    {
+      ret = IOD_ENOMEM;
+      goto done;
+    }
+
+  memset (&strm, 0, sizeof (strm));
+  if (inflateInit2 (&strm, 47) != Z_OK)
+    {
+      ret = IOD_ENOMEM;
+      goto done;
+    }
+
+  ret = ios_dev_zfile_add_point (zio, 0, 0, -1, NULL);
+  if (ret != IOD_OK)
+    goto end;
+
+  ios_dev_zfile_seek_input (zio, 0);
+  strm.avail_out = 0;
+  while (1)
+    {
+      int zret;
+
+      if (zio->in_avail == 0)
+        {
+          ret = ios_dev_zfile_read_input (zio);
+          if (ret == IOD_EOF)
+            {
+              /* A truncated member is an error.  The end of the file
+                 at the start of a member is the end of the data.  */
+              ret = member_p ? IOD_OK : IOD_ERROR;
+              break;
+            }
+          if (ret != IOD_OK)
+            break;
+        }
+
+      if (strm.avail_out == 0)
+        {
+          strm.next_out = window;
+          strm.avail_out = IOS_DEV_ZFILE_WINDOW_SIZE;
+        }
+
+      strm.next_in = (Bytef *) zio->in_next;
+      strm.avail_in = zio->in_avail;
+      totin += strm.avail_in;
+      totout += strm.avail_out;
+      zret = inflate (&strm, Z_BLOCK);
+      totin -= strm.avail_in;
+      totout -= strm.avail_out;
+      zio->in_next = strm.next_in;
+      zio->in_avail = strm.avail_in;
+
+      if (zret == Z_DATA_ERROR && member_p && members > 0
+          && totout == last)
+        {
+          /* Junk after the last member is ignored, like gzip does.
+             The checkpoint at its start is dropped below.  */
+          ret = IOD_OK;
+          break;
+        }
+      if (zret != Z_OK && zret != Z_STREAM_END && zret != Z_BUF_ERROR)
+        {
+          ret = IOD_ERROR;
+          break;
+        }
+      member_p = 0;
+
+      if (zret == Z_STREAM_END)
+        {
+          /* Another member may follow.  The checkpoints must have
+             increasing offsets, so the one at the start of the next
+             member replaces any other checkpoint at the same offset,
+             as happens after empty members.  */
+          inflateReset (&strm);
+          member_p = 1;
+          members++;
+          last = totout;
+          if (zio->points[zio->num_points - 1].uoffset == totout)
+            free (zio->points[--zio->num_points].window);
+          ret = ios_dev_zfile_add_point (zio, totout, totin, -1, NULL);
+          if (ret != IOD_OK)
+            break;
+          continue;
+        }
+
+      /* At the end of a deflate block which is not the last one,
+         record a checkpoint if enough data was decompressed since the
+         last one.  */
+      if ((strm.data_type & 128) && !(strm.data_type & 64)
+          && totout - last > IOS_DEV_ZFILE_SPAN)
+        {
+          size_t left = strm.avail_out;
+
+          memcpy (window_copy, window + IOS_DEV_ZFILE_WINDOW_SIZE - left,
+                  left);
+          memcpy (window_copy + left, window,
+                  IOS_DEV_ZFILE_WINDOW_SIZE - left);
+          ret = ios_dev_zfile_add_point (zio, totout, totin,
+                                         strm.data_type & 7, window_copy);
+          if (ret != IOD_OK)
+            break;
+          last = totout;
+        }
+    }
+
+  /* The checkpoint at the end of the last member is useless.  */
+  if (ret == IOD_OK && zio->num_points > 1
+      && zio->points[zio->num_points - 1].uoffset == totout)
+    free (zio->points[--zio->num_points].window);
+  zio->size = totout;
+
+ end:
+  inflateEnd (&strm);
+ done:
+  free (window);
+  free (window_copy);
+  return ret;
+}
+
+static int
+ios_dev_gzip_start (struct ios_dev_zfile *zio, size_t point)
+{
+  struct ios_dev_zfile_point *p = &zio->points[point];
+  z_stream *strm = &zio->dec.gz.strm;
+
+  /* Checkpoints inside a member are in the middle of raw deflate
+     data, so the gzip header of the member is not there.  */
+  memset (strm, 0, sizeof (*strm));
+  zio->dec.gz.raw_p = (p->aux != -1);
+  zio->dec.gz.trailer = 0;
+  if (inflateInit2 (strm, zio->dec.gz.raw_p ? -15 : 47) != Z_OK)
+    return IOD_ENOMEM;
+
+  if (p->aux > 0)
+    {
+      uint8_t byte;
+
+      if (ios_dev_zfile_pread_exact (zio, &byte, 1, p->coffset - 1)
+          != IOD_OK)
+        {
+          inflateEnd (strm);
+          return IOD_ERROR;
+        }
+      inflatePrime (strm, p->aux, byte >> (8 - p->aux));
+    }
+  if (p->window)
+    inflateSetDictionary (strm, p->window, IOS_DEV_ZFILE_WINDOW_SIZE);
+
+  ios_dev_zfile_seek_input (zio, p->coffset);
+  return IOD_OK;
+}
+
+static int
+ios_dev_gzip_decode (struct ios_dev_zfile *zio, uint8_t *buf, size_t count)
+{
+  z_stream *strm = &zio->dec.gz.strm;
+
+  strm->next_out = buf;
+  strm->avail_out = count;
+
+  while (strm->avail_out > 0)
+    {
+      int zret;
+
+      if (zio->in_avail == 0
+          && ios_dev_zfile_read_input (zio) != IOD_OK)
+        return IOD_ERROR;
+
+      /* Skip the trailer of a member decompressed as raw deflate
+         data, and then decompress the next member as gzip data.  */
+      if (zio->dec.gz.trailer > 0)
+        {
+          size_t n = (zio->dec.gz.trailer < zio->in_avail
+                      ? zio->dec.gz.trailer : zio->in_avail);
+
+          zio->in_next += n;
+          zio->in_avail -= n;
+          zio->dec.gz.trailer -= n;
+          if (zio->dec.gz.trailer == 0
+              && inflateReset2 (strm, 47) != Z_OK)
+            return IOD_ERROR;
+          continue;
+        }
+
+      strm->next_in = (Bytef *) zio->in_next;
+      strm->avail_in = zio->in_avail;
+      zret = inflate (strm, Z_NO_FLUSH);
+      zio->in_next = strm->next_in;
+      zio->in_avail = strm->avail_in;
+
+      if (zret == Z_STREAM_END)
+        {
+          if (zio->dec.gz.raw_p)
+            {
+              zio->dec.gz.raw_p = 0;
+              zio->dec.gz.trailer = 8;
+            }
+          else
+            inflateReset (strm);
+        }
+      else if (zret != Z_OK && zret != Z_BUF_ERROR)
+        return IOD_ERROR;
+    }
+
+  return IOD_OK;
+}
+
+static void
+ios_dev_gzip_end (struct ios_dev_zfile *zio)
+{
+  inflateEnd (&zio->dec.gz.strm);
+}
+
+static const struct ios_dev_zfile_format ios_dev_zfile_gzip =
+  {
+   .id = 1,
+   .prefix = "gzip://",
+   .min_aux = -1,
+   .max_aux = 7,
+   .index = ios_dev_gzip_index,
+   .start = ios_dev_gzip_start,
+   .decode = ios_dev_gzip_decode,
+   .end = ios_dev_gzip_end
+  };
+
+#endif /* HAVE_ZLIB */
+
+#ifdef HAVE_LIBLZMA
+
+/* xz files.  */
+
+static int
+ios_dev_xz_index (struct ios_dev_zfile *zio)
+{
+  lzma_stream strm = LZMA_STREAM_INIT;
+  lzma_index *index = NULL;
+  lzma_index_iter iter;
+  int ret = IOD_OK;
+
+  if (lzma_file_info_decoder (&strm, &index, UINT64_MAX, zio->csize)
+      != LZMA_OK)
+    return IOD_ENOMEM;
+
+  ios_dev_zfile_seek_input (zio, 0);
+  while (1)
+    {
+      lzma_ret lret;
+
+      if (zio->in_avail == 0)
+        {
+          ret = ios_dev_zfile_read_input (zio);
+          if (ret != IOD_OK)
+            {
+              ret = IOD_ERROR;
+              break;
+            }
+        }
+
+      strm.next_in = zio->in_next;
+      strm.avail_in = zio->in_avail;
+      lret = lzma_code (&strm, LZMA_RUN);
+      zio->in_next = strm.next_in;
+      zio->in_avail = strm.avail_in;
+
+      if (lret == LZMA_SEEK_NEEDED)
+        ios_dev_zfile_seek_input (zio, strm.seek_pos);
+      else if (lret == LZMA_STREAM_END)
+        break;
+      else if (lret != LZMA_OK)
+        {
+          ret = IOD_ERROR;
+          break;
+        }
+    }
+  lzma_end (&strm);
+
+  if (ret != IOD_OK)
+    return ret;
+
+  lzma_index_iter_init (&iter, index);
+  while (!lzma_index_iter_next (&iter, LZMA_INDEX_ITER_NONEMPTY_BLOCK))
+    {
+      ret = ios_dev_zfile_add_point (zio,
+                                     iter.block.uncompressed_file_offset,
+                                     iter.block.compressed_file_offset,
+                                     iter.stream.flags->check,
+                                     NULL);
+      if (ret != IOD_OK)
+        break;
+    }
+
+  zio->size = lzma_index_uncompressed_size (index);
+  lzma_index_end (index, NULL);
+
+  /* Files without data have no blocks.  */
+  if (ret == IOD_OK && zio->num_points == 0)
+    ret = ios_dev_zfile_add_point (zio, 0, 0, 0, NULL);
+  return ret;
+}
+
+static int
+ios_dev_xz_start (struct ios_dev_zfile *zio, size_t point)
+{
+  struct ios_dev_zfile_point *p = &zio->points[point];
+  /* The block decoder keeps using BLOCK until the end of the block.  */
+  lzma_block *block = &zio->dec.xz.block;
+  lzma_filter filters[LZMA_FILTERS_MAX + 1];
+  uint8_t header[LZMA_BLOCK_HEADER_SIZE_MAX];
+  lzma_ret lret;
+  int i, ret;
+
+  zio->dec.xz.strm = (lzma_stream) LZMA_STREAM_INIT;
+
+  ret = ios_dev_zfile_pread_exact (zio, header, 1, p->coffset);
+  if (ret != IOD_OK)
+    return IOD_ERROR;
+
+  memset (block, 0, sizeof (*block));
+  block->version = 1;
+  block->check = p->aux;
+  block->filters = filters;
+  block->header_size = lzma_block_header_size_decode (header[0]);
+
+  ret = ios_dev_zfile_pread_exact (zio, header, block->header_size,
+                                   p->coffset);
+  if (ret != IOD_OK || lzma_block_header_decode (block, NULL, header)
+                       != LZMA_OK)
+    return IOD_ERROR;
+
+  lret = lzma_block_decoder (&zio->dec.xz.strm, block);
+  for (i = 0; filters[i].id != LZMA_VLI_UNKNOWN; ++i)
+    free (filters[i].options);
+  block->filters = NULL;
+  if (lret != LZMA_OK)
+    return IOD_ERROR;
+
+  ios_dev_zfile_seek_input (zio, p->coffset + block->header_size);
+  return IOD_OK;
+}
+
+static void
+ios_dev_xz_end (struct ios_dev_zfile *zio)
+{
+  lzma_end (&zio->dec.xz.strm);
+}
+
+static int
+ios_dev_xz_decode (struct ios_dev_zfile *zio, uint8_t *buf, size_t count)
+{
+  lzma_stream *strm = &zio->dec.xz.strm;
+
+  strm->next_out = buf;
+  strm->avail_out = count;
+
+  while (strm->avail_out > 0)
+    {
+      lzma_ret lret;
+
+      if (zio->in_avail == 0
+          && ios_dev_zfile_read_input (zio) != IOD_OK)
+        return IOD_ERROR;
+
+      strm->next_in = zio->in_next;
+      strm->avail_in = zio->in_avail;
+      lret = lzma_code (strm, LZMA_RUN);
+      zio->in_next = strm->next_in;
+      zio->in_avail = strm->avail_in;
+
+      if (lret == LZMA_STREAM_END)
+        {
+          /* Continue with the next block, if there is one.  The
+             decoder may reach the end of the last block while
+             producing the last requested bytes.  */
+          uint8_t *next_out = strm->next_out;
+          size_t avail_out = strm->avail_out;
+
+          if (zio->point + 1 >= zio->num_points)
+            return avail_out == 0 ? IOD_OK : IOD_ERROR;
+
+          lzma_end (strm);
+          zio->point++;
+          if (ios_dev_xz_start (zio, zio->point) != IOD_OK)
+            return IOD_ERROR;
+          strm->next_out = next_out;
+          strm->avail_out = avail_out;
+        }
+      else if (lret != LZMA_OK)
+        return IOD_ERROR;
+    }
+
+  return IOD_OK;
+}
+
+static const struct ios_dev_zfile_format ios_dev_zfile_xz =
+  {
+   .id = 2,
+   .prefix = "xz://",
+   .min_aux = 0,
+   .max_aux = LZMA_CHECK_ID_MAX,
+   .index = ios_dev_xz_index,
+   .start = ios_dev_xz_start,
+   .decode = ios_dev_xz_decode,
+   .end = ios_dev_xz_end
+  };
+
+#endif /* HAVE_LIBLZMA */
+
+#ifdef HAVE_LIBZSTD
+
+/* zstd files.  */
+
+static int
+ios_dev_zstd_start (struct ios_dev_zfile *zio, size_t point)
+{
+  zio->dec.zstd = ZSTD_createDStream ();
+  if (!zio->dec.zstd)
+    return IOD_ENOMEM;
+
+  ios_dev_zfile_seek_input (zio, zio->points[point].coffset);
+  return IOD_OK;
+}
+
+static void
+ios_dev_zstd_end (struct ios_dev_zfile *zio)
+{
+  ZSTD_freeDStream (zio->dec.zstd);
+}
+
+/* Decompress the next COUNT bytes into BUF.  If BUF is NULL, just
+   count the bytes until the end of the current frame, and return
+   them in *COUNTED.  */
+
+static int
+ios_dev_zstd_decode_1 (struct ios_dev_zfile *zio, uint8_t *buf, size_t count,
+                       ios_dev_off *counted)
+{
+  uint8_t *scratch = NULL;
+  ZSTD_outBuffer out;
+
+  if (!buf)
+    {
+      scratch = malloc (IOS_DEV_ZFILE_PAGE_SIZE);
+      if (!scratch)
+        return IOD_ENOMEM;
+      *counted = 0;
+    }
+
+  out.dst = buf ? buf : scratch;
+  out.size = buf ? count : IOS_DEV_ZFILE_PAGE_SIZE;
+  out.pos = 0;
+
+  while (!buf || out.pos < out.size)
+    {
+      ZSTD_inBuffer in;
+      size_t zret;
+
+      if (zio->in_avail == 0
+          && ios_dev_zfile_read_input (zio) != IOD_OK)
+        {
+          free (scratch);
+          return IOD_ERROR;
+        }
+
+      in.src = zio->in_next;
+      in.size = zio->in_avail;
+      in.pos = 0;
+      zret = ZSTD_decompressStream (zio->dec.zstd, &out, &in);
+      zio->in_next += in.pos;
+      zio->in_avail -= in.pos;
+
+      if (ZSTD_isError (zret))
+        {
+          free (scratch);
+          return IOD_ERROR;
+        }
+
+      if (!buf)
+        {
+          *counted += out.pos;
+          out.pos = 0;
+          if (zret == 0)
+            break;
+        }
+    }
+
+  free (scratch);
+  return IOD_OK;
+}
+
+static int
+ios_dev_zstd_decode (struct ios_dev_zfile *zio, uint8_t *buf, size_t count)
+{
+  return ios_dev_zstd_decode_1 (zio, buf, count, NULL);
+}
+
+/* Read a little-endian integer of SIZE bytes at P.  */
+
+static uint64_t
+ios_dev_zstd_le (const uint8_t *p, int size)
+{
+  uint64_t value = 0;
+  int i;
+
+  for (i = size - 1; i >= 0; --i)
+    value = (value << 8) | p[i];
+  return value;
+}
+
+/* Walk through the frames of the file, which are described in RFC
+   8878, recording a checkpoint at every frame with data.  The size of
+   the data in frames not recording it is found by decompressing
+   them.  */
+
+static int
+ios_dev_zstd_index (struct ios_dev_zfile *zio)
+{
+  ios_dev_off coffset = 0, uoffset = 0;
+  uint8_t header[18];
+  int ret;
+
+  while (coffset < zio->csize)
+    {
+      uint32_t magic;
+      uint8_t fhd;
+      int fcs_size, did_size, single_segment_p, checksum_p;
+      ios_dev_off frame_size, content_size;
+      ios_dev_off block;
+
+      ret = ios_dev_zfile_pread_exact (zio, header, 8, coffset);
+      if (ret != IOD_OK)
+        return IOD_ERROR;
+
+      magic = ios_dev_zstd_le (header, 4);
+      if ((magic & 0xfffffff0) == 0x184d2a50)
+        {
+          /* Skippable frame.  */
+          coffset += 8 + ios_dev_zstd_le (header + 4, 4);
+          continue;
+        }
+      if (magic != 0xfd2fb528)
+        return IOD_ERROR;
+
+      fhd = header[4];
+      single_segment_p = (fhd >> 5) & 1;
+      checksum_p = (fhd >> 2) & 1;
+      did_size = (int[]) {0, 1, 2, 4}[fhd & 3];
+      fcs_size = (int[]) {single_segment_p, 2, 4, 8}[fhd >> 6];
+
+      ret = ios_dev_zfile_pread_exact (zio, header, 5 + !single_segment_p
+                                       + did_size + fcs_size, coffset);
+      if (ret != IOD_OK)
+        return IOD_ERROR;
+
+      content_size = ios_dev_zstd_le (header + 5 + !single_segment_p
+                                      + did_size, fcs_size);
+      if (fcs_size == 2)
+        content_size += 256;
+
+      /* Skip the blocks.  */
+      block = coffset + 5 + !single_segment_p + did_size + fcs_size;
+      while (1)
+        {
+          uint32_t bh;
+
+          ret = ios_dev_zfile_pread_exact (zio, header, 3, block);
+          if (ret != IOD_OK)
+            return IOD_ERROR;
+
+          bh = ios_dev_zstd_le (header, 3);
+          block += 3 + (((bh >> 1) & 3) == 1 ? 1 : bh >> 3);
+          if (bh & 1)
+            break;
+        }
+      frame_size = block + (checksum_p ? 4 : 0) - coffset;
+
+      if (fcs_size == 0)
+        {
+          ret = ios_dev_zfile_add_point (zio, uoffset, coffset, 0, NULL);
+          if (ret != IOD_OK)
+            return ret;
+
+          ret = ios_dev_zstd_start (zio, zio->num_points - 1);
+          if (ret != IOD_OK)
+            return ret;
+          ret = ios_dev_zstd_decode_1 (zio, NULL, 0, &content_size);
+          ios_dev_zstd_end (zio);
+          if (ret != IOD_OK)
+            return ret;
+
+          if (content_size == 0)
+            zio->num_points--;
+        }
+      else if (content_size > 0)
+        {
+          ret = ios_dev_zfile_add_point (zio, uoffset, coffset, 0, NULL);
+          if (ret != IOD_OK)
+            return ret;
+        }
+
+      coffset += frame_size;
+      uoffset += content_size;
+    }
+
+  zio->size = uoffset;
+  if (zio->num_points == 0)
+    return ios_dev_zfile_add_point (zio, 0, 0, 0, NULL);
+  return IOD_OK;
+}
+
+static const struct ios_dev_zfile_format ios_dev_zfile_zstd =
+  {
+   .id = 3,
+   .prefix = "zstd://",
+   .min_aux = 0,
+   .max_aux = 0,
+   .index = ios_dev_zstd_index,
+   .start = ios_dev_zstd_start,
+   .decode = ios_dev_zstd_decode,
+   .end = ios_dev_zstd_end
+  };
+
+#endif /* HAVE_LIBZSTD */
+
+/* Saved indexes.
+
+   An index file contains a header of 7 little-endian 64-bit words:
+   a magic number, the format identifier, the size, modification time
+   and tag of the compressed file, the size of the decompressed data
+   and the number of checkpoints.  Then every checkpoint follows, as three
+   words containing its UOFFSET, COFFSET and AUX fields, plus its
+   window, if AUX is not -1 in gzip files.  */
+
+#define IOS_DEV_ZFILE_INDEX_MAGIC 0x32584449454b4f50ULL /* "POKEIDX2" */
+
+static int
+ios_dev_zfile_write_word (FILE *file, uint64_t word)
+{
+  uint8_t bytes[8];
+  int i;
+
+  for (i = 0; i < 8; ++i)
+    bytes[i] = word >> (8 * i);
+  return fwrite (bytes, 8, 1, file) == 1;
+}
+
+static int
+ios_dev_zfile_read_word (FILE *file, uint64_t *word)
+{
+  uint8_t bytes[8];
+  int i;
+
+  if (fread (bytes, 8, 1, file) != 1)
+    return 0;
+  *word = 0;
+  for (i = 7; i >= 0; --i)
+    *word = (*word << 8) | bytes[i];
+  return 1;
+}
+
+/* Compute the tag of the compressed file of ZIO, whose size must be
+   known.  The tag catches most changes to the file which preserve its
+   size and modification time, since most formats keep checksums or
+   sizes at the end of the file.  */
+
+static int
+ios_dev_zfile_compute_tag (struct ios_dev_zfile *zio)
+{
+  uint8_t buf[IOS_DEV_ZFILE_TAG_SIZE];
+  size_t n = (zio->csize < IOS_DEV_ZFILE_TAG_SIZE
+              ? zio->csize : IOS_DEV_ZFILE_TAG_SIZE);
+  uint32_t head, tail;
+  int ret;
+
+  ret = ios_dev_zfile_pread_exact (zio, buf, n, 0);
+  if (ret != IOD_OK)
+    return ret;
+  head = crc32_update (0, (const char *) buf, n);
+
+  ret = ios_dev_zfile_pread_exact (zio, buf, n, zio->csize - n);
+  if (ret != IOD_OK)
+    return ret;
+  tail = crc32_update (0, (const char *) buf, n);
+
+  zio->tag = (uint64_t) head << 32 | tail;
+  return IOD_OK;
+}
+
+static char *
+ios_dev_zfile_index_path (struct ios_dev_zfile *zio)
+{
+  char *path = malloc (strlen (zio->path) + sizeof (".pkidx"));
+
+  if (path)
+    {
+      strcpy (path, zio->path);
+      strcat (path, ".pkidx");
+    }
+  return path;
+}
+
+static void
+ios_dev_zfile_save_index (struct ios_dev_zfile *zio)
+{
+  char *path = ios_dev_zfile_index_path (zio);
+  FILE *file;
+  size_t i;
+  int ok;
+
+  if (!path)
+    return;
+  file = fopen (path, "wb");
+  if (!file)
+    {
+      free (path);
+      return;
+    }
+
+  ok = (ios_dev_zfile_write_word (file, IOS_DEV_ZFILE_INDEX_MAGIC)
+        && ios_dev_zfile_write_word (file, zio->format->id)
+        && ios_dev_zfile_write_word (file, zio->csize)
+        && ios_dev_zfile_write_word (file, zio->mtime)
+        && ios_dev_zfile_write_word (file, zio->tag)
+        && ios_dev_zfile_write_word (file, zio->size)
+        && ios_dev_zfile_write_word (file, zio->num_points));
+
+  for (i = 0; ok && i < zio->num_points; ++i)
+    {
+      struct ios_dev_zfile_point *p = &zio->points[i];
+
+      ok = (ios_dev_zfile_write_word (file, p->uoffset)
+            && ios_dev_zfile_write_word (file, p->coffset)
+            && ios_dev_zfile_write_word (file, (int64_t) p->aux)
+            && (!p->window
+                || fwrite (p->window, IOS_DEV_ZFILE_WINDOW_SIZE, 1, file)
+                   == 1));
+    }
+
+  /* A partial index is not useful.  */
+  if (fclose (file) != 0 || !ok)
+    unlink (path);
+  free (path);
+}
+
+/* Load the saved index of ZIO, if there is one that matches the
+   compressed file.  Return whether it was loaded.  */
+
+static int
+ios_dev_zfile_load_index (struct ios_dev_zfile *zio)
+{
+  char *path = ios_dev_zfile_index_path (zio);
+  uint64_t magic, id, csize, mtime, tag, size, num_points, i;
+  uint64_t prev_uoffset = 0;
+  FILE *file;
+  int ok;
+
+  if (!path)
+    return 0;
+  file = fopen (path, "rb");
+  free (path);
+  if (!file)
+    return 0;
+
+  ok = (ios_dev_zfile_read_word (file, &magic)
+        && ios_dev_zfile_read_word (file, &id)
+        && ios_dev_zfile_read_word (file, &csize)
+        && ios_dev_zfile_read_word (file, &mtime)
+        && ios_dev_zfile_read_word (file, &tag)
+        && ios_dev_zfile_read_word (file, &size)
+        && ios_dev_zfile_read_word (file, &num_points)
+        && magic == IOS_DEV_ZFILE_INDEX_MAGIC
+        && id == (uint64_t) zio->format->id
+        && csize == zio->csize
+        && (int64_t) mtime == zio->mtime
+        && tag == zio->tag
+        && num_points > 0);
+
+  for (i = 0; ok && i < num_points; ++i)
+    {
+      uint64_t uoffset, coffset, aux;
+      uint8_t window[IOS_DEV_ZFILE_WINDOW_SIZE];
+      int window_p;
+
+      ok = (ios_dev_zfile_read_word (file, &uoffset)
+            && ios_dev_zfile_read_word (file, &coffset)
+            && ios_dev_zfile_read_word (file, &aux));
+      if (!ok)
+        break;
+
+      /* The checkpoints are used as they are, so reject anything
+         INDEX wouldn't have built.  Gzip checkpoints with AUX bits
+         take them from the byte before COFFSET, and only gzip
+         checkpoints inside members have windows.  */
+      ok = ((int64_t) aux >= zio->format->min_aux
+            && (int64_t) aux <= zio->format->max_aux
+            && (i == 0 ? uoffset == 0 : uoffset > prev_uoffset)
+            && uoffset <= size
+            && coffset <= csize
+            && ((int64_t) aux <= 0 || coffset >= 1));
+      if (!ok)
+        break;
+      prev_uoffset = uoffset;
+
+      window_p = (zio->format->id == 1 && (int64_t) aux != -1);
+      ok = ((!window_p
+             || fread (window, IOS_DEV_ZFILE_WINDOW_SIZE, 1, file) == 1)
+            && ios_dev_zfile_add_point (zio, uoffset, coffset,
+                                        (int64_t) aux,
+                                        window_p ? window : NULL) == IOD_OK);
+    }
+
+  fclose (file);
+  if (!ok)
+    {
+      ios_dev_zfile_free_points (zio);
+      return 0;
+    }
+
+  zio->size = size;
+  return 1;
+}
+
+static const struct ios_dev_zfile_format *
+ios_dev_zfile_formats[] =
+  {
+#ifdef HAVE_ZLIB
+   &ios_dev_zfile_gzip,
+#endif
+#ifdef HAVE_LIBLZMA
+   &ios_dev_zfile_xz,
+#endif
+#ifdef HAVE_LIBZSTD
+   &ios_dev_zfile_zstd,
+#endif
+   NULL
+  };
+
+/* Return the format whose handlers start like HANDLER, or NULL.  */
+
+static const struct ios_dev_zfile_format *
+ios_dev_zfile_format (const char *handler)
+{
+  int i;
+
+  for (i = 0; ios_dev_zfile_formats[i]; ++i)
+    {
+      const char *prefix = ios_dev_zfile_formats[i]->prefix;
+
+      if (strncmp (handler, prefix, strlen (prefix)) == 0
+          && handler[strlen (prefix)] != '\0')
+        return ios_dev_zfile_formats[i];
+    }
+
+  return NULL;
+}
+
+static const char *
+ios_dev_zfile_get_if_name () {
+  return "ZFILE";
+}
+
+static char *
+ios_dev_zfile_handler_normalize (const char *handler, uint64_t flags,
+                                 int *error)
+{
+  char *new_handler = NULL;
+
+  if (ios_dev_zfile_format (handler))
+    {
+      new_handler = strdup (handler);
+      if (new_handler == NULL && error)
+        {
+          *error = IOD_ENOMEM;
+          return NULL;
+        }
+    }
+
+  if (error)
+    *error = IOD_OK;
+  return new_handler;
+}
+
+static void *
+ios_dev_zfile_open (const char *handler, uint64_t flags, int *error,
+                    void *data __attribute__ ((unused)))
+{
+  struct ios_dev_zfile *zio;
+  struct stat st;
+  int internal_error = IOD_ERROR;
+
+  /* These devices are read-only.  */
+  if ((flags & IOS_F_WRITE)
+      || (flags & ~(IOS_F_READ | IOS_F_SAVE_INDEX)))
+    {
+      if (error)
+        *error = IOD_EFLAGS;
+      return NULL;
+    }
+
+  zio = calloc (1, sizeof (struct ios_dev_zfile));
+  if (!zio)
+    {
+      if (error)
+        *error = IOD_ENOMEM;
+      return NULL;
+    }
+
+  zio->fd = -1;
+  zio->format = ios_dev_zfile_format (handler);
+  zio->flags = IOS_F_READ;
+  zio->path = strdup (handler + strlen (zio->format->prefix));
+  zio->in = malloc (IOS_DEV_ZFILE_IN_SIZE);
+  if (!zio->path || !zio->in)
+    {
+      internal_error = IOD_ENOMEM;
+      goto err;
+    }
+
+  zio->fd = open (zio->path, O_RDONLY);
+  if (zio->fd == -1 || fstat (zio->fd, &st) == -1)
+    goto err;
+  zio->csize = st.st_size;
+  zio->mtime = ((int64_t) get_stat_mtime (&st).tv_sec * 1000000000
+                + get_stat_mtime_ns (&st));
+
+  internal_error = ios_dev_zfile_compute_tag (zio);
+  if (internal_error != IOD_OK)
+    goto err;
+
+  if (!ios_dev_zfile_load_index (zio))
+    {
+      internal_error = zio->format->index (zio);
+      if (internal_error != IOD_OK)
+        goto err;
+      if (flags & IOS_F_SAVE_INDEX)
+        ios_dev_zfile_save_index (zio);
+    }
+
+  if (error)
+    *error = IOD_OK;
+  return zio;
+
+ err:
+  ios_dev_zfile_free_points (zio);
+  if (zio->fd != -1)
+    close (zio->fd);
+  free (zio->in);
+  free (zio->path);
+  free (zio);
+  if (error)
+    *error = internal_error;
+  return NULL;
+}
+
+static int
+ios_dev_zfile_close (void *iod)
+{
+  struct ios_dev_zfile *zio = iod;
+  int i;
+
+  if (zio->started_p)
+    zio->format->end (zio);
+  for (i = 0; i < IOS_DEV_ZFILE_NUM_PAGES; ++i)
+    free (zio->pages[i].data);
+  ios_dev_zfile_free_points (zio);
+  close (zio->fd);
+  free (zio->in);
+  free (zio->path);
+  free (zio);
+  return IOD_OK;
+}
+
+static uint64_t
+ios_dev_zfile_get_flags (void *iod)
+{
+  struct ios_dev_zfile *zio = iod;
+
+  return zio->flags;
+}
+
+/* Decompress the COUNT bytes at OFFSET into BUF.  */
+
+static int
+ios_dev_zfile_decompress (struct ios_dev_zfile *zio, uint8_t *buf,
+                          size_t count, ios_dev_off offset)
+{
+  size_t lo = 0, hi = zio->num_points;
+  int ret;
+
+  /* Find the last checkpoint at or before OFFSET.  */
+  while (hi - lo > 1)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+
+      if (zio->points[mid].uoffset <= offset)
+        lo = mid;
+      else
+        hi = mid;
+    }
+
+  /* Keep going with the decompressor if it is between the checkpoint
+     and OFFSET.  */
+  if (!zio->started_p
+      || zio->doffset > offset
+      || zio->doffset < zio->points[lo].uoffset)
+    {
+      if (zio->started_p)
+        zio->format->end (zio);
+      zio->started_p = 0;
+
+      ret = zio->format->start (zio, lo);
+      if (ret != IOD_OK)
+        return ret;
+      zio->started_p = 1;
+      zio->point = lo;
+      zio->doffset = zio->points[lo].uoffset;
+    }
+
+  while (zio->doffset < offset)
+    {
+      size_t n = (offset - zio->doffset < count
+                  ? offset - zio->doffset : count);
+
+      ret = zio->format->decode (zio, buf, n);
+      if (ret != IOD_OK)
+        goto error;
+      zio->doffset += n;
+    }
+
+  ret = zio->format->decode (zio, buf, count);
+  if (ret != IOD_OK)
+    goto error;
+  zio->doffset += count;
+  return IOD_OK;
+
+ error:
+  zio->format->end (zio);
+  zio->started_p = 0;
+  return ret;
+}
+
+static int
+ios_dev_zfile_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
+{
+  struct ios_dev_zfile *zio = iod;
+  uint8_t *p = buf;
+
+  if (offset > zio->size || count > zio->size - offset)
+    return IOD_EOF;
+
+  zio->clock++;
+  while (count > 0)
+    {
+      ios_dev_off page_offset = offset - offset % IOS_DEV_ZFILE_PAGE_SIZE;
+      struct ios_dev_zfile_page *page = NULL;
+      size_t n;
+      int i;
+
+      for (i = 0; i < IOS_DEV_ZFILE_NUM_PAGES; ++i)
+        {
+          struct ios_dev_zfile_page *pg = &zio->pages[i];
+
+          if (pg->valid_p && pg->offset == page_offset)
+            {
+              page = pg;
+              break;
+            }
+          if (!page || (page->valid_p
+                        && (!pg->valid_p || pg->stamp < page->stamp)))
+            page = pg;
+        }
+
+      if (!page->valid_p || page->offset != page_offset)
+        {
+          size_t page_size = (zio->size - page_offset
+                              < IOS_DEV_ZFILE_PAGE_SIZE
+                              ? zio->size - page_offset
+                              : IOS_DEV_ZFILE_PAGE_SIZE);
+          int ret;
+
+          if (!page->data)
+            {
+              page->data = malloc (IOS_DEV_ZFILE_PAGE_SIZE);
+              if (!page->data)
+                return IOD_ENOMEM;
+            }
+
+          page->valid_p = 0;
+          ret = ios_dev_zfile_decompress (zio, page->data, page_size,
+                                          page_offset);
+          if (ret != IOD_OK)
+            return ret;
+          page->valid_p = 1;
+          page->offset = page_offset;
+        }
+
+      page->stamp = zio->clock;
+      n = IOS_DEV_ZFILE_PAGE_SIZE - (offset - page_offset);
+      if (n > count)
+        n = count;
+      memcpy (p, page->data + (offset - page_offset), n);
+
+      p += n;
+      offset += n;
+      count -= n;
+    }
+
+  return IOD_OK;
+}
+
+static int
+ios_dev_zfile_pwrite (void *iod, const void *buf, size_t count,
+                      ios_dev_off offset)
+{
+  return IOD_ERROR;
+}
+
+static ios_dev_off
+ios_dev_zfile_size (void *iod)
+{
+  struct ios_dev_zfile *zio = iod;
+
+  return zio->size;
+}
+
+static int
+ios_dev_zfile_flush (void *iod, ios_dev_off offset)
+{
+  return IOD_OK;
+}
+
+struct ios_dev_if ios_dev_zfile =
+  {
+   .get_if_name = ios_dev_zfile_get_if_name,
+   .handler_normalize = ios_dev_zfile_handler_normalize,
+   .open = ios_dev_zfile_open,
+   .close = ios_dev_zfile_close,
+   .pread = ios_dev_zfile_pread,
+   .pwrite = ios_dev_zfile_pwrite,
+   .get_flags = ios_dev_zfile_get_flags,
+   .size = ios_dev_zfile_size,
+   .flush = ios_dev_zfile_flush,
+  };
@@ -50,7 +50,32 @@ typedef uint64_t ios_dev_off;
    instance of the struct defined below.
 
    See the pk_iod_if struct in libpoke.h for an explanation of the
-   interface functions.  */
+   interface functions.
+
+   GET_MEM is optional and is not available to foreign IO devices.
+   If provided, it returns a pointer to memory holding the contents of
+   the device, or NULL if there is no such memory at the moment, and
+   sets *SIZE to the number of bytes available there.  IO spaces use
+   it to access the device without calling PREAD and PWRITE.  The
+   returned pointer is valid until the next call to PWRITE or CLOSE.
+
+   NEXT_DATA is optional and is not available to foreign IO devices
+   either.  If provided, it finds the first extent of the device
+   containing data that ends after OFFSET, and sets *BEGIN and *END to
+   its boundaries, with *BEGIN not lower than OFFSET.  The bytes in
+   [OFFSET,*BEGIN) are then known to read as zeroes.  It returns
+   IOD_EOF if there is no data after OFFSET.  Devices without
+   NEXT_DATA are assumed to contain data everywhere.
+
+   GET_FD is optional and is not available to foreign IO devices
+   either.  If provided, it returns a file descriptor whose file
+   offsets are the offsets of the device, or -1 if there is no such
+   thing.  IO spaces use it to let the kernel copy data between
+   devices.
+
+   The DATA argument of OPEN is the DATA field of foreign IO devices.
+   Built-in IO devices get the IO context where the space is being
+   opened instead.  */
 
 struct ios_dev_if
 {
@@ -63,6 +88,10 @@ struct ios_dev_if
   uint64_t (*get_flags) (void *dev);
   ios_dev_off (*size) (void *dev);
   int (*flush) (void *dev, ios_dev_off offset);
+  void *(*get_mem) (void *dev, ios_dev_off *size);
+  int (*next_data) (void *dev, ios_dev_off offset,
+                    ios_dev_off *begin, ios_dev_off *end);
+  int (*get_fd) (void *dev);
   void *data;
 };
 
@@ -91,3 +120,22 @@ struct ios_dev_if
 
 extern void *ios_get_dev (ios ios);
 extern struct ios_dev_if *ios_get_dev_if (ios ios);
+
+/* Read/write COUNT bytes at the byte OFFSET of the device operated by
+   the IO space IOS, going through the cache of the space unless FLAGS
+   contains IOS_F_BYPASS_CACHE.  Note that the bias of the space is
+   not applied.  Return an IOD_* status code.  */
+
+extern int ios_pread (ios ios, int flags, void *buf, size_t count,
+                      ios_dev_off offset);
+extern int ios_pwrite (ios ios, int flags, const void *buf, size_t count,
+                       ios_dev_off offset);
+
+/* Find the first extent of data ending after the byte OFFSET of the
+   device operated by the IO space IOS, like the NEXT_DATA function of
+   IO devices.  Pending writes in the space are taken into account.
+   Note that the bias of the space is not applied.  Return an IOD_*
+   status code.  */
+
+extern int ios_seek_data (ios ios, ios_dev_off offset,
+                          ios_dev_off *begin, ios_dev_off *end);
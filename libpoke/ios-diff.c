@@ -0,0 +1,193 @@
+/* ios-diff.c - Comparing ranges of IO spaces.  */
+
+/* Copyright (C) 2026 Free Software Foundation, Inc. */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ios.h"
+#include "ios-dev.h"
+
+/* The ranges are compared in blocks of IOS_DIFF_BLOCK bytes.  Within
+   a block, equal runs are skipped IOS_DIFF_CHUNK bytes at a time with
+   memcmp, and then a word at a time.  */
+
+#define IOS_DIFF_BLOCK (1024 * 1024)
+#define IOS_DIFF_CHUNK 4096
+
+/* Changes separated by less than IOS_DIFF_GAP equal bytes are
+   reported as a single hunk.  */
+
+#define IOS_DIFF_GAP 8
+
+/* Return the index of the first byte in [I,COUNT) which differs in A
+   and B, or COUNT if there is none.  */
+
+static size_t
+ios_diff_skip (const uint8_t *a, const uint8_t *b, size_t i, size_t count)
+{
+  while (count - i >= IOS_DIFF_CHUNK
+         && memcmp (a + i, b + i, IOS_DIFF_CHUNK) == 0)
+    i += IOS_DIFF_CHUNK;
+
+  for (; count - i >= sizeof (uint64_t); i += sizeof (uint64_t))
+    {
+      uint64_t x, y;
+
+      memcpy (&x, a + i, sizeof (uint64_t));
+      memcpy (&y, b + i, sizeof (uint64_t));
+      if (x != y)
+        break;
+    }
+
+  while (i < count && a[i] == b[i])
+    i++;
+  return i;
+}
+
+/* The hunk being built while comparing, if OPEN_P.  It covers the
+   bytes [BEGIN,END) of the ranges.  */
+
+struct ios_diff_hunk
+{
+  int open_p;
+  uint64_t begin;
+  uint64_t end;
+};
+
+/* Add the changed bytes [BEGIN,END) to HUNK, reporting the hunk
+   built so far if they are not close enough to it.  Return non-zero
+   if the comparison shall stop.  */
+
+static int
+ios_diff_change (struct ios_diff_hunk *hunk, uint64_t begin, uint64_t end,
+                 ios_diff_fn cb, void *data)
+{
+  if (hunk->open_p && begin - hunk->end < IOS_DIFF_GAP)
+    {
+      hunk->end = end;
+      return 0;
+    }
+
+  if (hunk->open_p
+      && cb ((ios_off) hunk->begin * 8,
+             (ios_off) (hunk->end - hunk->begin) * 8, data))
+    return 1;
+
+  hunk->open_p = 1;
+  hunk->begin = begin;
+  hunk->end = end;
+  return 0;
+}
+
+int
+ios_diff (ios a_io, ios_off a_from, ios b_io, ios_off b_from,
+          ios_off size, ios_diff_fn cb, void *data)
+{
+  ios_off a_dev = a_from + ios_get_bias (a_io);
+  ios_off b_dev = b_from + ios_get_bias (b_io);
+  struct ios_diff_hunk hunk = { 0, 0, 0 };
+  uint64_t a_size, b_size, a_len, b_len, len, pos;
+  uint8_t *a_buf, *b_buf;
+  int ret = IOS_OK;
+
+  if (!(ios_flags (a_io) & IOS_F_READ) || !(ios_flags (b_io) & IOS_F_READ))
+    return IOS_EPERM;
+
+  if (a_dev < 0 || b_dev < 0 || a_dev % 8 != 0 || b_dev % 8 != 0
+      || size < 0)
+    return IOS_EINVAL;
+
+  /* Bytes past the end of one of the spaces are different from
+     whatever there is in the other space.  */
+  a_size = ios_size (a_io);
+  b_size = ios_size (b_io);
+  a_len = a_size > (uint64_t) a_dev / 8 ? a_size - a_dev / 8 : 0;
+  b_len = b_size > (uint64_t) b_dev / 8 ? b_size - b_dev / 8 : 0;
+  len = a_len > b_len ? a_len : b_len;
+  if (size != 0 && (uint64_t) size / 8 < len)
+    len = size / 8;
+
+  a_buf = malloc (IOS_DIFF_BLOCK);
+  b_buf = malloc (IOS_DIFF_BLOCK);
+  if (!a_buf || !b_buf)
+    {
+      ret = IOS_ENOMEM;
+      goto done;
+    }
+
+  for (pos = 0; pos < len; pos += IOS_DIFF_BLOCK)
+    {
+      size_t count = len - pos < IOS_DIFF_BLOCK ? len - pos : IOS_DIFF_BLOCK;
+      size_t a_count = a_len > pos ? a_len - pos : 0;
+      size_t b_count = b_len > pos ? b_len - pos : 0;
+      size_t common, i;
+
+      if (a_count > count)
+        a_count = count;
+      if (b_count > count)
+        b_count = count;
+      common = a_count < b_count ? a_count : b_count;
+
+      if (a_count > 0)
+        {
+          ret = ios_pread (a_io, IOS_F_BYPASS_CACHE, a_buf, a_count,
+                           a_dev / 8 + pos);
+          if (ret != IOD_OK)
+            {
+              ret = IOD_ERROR_TO_IOS_ERROR (ret);
+              goto done;
+            }
+        }
+      if (b_count > 0)
+        {
+          ret = ios_pread (b_io, IOS_F_BYPASS_CACHE, b_buf, b_count,
+                           b_dev / 8 + pos);
+          if (ret != IOD_OK)
+            {
+              ret = IOD_ERROR_TO_IOS_ERROR (ret);
+              goto done;
+            }
+        }
+
+      for (i = ios_diff_skip (a_buf, b_buf, 0, common);
+           i < common;
+           i = ios_diff_skip (a_buf, b_buf, i, common))
+        {
+          size_t begin = i;
+
+          while (i < common && a_buf[i] != b_buf[i])
+            i++;
+          if (ios_diff_change (&hunk, pos + begin, pos + i, cb, data))
+            goto done;
+        }
+
+      if (common < count
+          && ios_diff_change (&hunk, pos + common, pos + count, cb, data))
+        goto done;
+    }
+
+  if (hunk.open_p)
+    cb ((ios_off) hunk.begin * 8, (ios_off) (hunk.end - hunk.begin) * 8,
+        data);
+
+ done:
+  free (a_buf);
+  free (b_buf);
+  return ret;
+}
@@ -0,0 +1,424 @@
+/* ios-digest.c - Digests of ranges of IO spaces.  */
+
+/* Copyright (C) 2026 Free Software Foundation, Inc. */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "crc.h"
+#include "sha1.h"
+#include "sha256.h"
+
+#include "ios.h"
+#include "ios-dev.h"
+
+/* The data is read in blocks of IOS_DIGEST_BLOCK bytes, which are
+   fed to the digest as they are read.
+
+   CRC-32 and SHA are computed by gnulib, which uses carry-less
+   multiplication for the former, and the SHA implementation of
+   OpenSSL for the latter, if they are available.  CRC-32C uses the
+   CRC32 instructions of the host, if any.  */
+
+#define IOS_DIGEST_BLOCK (1024 * 1024)
+
+#if defined __GNUC__ && defined __x86_64__
+# define IOS_DIGEST_X86 1
+# include <immintrin.h>
+#elif defined __aarch64__ && defined __ARM_FEATURE_CRC32
+# define IOS_DIGEST_ARM 1
+# include <arm_acle.h>
+#endif
+
+static inline uint64_t
+ios_digest_le64 (const uint8_t *p)
+{
+  return ((uint64_t) p[0] | (uint64_t) p[1] << 8
+          | (uint64_t) p[2] << 16 | (uint64_t) p[3] << 24
+          | (uint64_t) p[4] << 32 | (uint64_t) p[5] << 40
+          | (uint64_t) p[6] << 48 | (uint64_t) p[7] << 56);
+}
+
+static inline uint32_t
+ios_digest_le32 (const uint8_t *p)
+{
+  return ((uint32_t) p[0] | (uint32_t) p[1] << 8
+          | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24);
+}
+
+/* Store the N bytes of VALUE in BUF, most significant byte first.  */
+
+static void
+ios_digest_store_be (uint8_t *buf, uint64_t value, int n)
+{
+  int i;
+
+  for (i = n - 1; i >= 0; --i)
+    {
+      buf[i] = value & 0xff;
+      value >>= 8;
+    }
+}
+
+/* CRC-32C, using the Castagnoli polynomial.  The software version
+   processes eight bytes at a time using the tables in CRC32C_TABLE,
+   which are built by crc32c_build.  Like crc32_update, crc32c_update
+   takes and returns the complement of the CRC.  */
+
+#define CRC32C_POLY 0x82f63b78
+
+static uint32_t crc32c_table[8][256];
+
+typedef uint32_t (*crc32c_fn) (uint32_t crc, const uint8_t *buf,
+                               size_t len);
+
+static uint32_t
+crc32c_sw (uint32_t crc, const uint8_t *buf, size_t len)
+{
+  for (; len >= 8; len -= 8, buf += 8)
+    {
+      uint32_t lo = crc ^ ios_digest_le32 (buf);
+      uint32_t hi = ios_digest_le32 (buf + 4);
+
+      crc = (crc32c_table[7][lo & 0xff]
+             ^ crc32c_table[6][(lo >> 8) & 0xff]
+             ^ crc32c_table[5][(lo >> 16) & 0xff]
+             ^ crc32c_table[4][lo >> 24]
+             ^ crc32c_table[3][hi & 0xff]
+             ^ crc32c_table[2][(hi >> 8) & 0xff]
+             ^ crc32c_table[1][(hi >> 16) & 0xff]
+             ^ crc32c_table[0][hi >> 24]);
+    }
+
+  for (; len > 0; len--, buf++)
+    crc = crc32c_table[0][(crc ^ *buf) & 0xff] ^ (crc >> 8);
+  return crc;
+}
+
+#if defined IOS_DIGEST_X86
+
+__attribute__ ((target ("sse4.2")))
+static uint32_t
+crc32c_hw (uint32_t crc, const uint8_t *buf, size_t len)
+{
+  uint64_t c = crc;
+
+  for (; len >= 8; len -= 8, buf += 8)
+    c = _mm_crc32_u64 (c, ios_digest_le64 (buf));
+  for (; len > 0; len--, buf++)
+    c = _mm_crc32_u8 (c, *buf);
+  return c;
+}
+
+#elif defined IOS_DIGEST_ARM
+
+static uint32_t
+crc32c_hw (uint32_t crc, const uint8_t *buf, size_t len)
+{
+  for (; len >= 8; len -= 8, buf += 8)
+    crc = __crc32cd (crc, ios_digest_le64 (buf));
+  for (; len > 0; len--, buf++)
+    crc = __crc32cb (crc, *buf);
+  return crc;
+}
+
+#endif
+
+static crc32c_fn crc32c_kernel;
+
+static void
+crc32c_build (void)
+{
+  uint32_t i;
+  int k;
+
+  for (i = 0; i < 256; ++i)
+    {
+      uint32_t c = i;
+
+      for (k = 0; k < 8; ++k)
+        c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+      crc32c_table[0][i] = c;
+    }
+  for (i = 0; i < 256; ++i)
+    for (k = 1; k < 8; ++k)
+      crc32c_table[k][i] = (crc32c_table[0][crc32c_table[k - 1][i] & 0xff]
+                            ^ (crc32c_table[k - 1][i] >> 8));
+
+  crc32c_kernel = crc32c_sw;
+#if defined IOS_DIGEST_X86
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("sse4.2"))
+    crc32c_kernel = crc32c_hw;
+#elif defined IOS_DIGEST_ARM
+  crc32c_kernel = crc32c_hw;
+#endif
+}
+
+static void
+crc32c_init (void)
+{
+  static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+  pthread_once (&once, crc32c_build);
+}
+
+static uint32_t
+crc32c_update (uint32_t crc, const uint8_t *buf, size_t len)
+{
+  return ~crc32c_kernel (~crc, buf, len);
+}
+
+/* XXH64, as specified in https://github.com/Cyan4973/xxHash, with a
+   seed of zero.  The input is consumed in stripes of 32 bytes, the
+   last incomplete stripe being kept in BUF.  */
+
+#define XXH_PRIME64_1 0x9e3779b185ebca87ULL
+#define XXH_PRIME64_2 0xc2b2ae3d27d4eb4fULL
+#define XXH_PRIME64_3 0x165667b19e3779f9ULL
+#define XXH_PRIME64_4 0x85ebca77c2b2ae63ULL
+#define XXH_PRIME64_5 0x27d4eb2f165667c5ULL
+
+#define XXH_ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+struct xxh64_state
+{
+  uint64_t total_len;
+  uint64_t v[4];
+  uint8_t buf[32];
+  size_t buf_len;
+};
+
+static inline uint64_t
+xxh64_round (uint64_t acc, uint64_t input)
+{
+  acc += input * XXH_PRIME64_2;
+  acc = XXH_ROTL64 (acc, 31);
+  return acc * XXH_PRIME64_1;
+}
+
+static inline uint64_t
+xxh64_merge_round (uint64_t acc, uint64_t val)
+{
+  acc ^= xxh64_round (0, val);
+  return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+static void
+xxh64_init (struct xxh64_state *s)
+{
+  memset (s, 0, sizeof (struct xxh64_state));
+  s->v[0] = XXH_PRIME64_1 + XXH_PRIME64_2;
+  s->v[1] = XXH_PRIME64_2;
+  s->v[2] = 0;
+  s->v[3] = -XXH_PRIME64_1;
+}
+
+static void
+xxh64_stripe (struct xxh64_state *s, const uint8_t *p)
+{
+  s->v[0] = xxh64_round (s->v[0], ios_digest_le64 (p));
+  s->v[1] = xxh64_round (s->v[1], ios_digest_le64 (p + 8));
+  s->v[2] = xxh64_round (s->v[2], ios_digest_le64 (p + 16));
+  s->v[3] = xxh64_round (s->v[3], ios_digest_le64 (p + 24));
+}
+
+static void
+xxh64_update (struct xxh64_state *s, const uint8_t *p, size_t len)
+{
+  s->total_len += len;
+
+  if (s->buf_len > 0)
+    {
+      size_t n = 32 - s->buf_len < len ? 32 - s->buf_len : len;
+
+      memcpy (s->buf + s->buf_len, p, n);
+      s->buf_len += n;
+      p += n;
+      len -= n;
+      if (s->buf_len < 32)
+        return;
+      xxh64_stripe (s, s->buf);
+      s->buf_len = 0;
+    }
+
+  for (; len >= 32; len -= 32, p += 32)
+    xxh64_stripe (s, p);
+
+  memcpy (s->buf, p, len);
+  s->buf_len = len;
+}
+
+static uint64_t
+xxh64_final (struct xxh64_state *s)
+{
+  const uint8_t *p = s->buf;
+  size_t len = s->buf_len;
+  uint64_t h;
+
+  if (s->total_len >= 32)
+    {
+      h = (XXH_ROTL64 (s->v[0], 1) + XXH_ROTL64 (s->v[1], 7)
+           + XXH_ROTL64 (s->v[2], 12) + XXH_ROTL64 (s->v[3], 18));
+      h = xxh64_merge_round (h, s->v[0]);
+      h = xxh64_merge_round (h, s->v[1]);
+      h = xxh64_merge_round (h, s->v[2]);
+      h = xxh64_merge_round (h, s->v[3]);
+    }
+  else
+    h = s->v[2] + XXH_PRIME64_5;
+
+  h += s->total_len;
+
+  for (; len >= 8; len -= 8, p += 8)
+    {
+      h ^= xxh64_round (0, ios_digest_le64 (p));
+      h = XXH_ROTL64 (h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    }
+  if (len >= 4)
+    {
+      h ^= (uint64_t) ios_digest_le32 (p) * XXH_PRIME64_1;
+      h = XXH_ROTL64 (h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+      len -= 4;
+      p += 4;
+    }
+  for (; len > 0; len--, p++)
+    {
+      h ^= *p * XXH_PRIME64_5;
+      h = XXH_ROTL64 (h, 11) * XXH_PRIME64_1;
+    }
+
+  h ^= h >> 33;
+  h *= XXH_PRIME64_2;
+  h ^= h >> 29;
+  h *= XXH_PRIME64_3;
+  h ^= h >> 32;
+  return h;
+}
+
+int
+ios_digest (ios io, ios_off from, ios_off size, int algo,
+            uint8_t *digest, size_t *len)
+{
+  ios_off dev_from = from + ios_get_bias (io);
+  uint64_t io_size, count, pos;
+  uint32_t crc = 0;
+  struct sha1_ctx sha1;
+  struct sha256_ctx sha256;
+  struct xxh64_state xxh64;
+  uint8_t *buf;
+  int ret = IOS_OK;
+
+  if (!(ios_flags (io) & IOS_F_READ))
+    return IOS_EPERM;
+
+  if (dev_from < 0 || dev_from % 8 != 0 || size < 0 || size % 8 != 0)
+    return IOS_EINVAL;
+
+  io_size = ios_size (io);
+  if ((uint64_t) dev_from / 8 > io_size)
+    return IOS_EOF;
+  if (size == 0)
+    count = io_size - dev_from / 8;
+  else if ((uint64_t) size / 8 > io_size - dev_from / 8)
+    return IOS_EOF;
+  else
+    count = size / 8;
+
+  switch (algo)
+    {
+    case IOS_DIGEST_CRC32:
+      break;
+    case IOS_DIGEST_CRC32C:
+      crc32c_init ();
+      break;
+    case IOS_DIGEST_SHA1:
+      sha1_init_ctx (&sha1);
+      break;
+    case IOS_DIGEST_SHA256:
+      sha256_init_ctx (&sha256);
+      break;
+    case IOS_DIGEST_XXH64:
+      xxh64_init (&xxh64);
+      break;
+    default:
+      return IOS_EINVAL;
+    }
+
+  buf = malloc (IOS_DIGEST_BLOCK);
+  if (!buf)
+    return IOS_ENOMEM;
+
+  for (pos = 0; pos < count; pos += IOS_DIGEST_BLOCK)
+    {
+      size_t n = (count - pos < IOS_DIGEST_BLOCK
+                  ? count - pos : IOS_DIGEST_BLOCK);
+
+      ret = ios_pread (io, IOS_F_BYPASS_CACHE, buf, n, dev_from / 8 + pos);
+      if (ret != IOD_OK)
+        {
+          ret = IOD_ERROR_TO_IOS_ERROR (ret);
+          goto done;
+        }
+
+      switch (algo)
+        {
+        case IOS_DIGEST_CRC32:
+          crc = crc32_update (crc, (const char *) buf, n);
+          break;
+        case IOS_DIGEST_CRC32C:
+          crc = crc32c_update (crc, buf, n);
+          break;
+        case IOS_DIGEST_SHA1:
+          sha1_process_bytes (buf, n, &sha1);
+          break;
+        case IOS_DIGEST_SHA256:
+          sha256_process_bytes (buf, n, &sha256);
+          break;
+        case IOS_DIGEST_XXH64:
+          xxh64_update (&xxh64, buf, n);
+          break;
+        }
+    }
+
+  switch (algo)
+    {
+    case IOS_DIGEST_CRC32:
+    case IOS_DIGEST_CRC32C:
+      ios_digest_store_be (digest, crc, 4);
+      *len = 4;
+      break;
+    case IOS_DIGEST_SHA1:
+      sha1_finish_ctx (&sha1, digest);
+      *len = SHA1_DIGEST_SIZE;
+      break;
+    case IOS_DIGEST_SHA256:
+      sha256_finish_ctx (&sha256, digest);
+      *len = SHA256_DIGEST_SIZE;
+      break;
+    case IOS_DIGEST_XXH64:
+      ios_digest_store_be (digest, xxh64_final (&xxh64), 8);
+      *len = 8;
+      break;
+    }
+
+ done:
+  free (buf);
+  return ret;
+}
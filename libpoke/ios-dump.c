@@ -0,0 +1,380 @@
+/* ios-dump.c - Printing dumps of IO spaces.  */
+
+/* Copyright (C) 2026 Free Software Foundation, Inc. */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "pkt.h"
+#include "ios.h"
+
+/* The hexadecimal representation of every byte.  */
+
+#define IOS_HEX_PAIRS(D)                                \
+  D "0" D "1" D "2" D "3" D "4" D "5" D "6" D "7"       \
+  D "8" D "9" D "a" D "b" D "c" D "d" D "e" D "f"
+
+static const char ios_hex_pairs[] =
+  IOS_HEX_PAIRS ("0") IOS_HEX_PAIRS ("1") IOS_HEX_PAIRS ("2")
+  IOS_HEX_PAIRS ("3") IOS_HEX_PAIRS ("4") IOS_HEX_PAIRS ("5")
+  IOS_HEX_PAIRS ("6") IOS_HEX_PAIRS ("7") IOS_HEX_PAIRS ("8")
+  IOS_HEX_PAIRS ("9") IOS_HEX_PAIRS ("a") IOS_HEX_PAIRS ("b")
+  IOS_HEX_PAIRS ("c") IOS_HEX_PAIRS ("d") IOS_HEX_PAIRS ("e")
+  IOS_HEX_PAIRS ("f");
+
+/* Dumps have rows of IOS_DUMP_ROW bytes, and are read from the IO
+   space in blocks of IOS_DUMP_BLOCK bytes.  The latter must be a
+   multiple of the former, so rows never span two blocks.  */
+
+#define IOS_DUMP_ROW 16
+#define IOS_DUMP_BLOCK 4096
+
+/* The output of a dump is collected in BUF, which has room for
+   SIZE characters, LEN of which are used.  All of them are to be
+   printed using the style class CLASS, or no class if it is
+   NULL.  ENOMEM_P is set if BUF couldn't be grown.  */
+
+struct ios_dump_out
+{
+  const char *class;
+  char *buf;
+  size_t len;
+  size_t size;
+  int enomem_p;
+};
+
+static void
+ios_dump_flush (struct ios_dump_out *out)
+{
+  if (out->len == 0)
+    return;
+
+  out->buf[out->len] = '\0';
+  if (out->class)
+    pk_term_class (out->class);
+  pk_puts (out->buf);
+  if (out->class)
+    pk_term_end_class (out->class);
+  out->len = 0;
+}
+
+/* Append the LEN characters in STR to OUT, to be printed with the
+   style class CLASS.  */
+
+static void
+ios_dump_put (struct ios_dump_out *out, const char *class,
+              const char *str, size_t len)
+{
+  if (class != out->class)
+    {
+      ios_dump_flush (out);
+      out->class = class;
+    }
+
+  if (out->len + len >= out->size)
+    {
+      ios_dump_flush (out);
+      if (len >= out->size)
+        {
+          char *buf = realloc (out->buf, len + 1);
+
+          if (!buf)
+            {
+              out->enomem_p = 1;
+              return;
+            }
+          out->buf = buf;
+          out->size = len + 1;
+        }
+    }
+
+  memcpy (out->buf + out->len, str, len);
+  out->len += len;
+}
+
+/* A block of bytes read from the IO space.  VALUES holds the COUNT
+   bytes starting at the byte OFFSET, the ones flagged in UNKNOWN
+   being unreadable.  The end of the IO space was found at the
+   byte EOF_OFFSET, or not yet if it is UINT64_MAX.  */
+
+struct ios_dump_block
+{
+  uint64_t offset;
+  uint64_t count;
+  uint64_t eof_offset;
+  uint64_t values[IOS_DUMP_BLOCK];
+  uint8_t unknown[IOS_DUMP_BLOCK];
+};
+
+/* Read the bytes from OFFSET up to END, at most IOS_DUMP_BLOCK of
+   them, into BLOCK.  Reading stops at the end of the IO space.  */
+
+static void
+ios_dump_read (ios io, struct ios_dump_block *block,
+               uint64_t offset, uint64_t end)
+{
+  uint64_t count = end - offset, i;
+
+  if (count > IOS_DUMP_BLOCK)
+    count = IOS_DUMP_BLOCK;
+  if (block->eof_offset < offset + count)
+    count = block->eof_offset > offset ? block->eof_offset - offset : 0;
+
+  block->offset = offset;
+  block->count = count;
+  memset (block->unknown, 0, count);
+  if (count == 0
+      || ios_read_uint_array (io, offset * 8, 0, 8, IOS_ENDIAN_MSB,
+                              count, block->values) == IOS_OK)
+    return;
+
+  /* Find out which bytes are the culprits.  */
+  for (i = 0; i < count; ++i)
+    {
+      int ret = ios_read_uint (io, (offset + i) * 8, 0, 8,
+                               IOS_ENDIAN_MSB, &block->values[i]);
+
+      if (ret == IOS_EOF)
+        {
+          block->count = i;
+          block->eof_offset = offset + i;
+          break;
+        }
+      block->unknown[i] = (ret != IOS_OK);
+    }
+}
+
+int
+ios_dump (ios io, uint64_t from, uint64_t top, ios_off group_by,
+          int32_t cluster_by, int ruler, int ascii,
+          const char *unknown_byte, char nonprintable_char)
+{
+  static const char *address_class = "dump-address";
+  static const char *ruler_class = "dump-ruler";
+  static const char *ascii_class = "dump-ascii";
+  static const char *unknown_class = "dump-unknown";
+
+  struct ios_dump_out out = { NULL, NULL, 0, 0, 0 };
+  struct ios_dump_block *block;
+  uint64_t offset = from / 8, end, cluster_bytes;
+  size_t unknown_len = strlen (unknown_byte);
+  int group_sep[IOS_DUMP_ROW], cluster_sep[IOS_DUMP_ROW];
+  int o, ret = IOS_OK;
+
+  if (!(ios_flags (io) & IOS_F_READ))
+    return IOS_EPERM;
+  if (group_by <= 0 || cluster_by <= 0)
+    return IOS_EINVAL;
+
+  /* Whether a space goes before every byte of a row, and whether
+     another one goes after it.  */
+  for (o = 0; o < IOS_DUMP_ROW; ++o)
+    {
+      group_sep[o] = (o * 8) % group_by == 0;
+      cluster_sep[o] = (o + 1 < IOS_DUMP_ROW
+                        && ((o + 1) * 8) % (cluster_by * group_by) == 0);
+    }
+  cluster_bytes = cluster_by * group_by / 8;
+
+  out.size = 4096;
+  out.buf = malloc (out.size);
+  block = malloc (sizeof (struct ios_dump_block));
+  if (!out.buf || !block)
+    {
+      ret = IOS_ENOMEM;
+      goto done;
+    }
+  block->offset = block->count = 0;
+  block->eof_offset = UINT64_MAX;
+
+  if (ruler)
+    {
+      if (offset > 0xffffffff)
+        ios_dump_put (&out, ruler_class, "FEDCBA9876543210 ", 17);
+      else
+        ios_dump_put (&out, ruler_class, "76543210 ", 9);
+
+      for (o = 0; o < IOS_DUMP_ROW; ++o)
+        {
+          if (group_sep[o])
+            ios_dump_put (&out, ruler_class, " ", 1);
+          ios_dump_put (&out, ruler_class,
+                        ios_hex_pairs + o * 0x11 * 2, 2);
+          if (cluster_sep[o])
+            ios_dump_put (&out, NULL, " ", 1);
+        }
+
+      if (ascii)
+        {
+          ios_dump_put (&out, ruler_class, "  ", 2);
+          for (o = 0; o < IOS_DUMP_ROW; ++o)
+            {
+              ios_dump_put (&out, ruler_class,
+                            "0123456789ABCDEF" + o, 1);
+              if (o + 1 < IOS_DUMP_ROW && cluster_bytes
+                  && (o + 1) % cluster_bytes == 0)
+                ios_dump_put (&out, ruler_class, " ", 1);
+            }
+        }
+      ios_dump_put (&out, NULL, "\n", 1);
+    }
+
+  end = top / 8 + (top % 8 != 0);
+  for (; offset < end; offset += IOS_DUMP_ROW)
+    {
+      char address[17];
+      int i;
+
+      if (offset < block->offset
+          || offset >= block->offset + block->count)
+        ios_dump_read (io, block, offset, end);
+
+      /* Rows past 4GiB get 64-bit addresses.  */
+      for (i = 0; i < 8; ++i)
+        memcpy (address + i * 2,
+                ios_hex_pairs + ((offset >> (56 - i * 8)) & 0xff) * 2, 2);
+      address[16] = ':';
+      if (offset > 0xffffffff)
+        ios_dump_put (&out, address_class, address, 17);
+      else
+        ios_dump_put (&out, address_class, address + 8, 9);
+
+      for (o = 0; o < IOS_DUMP_ROW && offset + o < end; ++o)
+        {
+          uint64_t b = offset + o - block->offset;
+
+          if (b >= block->count)
+            break;
+
+          if (group_sep[o])
+            ios_dump_put (&out, NULL, " ", 1);
+          if (block->unknown[b])
+            ios_dump_put (&out, unknown_class, unknown_byte,
+                          unknown_len);
+          else
+            ios_dump_put (&out, NULL,
+                          ios_hex_pairs + block->values[b] * 2, 2);
+          if (cluster_sep[o])
+            ios_dump_put (&out, NULL, " ", 1);
+        }
+
+      if (ascii)
+        {
+          for (; o < IOS_DUMP_ROW; ++o)
+            {
+              if (group_sep[o])
+                ios_dump_put (&out, NULL, " ", 1);
+              ios_dump_put (&out, NULL, "  ", 2);
+            }
+
+          ios_dump_put (&out, NULL, "  ", 2);
+          for (o = 0; o < IOS_DUMP_ROW && offset + o < end; ++o)
+            {
+              uint64_t b = offset + o - block->offset;
+              uint8_t c;
+
+              /* The dump ends at the end of the IO space.  */
+              if (b >= block->count)
+                {
+                  ios_dump_put (&out, NULL, "\n", 1);
+                  goto done;
+                }
+
+              c = block->values[b];
+              if (block->unknown[b])
+                ios_dump_put (&out, unknown_class,
+                              &nonprintable_char, 1);
+              else if (c < ' ' || c > '~')
+                ios_dump_put (&out, ascii_class,
+                              &nonprintable_char, 1);
+              else
+                ios_dump_put (&out, ascii_class, (const char *) &c, 1);
+              if (cluster_sep[o])
+                ios_dump_put (&out, NULL, " ", 1);
+            }
+        }
+
+      ios_dump_put (&out, NULL, "\n", 1);
+    }
+
+done:
+  if (out.buf)
+    ios_dump_flush (&out);
+  if (out.enomem_p)
+    ret = IOS_ENOMEM;
+  free (out.buf);
+  free (block);
+  return ret;
+}
+
+
+/* The strings printed by ios_print_strings are collected in OUT,
+   preceded by their offsets if OFFSETS_P is set.  */
+
+struct ios_dump_strings
+{
+  int offsets_p;
+  struct ios_dump_out out;
+};
+
+static int
+ios_dump_string (ios_off offset, const char *str, size_t len, void *data)
+{
+  struct ios_dump_strings *s = data;
+
+  if (s->offsets_p)
+    {
+      char buf[32];
+      int n;
+
+      if (offset % 8 == 0)
+        n = snprintf (buf, sizeof buf, "0x%08" PRIx64 "#B",
+                      (uint64_t) offset / 8);
+      else
+        n = snprintf (buf, sizeof buf, "%" PRIu64 "#b", (uint64_t) offset);
+      ios_dump_put (&s->out, "offset", buf, n);
+      ios_dump_put (&s->out, NULL, " ", 1);
+    }
+  ios_dump_put (&s->out, NULL, str, len);
+  ios_dump_put (&s->out, NULL, "\n", 1);
+  return s->out.enomem_p;
+}
+
+int
+ios_print_strings (ios io, ios_off from, ios_off size, int encoding,
+                   size_t min_len, int offsets_p)
+{
+  struct ios_dump_strings s = { offsets_p, { NULL, NULL, 0, 0, 0 } };
+  int ret;
+
+  s.out.size = 4096;
+  s.out.buf = malloc (s.out.size);
+  if (!s.out.buf)
+    return IOS_ENOMEM;
+
+  ret = ios_strings (io, from, size, encoding, min_len,
+                     ios_dump_string, &s);
+  ios_dump_flush (&s.out);
+  if (ret == IOS_OK && s.out.enomem_p)
+    ret = IOS_ENOMEM;
+
+  free (s.out.buf);
+  return ret;
+}
@@ -0,0 +1,340 @@
+/* ios-entropy.c - Byte statistics of IO spaces.  */
+
+/* Copyright (C) 2026 Free Software Foundation, Inc. */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "ios.h"
+#include "ios-dev.h"
+
+/* The data is read in blocks of IOS_ENTROPY_BLOCK bytes.  */
+
+#define IOS_ENTROPY_BLOCK (1024 * 1024)
+
+/* When consecutive windows overlap and the step between them is
+   shorter than IOS_ENTROPY_INCREMENTAL bytes, the entropy is updated
+   with every byte entering or leaving the window.  Otherwise it is
+   computed from the byte counts of every window.  In both cases the
+   values of c*log2(c) are taken from a table with at most
+   IOS_ENTROPY_TABLE_MAX entries.  */
+
+#define IOS_ENTROPY_INCREMENTAL 4096
+#define IOS_ENTROPY_TABLE_MAX (1024 * 1024)
+
+/* A sequential reader of the bytes of a range of an IO space.  BUF
+   holds LEN bytes of the range, starting at its byte POS.  The range
+   starts at the byte DEV_FROM of the device and ends at its byte END,
+   or at the end of the space if END is UINT64_MAX.  */
+
+struct ios_entropy_reader
+{
+  ios io;
+  uint64_t dev_from;
+  uint64_t end;
+  uint8_t *buf;
+  uint64_t pos;
+  size_t len;
+};
+
+/* Make the byte OFFSET of the range of R available in its buffer.
+   Return IOS_OK, IOS_EOF if OFFSET is past the end of the range or
+   of the space, or another error code.  */
+
+static int
+ios_entropy_fill (struct ios_entropy_reader *r, uint64_t offset)
+{
+  size_t n;
+  int ret;
+
+  if (offset >= r->pos && offset < r->pos + r->len)
+    return IOS_OK;
+  if (offset >= r->end)
+    return IOS_EOF;
+
+  n = r->end - offset < IOS_ENTROPY_BLOCK ? r->end - offset
+                                          : IOS_ENTROPY_BLOCK;
+  ret = ios_pread (r->io, IOS_F_BYPASS_CACHE, r->buf, n,
+                   r->dev_from + offset);
+  if (ret == IOD_EOF)
+    {
+      /* Read whatever is left before the end of the space.  */
+      uint64_t io_size = ios_size (r->io);
+
+      if (io_size <= r->dev_from + offset)
+        return IOS_EOF;
+      if (io_size - r->dev_from - offset < n)
+        n = io_size - r->dev_from - offset;
+      ret = ios_pread (r->io, IOS_F_BYPASS_CACHE, r->buf, n,
+                       r->dev_from + offset);
+    }
+  if (ret != IOD_OK)
+    return IOD_ERROR_TO_IOS_ERROR (ret);
+
+  r->pos = offset;
+  r->len = n;
+  return IOS_OK;
+}
+
+/* Check the arguments common to ios_histogram and ios_entropy and
+   initialize R to read the range.  Return IOS_OK or an error
+   code.  */
+
+static int
+ios_entropy_reader_init (struct ios_entropy_reader *r, ios io,
+                         ios_off from, ios_off size)
+{
+  ios_off dev_from = from + ios_get_bias (io);
+
+  if (!(ios_flags (io) & IOS_F_READ))
+    return IOS_EPERM;
+  if (dev_from < 0 || dev_from % 8 != 0 || size < 0 || size % 8 != 0)
+    return IOS_EINVAL;
+
+  r->io = io;
+  r->dev_from = dev_from / 8;
+  r->end = size == 0 ? UINT64_MAX : (uint64_t) size / 8;
+  r->pos = 0;
+  r->len = 0;
+  r->buf = malloc (IOS_ENTROPY_BLOCK);
+  return r->buf ? IOS_OK : IOS_ENOMEM;
+}
+
+int
+ios_histogram (ios io, ios_off from, ios_off size, uint64_t counts[256])
+{
+  struct ios_entropy_reader r;
+  uint64_t c[4][256], pos;
+  int ret, i;
+
+  ret = ios_entropy_reader_init (&r, io, from, size);
+  if (ret != IOS_OK)
+    return ret;
+
+  /* Bytes are counted in four tables, so that runs of the same byte
+     don't stall on the increments of a single counter.  */
+  memset (c, 0, sizeof c);
+  for (pos = 0; pos < r.end; pos += r.len)
+    {
+      const uint8_t *p;
+      size_t n, j;
+
+      ret = ios_entropy_fill (&r, pos);
+      if (ret == IOS_EOF && size == 0)
+        {
+          ret = IOS_OK;
+          break;
+        }
+      if (ret != IOS_OK)
+        goto done;
+
+      p = r.buf;
+      n = r.len;
+      for (j = 0; j + 4 <= n; j += 4)
+        {
+          c[0][p[j]]++;
+          c[1][p[j + 1]]++;
+          c[2][p[j + 2]]++;
+          c[3][p[j + 3]]++;
+        }
+      for (; j < n; ++j)
+        c[0][p[j]]++;
+    }
+
+  for (i = 0; i < 256; ++i)
+    counts[i] = c[0][i] + c[1][i] + c[2][i] + c[3][i];
+
+ done:
+  free (r.buf);
+  return ret;
+}
+
+/* The byte counts of the current window, and, if INCREMENTAL_P, the
+   sum of c*log2(c) for every count c.  TABLE holds c*log2(c) for the
+   counts lower than TABLE_LEN.  */
+
+struct ios_entropy_window
+{
+  uint64_t counts[256];
+  int incremental_p;
+  double sum;
+  double *table;
+  uint64_t table_len;
+};
+
+static inline double
+ios_entropy_clog2c (const struct ios_entropy_window *w, uint64_t c)
+{
+  return c < w->table_len ? w->table[c] : (double) c * log2 ((double) c);
+}
+
+/* Add the bytes [BEGIN,END) of the range read by R to the window W,
+   or remove them if REMOVE_P.  Return IOS_OK, IOS_EOF if the end of
+   the space was found or another error code.  */
+
+static int
+ios_entropy_update (struct ios_entropy_window *w,
+                    struct ios_entropy_reader *r,
+                    uint64_t begin, uint64_t end, int remove_p)
+{
+  uint64_t pos;
+  int ret;
+
+  for (pos = begin; pos < end;)
+    {
+      const uint8_t *p;
+      size_t n, j;
+
+      ret = ios_entropy_fill (r, pos);
+      if (ret != IOS_OK)
+        return ret;
+
+      p = r->buf + (pos - r->pos);
+      n = r->pos + r->len - pos;
+      if (n > end - pos)
+        n = end - pos;
+
+      if (!w->incremental_p)
+        {
+          if (remove_p)
+            for (j = 0; j < n; ++j)
+              w->counts[p[j]]--;
+          else
+            for (j = 0; j < n; ++j)
+              w->counts[p[j]]++;
+        }
+      else
+        for (j = 0; j < n; ++j)
+          {
+            uint64_t c = w->counts[p[j]];
+            uint64_t nc = remove_p ? c - 1 : c + 1;
+
+            w->sum += (ios_entropy_clog2c (w, nc)
+                       - ios_entropy_clog2c (w, c));
+            w->counts[p[j]] = nc;
+          }
+
+      pos += n;
+    }
+
+  return IOS_OK;
+}
+
+/* Return the entropy of the window W, which has SIZE bytes, in bits
+   per byte.  */
+
+static double
+ios_entropy_value (struct ios_entropy_window *w, uint64_t size)
+{
+  double sum = w->sum, entropy;
+  int i;
+
+  if (!w->incremental_p)
+    for (sum = 0, i = 0; i < 256; ++i)
+      sum += ios_entropy_clog2c (w, w->counts[i]);
+
+  entropy = log2 ((double) size) - sum / size;
+  return entropy < 0 ? 0 : entropy > 8 ? 8 : entropy;
+}
+
+int
+ios_entropy (ios io, ios_off from, ios_off size, ios_off window,
+             ios_off step, ios_entropy_fn cb, void *data)
+{
+  struct ios_entropy_reader head, tail = { 0 };
+  struct ios_entropy_window w;
+  uint64_t wsize, wstep, begin, c;
+  int ret;
+
+  if (window <= 0 || window % 8 != 0 || step <= 0 || step % 8 != 0)
+    return IOS_EINVAL;
+
+  ret = ios_entropy_reader_init (&head, io, from, size);
+  if (ret != IOS_OK)
+    return ret;
+
+  wsize = window / 8;
+  wstep = step / 8;
+  memset (&w, 0, sizeof w);
+
+  w.table_len = (wsize < IOS_ENTROPY_TABLE_MAX
+                 ? wsize + 1 : IOS_ENTROPY_TABLE_MAX);
+  w.table = malloc (w.table_len * sizeof (double));
+  if (!w.table)
+    {
+      ret = IOS_ENOMEM;
+      goto done;
+    }
+  w.table[0] = 0;
+  for (c = 1; c < w.table_len; ++c)
+    w.table[c] = (double) c * log2 ((double) c);
+
+  /* When the windows overlap, the bytes leaving the window are read
+     again by a reader trailing the first one.  */
+  if (wstep < wsize)
+    {
+      tail = head;
+      tail.buf = malloc (IOS_ENTROPY_BLOCK);
+      if (!tail.buf)
+        {
+          ret = IOS_ENOMEM;
+          goto done;
+        }
+      w.incremental_p = wstep < IOS_ENTROPY_INCREMENTAL;
+    }
+
+  for (begin = 0;
+       head.end == UINT64_MAX || begin + wsize <= head.end;
+       begin += wstep)
+    {
+      if (begin == 0 || wstep >= wsize)
+        {
+          memset (w.counts, 0, sizeof w.counts);
+          w.sum = 0;
+          ret = ios_entropy_update (&w, &head, begin, begin + wsize, 0);
+        }
+      else
+        {
+          ret = ios_entropy_update (&w, &head, begin - wstep + wsize,
+                                    begin + wsize, 0);
+          if (ret == IOS_OK)
+            ret = ios_entropy_update (&w, &tail, begin - wstep, begin, 1);
+        }
+
+      /* The last window ends at the end of the space if no size was
+         given.  */
+      if (ret == IOS_EOF && size == 0)
+        {
+          ret = IOS_OK;
+          break;
+        }
+      if (ret != IOS_OK)
+        break;
+
+      if (cb (from + (ios_off) begin * 8, ios_entropy_value (&w, wsize),
+              data))
+        break;
+    }
+
+ done:
+  free (w.table);
+  free (tail.buf);
+  free (head.buf);
+  return ret;
+}
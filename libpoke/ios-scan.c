@@ -0,0 +1,559 @@
+/* ios-scan.c - Scanning IO spaces for many patterns at once.  */
+
+/* Copyright (C) 2026 Free Software Foundation, Inc. */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "ios.h"
+#include "ios-dev.h"
+
+/* The patterns are compiled into an Aho-Corasick automaton, which
+   finds all the occurrences of all of them in a single pass over the
+   data.
+
+   Running the automaton costs a random access to its transition
+   table per byte, which is slow if the table doesn't fit in the
+   cache.  Therefore, if the first two bytes of the patterns are
+   selective enough, the data is first filtered by looking them up in
+   a bitmap, and the automaton is only run from the positions which
+   pass the filter, following the transitions of its trie.
+
+   The data is read in chunks by the calling thread.  The range of
+   every chunk is split into slices, which are scanned in parallel by
+   up to IOS_SCAN_MAX_WORKERS threads.  Every match is found by a
+   single slice: the one where it ends, if the automaton is run over
+   all the data, or the one where it begins, if the data is filtered.
+   In order to find the matches which cross the boundaries of the
+   slices, every slice is scanned including the length of the longest
+   pattern minus one bytes before and after it.  The chunks overlap
+   in the same way.  */
+
+#define IOS_SCAN_SLICE (4 * 1024 * 1024)
+#define IOS_SCAN_MAX_WORKERS 8
+
+/* The filter is used if at most one in IOS_SCAN_FILTER_RATIO pairs
+   of bytes pass it.  */
+
+#define IOS_SCAN_FILTER_RATIO 16
+
+/* An Aho-Corasick automaton.
+
+   The bytes are mapped to equivalence classes by CLASSES: every byte
+   which appears in some pattern has a class of its own, and all the
+   other bytes share the class zero.  NCLASSES is the number of
+   classes.
+
+   DELTA is the transition table, with NCLASSES entries per state.
+   The states are identified by the index of their first entry in
+   DELTA, so the transition from the state S with the byte B goes to
+   DELTA[S + CLASSES[B]].  If the target state is accepting, i.e. if
+   some pattern ends in it, the entry contains the ones' complement of
+   the state instead.
+
+   OUT contains, for every state, the first of the patterns which end
+   at it, or -1.  NEXT_OUT links the patterns which end at the same
+   state, as identical patterns do.  DICT contains, for every state,
+   the closest state in its chain of failure links which has patterns
+   ending at it, or -1.  DEPTH contains the length of the path from
+   the initial state to every state in the trie.  OUT, DICT and DEPTH
+   are indexed by state number, i.e. S / NCLASSES.
+
+   FILTER, if not NULL, is a bitmap with a bit set for every pair of
+   bytes which may begin a match.
+
+   LENS contains the lengths of the patterns, and MAX_LEN the length
+   of the longest one.  */
+
+struct ios_ac
+{
+  uint16_t classes[256];
+  size_t nclasses;
+  size_t nstates;
+  int32_t *delta;
+  ssize_t *out;
+  ssize_t *dict;
+  ssize_t *next_out;
+  size_t *depth;
+  uint8_t *filter;
+  const size_t *lens;
+  size_t max_len;
+};
+
+static void
+ios_ac_free (struct ios_ac *ac)
+{
+  free (ac->delta);
+  free (ac->out);
+  free (ac->dict);
+  free (ac->next_out);
+  free (ac->depth);
+  free (ac->filter);
+}
+
+static int
+ios_ac_compile (struct ios_ac *ac, const uint8_t *const *patterns,
+                const size_t *lens, size_t npatterns)
+{
+  size_t total = 1, nclasses = 1, ncl, s, i, j, head, tail;
+  ssize_t *fail = NULL, *queue = NULL;
+
+  memset (ac, 0, sizeof (struct ios_ac));
+  ac->lens = lens;
+
+  for (i = 0; i < npatterns; ++i)
+    {
+      total += lens[i];
+      if (lens[i] > ac->max_len)
+        ac->max_len = lens[i];
+      for (j = 0; j < lens[i]; ++j)
+        if (ac->classes[patterns[i][j]] == 0)
+          ac->classes[patterns[i][j]] = nclasses++;
+    }
+  ac->nclasses = ncl = nclasses;
+
+  /* There is at most a state per byte in the patterns, plus the
+     initial state.  */
+  if (total > INT32_MAX / ncl)
+    return 0;
+  ac->delta = malloc (total * ncl * sizeof (int32_t));
+  ac->out = malloc (total * sizeof (ssize_t));
+  ac->dict = malloc (total * sizeof (ssize_t));
+  ac->next_out = malloc (npatterns * sizeof (ssize_t));
+  ac->depth = malloc (total * sizeof (size_t));
+  fail = malloc (total * sizeof (ssize_t));
+  queue = malloc (total * sizeof (ssize_t));
+  if (!ac->delta || !ac->out || !ac->dict || !ac->next_out
+      || !ac->depth || !fail || !queue)
+    goto error;
+
+  /* Build the trie of the patterns.  Missing transitions are -1.  */
+  for (i = 0; i < total * ncl; ++i)
+    ac->delta[i] = -1;
+  ac->out[0] = -1;
+  ac->depth[0] = 0;
+  ac->nstates = 1;
+
+  for (i = 0; i < npatterns; ++i)
+    {
+      s = 0;
+      for (j = 0; j < lens[i]; ++j)
+        {
+          int32_t *t = &ac->delta[s * ncl + ac->classes[patterns[i][j]]];
+
+          if (*t == -1)
+            {
+              ac->out[ac->nstates] = -1;
+              ac->depth[ac->nstates] = j + 1;
+              *t = ac->nstates++;
+            }
+          s = *t;
+        }
+
+      /* Keep the patterns ending at the same state in ascending
+         order.  */
+      ac->next_out[i] = -1;
+      if (ac->out[s] == -1)
+        ac->out[s] = i;
+      else
+        {
+          ssize_t p = ac->out[s];
+
+          while (ac->next_out[p] != -1)
+            p = ac->next_out[p];
+          ac->next_out[p] = i;
+        }
+    }
+
+  /* Compute the failure links in breadth-first order, and fill in the
+     missing transitions with the transitions of the failure state, so
+     DELTA becomes a DFA.  */
+  head = tail = 0;
+  fail[0] = 0;
+  ac->dict[0] = -1;
+  for (i = 0; i < ncl; ++i)
+    {
+      int32_t t = ac->delta[i];
+
+      if (t == -1)
+        ac->delta[i] = 0;
+      else
+        {
+          fail[t] = 0;
+          ac->dict[t] = -1;
+          queue[tail++] = t;
+        }
+    }
+
+  while (head < tail)
+    {
+      s = queue[head++];
+      for (i = 0; i < ncl; ++i)
+        {
+          int32_t t = ac->delta[s * ncl + i];
+
+          if (t == -1)
+            ac->delta[s * ncl + i] = ac->delta[fail[s] * ncl + i];
+          else
+            {
+              size_t f = ac->delta[fail[s] * ncl + i];
+
+              fail[t] = f;
+              ac->dict[t] = ac->out[f] != -1 ? (ssize_t) f : ac->dict[f];
+              queue[tail++] = t;
+            }
+        }
+    }
+
+  /* Finally, turn the state numbers into offsets in DELTA, and mark
+     the accepting states.  */
+  for (i = 0; i < ac->nstates * ncl; ++i)
+    {
+      int32_t t = ac->delta[i];
+
+      if (ac->out[t] != -1 || ac->dict[t] != -1)
+        ac->delta[i] = ~(int32_t) (t * ncl);
+      else
+        ac->delta[i] = t * ncl;
+    }
+
+  /* Build the filter, and forget about it if too many pairs of
+     bytes pass it.  Patterns of a single byte pass all the pairs
+     beginning with it.  */
+  ac->filter = calloc (65536 / 8, 1);
+  if (!ac->filter)
+    goto error;
+  for (i = 0; i < npatterns; ++i)
+    for (j = 0; j < 256; ++j)
+      {
+        size_t pair = patterns[i][0] << 8 | (lens[i] > 1
+                                              ? patterns[i][1] : j);
+
+        ac->filter[pair / 8] |= 1 << (pair % 8);
+        if (lens[i] > 1)
+          break;
+      }
+
+  for (i = 0, j = 0; i < 65536 / 8; ++i)
+    j += __builtin_popcount (ac->filter[i]);
+  if (j > 65536 / IOS_SCAN_FILTER_RATIO)
+    {
+      free (ac->filter);
+      ac->filter = NULL;
+    }
+
+  free (fail);
+  free (queue);
+  return 1;
+
+ error:
+  free (fail);
+  free (queue);
+  ios_ac_free (ac);
+  return 0;
+}
+
+/* A match found by a worker.  POS is the device offset, in bytes, of
+   its first byte.  */
+
+struct ios_scan_match
+{
+  size_t pattern;
+  ios_dev_off pos;
+};
+
+/* A slice of a chunk to be scanned by a worker.  The SIZE bytes of
+   the chunk are in BUF, and the first one is at the device offset
+   BUF_POS.  The matches ending, or beginning if the data is filtered,
+   in the bytes [BEGIN,END) of BUF are collected in MATCHES.  */
+
+struct ios_scan_slice
+{
+  const struct ios_ac *ac;
+  const uint8_t *buf;
+  size_t size;
+  ios_dev_off buf_pos;
+  size_t begin;
+  size_t end;
+
+  struct ios_scan_match *matches;
+  size_t nmatches;
+  size_t allocated;
+  int enomem_p;
+};
+
+static void
+ios_scan_add (struct ios_scan_slice *slice, size_t pattern, size_t pos)
+{
+  if (slice->nmatches == slice->allocated)
+    {
+      size_t allocated = slice->allocated ? slice->allocated * 2 : 64;
+      struct ios_scan_match *matches
+        = realloc (slice->matches,
+                   allocated * sizeof (struct ios_scan_match));
+
+      if (!matches)
+        {
+          slice->enomem_p = 1;
+          return;
+        }
+      slice->matches = matches;
+      slice->allocated = allocated;
+    }
+
+  slice->matches[slice->nmatches].pattern = pattern;
+  slice->matches[slice->nmatches].pos = slice->buf_pos + pos;
+  slice->nmatches++;
+}
+
+/* Run the automaton over the slice, starting early enough to find
+   the matches which end in it.  */
+
+static void
+ios_scan_run (struct ios_scan_slice *slice)
+{
+  const struct ios_ac *ac = slice->ac;
+  const int32_t *delta = ac->delta;
+  const uint16_t *classes = ac->classes;
+  const uint8_t *buf = slice->buf;
+  size_t overlap = ac->max_len - 1;
+  size_t i, s = 0;
+
+  for (i = slice->begin < overlap ? 0 : slice->begin - overlap;
+       i < slice->end;
+       ++i)
+    {
+      int32_t t = delta[s + classes[buf[i]]];
+
+      if (t >= 0)
+        {
+          s = t;
+          continue;
+        }
+
+      s = ~t;
+      if (i >= slice->begin && !slice->enomem_p)
+        {
+          ssize_t state = s / ac->nclasses, p;
+
+          if (ac->out[state] == -1)
+            state = ac->dict[state];
+          for (; state != -1; state = ac->dict[state])
+            for (p = ac->out[state]; p != -1; p = ac->next_out[p])
+              ios_scan_add (slice, p, i + 1 - ac->lens[p]);
+        }
+    }
+}
+
+/* Look for the positions of the slice which pass the filter, and
+   follow the trie from them.  */
+
+static void
+ios_scan_filter (struct ios_scan_slice *slice)
+{
+  const struct ios_ac *ac = slice->ac;
+  const int32_t *delta = ac->delta;
+  const uint16_t *classes = ac->classes;
+  const uint8_t *filter = ac->filter;
+  const uint8_t *buf = slice->buf;
+  size_t i, j;
+
+  for (i = slice->begin; i < slice->end; ++i)
+    {
+      size_t pair = buf[i] << 8 | (i + 1 < slice->size ? buf[i + 1] : 0);
+      size_t s = 0;
+
+      if (!(filter[pair / 8] & (1 << (pair % 8))))
+        continue;
+
+      for (j = i; j < slice->size; ++j)
+        {
+          int32_t t = delta[s + classes[buf[j]]];
+          ssize_t state, p;
+
+          s = t < 0 ? ~t : t;
+          state = s / ac->nclasses;
+          if (ac->depth[state] != j - i + 1)
+            break;
+          if (t < 0 && !slice->enomem_p)
+            for (p = ac->out[state]; p != -1; p = ac->next_out[p])
+              ios_scan_add (slice, p, i);
+        }
+    }
+}
+
+static void *
+ios_scan_worker (void *data)
+{
+  struct ios_scan_slice *slice = data;
+
+  if (slice->ac->filter)
+    ios_scan_filter (slice);
+  else
+    ios_scan_run (slice);
+  return NULL;
+}
+
+/* Return the number of workers to use.  */
+
+static size_t
+ios_scan_nworkers (void)
+{
+  long n = 1;
+
+#ifdef _SC_NPROCESSORS_ONLN
+  n = sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+  if (n < 1)
+    n = 1;
+  return n > IOS_SCAN_MAX_WORKERS ? IOS_SCAN_MAX_WORKERS : n;
+}
+
+int
+ios_scan (ios io, ios_off from, ios_off size,
+          const uint8_t *const *patterns, const size_t *lens,
+          size_t npatterns, ios_scan_fn cb, void *data)
+{
+  ios_off bias = ios_get_bias (io);
+  struct ios_scan_slice slices[IOS_SCAN_MAX_WORKERS];
+  pthread_t threads[IOS_SCAN_MAX_WORKERS];
+  int started[IOS_SCAN_MAX_WORKERS];
+  size_t nworkers, overlap, i, j;
+  ios_dev_off begin, end, chunk;
+  struct ios_ac ac;
+  uint8_t *buf;
+  int ret = IOS_OK, stop = 0;
+
+  if (!(ios_flags (io) & IOS_F_READ))
+    return IOS_EPERM;
+
+  if (npatterns == 0)
+    return IOS_EINVAL;
+  for (i = 0; i < npatterns; ++i)
+    if (lens[i] == 0)
+      return IOS_EINVAL;
+
+  /* The bytes to scan.  */
+  begin = from + bias <= 0 ? 0 : (from + bias + 7) / 8;
+  end = ios_size (io);
+  if (size > 0 && from + bias + size >= 0
+      && (uint64_t) (from + bias + size) / 8 < end)
+    end = (from + bias + size) / 8;
+  if (begin >= end)
+    return IOS_OK;
+
+  if (!ios_ac_compile (&ac, patterns, lens, npatterns))
+    return IOS_ENOMEM;
+  overlap = ac.max_len - 1;
+
+  nworkers = ios_scan_nworkers ();
+  buf = malloc (IOS_SCAN_SLICE * nworkers + 2 * overlap);
+  if (!buf)
+    {
+      ios_ac_free (&ac);
+      return IOS_ENOMEM;
+    }
+  memset (slices, 0, sizeof (slices));
+
+  for (chunk = begin; chunk < end && !stop; )
+    {
+      ios_dev_off chunk_end = chunk + IOS_SCAN_SLICE * nworkers;
+      ios_dev_off buf_pos, buf_end;
+      size_t nslices, slice_size;
+
+      if (chunk_end > end)
+        chunk_end = end;
+      buf_pos = chunk - begin < overlap ? begin : chunk - overlap;
+      buf_end = end - chunk_end < overlap ? end : chunk_end + overlap;
+
+      ret = ios_pread (io, IOS_F_BYPASS_CACHE, buf, buf_end - buf_pos,
+                       buf_pos);
+      if (ret != IOD_OK)
+        {
+          ret = IOD_ERROR_TO_IOS_ERROR (ret);
+          break;
+        }
+
+      /* Split the chunk in slices of at least IOS_SCAN_SLICE / 4
+         bytes, since smaller ones are not worth a thread.  */
+      nslices = (chunk_end - chunk + IOS_SCAN_SLICE / 4 - 1)
+                / (IOS_SCAN_SLICE / 4);
+      if (nslices > nworkers)
+        nslices = nworkers;
+      slice_size = (chunk_end - chunk + nslices - 1) / nslices;
+
+      for (j = 0; j < nslices; ++j)
+        {
+          struct ios_scan_slice *slice = &slices[j];
+
+          slice->ac = &ac;
+          slice->buf = buf;
+          slice->size = buf_end - buf_pos;
+          slice->buf_pos = buf_pos;
+          slice->begin = chunk - buf_pos + j * slice_size;
+          slice->end = slice->begin + slice_size;
+          if (slice->end > chunk_end - buf_pos)
+            slice->end = chunk_end - buf_pos;
+          slice->nmatches = 0;
+        }
+
+      /* The first slice is scanned by this thread.  */
+      for (j = 1; j < nslices; ++j)
+        started[j] = pthread_create (&threads[j], NULL, ios_scan_worker,
+                                     &slices[j]) == 0;
+      ios_scan_worker (&slices[0]);
+      for (j = 1; j < nslices; ++j)
+        {
+          if (started[j])
+            pthread_join (threads[j], NULL);
+          else
+            ios_scan_worker (&slices[j]);
+        }
+
+      /* Report the matches, in order.  */
+      for (j = 0; j < nslices && !stop; ++j)
+        {
+          struct ios_scan_slice *slice = &slices[j];
+
+          if (slice->enomem_p)
+            {
+              ret = IOS_ENOMEM;
+              stop = 1;
+              break;
+            }
+
+          for (i = 0; i < slice->nmatches; ++i)
+            if (cb (slice->matches[i].pattern,
+                    (ios_off) slice->matches[i].pos * 8 - bias, data))
+              {
+                stop = 1;
+                break;
+              }
+        }
+
+      chunk = chunk_end;
+    }
+
+  for (j = 0; j < nworkers; ++j)
+    free (slices[j].matches);
+  free (buf);
+  ios_ac_free (&ac);
+  return ret;
+}
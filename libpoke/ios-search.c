@@ -0,0 +1,278 @@
+/* ios-search.c - Searching for byte patterns in IO spaces.  */
+
+/* Copyright (C) 2026 Free Software Foundation, Inc. */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "ios.h"
+#include "ios-dev.h"
+
+/* The data of the IO space is searched in blocks of IOS_SEARCH_BLOCK
+   bytes.  Consecutive blocks overlap in the length of the pattern
+   minus one byte, so matches spanning two blocks are found.  */
+
+#define IOS_SEARCH_BLOCK (1024 * 1024)
+
+/* Patterns whose alignment is at least IOS_SEARCH_STRIDE bytes are
+   searched by checking every aligned position, instead of looking
+   for matches everywhere and discarding the unaligned ones.  */
+
+#define IOS_SEARCH_STRIDE 16
+
+/* A pattern to search for.
+
+   BYTES contains the LEN bytes of the pattern.  MASK, if not NULL,
+   contains a mask for each byte: only the bits set in the mask are
+   compared.  The bytes in BYTES are already masked.
+
+   ANCHOR is the index of a byte of the pattern whose mask has all
+   the bits set, which is looked for with memchr before checking the
+   rest of the pattern.  It is -1 if there is no such byte.
+
+   ZERO_P is true if the pattern matches a sequence of zeroes.  Holes
+   in the IO space can only be skipped if it doesn't.  */
+
+struct ios_pattern
+{
+  size_t len;
+  uint8_t *bytes;
+  const uint8_t *mask;
+  ssize_t anchor;
+  int zero_p;
+};
+
+static int
+ios_pattern_init (struct ios_pattern *pat, const uint8_t *bytes,
+                  const uint8_t *mask, size_t len)
+{
+  size_t i;
+
+  pat->len = len;
+  pat->bytes = malloc (len);
+  if (!pat->bytes)
+    return 0;
+
+  pat->mask = NULL;
+  pat->anchor = -1;
+  pat->zero_p = 1;
+
+  /* A mask with all the bits set is the same than no mask.  */
+  if (mask)
+    for (i = 0; i < len; ++i)
+      if (mask[i] != 0xff)
+        {
+          pat->mask = mask;
+          break;
+        }
+
+  for (i = 0; i < len; ++i)
+    {
+      pat->bytes[i] = pat->mask ? bytes[i] & pat->mask[i] : bytes[i];
+      if (pat->bytes[i] != 0)
+        pat->zero_p = 0;
+
+      /* Prefer anchors which are not 0x00 nor 0xff, since these are
+         the most common bytes in binary data.  */
+      if (pat->mask && pat->mask[i] == 0xff
+          && (pat->anchor == -1
+              || ((pat->bytes[pat->anchor] == 0x00
+                   || pat->bytes[pat->anchor] == 0xff)
+                  && pat->bytes[i] != 0x00 && pat->bytes[i] != 0xff)))
+        pat->anchor = i;
+    }
+
+  return 1;
+}
+
+static void
+ios_pattern_fini (struct ios_pattern *pat)
+{
+  free (pat->bytes);
+}
+
+/* Return whether PAT matches the bytes at P.  */
+
+static inline int
+ios_pattern_match_p (const struct ios_pattern *pat, const uint8_t *p)
+{
+  size_t i;
+
+  if (!pat->mask)
+    return memcmp (p, pat->bytes, pat->len) == 0;
+
+  for (i = 0; i < pat->len; ++i)
+    if ((p[i] & pat->mask[i]) != pat->bytes[i])
+      return 0;
+  return 1;
+}
+
+/* Return a pointer to the first match of PAT in the SIZE bytes at
+   BUF, or NULL if there is none.  */
+
+static const uint8_t *
+ios_pattern_find (const struct ios_pattern *pat, const uint8_t *buf,
+                  size_t size)
+{
+  const uint8_t *p, *end;
+
+  if (size < pat->len)
+    return NULL;
+
+  if (!pat->mask)
+    return memmem (buf, size, pat->bytes, pat->len);
+
+  end = buf + size - pat->len + 1;
+  if (pat->anchor == -1)
+    {
+      for (p = buf; p < end; ++p)
+        if (ios_pattern_match_p (pat, p))
+          return p;
+      return NULL;
+    }
+
+  for (p = buf; p < end; ++p)
+    {
+      p = memchr (p + pat->anchor, pat->bytes[pat->anchor],
+                  end - p);
+      if (p == NULL)
+        return NULL;
+      p -= pat->anchor;
+      if (ios_pattern_match_p (pat, p))
+        return p;
+    }
+
+  return NULL;
+}
+
+int
+ios_search_bytes (ios io, ios_off from, const uint8_t *bytes,
+                  const uint8_t *mask, size_t len, ios_off align,
+                  ios_match_fn cb, void *data)
+{
+  ios_off bias = ios_get_bias (io);
+  ios_off dev_from = from + bias;
+  uint64_t size = ios_size (io);
+  struct ios_pattern pat;
+  ios_dev_off pos;
+  size_t stride = 0;
+  uint8_t *buf;
+  int ret = IOS_OK;
+
+  if (!(ios_flags (io) & IOS_F_READ))
+    return IOS_EPERM;
+
+  if (len == 0 || align <= 0)
+    return IOS_EINVAL;
+
+  if (!ios_pattern_init (&pat, bytes, mask, len))
+    return IOS_ENOMEM;
+
+  buf = malloc (IOS_SEARCH_BLOCK + len - 1);
+  if (!buf)
+    {
+      ios_pattern_fini (&pat);
+      return IOS_ENOMEM;
+    }
+
+  /* Matches start at the first byte boundary at or after FROM.  */
+  pos = dev_from < 0 ? 0 : (dev_from + 7) / 8;
+
+  /* If the aligned positions are sparse enough, and all of them are
+     at byte boundaries, just check them.  */
+  if (align % 8 == 0 && bias % 8 == 0 && align / 8 >= IOS_SEARCH_STRIDE)
+    stride = align / 8;
+
+  while (pos < size && size - pos >= len)
+    {
+      size_t count, i;
+
+      /* Skip the holes, unless they can contain matches.  Matches
+         can begin at most LEN - 1 bytes before the data.  */
+      if (!pat.zero_p)
+        {
+          ios_dev_off begin, end;
+
+          ret = ios_seek_data (io, pos, &begin, &end);
+          if (ret == IOD_EOF)
+            {
+              ret = IOS_OK;
+              break;
+            }
+          if (ret != IOD_OK)
+            {
+              ret = IOD_ERROR_TO_IOS_ERROR (ret);
+              break;
+            }
+          if (begin >= size)
+            break;
+          if (begin - pos >= len)
+            {
+              pos = begin - len + 1;
+              continue;
+            }
+        }
+
+      count = IOS_SEARCH_BLOCK + len - 1;
+      if (count > size - pos)
+        count = size - pos;
+
+      ret = ios_pread (io, IOS_F_BYPASS_CACHE, buf, count, pos);
+      if (ret != IOD_OK)
+        {
+          ret = IOD_ERROR_TO_IOS_ERROR (ret);
+          break;
+        }
+
+      if (stride)
+        {
+          /* The first aligned position in the block.  */
+          ios_off first = (ios_off) pos * 8 - bias;
+
+          i = (first % align == 0
+               ? 0 : (align - first % align) / 8);
+          for (; i + len <= count; i += stride)
+            if (ios_pattern_match_p (&pat, buf + i)
+                && cb ((ios_off) (pos + i) * 8 - bias, data))
+              goto done;
+        }
+      else
+        {
+          const uint8_t *p = buf;
+
+          while ((p = ios_pattern_find (&pat, p, buf + count - p)))
+            {
+              ios_off offset = (ios_off) (pos + (p - buf)) * 8 - bias;
+
+              if (offset % align == 0 && cb (offset, data))
+                goto done;
+              p++;
+            }
+        }
+
+      /* Every position from which a match could start in this block
+         has been checked.  */
+      pos += count - len + 1;
+    }
+
+ done:
+  free (buf);
+  ios_pattern_fini (&pat);
+  return ret;
+}
@@ -0,0 +1,271 @@
+/* ios-strings.c - Finding strings in IO spaces.  */
+
+/* Copyright (C) 2026 Free Software Foundation, Inc. */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#include "count-trailing-zeros.h"
+
+#include "ios.h"
+#include "ios-dev.h"
+
+/* The data is read in blocks of IOS_STRINGS_BLOCK bytes, and
+   classified 64 bytes at a time into a bitmap with a bit set for
+   every byte which is part of a printable character.  The runs of
+   printable characters are then found by counting the bits set and
+   clear in the bitmap, so the bytes which are not part of strings are
+   skipped a word at a time.
+
+   Printable characters are the ASCII graphic characters, space and
+   tab.  In UTF-16 strings, they are the code units which encode
+   them.  */
+
+#define IOS_STRINGS_BLOCK (1024 * 1024)
+
+#if defined __SSE2__
+# include <emmintrin.h>
+#endif
+
+/* Return a bitmap with the bit I set if the byte P[I] is printable.
+   If ZEROS is not NULL, set *ZEROS to a bitmap with the bit I set if
+   the byte P[I] is zero.  P shall have room for 64 bytes.  */
+
+static uint64_t
+ios_strings_classify (const uint8_t *p, uint64_t *zeros)
+{
+  uint64_t printable = 0, zero = 0;
+  int i;
+
+#if defined __SSE2__
+  for (i = 0; i < 64; i += 16)
+    {
+      __m128i v = _mm_loadu_si128 ((const __m128i *) (p + i));
+      __m128i m
+        = _mm_or_si128 (_mm_and_si128 (_mm_cmpgt_epi8 (v,
+                                                       _mm_set1_epi8 (0x1f)),
+                                       _mm_cmplt_epi8 (v,
+                                                       _mm_set1_epi8 (0x7f))),
+                        _mm_cmpeq_epi8 (v, _mm_set1_epi8 ('\t')));
+
+      printable |= (uint64_t) (uint16_t) _mm_movemask_epi8 (m) << i;
+      if (zeros)
+        zero |= ((uint64_t) (uint16_t)
+                 _mm_movemask_epi8 (_mm_cmpeq_epi8 (v, _mm_setzero_si128 ()))
+                 << i);
+    }
+#else
+  for (i = 0; i < 64; ++i)
+    {
+      printable |= (uint64_t) ((p[i] >= 0x20 && p[i] <= 0x7e)
+                               || p[i] == '\t') << i;
+      zero |= (uint64_t) (p[i] == 0) << i;
+    }
+#endif
+
+  if (zeros)
+    *zeros = zero;
+  return printable;
+}
+
+/* The string being collected, if OPEN_P.  It begins at the byte
+   BEGIN of the range, and its LEN characters are in STR, which has
+   room for ALLOCATED characters.  */
+
+struct ios_strings_run
+{
+  int open_p;
+  uint64_t begin;
+  char *str;
+  size_t len;
+  size_t allocated;
+};
+
+/* Append to RUN the characters encoded by the COUNT bytes at P, using
+   ENCODING.  Return IOS_OK or IOS_ENOMEM.  */
+
+static int
+ios_strings_append (struct ios_strings_run *run, const uint8_t *p,
+                    size_t count, int encoding)
+{
+  size_t nchars = encoding == IOS_STRINGS_ASCII ? count : count / 2;
+  size_t i;
+
+  if (run->len + nchars + 1 > run->allocated)
+    {
+      size_t allocated = (run->len + nchars + 1) * 2;
+      char *str = realloc (run->str, allocated);
+
+      if (!str)
+        return IOS_ENOMEM;
+      run->str = str;
+      run->allocated = allocated;
+    }
+
+  if (encoding == IOS_STRINGS_ASCII)
+    memcpy (run->str + run->len, p, count);
+  else
+    {
+      p += encoding == IOS_STRINGS_UTF16BE;
+      for (i = 0; i < nchars; ++i)
+        run->str[run->len + i] = p[2 * i];
+    }
+
+  run->len += nchars;
+  return IOS_OK;
+}
+
+/* Close RUN, and report it if it is long enough.  Return non-zero if
+   the search shall stop.  */
+
+static int
+ios_strings_close (struct ios_strings_run *run, ios_off from,
+                   size_t min_len, ios_strings_fn cb, void *data)
+{
+  run->open_p = 0;
+  if (run->len < min_len)
+    return 0;
+
+  run->str[run->len] = '\0';
+  return cb (from + (ios_off) run->begin * 8, run->str, run->len, data);
+}
+
+int
+ios_strings (ios io, ios_off from, ios_off size, int encoding,
+             size_t min_len, ios_strings_fn cb, void *data)
+{
+  ios_off dev_from = from + ios_get_bias (io);
+  struct ios_strings_run run = { 0, 0, NULL, 0, 0 };
+  uint64_t end, pos, io_size;
+  uint8_t *buf;
+  int ret = IOS_OK, stop_p = 0, eof_p = 0;
+
+  if (!(ios_flags (io) & IOS_F_READ))
+    return IOS_EPERM;
+
+  if (dev_from < 0 || dev_from % 8 != 0 || size < 0 || min_len == 0
+      || (encoding != IOS_STRINGS_ASCII && encoding != IOS_STRINGS_UTF16LE
+          && encoding != IOS_STRINGS_UTF16BE))
+    return IOS_EINVAL;
+
+  /* The range extends up to the end of the space if SIZE is zero.
+     Streams are read until their end is found.  */
+  end = size == 0 ? UINT64_MAX : (uint64_t) size / 8;
+
+  buf = malloc (IOS_STRINGS_BLOCK + 64);
+  if (!buf)
+    return IOS_ENOMEM;
+
+  for (pos = 0; pos < end && !stop_p && !eof_p; pos += IOS_STRINGS_BLOCK)
+    {
+      size_t n = end - pos < IOS_STRINGS_BLOCK ? end - pos : IOS_STRINGS_BLOCK;
+      size_t w;
+
+      ret = ios_pread (io, IOS_F_BYPASS_CACHE, buf, n, dev_from / 8 + pos);
+      if (ret == IOD_EOF)
+        {
+          /* Read whatever is left before the end of the space.  */
+          eof_p = 1;
+          io_size = ios_size (io);
+          if (io_size <= (uint64_t) dev_from / 8 + pos)
+            {
+              ret = IOS_OK;
+              break;
+            }
+          if (io_size - dev_from / 8 - pos < n)
+            n = io_size - dev_from / 8 - pos;
+          ret = ios_pread (io, IOS_F_BYPASS_CACHE, buf, n,
+                           dev_from / 8 + pos);
+        }
+      if (ret != IOD_OK)
+        {
+          ret = IOD_ERROR_TO_IOS_ERROR (ret);
+          goto done;
+        }
+      if (n < IOS_STRINGS_BLOCK)
+        memset (buf + n, 0, 64);
+
+      for (w = 0; w < n && !stop_p; w += 64)
+        {
+          unsigned lim = n - w < 64 ? n - w : 64;
+          uint64_t valid, mask, zeros;
+          unsigned i = 0;
+
+          /* Units of UTF-16 strings are aligned to the beginning of
+             the range, and both of their bytes are flagged.  */
+          if (encoding == IOS_STRINGS_ASCII)
+            mask = ios_strings_classify (buf + w, NULL);
+          else
+            {
+              mask = ios_strings_classify (buf + w, &zeros);
+              if (encoding == IOS_STRINGS_UTF16LE)
+                mask &= zeros >> 1;
+              else
+                mask = (mask >> 1) & zeros;
+              mask &= 0x5555555555555555ULL;
+              mask |= mask << 1;
+              lim &= ~1U;
+            }
+
+          valid = lim == 64 ? ~0ULL : (1ULL << lim) - 1;
+          mask &= valid;
+
+          while (i < lim)
+            {
+              if (!run.open_p)
+                {
+                  uint64_t t = mask >> i;
+
+                  if (t == 0)
+                    break;
+                  i += count_trailing_zeros_ll (t);
+                  run.open_p = 1;
+                  run.begin = pos + w + i;
+                  run.len = 0;
+                }
+              else
+                {
+                  uint64_t t = (~mask & valid) >> i;
+                  unsigned k = t == 0 ? lim - i : count_trailing_zeros_ll (t);
+
+                  ret = ios_strings_append (&run, buf + w + i, k, encoding);
+                  if (ret != IOS_OK)
+                    goto done;
+                  i += k;
+                  if (t != 0
+                      && ios_strings_close (&run, from, min_len, cb, data))
+                    {
+                      stop_p = 1;
+                      break;
+                    }
+                }
+            }
+        }
+
+      /* A short read means that the end of the range was reached.  */
+      if (n < IOS_STRINGS_BLOCK)
+        break;
+    }
+
+  if (run.open_p && !stop_p)
+    ios_strings_close (&run, from, min_len, cb, data);
+
+ done:
+  free (run.str);
+  free (buf);
+  return ret;
+}
@@ -0,0 +1,313 @@
+/* ios-swap.c - Bulk conversion of integers for IO spaces.  */
+
+/* Copyright (C) 2026 Free Software Foundation, Inc. */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "ios.h"
+#include "ios-swap.h"
+
+/* All the kernels work the same way: the bytes of two integers are
+   permuted into a 16-byte vector, using a byte shuffle instruction
+   and a mask which depends on the width and the endianness of the
+   integers.  Bytes in the mask with the most significant bit set
+   produce zeroes.
+
+   When decoding, every vector contains two 64-bit integers, which
+   are taken from the first 2 * WIDTH bytes of a 16-byte load.  When
+   encoding, the 2 * WIDTH bytes of two integers are placed at the
+   beginning of the vector, which is stored in full.  The excess
+   bytes are overwritten by the next store.
+
+   Note that the layout of the 64-bit integers in the vectors assumes
+   a little-endian host.  */
+
+#if !defined WORDS_BIGENDIAN && defined __GNUC__ \
+  && (defined __x86_64__ || defined __i386__)
+# define IOS_SWAP_X86 1
+# include <immintrin.h>
+#elif !defined WORDS_BIGENDIAN && defined __aarch64__ \
+  && defined __ARM_NEON
+# define IOS_SWAP_NEON 1
+# include <arm_neon.h>
+#endif
+
+#if defined IOS_SWAP_X86 || defined IOS_SWAP_NEON
+
+/* A kernel converts a prefix of the COUNT integers in SRC into DST,
+   using the shuffle mask MASK, and returns the number of integers it
+   converted.  */
+
+typedef size_t (*ios_swap_fn) (void *dst, const void *src, size_t count,
+                               int width, const uint8_t *mask);
+
+/* Kernels in use.  NULL means that the host doesn't support any of
+   them, and that the callers shall convert the integers one by
+   one.  */
+
+static ios_swap_fn decode_kernel;
+static ios_swap_fn encode_kernel;
+
+/* Shuffle masks, indexed by endianness and width.  */
+
+static uint8_t decode_masks[2][9][16];
+static uint8_t encode_masks[2][9][16];
+
+static void
+init_masks (void)
+{
+  int endian, width, k;
+
+  for (endian = 0; endian < 2; ++endian)
+    for (width = 1; width <= 8; ++width)
+      for (k = 0; k < 16; ++k)
+        {
+          int elem, byte;
+
+          /* Byte K of the decoded vector is the byte of significance
+             K % 8 of the integer K / 8.  */
+          elem = k / 8;
+          byte = k % 8;
+          if (byte >= width)
+            decode_masks[endian][width][k] = 0x80;
+          else
+            decode_masks[endian][width][k]
+              = elem * width + (endian == IOS_ENDIAN_LSB
+                                ? byte : width - 1 - byte);
+
+          /* Byte K of the encoded vector is the byte K % WIDTH of the
+             integer K / WIDTH.  */
+          elem = k / width;
+          byte = k % width;
+          if (elem >= 2)
+            encode_masks[endian][width][k] = 0x80;
+          else
+            encode_masks[endian][width][k]
+              = elem * 8 + (endian == IOS_ENDIAN_LSB
+                            ? byte : width - 1 - byte);
+        }
+}
+
+#endif
+
+#ifdef IOS_SWAP_X86
+
+/* In both SSSE3 kernels, the condition on I * WIDTH + 16 ensures
+   that the loads, or the stores, don't go past the end of RAW.  */
+
+__attribute__ ((target ("ssse3")))
+static size_t
+decode_ssse3 (void *dst, const void *src, size_t count, int width,
+              const uint8_t *mask)
+{
+  uint64_t *values = dst;
+  const uint8_t *raw = src;
+  __m128i m = _mm_loadu_si128 ((const __m128i *) mask);
+  size_t i;
+
+  for (i = 0; i + 2 <= count && i * width + 16 <= count * width; i += 2)
+    {
+      __m128i v = _mm_loadu_si128 ((const __m128i *) (raw + i * width));
+      _mm_storeu_si128 ((__m128i *) (values + i), _mm_shuffle_epi8 (v, m));
+    }
+
+  return i;
+}
+
+__attribute__ ((target ("ssse3")))
+static size_t
+encode_ssse3 (void *dst, const void *src, size_t count, int width,
+              const uint8_t *mask)
+{
+  uint8_t *raw = dst;
+  const uint64_t *values = src;
+  __m128i m = _mm_loadu_si128 ((const __m128i *) mask);
+  size_t i;
+
+  for (i = 0; i + 2 <= count && i * width + 16 <= count * width; i += 2)
+    {
+      __m128i v = _mm_loadu_si128 ((const __m128i *) (values + i));
+      _mm_storeu_si128 ((__m128i *) (raw + i * width),
+                        _mm_shuffle_epi8 (v, m));
+    }
+
+  return i;
+}
+
+/* The AVX2 kernels handle four integers per iteration.  The byte
+   shuffle doesn't cross the 128-bit lanes, so every lane is loaded,
+   or stored, separately.  */
+
+__attribute__ ((target ("avx2")))
+static size_t
+decode_avx2 (void *dst, const void *src, size_t count, int width,
+             const uint8_t *mask)
+{
+  uint64_t *values = dst;
+  const uint8_t *raw = src;
+  __m256i m
+    = _mm256_broadcastsi128_si256 (_mm_loadu_si128 ((const __m128i *) mask));
+  size_t i;
+
+  for (i = 0;
+       i + 4 <= count && (i + 2) * width + 16 <= count * width;
+       i += 4)
+    {
+      __m128i lo = _mm_loadu_si128 ((const __m128i *) (raw + i * width));
+      __m128i hi
+        = _mm_loadu_si128 ((const __m128i *) (raw + (i + 2) * width));
+      __m256i v
+        = _mm256_inserti128_si256 (_mm256_castsi128_si256 (lo), hi, 1);
+
+      _mm256_storeu_si256 ((__m256i *) (values + i),
+                           _mm256_shuffle_epi8 (v, m));
+    }
+
+  return i + decode_ssse3 (values + i, raw + i * width, count - i,
+                           width, mask);
+}
+
+__attribute__ ((target ("avx2")))
+static size_t
+encode_avx2 (void *dst, const void *src, size_t count, int width,
+             const uint8_t *mask)
+{
+  uint8_t *raw = dst;
+  const uint64_t *values = src;
+  __m256i m
+    = _mm256_broadcastsi128_si256 (_mm_loadu_si128 ((const __m128i *) mask));
+  size_t i;
+
+  for (i = 0;
+       i + 4 <= count && (i + 2) * width + 16 <= count * width;
+       i += 4)
+    {
+      __m256i v = _mm256_shuffle_epi8 (_mm256_loadu_si256 ((const __m256i *)
+                                                           (values + i)),
+                                       m);
+
+      _mm_storeu_si128 ((__m128i *) (raw + i * width),
+                        _mm256_castsi256_si128 (v));
+      _mm_storeu_si128 ((__m128i *) (raw + (i + 2) * width),
+                        _mm256_extracti128_si256 (v, 1));
+    }
+
+  return i + encode_ssse3 (raw + i * width, values + i, count - i,
+                           width, mask);
+}
+
+#endif /* IOS_SWAP_X86 */
+
+#ifdef IOS_SWAP_NEON
+
+static size_t
+decode_neon (void *dst, const void *src, size_t count, int width,
+             const uint8_t *mask)
+{
+  uint64_t *values = dst;
+  const uint8_t *raw = src;
+  uint8x16_t m = vld1q_u8 (mask);
+  size_t i;
+
+  for (i = 0; i + 2 <= count && i * width + 16 <= count * width; i += 2)
+    {
+      uint8x16_t v = vld1q_u8 (raw + i * width);
+      vst1q_u8 ((uint8_t *) (values + i), vqtbl1q_u8 (v, m));
+    }
+
+  return i;
+}
+
+static size_t
+encode_neon (void *dst, const void *src, size_t count, int width,
+             const uint8_t *mask)
+{
+  uint8_t *raw = dst;
+  const uint64_t *values = src;
+  uint8x16_t m = vld1q_u8 (mask);
+  size_t i;
+
+  for (i = 0; i + 2 <= count && i * width + 16 <= count * width; i += 2)
+    {
+      uint8x16_t v = vld1q_u8 ((const uint8_t *) (values + i));
+      vst1q_u8 (raw + i * width, vqtbl1q_u8 (v, m));
+    }
+
+  return i;
+}
+
+#endif /* IOS_SWAP_NEON */
+
+static void
+ios_swap_select (void)
+{
+#if defined IOS_SWAP_X86
+  init_masks ();
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2"))
+    {
+      decode_kernel = decode_avx2;
+      encode_kernel = encode_avx2;
+    }
+  else if (__builtin_cpu_supports ("ssse3"))
+    {
+      decode_kernel = decode_ssse3;
+      encode_kernel = encode_ssse3;
+    }
+#elif defined IOS_SWAP_NEON
+  init_masks ();
+  decode_kernel = decode_neon;
+  encode_kernel = encode_neon;
+#endif
+}
+
+void
+ios_swap_init (void)
+{
+  static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+  pthread_once (&once, ios_swap_select);
+}
+
+size_t
+ios_swap_decode (uint64_t *values, const uint8_t *raw,
+                 size_t count, int width,
+                 enum ios_endian endian)
+{
+#if defined IOS_SWAP_X86 || defined IOS_SWAP_NEON
+  if (decode_kernel)
+    return decode_kernel (values, raw, count, width,
+                          decode_masks[endian][width]);
+#endif
+  return 0;
+}
+
+size_t
+ios_swap_encode (uint8_t *raw, const uint64_t *values,
+                 size_t count, int width,
+                 enum ios_endian endian)
+{
+#if defined IOS_SWAP_X86 || defined IOS_SWAP_NEON
+  if (encode_kernel)
+    return encode_kernel (raw, values, count, width,
+                          encode_masks[endian][width]);
+#endif
+  return 0;
+}
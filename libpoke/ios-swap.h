@@ -0,0 +1,57 @@
+/* ios-swap.h - Bulk conversion of integers for IO spaces.  */
+
+/* Copyright (C) 2026 Free Software Foundation, Inc. */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The functions below convert arrays of contiguous integers between
+   their representation in an IO space, which is WIDTH bytes per
+   integer in some byte endianness, and an array of 64-bit host
+   integers.  This involves swapping the bytes of every integer, if
+   the endianness is not the one of the host, and widening or
+   narrowing it to 64 bits.
+
+   The conversion is done using vector instructions, if the host
+   supports them.  The kernels to use are chosen at run-time by
+   ios_swap_init.
+
+   Both functions convert a prefix of the array and return the number
+   of integers they converted, which may be anything from zero to
+   COUNT.  It is up to the caller to convert the remaining integers
+   one by one.  */
+
+/* Select the best kernels supported by the host.  This function can
+   be called any number of times, from any thread.  */
+
+void ios_swap_init (void);
+
+/* Decode COUNT integers of WIDTH bytes, stored contiguously at RAW
+   with the ENDIAN byte endianness, into VALUES.
+
+   RAW may be located at the end of the buffer pointed by VALUES,
+   i.e. at VALUES + COUNT * 8 - COUNT * WIDTH bytes.  In that case
+   the integers are decoded in place.  */
+
+size_t ios_swap_decode (uint64_t *values, const uint8_t *raw,
+                        size_t count, int width,
+                        enum ios_endian endian);
+
+/* Encode the COUNT integers in VALUES into RAW, using WIDTH bytes per
+   integer and the ENDIAN byte endianness.  The buffers shall not
+   overlap.  */
+
+size_t ios_swap_encode (uint8_t *raw, const uint64_t *values,
+                        size_t count, int width,
+                        enum ios_endian endian);
@@ -0,0 +1,293 @@
+/* ios-wbuf.c - Write-combining buffers for IO spaces.  */
+
+/* Copyright (C) 2026 Free Software Foundation, Inc. */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ios.h"
+#include "ios-dev.h"
+#include "ios-wbuf.h"
+
+/* An extent of pending data.
+
+   OFFSET is the byte offset in the device of the first byte of the
+   extent, and COUNT the number of bytes in it.
+
+   DATA holds the pending bytes.  CAPACITY is the number of bytes
+   allocated for it, which may be bigger than COUNT.  */
+
+struct ios_wbuf_extent
+{
+  ios_dev_off offset;
+  size_t count;
+  size_t capacity;
+  uint8_t *data;
+};
+
+/* EXTENTS is an array of NEXTENTS extents, sorted by offset.  There
+   is room in it for ALLOCATED extents.  Extents never overlap nor are
+   adjacent to each other.
+
+   NBYTES is the total number of pending bytes.
+
+   MAX_BYTES and MAX_EXTENTS determine when the buffer is full.  */
+
+struct ios_wbuf
+{
+  struct ios_wbuf_extent *extents;
+  size_t nextents;
+  size_t allocated;
+  size_t nbytes;
+  size_t max_bytes;
+  size_t max_extents;
+};
+
+struct ios_wbuf *
+ios_wbuf_new (size_t max_bytes, size_t max_extents)
+{
+  struct ios_wbuf *wbuf = malloc (sizeof (struct ios_wbuf));
+
+  if (!wbuf)
+    return NULL;
+
+  wbuf->extents = NULL;
+  wbuf->nextents = 0;
+  wbuf->allocated = 0;
+  wbuf->nbytes = 0;
+  wbuf->max_bytes = max_bytes;
+  wbuf->max_extents = max_extents;
+  return wbuf;
+}
+
+void
+ios_wbuf_free (struct ios_wbuf *wbuf)
+{
+  size_t i;
+
+  for (i = 0; i < wbuf->nextents; ++i)
+    free (wbuf->extents[i].data);
+  free (wbuf->extents);
+  free (wbuf);
+}
+
+/* Return the index of the first extent in WBUF whose end is at or
+   past OFFSET, i.e. the first extent that may overlap with or be
+   adjacent to a range starting at OFFSET.  Return WBUF->nextents if
+   there is no such extent.  */
+
+static size_t
+ios_wbuf_search (struct ios_wbuf *wbuf, ios_dev_off offset)
+{
+  size_t lo = 0, hi = wbuf->nextents;
+
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      struct ios_wbuf_extent *e = &wbuf->extents[mid];
+
+      if (e->offset + e->count < offset)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  return lo;
+}
+
+int
+ios_wbuf_add (struct ios_wbuf *wbuf, const void *buf, size_t count,
+              ios_dev_off offset)
+{
+  size_t first, last, i;
+  ios_dev_off start, end;
+  struct ios_wbuf_extent *e;
+
+  if (count == 0)
+    return IOD_OK;
+
+  /* Find the range of extents [FIRST,LAST) that overlap with or are
+     adjacent to the new data.  */
+  first = ios_wbuf_search (wbuf, offset);
+  for (last = first;
+       last < wbuf->nextents && wbuf->extents[last].offset <= offset + count;
+       ++last)
+    ;
+
+  if (first == last)
+    {
+      /* The data doesn't touch any existing extent: insert a new
+         one.  */
+      if (wbuf->nextents == wbuf->allocated)
+        {
+          size_t allocated = wbuf->allocated ? wbuf->allocated * 2 : 16;
+          struct ios_wbuf_extent *extents
+            = realloc (wbuf->extents, allocated * sizeof (*extents));
+
+          if (!extents)
+            return IOD_ENOMEM;
+          wbuf->extents = extents;
+          wbuf->allocated = allocated;
+        }
+
+      e = &wbuf->extents[first];
+      memmove (e + 1, e, (wbuf->nextents - first) * sizeof (*e));
+      e->data = malloc (count);
+      if (!e->data)
+        {
+          memmove (e, e + 1, (wbuf->nextents - first) * sizeof (*e));
+          return IOD_ENOMEM;
+        }
+      memcpy (e->data, buf, count);
+      e->offset = offset;
+      e->count = count;
+      e->capacity = count;
+      wbuf->nextents++;
+      wbuf->nbytes += count;
+      return IOD_OK;
+    }
+
+  /* Merge the extents [FIRST,LAST) and the new data into the extent
+     FIRST.  */
+  e = &wbuf->extents[first];
+  start = offset < e->offset ? offset : e->offset;
+  end = wbuf->extents[last - 1].offset + wbuf->extents[last - 1].count;
+  if (offset + count > end)
+    end = offset + count;
+
+  if (start < e->offset || end - start > e->capacity)
+    {
+      size_t capacity = end - start;
+      uint8_t *data;
+
+      /* Leave some room for further appends, which are the most
+         common case when poking a sequence of values.  */
+      if (start == e->offset)
+        capacity += capacity / 2;
+
+      data = malloc (capacity);
+      if (!data)
+        return IOD_ENOMEM;
+      memcpy (data + (e->offset - start), e->data, e->count);
+      free (e->data);
+      e->data = data;
+      e->capacity = capacity;
+      wbuf->nbytes -= e->count;
+      e->count += e->offset - start;
+      wbuf->nbytes += e->count;
+      e->offset = start;
+    }
+
+  for (i = first + 1; i < last; ++i)
+    {
+      struct ios_wbuf_extent *o = &wbuf->extents[i];
+
+      memcpy (e->data + (o->offset - start), o->data, o->count);
+      wbuf->nbytes -= o->count;
+      free (o->data);
+    }
+
+  /* The new data goes last, since it is the most recent.  */
+  memcpy (e->data + (offset - start), buf, count);
+  wbuf->nbytes -= e->count;
+  e->count = end - start;
+  wbuf->nbytes += e->count;
+
+  memmove (e + 1, &wbuf->extents[last],
+           (wbuf->nextents - last) * sizeof (*e));
+  wbuf->nextents -= last - first - 1;
+  return IOD_OK;
+}
+
+int
+ios_wbuf_full_p (struct ios_wbuf *wbuf)
+{
+  return (wbuf->nbytes > wbuf->max_bytes
+          || wbuf->nextents > wbuf->max_extents);
+}
+
+int
+ios_wbuf_overlap_p (struct ios_wbuf *wbuf, size_t count,
+                    ios_dev_off offset)
+{
+  size_t i = ios_wbuf_search (wbuf, offset);
+
+  /* Note that the extent found may just be adjacent to the range.  */
+  for (; i < wbuf->nextents && wbuf->extents[i].offset < offset + count; ++i)
+    if (wbuf->extents[i].offset + wbuf->extents[i].count > offset)
+      return 1;
+
+  return 0;
+}
+
+ios_dev_off
+ios_wbuf_end (struct ios_wbuf *wbuf)
+{
+  struct ios_wbuf_extent *e;
+
+  if (wbuf->nextents == 0)
+    return 0;
+
+  e = &wbuf->extents[wbuf->nextents - 1];
+  return e->offset + e->count;
+}
+
+void
+ios_wbuf_overlay (struct ios_wbuf *wbuf, void *buf, size_t count,
+                  ios_dev_off offset)
+{
+  size_t i = ios_wbuf_search (wbuf, offset);
+
+  for (; i < wbuf->nextents && wbuf->extents[i].offset < offset + count; ++i)
+    {
+      struct ios_wbuf_extent *e = &wbuf->extents[i];
+      ios_dev_off start = e->offset > offset ? e->offset : offset;
+      ios_dev_off end = e->offset + e->count;
+
+      if (end > offset + count)
+        end = offset + count;
+      if (start < end)
+        memcpy ((uint8_t *) buf + (start - offset),
+                e->data + (start - e->offset), end - start);
+    }
+}
+
+int
+ios_wbuf_flush (struct ios_wbuf *wbuf, ios_wbuf_write_fn write,
+                void *data)
+{
+  size_t i;
+  int ret = IOD_OK;
+
+  for (i = 0; i < wbuf->nextents; ++i)
+    {
+      struct ios_wbuf_extent *e = &wbuf->extents[i];
+
+      ret = write (data, e->data, e->count, e->offset);
+      if (ret != IOD_OK)
+        break;
+      wbuf->nbytes -= e->count;
+      free (e->data);
+    }
+
+  /* Keep the extents that couldn't be written.  */
+  memmove (wbuf->extents, &wbuf->extents[i],
+           (wbuf->nextents - i) * sizeof (struct ios_wbuf_extent));
+  wbuf->nextents -= i;
+  return ret;
+}
@@ -0,0 +1,88 @@
+/* ios-wbuf.h - Write-combining buffers for IO spaces.  */
+
+/* Copyright (C) 2026 Free Software Foundation, Inc. */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* A write-combining buffer collects the data written to an IO space
+   instead of passing every single write down to the device.  Writes
+   to overlapping or adjacent byte ranges are merged together, so the
+   buffer holds a set of disjoint, non-adjacent "extents" of pending
+   data, sorted by offset.
+
+   The pending data is written out, in offset order and one device
+   write per extent, when the buffer is flushed.  It is up to the
+   user of the buffer to flush it when it gets full, or whenever the
+   device must see the written data.
+
+   Data read from the device must be patched with the pending data
+   using ios_wbuf_overlay.  */
+
+struct ios_wbuf;
+
+/* Function used to write out the pending data.  DATA is the closure
+   passed to ios_wbuf_flush.  Return an IOD_* status code.  */
+
+typedef int (*ios_wbuf_write_fn) (void *data, const void *buf, size_t count,
+                                  ios_dev_off offset);
+
+/* Create a new, empty, write-combining buffer.  The buffer is
+   considered to be full when it holds more than MAX_BYTES bytes of
+   pending data, or more than MAX_EXTENTS extents.
+
+   Return NULL if there is not enough memory.  */
+
+struct ios_wbuf *ios_wbuf_new (size_t max_bytes, size_t max_extents);
+
+/* Free all the resources used by WBUF.  Pending data is discarded:
+   call ios_wbuf_flush first if that is not desired.  */
+
+void ios_wbuf_free (struct ios_wbuf *wbuf);
+
+/* Record the writing of COUNT bytes from BUF at the byte OFFSET.
+   Return an IOD_* status code.  */
+
+int ios_wbuf_add (struct ios_wbuf *wbuf, const void *buf, size_t count,
+                  ios_dev_off offset);
+
+/* Return whether WBUF is full and should be flushed.  */
+
+int ios_wbuf_full_p (struct ios_wbuf *wbuf);
+
+/* Return whether WBUF holds pending data overlapping with the range
+   [OFFSET,OFFSET+COUNT).  */
+
+int ios_wbuf_overlap_p (struct ios_wbuf *wbuf, size_t count,
+                        ios_dev_off offset);
+
+/* Return the offset of the byte following the last pending byte in
+   WBUF, or 0 if there is no pending data.  */
+
+ios_dev_off ios_wbuf_end (struct ios_wbuf *wbuf);
+
+/* Copy the pending data in the range [OFFSET,OFFSET+COUNT) into the
+   corresponding positions of BUF.  */
+
+void ios_wbuf_overlay (struct ios_wbuf *wbuf, void *buf, size_t count,
+                       ios_dev_off offset);
+
+/* Write out all the pending data in WBUF, in ascending offset order,
+   calling WRITE once per extent.  The written extents are removed
+   from the buffer.  If WRITE fails then stop and return its status
+   code, keeping the extents not yet written.  Otherwise return
+   IOD_OK.  */
+
+int ios_wbuf_flush (struct ios_wbuf *wbuf, ios_wbuf_write_fn write,
+                    void *data);
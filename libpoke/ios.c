@@ -18,11 +18,16 @@
 
 #include <config.h>
 #include <gettext.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 #include <limits.h>
+#ifdef HAVE_SYS_SENDFILE_H
+# include <sys/sendfile.h>
+#endif
 #define _(str) gettext (str)
 #include <streq.h>
 
@@ -31,11 +36,14 @@
 #include "pk-utils.h"
 #include "ios.h"
 #include "ios-dev.h"
+#include "ios-cache.h"
+#include "ios-wbuf.h"
+#include "ios-swap.h"
 
-#define IOS_GET_C_ERR_CHCK(c, io, off)                                 \
+#define IOS_GET_C_ERR_CHCK(c, io, flags, off)                          \
   {                                                                    \
     uint8_t ch;                                                        \
-    int ret = (io)->dev_if->pread ((io)->dev, &ch, 1, off);            \
+    int ret = ios_pread ((io), (flags), &ch, 1, off);                  \
     if (ret != IOD_OK && ret != IOD_EOF)                               \
       return IOD_ERROR_TO_IOS_ERROR (ret);                             \
     /* If the pread reports an EOF, it means the partial byte */       \
@@ -46,13 +54,34 @@
     (c) = ret == IOD_EOF ? 0 : ch;                                     \
   }
 
-#define IOS_PUT_C_ERR_CHCK(c, io, len, off)                     \
+#define IOS_PUT_C_ERR_CHCK(c, io, flags, len, off)              \
   {                                                             \
-    int ret = (io)->dev_if->pwrite ((io)->dev, c, len, off);    \
+    int ret = ios_pwrite ((io), (flags), c, len, off);          \
     if (ret != IOD_OK)                                          \
       return IOD_ERROR_TO_IOS_ERROR (ret);                      \
   }
 
+/* The following struct holds the data read ahead from the device of
+   an uncached IO space.
+
+   BUF holds COUNT bytes of data read from the byte OFFSET of the
+   device.  It has room for IOS_READAHEAD_MAX bytes, or is NULL if it
+   hasn't been needed yet.
+
+   WINDOW is the number of bytes to read ahead next time, or zero if
+   the space is not being read sequentially.
+
+   NEXT is the offset of the byte following the last byte read.  */
+
+struct ios_readahead
+{
+  uint8_t *buf;
+  size_t count;
+  ios_dev_off offset;
+  size_t window;
+  ios_dev_off next;
+};
+
 /* The following struct implements an instance of an IO space.
 
    `ID' is an unique integer identifying the IO space.
@@ -62,6 +91,20 @@
    DEV is the device operated by the IO space.
    DEV_IF is the interface to use when operating the device.
 
+   CACHE is the page cache sitting between the IO space and the
+   device, or NULL if the space is not cached.
+
+   WBUF is the write-combining buffer collecting the data written to
+   the space, or NULL if writes go straight to the cache or the
+   device.
+
+   MEM is a pointer to memory holding the MEM_SIZE bytes of contents
+   of the device, for devices providing such a thing.  Uncached spaces
+   read and write it directly instead of calling the device.
+   MEM_WRITE_P tells whether MEM can be written to.
+
+   RA is the read-ahead window of uncached spaces.  See below.
+
    NEXT is a pointer to the next open IO space, or NULL.
 
    XXX: add status, saved or not saved.
@@ -74,26 +117,29 @@ struct ios
   void *dev;
   struct ios_dev_if *dev_if;
   ios_off bias;
+  struct ios_cache *cache;
+  struct ios_wbuf *wbuf;
+  uint8_t *mem;
+  ios_dev_off mem_size;
+  int mem_write_p;
+  struct ios_readahead ra;
 
   struct ios *next;
 };
 
-/* Next available IOS id.  */
-
-static int ios_next_id = 0;
-
-/* List of IO spaces, and pointer to the current one.  */
-
-static struct ios *io_list;
-static struct ios *cur_io;
-
 /* The available backends are implemented in their own files, and
    provide the following interfaces.  */
 
 extern struct ios_dev_if ios_dev_zero; /* ios-dev-zero.c */
 extern struct ios_dev_if ios_dev_mem; /* ios-dev-mem.c */
+extern size_t ios_dev_mem_usage (void *dev); /* Likewise.  */
 extern struct ios_dev_if ios_dev_file; /* ios-dev-file.c */
+#ifdef HAVE_MMAP
+extern struct ios_dev_if ios_dev_mmap; /* ios-dev-mmap.c */
+#endif
 extern struct ios_dev_if ios_dev_stream; /* ios-dev-stream.c */
+extern int ios_dev_stream_set_window (void *dev,
+                                      size_t window); /* Likewise.  */
 #ifdef HAVE_LIBNBD
 extern struct ios_dev_if ios_dev_nbd; /* ios-dev-nbd.c */
 #endif
@@ -101,6 +147,15 @@ extern struct ios_dev_if ios_dev_nbd; /* ios-dev-nbd.c */
 extern struct ios_dev_if ios_dev_proc; /* ios-dev-proc.c */
 #endif
 extern struct ios_dev_if ios_dev_sub; /* ios-dev-sub.c */
+extern void ios_dev_sub_base_closed (void *dev, ios base); /* Likewise.  */
+extern struct ios_dev_if ios_dev_overlay; /* ios-dev-overlay.c */
+extern void ios_dev_overlay_base_closed (void *dev,
+                                         ios base); /* Likewise.  */
+extern int ios_dev_overlay_commit (void *dev); /* Likewise.  */
+extern void ios_dev_overlay_discard (void *dev); /* Likewise.  */
+#if defined HAVE_ZLIB || defined HAVE_LIBLZMA || defined HAVE_LIBZSTD
+extern struct ios_dev_if ios_dev_zfile; /* ios-dev-zfile.c */
+#endif
 
 static struct ios_dev_if *ios_dev_ifs[] =
   {
@@ -115,30 +170,227 @@ static struct ios_dev_if *ios_dev_ifs[] =
    &ios_dev_proc,
 #endif
    &ios_dev_sub,
+   &ios_dev_overlay,
+#if defined HAVE_ZLIB || defined HAVE_LIBLZMA || defined HAVE_LIBZSTD
+   &ios_dev_zfile,
+#endif
+#ifdef HAVE_MMAP
+   &ios_dev_mmap,
+#endif
    /* File must be last */
    &ios_dev_file,
    NULL,
   };
 
-void
+#define IOS_NUM_DEV_IFS (sizeof (ios_dev_ifs) / sizeof (ios_dev_ifs[0]))
+
+/* The following struct implements an IO context, which holds a set
+   of open IO spaces.
+
+   NEXT_ID is the next available IOS id.
+
+   IO_LIST is the list of IO spaces, and CUR_IO a pointer to the
+   current one.
+
+   IOS_TABLE is a table of the IO spaces indexed by id, with room for
+   IOS_TABLE_SIZE entries.  Since ids are never reused, the entries of
+   closed spaces are just set to NULL.
+
+   DEV_IFS are the device interfaces to try when opening IO spaces, in
+   order.  The first entry is the foreign IO device, or NULL if none
+   has been registered.  */
+
+struct ios_context
+{
+  int next_id;
+  struct ios *io_list;
+  struct ios *cur_io;
+  struct ios **ios_table;
+  int ios_table_size;
+  struct ios_dev_if *dev_ifs[IOS_NUM_DEV_IFS];
+};
+
+/* Return whether the device operated by IO is worth caching.  Memory
+   based devices and mapped files gain nothing from it, streams do
+   their own buffering, sub-spaces go through the cache of their base
+   space, and the contents of process memory may change at any time.
+   NBD devices keep their own cache of blocks.  Foreign devices are
+   not cached either, since nothing is known about them.  */
+
+static int
+ios_dev_cacheable_p (ios io)
+{
+  if (!(io->dev_if->get_flags (io->dev) & IOS_F_READ))
+    return 0;
+
+  return io->dev_if == &ios_dev_file;
+}
+
+/* Fetch the memory view of the device operated by IO, if it provides
+   one.  This has to be done every time the device is written to,
+   since writes may move the memory around.  */
+
+static void
+ios_update_mem (ios io)
+{
+  io->mem = NULL;
+  io->mem_size = 0;
+  io->mem_write_p = 0;
+
+  if (io->dev_if->get_mem)
+    {
+      io->mem = io->dev_if->get_mem (io->dev, &io->mem_size);
+      io->mem_write_p
+        = (io->dev_if->get_flags (io->dev) & IOS_F_WRITE) != 0;
+    }
+}
+
+/* Return whether reads from the device operated by IO, when it is not
+   cached, benefit from reading ahead.  Process memory is not read
+   ahead for the same reason it is not cached.  */
+
+static int
+ios_dev_readahead_p (ios io)
+{
+  return io->dev_if == &ios_dev_file;
+}
+
+/* Read COUNT bytes at OFFSET from the device operated by the uncached
+   IO space IO, serving them from the read-ahead window if possible.
+   If the read follows the previous one, read ahead a window of data
+   starting at OFFSET.  */
+
+static int
+ios_readahead_pread (ios io, void *buf, size_t count, ios_dev_off offset)
+{
+  struct ios_readahead *ra = &io->ra;
+  ios_dev_off next = ra->next;
+  ios_dev_off dev_size;
+  size_t window;
+  int ret;
+
+  ra->next = offset + count;
+
+  if (ra->count > 0 && offset >= ra->offset
+      && count <= ra->count && offset - ra->offset <= ra->count - count)
+    {
+      memcpy (buf, ra->buf + (offset - ra->offset), count);
+      return IOD_OK;
+    }
+
+  /* Reads continuing the previous one, or starting inside the window,
+     are sequential.  Anything else discards the window.  */
+  if (count >= IOS_READAHEAD_MAX
+      || (offset != next
+          && !(ra->count > 0 && offset >= ra->offset
+               && offset - ra->offset <= ra->count)))
+    {
+      ra->count = 0;
+      ra->window = 0;
+      return io->dev_if->pread (io->dev, buf, count, offset);
+    }
+
+  ra->window = ra->window ? ra->window * 2 : IOS_READAHEAD_MIN;
+  if (ra->window > IOS_READAHEAD_MAX)
+    ra->window = IOS_READAHEAD_MAX;
+
+  window = ra->window < count ? count : ra->window;
+  dev_size = io->dev_if->size (io->dev);
+  if (offset < dev_size && dev_size - offset < window)
+    window = dev_size - offset;
+
+  ra->count = 0;
+  if (window <= count)
+    return io->dev_if->pread (io->dev, buf, count, offset);
+
+  if (!ra->buf)
+    {
+      ra->buf = malloc (IOS_READAHEAD_MAX);
+      if (!ra->buf)
+        return io->dev_if->pread (io->dev, buf, count, offset);
+    }
+
+  /* Parts of the window may not be readable.  Just read the
+     requested data in that case.  */
+  ret = io->dev_if->pread (io->dev, ra->buf, window, offset);
+  if (ret != IOD_OK)
+    {
+      ra->window = 0;
+      return io->dev_if->pread (io->dev, buf, count, offset);
+    }
+
+  ra->offset = offset;
+  ra->count = window;
+  memcpy (buf, ra->buf, count);
+  return IOD_OK;
+}
+
+/* Update the read-ahead window of IO after writing COUNT bytes from
+   BUF at OFFSET to its device.  */
+
+static void
+ios_readahead_update (ios io, const void *buf, size_t count,
+                      ios_dev_off offset)
+{
+  struct ios_readahead *ra = &io->ra;
+  ios_dev_off start, end;
+
+  if (ra->count == 0)
+    return;
+
+  start = offset > ra->offset ? offset : ra->offset;
+  end = offset + count;
+  if (end > ra->offset + ra->count)
+    end = ra->offset + ra->count;
+  if (start < end)
+    memcpy (ra->buf + (start - ra->offset),
+            (const uint8_t *) buf + (start - offset), end - start);
+}
+
+static int ios_pwrite_1 (ios io, int flags, const void *buf, size_t count,
+                         ios_dev_off offset);
+
+/* Write out data collected in the write buffer of the IO space DATA.
+   This is the callback passed to ios_wbuf_flush.  */
+
+static int
+ios_wbuf_write (void *data, const void *buf, size_t count,
+                ios_dev_off offset)
+{
+  return ios_pwrite_1 ((ios) data, 0, buf, count, offset);
+}
+
+ios_context
 ios_init (void)
 {
-  /* Nothing to do here... yet.  */
+  ios_context ios_ctx = calloc (1, sizeof (struct ios_context));
+
+  if (!ios_ctx)
+    return NULL;
+
+  memcpy (ios_ctx->dev_ifs, ios_dev_ifs, sizeof (ios_dev_ifs));
+  ios_swap_init ();
+  return ios_ctx;
 }
 
 void
-ios_shutdown (void)
+ios_shutdown (ios_context ios_ctx)
 {
   /* Close and free all open IO spaces.  */
-  while (io_list)
-    ios_close (io_list);
+  while (ios_ctx->io_list)
+    ios_close (ios_ctx, ios_ctx->io_list);
+
+  free (ios_ctx->ios_table);
+  free (ios_ctx);
 }
 
 int
-ios_open (const char *handler, uint64_t flags, int set_cur)
+ios_open (ios_context ios_ctx, const char *handler, uint64_t flags,
+          int set_cur)
 {
   struct ios *io;
   struct ios_dev_if **dev_if = NULL;
+  void *data;
   int iod_error = IOD_OK, error = IOS_ERROR;
 
   /* Allocate and initialize the new IO space.  */
@@ -149,10 +401,20 @@ ios_open (const char *handler, uint64_t flags, int set_cur)
   io->handler = NULL;
   io->next = NULL;
   io->bias = 0;
+  io->cache = NULL;
+  io->wbuf = NULL;
+  io->mem = NULL;
+  io->mem_size = 0;
+  io->mem_write_p = 0;
+  io->ra.buf = NULL;
+  io->ra.count = 0;
+  io->ra.offset = 0;
+  io->ra.window = 0;
+  io->ra.next = (ios_dev_off) -1;
 
   /* Look for a device interface suitable to operate on the given
      handler.  */
-  dev_if = ios_dev_ifs;
+  dev_if = ios_ctx->dev_ifs;
   do
     {
       if (*dev_if == NULL)
@@ -178,28 +440,69 @@ ios_open (const char *handler, uint64_t flags, int set_cur)
   io->dev_if = *dev_if;
 
   /* Do not re-open an already-open IO space.  */
-  for (ios i = io_list; i; i = i->next)
+  for (ios i = ios_ctx->io_list; i; i = i->next)
     if (STREQ (i->handler, io->handler))
       {
         error = IOS_EOPEN;
         goto error;
       }
 
-  /* Open the device using the interface found above.  */
-  io->dev = io->dev_if->open (handler, flags, &iod_error, io->dev_if->data);
+  /* Make room for the new space in the table.  */
+  if (ios_ctx->next_id >= ios_ctx->ios_table_size)
+    {
+      int size = ios_ctx->ios_table_size ? ios_ctx->ios_table_size * 2 : 16;
+      struct ios **table;
+
+      while (size <= ios_ctx->next_id)
+        size *= 2;
+      table = realloc (ios_ctx->ios_table, size * sizeof (struct ios *));
+      if (!table)
+        {
+          error = IOS_ENOMEM;
+          goto error;
+        }
+      memset (table + ios_ctx->ios_table_size, 0,
+              (size - ios_ctx->ios_table_size) * sizeof (struct ios *));
+      ios_ctx->ios_table = table;
+      ios_ctx->ios_table_size = size;
+    }
+
+  /* Open the device using the interface found above.  The foreign IO
+     device gets its own data.  The built-in devices get the context,
+     which the sub device uses to find its base space.  */
+  data = (io->dev_if == ios_ctx->dev_ifs[0]
+          ? io->dev_if->data : (void *) ios_ctx);
+  io->dev = io->dev_if->open (handler, flags, &iod_error, data);
   if (iod_error || io->dev == NULL)
     goto error;
 
+  /* Cache the space if the device benefits from it.  Failing to
+     allocate the cache is not fatal: the space just runs
+     uncached.  */
+  if (ios_dev_cacheable_p (io))
+    io->cache = ios_cache_new (io->dev_if, io->dev,
+                               IOS_CACHE_PAGE_SIZE,
+                               IOS_CACHE_DEFAULT_BUDGET,
+                               0 /* write_back */);
+  ios_update_mem (io);
+
+  /* Likewise, combine the writes to these devices, if they can be
+     written to.  */
+  if (ios_dev_cacheable_p (io)
+      && (io->dev_if->get_flags (io->dev) & IOS_F_WRITE))
+    io->wbuf = ios_wbuf_new (IOS_WBUF_MAX_BYTES, IOS_WBUF_MAX_EXTENTS);
+
   /* Increment the id counter after all possible errors are avoided.  */
-  io->id = ios_next_id++;
+  io->id = ios_ctx->next_id++;
+  ios_ctx->ios_table[io->id] = io;
 
   /* Add the newly created space to the list, and update the current
      space.  */
-  io->next = io_list;
-  io_list = io;
+  io->next = ios_ctx->io_list;
+  ios_ctx->io_list = io;
 
-  if (!cur_io || set_cur == 1)
-    cur_io = io;
+  if (!ios_ctx->cur_io || set_cur == 1)
+    ios_ctx->cur_io = io;
 
   return io->id;
 
@@ -215,32 +518,63 @@ ios_open (const char *handler, uint64_t flags, int set_cur)
 }
 
 int
-ios_close (ios io)
+ios_close (ios_context ios_ctx, ios io)
 {
   struct ios *tmp;
-  int ret;
+  int ret = IOD_OK, r;
 
   /* XXX: if not saved, ask before closing.  */
 
-  /* Close the device operated by the IO space.
-     XXX: Errors may be received from fclose.  What do we do in that case?  */
-  ret = io->dev_if->close (io->dev);
-
-  /* Unlink the IOS from the list.  */
-  assert (io_list != NULL); /* The list contains at least this IO space.  */
-  if (io_list == io)
-    io_list = io_list->next;
+  /* Write back any pending data and get rid of the write buffer and
+     the cache.  The first error found is reported.  */
+  if (io->wbuf)
+    {
+      ret = ios_wbuf_flush (io->wbuf, ios_wbuf_write, io);
+      ios_wbuf_free (io->wbuf);
+    }
+  if (io->cache)
+    {
+      r = ios_cache_flush (io->cache);
+      if (ret == IOD_OK)
+        ret = r;
+      ios_cache_free (io->cache);
+    }
+  free (io->ra.buf);
+
+  /* Sub-spaces and overlays of this space can no longer use it.  This
+     is done before closing the device, which may be a sub-space or an
+     overlay itself.  */
+  for (tmp = ios_ctx->io_list; tmp; tmp = tmp->next)
+    if (tmp == io)
+      continue;
+    else if (tmp->dev_if == &ios_dev_sub)
+      ios_dev_sub_base_closed (tmp->dev, io);
+    else if (tmp->dev_if == &ios_dev_overlay)
+      ios_dev_overlay_base_closed (tmp->dev, io);
+
+  /* Close the device operated by the IO space.  */
+  r = io->dev_if->close (io->dev);
+  if (ret == IOD_OK)
+    ret = r;
+
+  /* Unlink the IOS from the list and the table.  */
+  ios_ctx->ios_table[io->id] = NULL;
+  /* The list contains at least this IO space.  */
+  assert (ios_ctx->io_list != NULL);
+  if (ios_ctx->io_list == io)
+    ios_ctx->io_list = ios_ctx->io_list->next;
   else
     {
-      for (tmp = io_list; tmp->next != io; tmp = tmp->next)
+      for (tmp = ios_ctx->io_list; tmp->next != io; tmp = tmp->next)
         ;
       tmp->next = io->next;
     }
 
   /* Set the new current IO.  */
-  if (io == cur_io)
-    cur_io = io_list;
+  if (io == ios_ctx->cur_io)
+    ios_ctx->cur_io = ios_ctx->io_list;
 
+  free (io->handler);
   free (io);
 
   return IOD_ERROR_TO_IOS_ERROR (ret);
@@ -259,23 +593,23 @@ ios_handler (ios io)
 }
 
 ios
-ios_cur (void)
+ios_cur (ios_context ios_ctx)
 {
-  return cur_io;
+  return ios_ctx->cur_io;
 }
 
 void
-ios_set_cur (ios io)
+ios_set_cur (ios_context ios_ctx, ios io)
 {
-  cur_io = io;
+  ios_ctx->cur_io = io;
 }
 
 ios
-ios_search (const char *handler)
+ios_search (ios_context ios_ctx, const char *handler)
 {
   ios io;
 
-  for (io = io_list; io; io = io->next)
+  for (io = ios_ctx->io_list; io; io = io->next)
     if (STREQ (io->handler, handler))
       break;
 
@@ -283,15 +617,12 @@ ios_search (const char *handler)
 }
 
 ios
-ios_search_by_id (int id)
+ios_search_by_id (ios_context ios_ctx, int id)
 {
-  ios io;
+  if (id < 0 || id >= ios_ctx->ios_table_size)
+    return NULL;
 
-  for (io = io_list; io; io = io->next)
-    if (io->id == id)
-      break;
-
-  return io;
+  return ios_ctx->ios_table[id];
 }
 
 int
@@ -319,9 +650,9 @@ ios_set_bias (ios io, ios_off bias)
 }
 
 ios
-ios_begin (void)
+ios_begin (ios_context ios_ctx)
 {
-  return io_list;
+  return ios_ctx->io_list;
 }
 
 bool
@@ -337,12 +668,12 @@ ios_next (const ios io)
 }
 
 void
-ios_map (ios_map_fn cb, void *data)
+ios_map (ios_context ios_ctx, ios_map_fn cb, void *data)
 {
   ios io;
   ios io_next;
 
-  for (io = io_list; io; io = io_next)
+  for (io = ios_ctx->io_list; io; io = io_next)
     {
       /* Note that the handler may close IO.  */
       io_next = io->next;
@@ -350,512 +681,185 @@ ios_map (ios_map_fn cb, void *data)
     }
 }
 
-/* Set all except the lowest SIGNIFICANT_BITS of VALUE to zero.  */
-#define IOS_CHAR_GET_LSB(value, significant_bits)                \
-  (*(value) &= 0xFFU >> (CHAR_BIT - (significant_bits)))
-
-/* Set all except the highest SIGNIFICANT_BITS of the lowest
-   significant byte of VALUE to zero.  */
-#define IOS_CHAR_GET_MSB(value, significant_bits)                \
-  (*(value) &= 0xFFU << (CHAR_BIT - (significant_bits)))
+/* Decode an unsigned integer of WIDTH bytes stored at P using the
+   ENDIAN byte endianness.  WIDTH is expected to be a constant in the
+   callers, so the loop gets unrolled and, usually, replaced by a
+   single load.  */
 
-static inline int
-ios_read_int_common (ios io, ios_off offset, int flags,
-                     int bits,
-                     enum ios_endian endian,
-                     uint64_t *value)
+static inline uint64_t
+ios_decode_uint (const uint8_t *p, int width, enum ios_endian endian)
 {
-  int ret;
-
-  /* 64 bits might span at most 9 bytes.  */
-  uint8_t c[9] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
-
-  /* Number of signifcant bits in the first byte.  */
-  int firstbyte_bits = 8 - (offset % 8);
+  uint64_t value = 0;
+  int i;
 
-  /* (Total number of bytes that need to be read) - 1.  */
-  int bytes_minus1 = (bits - firstbyte_bits + 7) / 8;
-
-  /* Number of significant bits in the last byte.  */
-  int lastbyte_bits = (bits + (offset % 8)) % 8;
-  lastbyte_bits = lastbyte_bits == 0 ? 8 : lastbyte_bits;
+  if (endian == IOS_ENDIAN_LSB)
+    for (i = width - 1; i >= 0; --i)
+      value = (value << 8) | p[i];
+  else
+    for (i = 0; i < width; ++i)
+      value = (value << 8) | p[i];
 
-  /* Read the bytes and clear the unused bits.  */
-  ret = io->dev_if->pread (io->dev, c, bytes_minus1 + 1, offset / 8);
-  if (ret != IOD_OK)
-    return IOD_ERROR_TO_IOS_ERROR (ret);
+  return value;
+}
 
-  IOS_CHAR_GET_LSB(&c[0], firstbyte_bits);
+/* Encode VALUE in WIDTH bytes at P using the ENDIAN byte
+   endianness.  Like in ios_decode_uint, WIDTH is expected to be a
+   constant in the callers.  */
 
-  switch (bytes_minus1)
-  {
-  case 0:
-    *value = c[0] >> (8 - lastbyte_bits);
-    return IOS_OK;
+static inline void
+ios_encode_uint (uint8_t *p, int width, enum ios_endian endian,
+                 uint64_t value)
+{
+  int i;
 
-  case 1:
-    IOS_CHAR_GET_MSB(&c[1], lastbyte_bits);
-    if (endian == IOS_ENDIAN_LSB)
-      {
-        if (bits <= 8)
-          /* We need to shift to align the least significant bit.  */
-          *value = (c[0] << lastbyte_bits) | (c[1] >> (8 - lastbyte_bits));
-        else if ((offset % 8) == 0)
-          /* If little endian and the least significant byte is 8 bits aligned,
-          then we can handle the information byte by byte as we read.  */
-          *value = (c[1] << lastbyte_bits) | c[0];
-        else
-          {
-            /* Consider the order of bits in a little endian number:
-            7-6-5-4-3-2-1-0-15-14-13-12-11-10-9-8- ... If such an
-            encoding is not byte-aligned, we have to first shift to fill the
-            least significant byte to get the right bits in the same bytes.  */
-            uint64_t reg;
-            reg = (c[0] << (8 + offset % 8)) | (c[1] << offset % 8);
-            *value = ((reg & 0xff) << (bits % 8)) | (reg >> 8);
-          }
-      }
-    else
-      {
-        /* We should shift to fill the least significant byte
-        which is the last 8 bits.  */
-        *value = (c[0] << lastbyte_bits) | (c[1] >> (8 - lastbyte_bits));
-      }
-    return IOS_OK;
+  if (endian == IOS_ENDIAN_LSB)
+    for (i = 0; i < width; ++i, value >>= 8)
+      p[i] = value;
+  else
+    for (i = width - 1; i >= 0; --i, value >>= 8)
+      p[i] = value;
+}
 
-  case 2:
-    IOS_CHAR_GET_MSB(&c[2], lastbyte_bits);
-    if (endian == IOS_ENDIAN_LSB)
-      {
-        if ((offset % 8) == 0)
-          /* If little endian and the least significant byte is 8 bits aligned,
-          then we can handle the information byte by byte as we read.  */
-          *value = (c[2] << (8 + lastbyte_bits)) | (c[1] << 8) | c[0];
-        else
-          {
-            /* We have to shift to fill the least significant byte to get
-               the right bits in the same bytes.  */
-            uint64_t reg;
-            reg = ((uint64_t) c[0] << (56 + offset % 8))
-                  | ((uint64_t) c[1] << (48 + offset % 8))
-                  | ((uint64_t) c[2] << (40 + offset % 8));
-            /* The bits in the most-significant-byte-to-be is aligned to left,
-               shift it towards right! */
-            if (bits <= 16)
-              reg = ((reg & 0x00ff000000000000LL) >> (16 - bits))
-                    | (reg & 0xff00ffffffffffffLL);
-            else
-              reg = ((reg & 0x0000ff0000000000LL) >> (24 - bits))
-                    | (reg & 0xffff00ffffffffffLL);
-            /* Now we can place the bytes correctly.  */
-            *value = bswap_64(reg);
-          }
-      }
-    else
-      {
-        /* We should shift to fill the least significant byte
-        which is the last 8 bits.  */
-        *value = (c[0] << (8 + lastbyte_bits)) | (c[1] << lastbyte_bits)
-                 | (c[2] >> (8 - lastbyte_bits));
-      }
-    return IOS_OK;
+/* Likewise, for a WIDTH which is not a constant.  Each case is
+   compiled into a single load or store, plus a byte swap if the
+   endianness is not the one of the host.  */
 
-  case 3:
-    IOS_CHAR_GET_MSB(&c[3], lastbyte_bits);
-    if (endian == IOS_ENDIAN_LSB)
-      {
-        if ((offset % 8) == 0)
-          /* If little endian and the least significant byte is 8 bits aligned,
-          then we can handle the information byte by byte as we read.  */
-          *value = (c[3] << (16 + lastbyte_bits)) | (c[2] << 16) | (c[1] << 8)
-                   | c[0];
-        else
-          {
-            /* We have to shift to fill the least significant byte to get
-               the right bits in the same bytes.  */
-            uint64_t reg;
-            reg = ((uint64_t) c[0] << (56 + offset % 8))
-                  | ((uint64_t) c[1] << (48 + offset % 8))
-                  | ((uint64_t) c[2] << (40 + offset % 8))
-                  | ((uint64_t) c[3] << (32 + offset % 8));
-            /* The bits in the most-significant-byte-to-be is aligned to left,
-               shift it towards right! */
-            if (bits <= 24)
-              reg = ((reg & 0x0000ff0000000000LL) >> (24 - bits))
-                    | (reg & 0xffff00ffffffffffLL);
-            else
-              reg = ((reg & 0x000000ff00000000LL) >> (32 - bits))
-                    | (reg & 0xffffff00ffffffffLL);
-            /* Now we can place the bytes correctly.  */
-            *value = bswap_64(reg);
-          }
-      }
-    else
-      {
-        /* We should shift to fill the least significant byte
-        which is the last 8 bits.  */
-        *value = (c[0] << (16 + lastbyte_bits)) | (c[1] << (8 + lastbyte_bits))
-                 | (c[2] << lastbyte_bits) | (c[3] >> (8 - lastbyte_bits));
-      }
-    return IOS_OK;
+static inline uint64_t
+ios_decode_uint_n (const uint8_t *p, int width, enum ios_endian endian)
+{
+  switch (width)
+    {
+    case 1: return ios_decode_uint (p, 1, endian);
+    case 2: return ios_decode_uint (p, 2, endian);
+    case 3: return ios_decode_uint (p, 3, endian);
+    case 4: return ios_decode_uint (p, 4, endian);
+    case 5: return ios_decode_uint (p, 5, endian);
+    case 6: return ios_decode_uint (p, 6, endian);
+    case 7: return ios_decode_uint (p, 7, endian);
+    case 8: return ios_decode_uint (p, 8, endian);
+    default:
+      assert (0);
+      return 0;
+    }
+}
 
-  case 4:
-    IOS_CHAR_GET_MSB(&c[4], lastbyte_bits);
-    if (endian == IOS_ENDIAN_LSB)
-      {
-        if ((offset % 8) == 0)
-          /* If little endian and the least significant byte is 8 bits aligned,
-          then we can handle the information byte by byte as we read.  */
-          *value = ((uint64_t) c[4] << (24 + lastbyte_bits))
-                   | ((uint64_t) c[3] << 24) | (c[2] << 16)
-                   | (c[1] << 8) | c[0];
-        else
-          {
-            /* We have to shift to fill the least significant byte to get
-               the right bits in the same bytes.  */
-            uint64_t reg;
-            reg = ((uint64_t) c[0] << (56 + offset % 8))
-                  | ((uint64_t) c[1] << (48 + offset % 8))
-                  | ((uint64_t) c[2] << (40 + offset % 8))
-                  | ((uint64_t) c[3] << (32 + offset % 8))
-                  | ((uint64_t) c[4] << (24 + offset % 8));
-            /* The bits in the most-significant-byte-to-be is aligned to left,
-               shift it towards right! */
-            if (bits <= 32)
-              reg = ((reg & 0x000000ff00000000LL) >> (32 - bits))
-                    | (reg & 0xffffff00ffffffffLL);
-            else
-              reg = ((reg & 0x00000000ff000000LL) >> (40 - bits))
-                    | (reg & 0xffffffff00ffffffLL);
-            /* Now we can place the bytes correctly.  */
-            *value = bswap_64(reg);
-          }
-      }
-    else
-      {
-        /* We should shift to fill the least significant byte
-        which is the last 8 bits.  */
-        *value = ((uint64_t) c[0] << (24 + lastbyte_bits))
-                 | ((uint64_t) c[1] << (16 + lastbyte_bits))
-                 | (c[2] << (8 + lastbyte_bits)) | (c[3] << lastbyte_bits)
-                 | (c[4] >> (8 - lastbyte_bits));
-      }
-    return IOS_OK;
+static inline void
+ios_encode_uint_n (uint8_t *p, int width, enum ios_endian endian,
+                   uint64_t value)
+{
+  switch (width)
+    {
+    case 1: ios_encode_uint (p, 1, endian, value); break;
+    case 2: ios_encode_uint (p, 2, endian, value); break;
+    case 3: ios_encode_uint (p, 3, endian, value); break;
+    case 4: ios_encode_uint (p, 4, endian, value); break;
+    case 5: ios_encode_uint (p, 5, endian, value); break;
+    case 6: ios_encode_uint (p, 6, endian, value); break;
+    case 7: ios_encode_uint (p, 7, endian, value); break;
+    case 8: ios_encode_uint (p, 8, endian, value); break;
+    default:
+      assert (0);
+    }
+}
 
-  case 5:
-    IOS_CHAR_GET_MSB(&c[5], lastbyte_bits);
-    if (endian == IOS_ENDIAN_LSB)
-      {
-        if ((offset % 8) == 0)
-          /* If little endian and the least significant byte is 8 bits aligned,
-          then we can handle the information byte by byte as we read.  */
-          *value = ((uint64_t) c[5] << (32 + lastbyte_bits))
-                   | ((uint64_t) c[4] << 32) | ((uint64_t) c[3] << 24)
-                   | (c[2] << 16) | (c[1] << 8) | c[0];
-        else
-          {
-            /* We have to shift to fill the least significant byte to get
-               the right bits in the same bytes.  */
-            uint64_t reg;
-            reg = ((uint64_t) c[0] << (56 + offset % 8))
-                  | ((uint64_t) c[1] << (48 + offset % 8))
-                  | ((uint64_t) c[2] << (40 + offset % 8))
-                  | ((uint64_t) c[3] << (32 + offset % 8))
-                  | ((uint64_t) c[4] << (24 + offset % 8))
-                  | (c[5] << (16 + offset % 8));
-            /* The bits in the most-significant-byte-to-be is aligned to left,
-               shift it towards right! */
-            if (bits <= 40)
-              reg = ((reg & 0x00000000ff000000LL) >> (40 - bits))
-                    | (reg & 0xffffffff00ffffffLL);
-            else
-              reg = ((reg & 0x0000000000ff0000LL) >> (48 - bits))
-                    | (reg & 0xffffffffff00ffffLL);
-            /* Now we can place the bytes correctly.  */
-            *value = bswap_64(reg);
-          }
-      }
-    else
-      {
-        /* We should shift to fill the least significant byte
-        which is the last 8 bits.  */
-        *value = ((uint64_t) c[0] << (32 + lastbyte_bits))
-                 | ((uint64_t) c[1] << (24 + lastbyte_bits))
-                 | ((uint64_t) c[2] << (16 + lastbyte_bits))
-                 | (c[3] << (8 + lastbyte_bits))
-                 | (c[4] << lastbyte_bits) | (c[5] >> (8 - lastbyte_bits));
-      }
-    return IOS_OK;
+/* Integers in little endian whose width is not a multiple of 8 bits
+   are stored with their least significant bytes first, followed by
+   the remaining BITS % 8 most significant bits.  For example the
+   bits of a 12-bit integer are stored as 7-6-5-4-3-2-1-0-11-10-9-8.
 
-  case 6:
-    IOS_CHAR_GET_MSB(&c[6], lastbyte_bits);
-    if (endian == IOS_ENDIAN_LSB)
-      {
-        if ((offset % 8) == 0)
-          /* If little endian and the least significant byte is 8 bits aligned,
-          then we can handle the information byte by byte as we read.  */
-          *value = ((uint64_t) c[6] << (40 + lastbyte_bits))
-                   | ((uint64_t) c[5] << 40) | ((uint64_t) c[4] << 32)
-                   | ((uint64_t) c[3] << 24) | (c[2] << 16) | (c[1] << 8)
-                   | c[0];
-        else
-          {
-            /* We have to shift to fill the least significant byte to get
-               the right bits in the same bytes.  */
-            uint64_t reg;
-            reg = ((uint64_t) c[0] << (56 + offset % 8))
-                  | ((uint64_t) c[1] << (48 + offset % 8))
-                  | ((uint64_t) c[2] << (40 + offset % 8))
-                  | ((uint64_t) c[3] << (32 + offset % 8))
-                  | ((uint64_t) c[4] << (24 + offset % 8))
-                  | (c[5] << (16 + offset % 8))
-                  | (c[6] << (8 + offset % 8));
-            /* The bits in the most-significant-byte-to-be is aligned to left,
-               shift it towards right! */
-            if (bits <= 48)
-              reg = ((reg & 0x0000000000ff0000LL) >> (48 - bits))
-                    | (reg & 0xffffffffff00ffffLL);
-            else
-              reg = ((reg & 0x000000000000ff00LL) >> (56 - bits))
-                    | (reg & 0xffffffffffff00ffLL);
-            /* Now we can place the bytes correctly.  */
-            *value = bswap_64(reg);
-          }
-      }
-    else
-      {
-        /* We should shift to fill the least significant byte
-        which is the last 8 bits.  */
-        *value = ((uint64_t) c[0] << (40 + lastbyte_bits))
-                 | ((uint64_t) c[1] << (32 + lastbyte_bits))
-                 | ((uint64_t) c[2] << (24 + lastbyte_bits))
-                 | ((uint64_t) c[3] << (16 + lastbyte_bits))
-                 | (c[4] << (8 + lastbyte_bits)) | (c[5] << lastbyte_bits)
-                 | (c[6] >> (8 - lastbyte_bits));
-      }
-    return IOS_OK;
+   Convert the integer of BITS bits S, made of the bits in the order
+   in which they are stored, into its value.  */
 
-  case 7:
-    IOS_CHAR_GET_MSB(&c[7], lastbyte_bits);
-    if (endian == IOS_ENDIAN_LSB)
-      {
-        if ((offset % 8) == 0)
-          /* If little endian and the least significant byte is 8 bits aligned,
-          then we can handle the information byte by byte as we read.  */
-          *value = ((uint64_t) c[7] << (48 + lastbyte_bits))
-                   | ((uint64_t) c[6] << 48) | ((uint64_t) c[5] << 40)
-                   | ((uint64_t) c[4] << 32) | ((uint64_t) c[3] << 24)
-                   | (c[2] << 16) | (c[1] << 8) | c[0];
-        else
-          {
-            /* We have to shift to fill the least significant byte to get
-               the right bits in the same bytes.  */
-            uint64_t reg;
-            reg = ((uint64_t) c[0] << (56 + offset % 8))
-                  | ((uint64_t) c[1] << (48 + offset % 8))
-                  | ((uint64_t) c[2] << (40 + offset % 8))
-                  | ((uint64_t) c[3] << (32 + offset % 8))
-                  | ((uint64_t) c[4] << (24 + offset % 8))
-                  | (c[5] << (16 + offset % 8))
-                  | (c[6] << (8 + offset % 8)) | (c[7] << offset % 8);
-            /* The bits in the most-significant-byte-to-be is aligned to left,
-               shift it towards right! */
-            if (bits <= 56)
-              reg = ((reg & 0x000000000000ff00LL) >> (56 - bits))
-                    | (reg & 0xffffffffffff00ffLL);
-            else
-              reg = ((reg & 0x00000000000000ffLL) >> (64 - bits))
-                    | (reg & 0xffffffffffffff00LL);
-            /* Now we can place the bytes correctly.  */
-            *value = bswap_64(reg);
-          }
-      }
-    else
-      {
-        /* We should shift to fill the least significant byte
-        which is the last 8 bits.  */
-        *value = ((uint64_t) c[0] << (48 + lastbyte_bits))
-                 | ((uint64_t) c[1] << (40 + lastbyte_bits))
-                 | ((uint64_t) c[2] << (32 + lastbyte_bits))
-                 | ((uint64_t) c[3] << (24 + lastbyte_bits))
-                 | ((uint64_t) c[4] << (16 + lastbyte_bits))
-                 | (c[5] << (8 + lastbyte_bits))
-                 | (c[6] << lastbyte_bits) | (c[7] >> (8 - lastbyte_bits));
-      }
-    return IOS_OK;
+static inline uint64_t
+ios_lsb_to_value (uint64_t s, int bits)
+{
+  int nbytes = bits / 8;
+  int rest = bits % 8;
+  uint64_t value;
 
-  case 8:
-    IOS_CHAR_GET_MSB(&c[8], lastbyte_bits);
-    if (endian == IOS_ENDIAN_LSB)
-      {
-        /* We have to shift to fill the least significant byte to get
-           the right bits in the same bytes.  */
-        uint64_t reg;
-        reg = ((uint64_t) c[0] << (56 + offset % 8))
-              | ((uint64_t) c[1] << (48 + offset % 8))
-              | ((uint64_t) c[2] << (40 + offset % 8))
-              | ((uint64_t) c[3] << (32 + offset % 8))
-              | ((uint64_t) c[4] << (24 + offset % 8))
-              | (c[5] << (16 + offset % 8))
-              | (c[6] << (8 + offset % 8)) | (c[7] << offset % 8)
-              | (c[8] >> firstbyte_bits);
-        /* The bits in the most-significant-byte-to-be is aligned to left,
-           shift it towards right! */
-        reg = ((reg & 0x00000000000000ffLL) >> (64 - bits))
-              | (reg & 0xffffffffffffff00LL);
-        /* Now we can place the bytes correctly.  */
-        *value = bswap_64(reg);
-      }
-    else
-      {
-        /* We should shift to fill the least significant byte
-        which is the last 8 bits.  */
-        *value = ((uint64_t) c[0] << (56 + lastbyte_bits))
-                 | ((uint64_t) c[1] << (48 + lastbyte_bits))
-                 | ((uint64_t) c[2] << (40 + lastbyte_bits))
-                 | ((uint64_t) c[3] << (32 + lastbyte_bits))
-                 | ((uint64_t) c[4] << (24 + lastbyte_bits))
-                 | ((uint64_t) c[5] << (16 + lastbyte_bits))
-                 | (c[6] << (8 + lastbyte_bits)) | (c[7] << lastbyte_bits)
-                 | (c[8] >> (8 - lastbyte_bits));
-      }
-    return IOS_OK;
+  if (bits <= 8)
+    return s;
 
-  default:
-    assert (0);
-  }
+  value = bswap_64 (s >> rest) >> (64 - nbytes * 8);
+  if (rest)
+    value |= (s & ((1U << rest) - 1)) << (nbytes * 8);
+  return value;
 }
 
-int
-ios_read_int (ios io, ios_off offset, int flags,
-              int bits,
-              enum ios_endian endian,
-              enum ios_nenc nenc,
-              int64_t *value)
+/* And the other way around.  */
+
+static inline uint64_t
+ios_value_to_lsb (uint64_t value, int bits)
 {
-  /* The IOS should be readable.  */
-  if (!(io->dev_if->get_flags (io->dev) & IOS_F_READ))
-    return IOS_EPERM;
+  int nbytes = bits / 8;
+  int rest = bits % 8;
+  uint64_t s;
 
-  /* Apply the IOS bias.  */
-  offset += ios_get_bias (io);
+  if (bits <= 8)
+    return value;
 
-  /* Fast track for byte-aligned 8x bits  */
-  if (offset % 8 == 0 && bits % 8 == 0)
-    {
-      int ret;
-      uint8_t c[8];
+  s = bswap_64 (value << (64 - nbytes * 8)) << rest;
+  if (rest)
+    s |= (value >> (nbytes * 8)) & ((1U << rest) - 1);
+  return s;
+}
 
-      ret = io->dev_if->pread (io->dev, c, bits / 8, offset / 8);
-      if (ret != IOD_OK)
-        return IOD_ERROR_TO_IOS_ERROR (ret);
+/* Read an integer of BITS bits at the bit-offset OFFSET, which is
+   neither aligned to a byte boundary or has a width which is a
+   multiple of 8 bits.  The bias of the IO space is already applied
+   to OFFSET.  */
 
-      switch (bits) {
-      case 8:
-        {
-          *value = (int8_t) c[0];
-          return IOS_OK;
-        }
+static inline int
+ios_read_int_common (ios io, ios_off offset, int flags,
+                     int bits,
+                     enum ios_endian endian,
+                     uint64_t *value)
+{
+  /* 64 bits might span at most 9 bytes.  */
+  uint8_t c[9] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
 
-      case 16:
-        {
-          if (endian == IOS_ENDIAN_LSB)
-            *value = (int16_t) (c[1] << 8) | c[0];
-          else
-            *value = (int16_t) (c[0] << 8) | c[1];
-          return IOS_OK;
-        }
+  /* Number of bits preceding the integer in the first byte.  */
+  int shift = offset % 8;
 
-      case 24:
-        {
-          if (endian == IOS_ENDIAN_LSB)
-            *value = (c[2] << 16) | (c[1] << 8) | c[0];
-          else
-            *value = (c[0] << 16) | (c[1] << 8) | c[2];
-          *value <<= 40;
-          *value >>= 40;
-          return IOS_OK;
-        }
+  /* Number of bytes that need to be read.  */
+  int nbytes = (shift + bits + 7) / 8;
 
-      case 32:
-        {
-          if (endian == IOS_ENDIAN_LSB)
-            *value = (int32_t) (c[3] << 24) | (c[2] << 16) | (c[1] << 8) | c[0];
-          else
-            *value = (int32_t) (c[0] << 24) | (c[1] << 16) | (c[2] << 8) | c[3];
-          return IOS_OK;
-        }
+  uint64_t s;
+  int ret;
 
-      case 40:
-        {
-          if (endian == IOS_ENDIAN_LSB)
-            *value = ((uint64_t) c[4] << 32) | ((uint64_t) c[3] << 24)
-                     | (c[2] << 16) | (c[1] << 8) | c[0];
-          else
-            *value = ((uint64_t) c[0] << 32) | ((uint64_t) c[1] << 24)
-                     | (c[2] << 16) | (c[3] << 8) | c[4];
-          *value <<= 24;
-          *value >>= 24;
-          return IOS_OK;
-        }
+  ret = ios_pread (io, flags, c, nbytes, offset / 8);
+  if (ret != IOD_OK)
+    return IOD_ERROR_TO_IOS_ERROR (ret);
 
-      case 48:
-        {
-          if (endian == IOS_ENDIAN_LSB)
-            *value = ((uint64_t) c[5] << 40) | ((uint64_t) c[4] << 32)
-                     | ((uint64_t) c[3] << 24) | (c[2] << 16)
-                     | (c[1] << 8) | c[0];
-          else
-            *value = ((uint64_t) c[0] << 40) | ((uint64_t) c[1] << 32)
-                     | ((uint64_t) c[2] << 24) | (c[3] << 16)
-                     | (c[4] << 8) | c[5];
-          *value <<= 16;
-          *value >>= 16;
-          return IOS_OK;
-        }
+  /* The first eight bytes, read as a big endian word, contain the
+     integer after SHIFT bits.  Only when the integer spills into the
+     ninth byte are its last bits there.  */
+  s = (ios_decode_uint (c, 8, IOS_ENDIAN_MSB) << shift) >> (64 - bits);
+  if (shift + bits > 64)
+    s |= c[8] >> (72 - shift - bits);
 
-      case 56:
-        {
-          if (endian == IOS_ENDIAN_LSB)
-            *value = ((uint64_t) c[6] << 48) | ((uint64_t) c[5] << 40)
-                     | ((uint64_t) c[4] << 32) | ((uint64_t) c[3] << 24)
-                     | (c[2] << 16) | (c[1] << 8) | c[0];
-          else
-            *value = ((uint64_t) c[0] << 48) | ((uint64_t) c[1] << 40)
-                     | ((uint64_t) c[2] << 32) | ((uint64_t) c[3] << 24)
-                     | (c[4] << 16) | (c[5] << 8) | c[6];
-          *value <<= 8;
-          *value >>= 8;
-          return IOS_OK;
-        }
+  *value = endian == IOS_ENDIAN_LSB ? ios_lsb_to_value (s, bits) : s;
+  return IOS_OK;
+}
 
-      case 64:
-        {
-          if (endian == IOS_ENDIAN_LSB)
-            *value = ((uint64_t) c[7] << 56) | ((uint64_t) c[6] << 48)
-                     | ((uint64_t) c[5] << 40) | ((uint64_t) c[4] << 32)
-                     | ((uint64_t) c[3] << 24) | (c[2] << 16) | (c[1] << 8)
-                     | c[0];
-          else
-            *value = ((uint64_t) c[0] << 56) | ((uint64_t) c[1] << 48)
-                     | ((uint64_t) c[2] << 40) | ((uint64_t) c[3] << 32)
-                     | ((uint64_t) c[4] << 24) | (c[5] << 16) | (c[6] << 8)
-                     | c[7];
-          return IOS_OK;
-        }
-      }
-    }
+int
+ios_read_int (ios io, ios_off offset, int flags,
+              int bits,
+              enum ios_endian endian,
+              enum ios_nenc nenc,
+              int64_t *value)
+{
+  int ret = ios_read_uint (io, offset, flags, bits, endian,
+                           (uint64_t *) value);
 
-  /* Fall into the case for the unaligned and the sizes other than 8x.  */
-  int ret_val = ios_read_int_common (io, offset, flags, bits, endian,
-                                     (uint64_t *) value);
-  if (ret_val == IOS_OK)
+  if (ret == IOS_OK)
     {
+      /* Sign-extend the integer.  */
       *value <<= 64 - bits;
       *value >>= 64 - bits;
-      return IOS_OK;
     }
-  return ret_val;
+
+  return ret;
 }
 
 int
@@ -877,327 +881,250 @@ ios_read_uint (ios io, ios_off offset, int flags,
       int ret;
       uint8_t c[8];
 
-      ret = io->dev_if->pread (io->dev, c, bits / 8, offset / 8);
+      ret = ios_pread (io, flags, c, bits / 8, offset / 8);
       if (ret != IOD_OK)
         return IOD_ERROR_TO_IOS_ERROR (ret);
 
-      switch (bits) {
-      case 8:
-        *value = c[0];
-        return IOS_OK;
-
-      case 16:
-        if (endian == IOS_ENDIAN_LSB)
-          *value = (c[1] << 8) | c[0];
-        else
-          *value = (c[0] << 8) | c[1];
-        return IOS_OK;
-
-      case 24:
-        if (endian == IOS_ENDIAN_LSB)
-          *value = (c[2] << 16) | (c[1] << 8) | c[0];
-        else
-          *value = (c[0] << 16) | (c[1] << 8) | c[2];
-        return IOS_OK;
-
-      case 32:
-        if (endian == IOS_ENDIAN_LSB)
-          *value = ((uint64_t) c[3] << 24) | (c[2] << 16) | (c[1] << 8) | c[0];
-        else
-          *value = ((uint64_t) c[0] << 24) | (c[1] << 16) | (c[2] << 8) | c[3];
-        return IOS_OK;
-
-      case 40:
-        if (endian == IOS_ENDIAN_LSB)
-          *value = ((uint64_t) c[4] << 32) | ((uint64_t) c[3] << 24)
-                   | (c[2] << 16) | (c[1] << 8) | c[0];
-        else
-          *value = ((uint64_t) c[0] << 32) | ((uint64_t) c[1] << 24)
-                   | (c[2] << 16) | (c[3] << 8) | c[4];
-        return IOS_OK;
-
-      case 48:
-        if (endian == IOS_ENDIAN_LSB)
-          *value = ((uint64_t) c[5] << 40) | ((uint64_t) c[4] << 32)
-                   | ((uint64_t) c[3] << 24) | (c[2] << 16)
-                   | (c[1] << 8) | c[0];
-        else
-          *value = ((uint64_t) c[0] << 40) | ((uint64_t) c[1] << 32)
-                   | ((uint64_t) c[2] << 24) | (c[3] << 16)
-                   | (c[4] << 8) | c[5];
-        return IOS_OK;
-
-      case 56:
-        if (endian == IOS_ENDIAN_LSB)
-          *value = ((uint64_t) c[6] << 48) | ((uint64_t) c[5] << 40)
-                   | ((uint64_t) c[4] << 32) | ((uint64_t) c[3] << 24)
-                   | (c[2] << 16) | (c[1] << 8) | c[0];
-        else
-          *value = ((uint64_t) c[0] << 48) | ((uint64_t) c[1] << 40)
-                   | ((uint64_t) c[2] << 32) | ((uint64_t) c[3] << 24)
-                   | (c[4] << 16) | (c[5] << 8) | c[6];
-        return IOS_OK;
-
-      case 64:
-        if (endian == IOS_ENDIAN_LSB)
-          *value = ((uint64_t) c[7] << 56) | ((uint64_t) c[6] << 48)
-                   | ((uint64_t) c[5] << 40) | ((uint64_t) c[4] << 32)
-                   | ((uint64_t) c[3] << 24) | (c[2] << 16) | (c[1] << 8)
-                   | c[0];
-        else
-          *value = ((uint64_t) c[0] << 56) | ((uint64_t) c[1] << 48)
-                   | ((uint64_t) c[2] << 40) | ((uint64_t) c[3] << 32)
-                   | ((uint64_t) c[4] << 24) | (c[5] << 16) | (c[6] << 8)
-                   | c[7];
-        return IOS_OK;
-      }
+      *value = ios_decode_uint_n (c, bits / 8, endian);
+      return IOS_OK;
     }
 
   /* Fall into the case for the unaligned and the sizes other than 8x.  */
   return ios_read_int_common (io, offset, flags, bits, endian, value);
 }
 
-static int realloc_string (char **str, size_t newsize)
-{
-  char *newstr = realloc (*str, newsize);
-
-  if (!newstr)
-    return IOS_ENOMEM;
+/* Decode the integers not handled by ios_swap_decode, starting at
+   the index I.  */
 
-  *str = newstr;
-  return IOS_OK;
-}
+#define IOS_DECODE_UINTS(WIDTH)                                         \
+  do                                                                    \
+    {                                                                   \
+      for (; i < count; ++i)                                            \
+        values[i] = ios_decode_uint (raw + i * (WIDTH), (WIDTH), endian); \
+    }                                                                   \
+  while (0)
 
 int
-ios_read_string (ios io, ios_off offset, int flags, char **value)
+ios_read_uint_array (ios io, ios_off offset, int flags,
+                     int bits,
+                     enum ios_endian endian,
+                     uint64_t count,
+                     uint64_t *values)
 {
-  char *str = NULL;
-  size_t i = 0;
+  ios_off boffset = offset + ios_get_bias (io);
+  uint64_t i;
   int ret;
 
   /* The IOS should be readable.  */
   if (!(io->dev_if->get_flags (io->dev) & IOS_F_READ))
     return IOS_EPERM;
 
-  /* Apply the IOS bias.  */
-  offset += ios_get_bias (io);
+  if (count == 0)
+    return IOS_OK;
 
-  if (offset % 8 == 0)
+  /* Fast track for byte-aligned 8x bits.  All the integers are read
+     with a single device operation, into the tail of VALUES.  Each
+     integer occupies at most as many bytes in the device as in
+     VALUES, so decoding them in order never overwrites bytes not yet
+     decoded.  The vector kernels in ios-swap.c decode as many
+     integers as they can, and the rest are decoded one by one.  */
+  if (boffset % 8 == 0 && bits % 8 == 0)
     {
-      /* This is the fast case: the string is aligned to a byte
-         boundary.  We just read bytes from the IOD until either EOF
-         or a NULL byte.  */
+      size_t width = bits / 8;
+      size_t nbytes = count * width;
+      uint8_t *raw = (uint8_t *) values + count * sizeof (uint64_t) - nbytes;
 
-      do
-        {
-          if (i % 128 == 0)
-            {
-              if ((ret = realloc_string (&str, i + 128 * sizeof (char))) < 0)
-                goto error;
-            }
+      ret = ios_pread (io, flags, raw, nbytes, boffset / 8);
+      if (ret != IOD_OK)
+        return IOD_ERROR_TO_IOS_ERROR (ret);
 
-          ret = io->dev_if->pread (io->dev, &str[i], 1,  offset / 8 + i);
-          if (ret != IOD_OK)
-            return IOD_ERROR_TO_IOS_ERROR (ret);
+      i = ios_swap_decode (values, raw, count, width, endian);
+      switch (width)
+        {
+        case 1: IOS_DECODE_UINTS (1); break;
+        case 2: IOS_DECODE_UINTS (2); break;
+        case 3: IOS_DECODE_UINTS (3); break;
+        case 4: IOS_DECODE_UINTS (4); break;
+        case 5: IOS_DECODE_UINTS (5); break;
+        case 6: IOS_DECODE_UINTS (6); break;
+        case 7: IOS_DECODE_UINTS (7); break;
+        case 8: IOS_DECODE_UINTS (8); break;
+        default:
+          assert (0);
         }
-      while (str[i++] != '\0');
+
+      return IOS_OK;
     }
-  else
+
+  /* Otherwise read the integers one by one.  */
+  for (i = 0; i < count; ++i)
     {
-      /* The string is not aligned to a byte boundary.  Instead of
-         reading bytes from the IOD, we use the IOS to read 8-byte
-         unsigned integers.  */
+      ret = ios_read_uint (io, offset + i * bits, flags, bits, endian,
+                           &values[i]);
+      if (ret != IOS_OK)
+        return ret;
+    }
 
-      do
-        {
-          uint64_t abyte;
+  return IOS_OK;
+}
 
-          if (i % 128 == 0)
-            {
-              if ((ret = realloc_string (&str, i + 128 * sizeof (char))) < 0)
-                goto error;
-            }
+#undef IOS_DECODE_UINTS
 
-          ret = ios_read_uint (io, offset, flags, 8,
-                               IOS_ENDIAN_MSB, /* Arbitrary.  */
-                               &abyte);
-          if (ret != IOS_OK)
-            goto error;
+int
+ios_read_int_array (ios io, ios_off offset, int flags,
+                    int bits,
+                    enum ios_endian endian,
+                    enum ios_nenc nenc,
+                    uint64_t count,
+                    int64_t *values)
+{
+  uint64_t i;
+  int ret;
 
-          str[i] = (char) abyte;
-          offset += 8;
-        }
-      while (str[i++] != '\0');
+  ret = ios_read_uint_array (io, offset, flags, bits, endian, count,
+                             (uint64_t *) values);
+  if (ret != IOS_OK)
+    return ret;
+
+  /* Sign-extend the integers.  */
+  for (i = 0; i < count; ++i)
+    {
+      values[i] <<= 64 - bits;
+      values[i] >>= 64 - bits;
     }
 
-  *value = str;
   return IOS_OK;
+}
 
-error:
-  free (str);
-  return ret;
+static int realloc_string (char **str, size_t newsize)
+{
+  char *newstr = realloc (*str, newsize);
+
+  if (!newstr)
+    return IOS_ENOMEM;
+
+  *str = newstr;
+  return IOS_OK;
 }
 
-static inline int
-ios_write_int_fast (ios io, ios_off offset, int flags,
-                    int bits,
-                    enum ios_endian endian,
-                    uint64_t value)
+/* Strings are read from the IO devices in blocks of
+   IOS_STRING_BLOCK bytes.  Blocks are aligned to their size, so they
+   don't cross page boundaries and the terminator of a string stored
+   right before some unreadable memory can still be found.  */
+
+#define IOS_STRING_BLOCK 256
+
+int
+ios_read_string (ios io, ios_off offset, int flags, char **value)
 {
+  uint8_t block[IOS_STRING_BLOCK + 1];
+  char *str = NULL;
+  size_t len = 0, allocated = 0;
+  ios_dev_off pos, size;
+  int shift, extra;
   int ret;
-  uint8_t c[8];
 
-  switch (bits)
-    {
-    case 8:
-      c[0] = value;
-      break;
+  /* The IOS should be readable.  */
+  if (!(io->dev_if->get_flags (io->dev) & IOS_F_READ))
+    return IOS_EPERM;
 
-    case 16:
-      if (endian == IOS_ENDIAN_LSB)
-        {
-          c[0] = value;
-          c[1] = value >> 8;
-        }
-      else
-        {
-          c[0] = value >> 8;
-          c[1] = value;
-        }
-      break;
+  /* Apply the IOS bias.  */
+  offset += ios_get_bias (io);
 
-    case 24:
-      if (endian == IOS_ENDIAN_LSB)
-        {
-          c[0] = value;
-          c[1] = value >> 8;
-          c[2] = value >> 16;
-        }
-      else
-        {
-          c[0] = value >> 16;
-          c[1] = value >> 8;
-          c[2] = value;
-        }
-      break;
+  /* If the string is not aligned to a byte boundary every character
+     is made of the last bits of a byte and the first bits of the
+     next one, so one more byte is needed for the last character of
+     each block.  */
+  pos = offset / 8;
+  shift = offset % 8;
+  extra = (shift != 0);
+  size = ios_size (io);
 
-    case 32:
-      if (endian == IOS_ENDIAN_LSB)
-        {
-          c[0] = value;
-          c[1] = value >> 8;
-          c[2] = value >> 16;
-          c[3] = value >> 24;
-        }
-      else
+  while (1)
+    {
+      ios_dev_off end;
+      size_t nbytes, nchars;
+      uint8_t *nul;
+
+      end = ((pos + extra) / IOS_STRING_BLOCK + 1) * IOS_STRING_BLOCK;
+
+      /* Don't read past the end of the IOS, which would fail for
+         strings stored close to it, or wait for data that may never
+         come in streams.  Past the end, characters are read one by
+         one, leaving it to the device to tell whether there is
+         more data.  */
+      if (pos + extra >= size)
+        end = pos + 1 + extra;
+      else if (end > size)
+        end = size;
+
+      nbytes = end - pos;
+      nchars = nbytes - extra;
+      ret = ios_pread (io, flags, block, nbytes, pos);
+      if (ret != IOD_OK)
         {
-          c[0] = value >> 24;
-          c[1] = value >> 16;
-          c[2] = value >> 8;
-          c[3] = value;
+          ret = IOD_ERROR_TO_IOS_ERROR (ret);
+          goto error;
         }
-      break;
 
-    case 40:
-      if (endian == IOS_ENDIAN_LSB)
-        {
-          c[0] = value;
-          c[1] = value >> 8;
-          c[2] = value >> 16;
-          c[3] = value >> 24;
-          c[4] = value >> 32;
-        }
-      else
+      if (shift)
         {
-          c[0] = value >> 32;
-          c[1] = value >> 24;
-          c[2] = value >> 16;
-          c[3] = value >> 8;
-          c[4] = value;
-        }
-      break;
+          size_t i;
 
-    case 48:
-      if (endian == IOS_ENDIAN_LSB)
-        {
-          c[0] = value;
-          c[1] = value >> 8;
-          c[2] = value >> 16;
-          c[3] = value >> 24;
-          c[4] = value >> 32;
-          c[5] = value >> 40;
-        }
-      else
-        {
-          c[0] = value >> 40;
-          c[1] = value >> 32;
-          c[2] = value >> 24;
-          c[3] = value >> 16;
-          c[4] = value >> 8;
-          c[5] = value;
+          for (i = 0; i < nchars; ++i)
+            block[i] = (block[i] << shift) | (block[i + 1] >> (8 - shift));
         }
-      break;
 
-    case 56:
-      if (endian == IOS_ENDIAN_LSB)
-        {
-          c[0] = value;
-          c[1] = value >> 8;
-          c[2] = value >> 16;
-          c[3] = value >> 24;
-          c[4] = value >> 32;
-          c[5] = value >> 40;
-          c[6] = value >> 48;
-        }
-      else
-        {
-          c[0] = value >> 48;
-          c[1] = value >> 40;
-          c[2] = value >> 32;
-          c[3] = value >> 24;
-          c[4] = value >> 16;
-          c[5] = value >> 8;
-          c[6] = value;
-        }
-      break;
+      nul = memchr (block, '\0', nchars);
+      if (nul)
+        nchars = nul - block + 1;
 
-    case 64:
-      if (endian == IOS_ENDIAN_LSB)
+      if (len + nchars > allocated)
         {
-          c[0] = value;
-          c[1] = value >> 8;
-          c[2] = value >> 16;
-          c[3] = value >> 24;
-          c[4] = value >> 32;
-          c[5] = value >> 40;
-          c[6] = value >> 48;
-          c[7] = value >> 56;
-        }
-      else
-        {
-          c[0] = value >> 56;
-          c[1] = value >> 48;
-          c[2] = value >> 40;
-          c[3] = value >> 32;
-          c[4] = value >> 24;
-          c[5] = value >> 16;
-          c[6] = value >> 8;
-          c[7] = value;
+          allocated = allocated ? allocated * 2 : 128;
+          while (allocated < len + nchars)
+            allocated *= 2;
+          if ((ret = realloc_string (&str, allocated)) < 0)
+            goto error;
         }
-      break;
+      memcpy (str + len, block, nchars);
+      len += nchars;
+      pos += nchars;
 
-    default:
-      assert (0);
-      break;
+      if (nul)
+        break;
     }
 
-  ret = io->dev_if->pwrite (io->dev, c, bits / 8, offset / 8);
+  *value = str;
+  return IOS_OK;
+
+error:
+  free (str);
+  return ret;
+}
+
+static inline int
+ios_write_int_fast (ios io, ios_off offset, int flags,
+                    int bits,
+                    enum ios_endian endian,
+                    uint64_t value)
+{
+  int ret;
+  uint8_t c[8];
+
+  ios_encode_uint_n (c, bits / 8, endian, value);
+  ret = ios_pwrite (io, flags, c, bits / 8, offset / 8);
   if (ret != IOD_OK)
     return IOD_ERROR_TO_IOS_ERROR (ret);
 
   return IOS_OK;
 }
 
+/* Write an integer of BITS bits at the bit-offset OFFSET, which is
+   neither aligned to a byte boundary or has a width which is a
+   multiple of 8 bits.  The bias of the IO space is already applied
+   to OFFSET.  */
+
 static inline int
 ios_write_int_common (ios io, ios_off offset, int flags,
                       int bits,
@@ -1207,302 +1134,44 @@ ios_write_int_common (ios io, ios_off offset, int flags,
   /* 64 bits might span at most 9 bytes.  */
   uint8_t c[9] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
 
-  /* Number of signifcant bits in the first byte.  */
-  int firstbyte_bits = 8 - (offset % 8);
+  /* Number of bits preceding the integer in the first byte.  */
+  int shift = offset % 8;
 
-  /* (Total number of bytes that need to be read) - 1.  */
-  int bytes_minus1 = (bits - firstbyte_bits + 7) / 8;
+  /* Number of bytes that need to be written.  */
+  int nbytes = (shift + bits + 7) / 8;
 
-  /* Number of significant bits in the last byte.  */
-  int lastbyte_bits = (bits + (offset % 8)) % 8;
-  lastbyte_bits = lastbyte_bits == 0 ? 8 : lastbyte_bits;
+  /* Number of bits following the integer in the last byte.  */
+  int tail = nbytes * 8 - shift - bits;
 
-  /* The IOS should be readable to get the completing byte.  */
+  uint64_t mask, word;
+
+  /* The IOS should be readable to get the completing bits.  */
   if (!(io->dev_if->get_flags (io->dev) & IOS_F_READ))
     return IOS_EPERM;
 
-  switch (bytes_minus1)
-  {
-  case 0:
-    {
-      /* We are altering only a single byte.  */
-      uint64_t head, tail;
-      IOS_GET_C_ERR_CHCK(head, io, offset / 8);
-      tail = head;
-      IOS_CHAR_GET_MSB(&head, offset % 8);
-      IOS_CHAR_GET_LSB(&tail, 8 - lastbyte_bits);
-
-      /* Write the byte back without changing the surrounding bits.  */
-      c[0] = head | tail | (value << (8 - lastbyte_bits));
-      IOS_PUT_C_ERR_CHCK(c, io, 1, offset / 8);
-      return IOS_OK;
-    }
-
-  case 1:
-    /* Correctly set the unmodified leading bits of the first byte.  */
-    IOS_GET_C_ERR_CHCK(c[0], io, offset / 8);
-    IOS_CHAR_GET_MSB(&c[0], offset % 8);
-    /* Correctly set the unmodified trailing bits of the last byte.  */
-    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, offset / 8 + 1);
-    IOS_CHAR_GET_LSB(&c[bytes_minus1], 8 - lastbyte_bits);
-
-    if (endian == IOS_ENDIAN_LSB && bits > 8)
-      {
-        /* Convert to the little endian format. For example a 12-bit-long
-           number's bits get reordered as 7-6-5-4-3-2-1-0-11-10-9-8
-           with leading 0s.  */
-        value = ((value & 0xff) << (bits % 8))
-                | (value & 0xff00) >> 8;
-      }
-    c[0] |= value >> lastbyte_bits;
-    c[1] |= (value << (8 - lastbyte_bits)) & 0xff;
-    IOS_PUT_C_ERR_CHCK(c, io, 2, offset / 8);
-    return IOS_OK;
-
-  case 2:
-    /* Correctly set the unmodified leading bits of the first byte.  */
-    IOS_GET_C_ERR_CHCK(c[0], io, offset / 8);
-    IOS_CHAR_GET_MSB(&c[0], offset % 8);
-    /* Correctly set the unmodified trailing bits of the last byte.  */
-    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, offset / 8 + bytes_minus1);
-    IOS_CHAR_GET_LSB(&c[bytes_minus1], 8 - lastbyte_bits);
-
-    if (endian == IOS_ENDIAN_LSB)
-    {
-      /* Convert to the little endian format. For example a 12-bit-long
-         number's bits get reordered as 7-6-5-4-3-2-1-0-11-10-9-8
-         with leading 0s.  */
-      if (bits <= 16)
-        value = ((value & 0xff) << (bits % 8))
-                | (value & 0xff00) >> 8;
-      else
-        value = ((value & 0xff) << (8 + bits % 8))
-                | (value & 0xff00) >> (8 - bits % 8)
-                | (value & 0xff0000) >> 16;
-    }
-    c[0] |= value >> (8 + lastbyte_bits);
-    c[1] = (value >> lastbyte_bits) & 0xff;
-    c[2] |= (value << (8 - lastbyte_bits)) & 0xff;
-    IOS_PUT_C_ERR_CHCK(c, io, 3, offset / 8);
-    return IOS_OK;
-
-  case 3:
-    /* Correctly set the unmodified leading bits of the first byte.  */
-    IOS_GET_C_ERR_CHCK(c[0], io, offset / 8);
-    IOS_CHAR_GET_MSB(&c[0], offset % 8);
-    /* Correctly set the unmodified trailing bits of the last byte.  */
-    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, offset / 8 + bytes_minus1);
-    IOS_CHAR_GET_LSB(&c[bytes_minus1], 8 - lastbyte_bits);
-
-    if (endian == IOS_ENDIAN_LSB)
-    {
-      /* Convert to the little endian format. For example a 12-bit-long
-         number's bits get reordered as 7-6-5-4-3-2-1-0-11-10-9-8
-         with leading 0s.  */
-      if (bits <= 24)
-        value = ((value & 0xff) << (8 + bits % 8))
-                | (value & 0xff00) >> (8 - bits % 8)
-                | (value & 0xff0000) >> 16;
-      else
-        value = ((value & 0xff) << (16 + bits % 8))
-                | (value & 0xff00) << (bits % 8)
-                | (value & 0xff0000) >> (16 - bits % 8)
-                | (value & 0xff000000) >> 24;
-    }
-    c[0] |= value >> (16 + lastbyte_bits);
-    c[1] = (value >> (8 + lastbyte_bits)) & 0xff;
-    c[2] = (value >> lastbyte_bits) & 0xff;
-    c[3] |= (value << (8 - lastbyte_bits)) & 0xff;
-    IOS_PUT_C_ERR_CHCK(c, io, 4, offset / 8);
-    return IOS_OK;
-
-  case 4:
-    /* Correctly set the unmodified leading bits of the first byte.  */
-    IOS_GET_C_ERR_CHCK(c[0], io, offset / 8);
-    IOS_CHAR_GET_MSB(&c[0], offset % 8);
-    /* Correctly set the unmodified trailing bits of the last byte.  */
-    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, offset / 8 + bytes_minus1);
-    IOS_CHAR_GET_LSB(&c[bytes_minus1], 8 - lastbyte_bits);
-
-    if (endian == IOS_ENDIAN_LSB)
-    {
-      /* Convert to the little endian format. For example a 12-bit-long
-         number's bits get reordered as 7-6-5-4-3-2-1-0-11-10-9-8
-         with leading 0s.  */
-      if (bits <= 32)
-        value = ((value & 0xff) << (16 + bits % 8))
-                | (value & 0xff00) << (bits % 8)
-                | (value & 0xff0000) >> (16 - bits % 8)
-                | (value & 0xff000000) >> 24;
-      else
-        value = ((value & 0xff) << (24 + bits % 8))
-                | (value & 0xff00) << (8 + bits % 8)
-                | (value & 0xff0000) >> (8 - bits % 8)
-                | (value & 0xff000000) >> (24 - bits % 8)
-                | (value & 0xff00000000) >> 32;
-    }
-    c[0] |= value >> (24 + lastbyte_bits);
-    c[1] = (value >> (16 + lastbyte_bits)) & 0xff;
-    c[2] = (value >> (8 + lastbyte_bits)) & 0xff;
-    c[3] = (value >> lastbyte_bits) & 0xff;
-    c[4] |= (value << (8 - lastbyte_bits)) & 0xff;
-    IOS_PUT_C_ERR_CHCK(c, io, 5, offset / 8);
-    return IOS_OK;
-
-  case 5:
-    /* Correctly set the unmodified leading bits of the first byte.  */
-    IOS_GET_C_ERR_CHCK(c[0], io, offset / 8);
-    IOS_CHAR_GET_MSB(&c[0], offset % 8);
-    /* Correctly set the unmodified trailing bits of the last byte.  */
-    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, offset / 8 + bytes_minus1);
-    IOS_CHAR_GET_LSB(&c[bytes_minus1], 8 - lastbyte_bits);
-
-    if (endian == IOS_ENDIAN_LSB)
-    {
-      /* Convert to the little endian format. For example a 12-bit-long
-         number's bits get reordered as 7-6-5-4-3-2-1-0-11-10-9-8
-         with leading 0s.  */
-      if (bits <= 40)
-        value = ((value & 0xff) << (24 + bits % 8))
-                | (value & 0xff00) << (8 + bits % 8)
-                | (value & 0xff0000) >> (8 - bits % 8)
-                | (value & 0xff000000) >> (24 - bits % 8)
-                | (value & 0xff00000000) >> 32;
-      else
-        value = ((value & 0xff) << (32 + bits % 8))
-                | (value & 0xff00) << (16 + bits % 8)
-                | (value & 0xff0000) << (bits % 8)
-                | (value & 0xff000000) >> (16 - bits % 8)
-                | (value & 0xff00000000) >> (32 - bits % 8)
-                | (value & 0xff0000000000) >> 40;
-    }
-    c[0] |= value >> (32 + lastbyte_bits);
-    c[1] = (value >> (24 + lastbyte_bits)) & 0xff;
-    c[2] = (value >> (16 + lastbyte_bits)) & 0xff;
-    c[3] = (value >> (8 + lastbyte_bits)) & 0xff;
-    c[4] = (value >> lastbyte_bits) & 0xff;
-    c[5] |= (value << (8 - lastbyte_bits)) & 0xff;
-    IOS_PUT_C_ERR_CHCK(c, io, 6, offset / 8);
-    return IOS_OK;
-
-  case 6:
-    /* Correctly set the unmodified leading bits of the first byte.  */
-    IOS_GET_C_ERR_CHCK(c[0], io, offset / 8);
-    IOS_CHAR_GET_MSB(&c[0], offset % 8);
-    /* Correctly set the unmodified trailing bits of the last byte.  */
-    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, offset / 8 + bytes_minus1);
-    IOS_CHAR_GET_LSB(&c[bytes_minus1], 8 - lastbyte_bits);
-
-    if (endian == IOS_ENDIAN_LSB)
-    {
-      /* Convert to the little endian format. For example a 12-bit-long
-         number's bits get reordered as 7-6-5-4-3-2-1-0-11-10-9-8
-         with leading 0s.  */
-      if (bits <= 48)
-        value = ((value & 0xff) << (32 + bits % 8))
-                | (value & 0xff00) << (16 + bits % 8)
-                | (value & 0xff0000) << (bits % 8)
-                | (value & 0xff000000) >> (16 - bits % 8)
-                | (value & 0xff00000000) >> (32 - bits % 8)
-                | (value & 0xff0000000000) >> 40;
-      else
-        value = ((value & 0xff) << (40 + bits % 8))
-                | (value & 0xff00) << (24 + bits % 8)
-                | (value & 0xff0000) << (8 + bits % 8)
-                | (value & 0xff000000) >> (8 - bits % 8)
-                | (value & 0xff00000000) >> (24 - bits % 8)
-                | (value & 0xff0000000000) >> (40 - bits % 8)
-                | (value & 0xff000000000000) >> 48;
-    }
-    c[0] |= value >> (40 + lastbyte_bits);
-    c[1] = (value >> (32 + lastbyte_bits)) & 0xff;
-    c[2] = (value >> (24 + lastbyte_bits)) & 0xff;
-    c[3] = (value >> (16 + lastbyte_bits)) & 0xff;
-    c[4] = (value >> (8 + lastbyte_bits)) & 0xff;
-    c[5] = (value >> lastbyte_bits) & 0xff;
-    c[6] |= (value << (8 - lastbyte_bits)) & 0xff;
-    IOS_PUT_C_ERR_CHCK(c, io, 7, offset / 8);
-    return IOS_OK;
-
-  case 7:
-    /* Correctly set the unmodified leading bits of the first byte.  */
-    IOS_GET_C_ERR_CHCK(c[0], io, offset / 8);
-    IOS_CHAR_GET_MSB(&c[0], offset % 8);
-    /* Correctly set the unmodified trailing bits of the last byte.  */
-    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, offset / 8 + bytes_minus1);
-    IOS_CHAR_GET_LSB(&c[bytes_minus1], 8 - lastbyte_bits);
-
-    if (endian == IOS_ENDIAN_LSB)
-    {
-      /* Convert to the little endian format. For example a 12-bit-long
-         number's bits get reordered as 7-6-5-4-3-2-1-0-11-10-9-8
-         with leading 0s.  */
-      if (bits <= 56)
-        value = ((value & 0xff) << (40 + bits % 8))
-                | (value & 0xff00) << (24 + bits % 8)
-                | (value & 0xff0000) << (8 + bits % 8)
-                | (value & 0xff000000) >> (8 - bits % 8)
-                | (value & 0xff00000000) >> (24 - bits % 8)
-                | (value & 0xff0000000000) >> (40 - bits % 8)
-                | (value & 0xff000000000000) >> 48;
-      else
-        value = ((value & 0xff) << (48 + bits % 8))
-                | (value & 0xff00) << (32 + bits % 8)
-                | (value & 0xff0000) << (16 + bits % 8)
-                | (value & 0xff000000) << (bits % 8)
-                | (value & 0xff00000000) >> (16 - bits % 8)
-                | (value & 0xff0000000000) >> (32 - bits % 8)
-                | (value & 0xff000000000000) >> (48 - bits % 8)
-                | (value & 0xff00000000000000) >> 56;
-    }
-    c[0] |= value >> (48 + lastbyte_bits);
-    c[1] = (value >> (40 + lastbyte_bits)) & 0xff;
-    c[2] = (value >> (32 + lastbyte_bits)) & 0xff;
-    c[3] = (value >> (24 + lastbyte_bits)) & 0xff;
-    c[4] = (value >> (16 + lastbyte_bits)) & 0xff;
-    c[5] = (value >> (8 + lastbyte_bits)) & 0xff;
-    c[6] = (value >> lastbyte_bits) & 0xff;
-    c[7] |= (value << (8 - lastbyte_bits)) & 0xff;
-    IOS_PUT_C_ERR_CHCK(c, io, 8, offset / 8);
-    return IOS_OK;
-
-  case 8:
-    /* Correctly set the unmodified leading bits of the first byte.  */
-    IOS_GET_C_ERR_CHCK(c[0], io, offset / 8);
-    IOS_CHAR_GET_MSB(&c[0], offset % 8);
-    /* Correctly set the unmodified trailing bits of the last byte.  */
-    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, offset / 8 + bytes_minus1);
-    IOS_CHAR_GET_LSB(&c[bytes_minus1], 8 - lastbyte_bits);
-
-    if (endian == IOS_ENDIAN_LSB)
-    {
-      /* Convert to the little endian format. For example a 12-bit-long
-         number's bits get reordered as 7-6-5-4-3-2-1-0-11-10-9-8
-         with leading 0s.  */
-      value = ((value & 0xff) << (48 + bits % 8))
-              | (value & 0xff00) << (32 + bits % 8)
-              | (value & 0xff0000) << (16 + bits % 8)
-              | (value & 0xff000000) << (bits % 8)
-              | (value & 0xff00000000) >> (16 - bits % 8)
-              | (value & 0xff0000000000) >> (32 - bits % 8)
-              | (value & 0xff000000000000) >> (48 - bits % 8)
-              | (value & 0xff00000000000000) >> 56;
-    }
-    c[0] |= value >> (56 + lastbyte_bits);
-    c[1] = (value >> (48 + lastbyte_bits)) & 0xff;
-    c[2] = (value >> (40 + lastbyte_bits)) & 0xff;
-    c[3] = (value >> (32 + lastbyte_bits)) & 0xff;
-    c[4] = (value >> (24 + lastbyte_bits)) & 0xff;
-    c[5] = (value >> (16 + lastbyte_bits)) & 0xff;
-    c[6] = (value >> (8 + lastbyte_bits)) & 0xff;
-    c[7] = (value >> lastbyte_bits) & 0xff;
-    c[8] |= (value << (8 - lastbyte_bits)) & 0xff;
-    IOS_PUT_C_ERR_CHCK(c, io, 9, offset / 8);
-    return IOS_OK;
-
-  default:
-    assert (0);
-  }
+  /* Get the bits surrounding the integer in the first and the last
+     bytes, which shall be written back unchanged.  */
+  if (shift || (nbytes == 1 && tail))
+    IOS_GET_C_ERR_CHCK (c[0], io, flags, offset / 8);
+  if (nbytes > 1 && tail)
+    IOS_GET_C_ERR_CHCK (c[nbytes - 1], io, flags,
+                        offset / 8 + nbytes - 1);
+
+  if (endian == IOS_ENDIAN_LSB)
+    value = ios_value_to_lsb (value, bits);
+
+  /* Place the integer after SHIFT bits in the first eight bytes,
+     handled as a big endian word.  Its last bits go to the ninth
+     byte if they don't fit.  */
+  mask = (~(uint64_t) 0 << (64 - bits)) >> shift;
+  word = (value << (64 - bits)) >> shift;
+  word |= ios_decode_uint (c, 8, IOS_ENDIAN_MSB) & ~mask;
+  ios_encode_uint (c, 8, IOS_ENDIAN_MSB, word);
+  if (shift + bits > 64)
+    c[8] = (c[8] & ((1U << tail) - 1)) | (uint8_t) (value << tail);
+
+  IOS_PUT_C_ERR_CHCK (c, io, flags, nbytes, offset / 8);
+  return IOS_OK;
 }
 
 int
@@ -1552,6 +1221,104 @@ ios_write_uint (ios io, ios_off offset, int flags,
   return ios_write_int_common (io, offset, flags, bits, endian, value);
 }
 
+/* Encode the integers not handled by ios_swap_encode, starting at
+   the index J of the current chunk.  */
+
+#define IOS_ENCODE_UINTS(WIDTH)                                         \
+  do                                                                    \
+    {                                                                   \
+      for (; j < n; ++j)                                                \
+        ios_encode_uint (raw + j * (WIDTH), (WIDTH), endian,            \
+                         values[i + j]);                                \
+    }                                                                   \
+  while (0)
+
+/* Number of integers encoded at a time by ios_write_uint_array.  */
+#define IOS_ENCODE_CHUNK 512
+
+int
+ios_write_uint_array (ios io, ios_off offset, int flags,
+                      int bits,
+                      enum ios_endian endian,
+                      uint64_t count,
+                      const uint64_t *values)
+{
+  ios_off boffset = offset + ios_get_bias (io);
+  uint64_t i;
+  int ret;
+
+  /* The IOS should be writable.  */
+  if (!(io->dev_if->get_flags (io->dev) & IOS_F_WRITE))
+    return IOS_EPERM;
+
+  /* Fast track for byte-aligned 8x bits.  The integers are encoded
+     in chunks, and every chunk is written with a single device
+     operation.  */
+  if (boffset % 8 == 0 && bits % 8 == 0)
+    {
+      size_t width = bits / 8;
+      uint8_t raw[IOS_ENCODE_CHUNK * 8];
+
+      for (i = 0; i < count; i += IOS_ENCODE_CHUNK)
+        {
+          uint64_t n = count - i;
+          uint64_t j;
+
+          if (n > IOS_ENCODE_CHUNK)
+            n = IOS_ENCODE_CHUNK;
+
+          j = ios_swap_encode (raw, values + i, n, width, endian);
+          switch (width)
+            {
+            case 1: IOS_ENCODE_UINTS (1); break;
+            case 2: IOS_ENCODE_UINTS (2); break;
+            case 3: IOS_ENCODE_UINTS (3); break;
+            case 4: IOS_ENCODE_UINTS (4); break;
+            case 5: IOS_ENCODE_UINTS (5); break;
+            case 6: IOS_ENCODE_UINTS (6); break;
+            case 7: IOS_ENCODE_UINTS (7); break;
+            case 8: IOS_ENCODE_UINTS (8); break;
+            default:
+              assert (0);
+            }
+
+          ret = ios_pwrite (io, flags, raw, n * width,
+                            boffset / 8 + i * width);
+          if (ret != IOD_OK)
+            return IOD_ERROR_TO_IOS_ERROR (ret);
+        }
+
+      return IOS_OK;
+    }
+
+  /* Otherwise write the integers one by one.  */
+  for (i = 0; i < count; ++i)
+    {
+      ret = ios_write_uint (io, offset + i * bits, flags, bits, endian,
+                            values[i]);
+      if (ret != IOS_OK)
+        return ret;
+    }
+
+  return IOS_OK;
+}
+
+#undef IOS_ENCODE_UINTS
+
+int
+ios_write_int_array (ios io, ios_off offset, int flags,
+                     int bits,
+                     enum ios_endian endian,
+                     enum ios_nenc nenc,
+                     uint64_t count,
+                     const int64_t *values)
+{
+  /* The bits of the integers beyond BITS are ignored when they are
+     encoded, so signed integers are written like unsigned ones.  */
+  return ios_write_uint_array (io, offset, flags, bits, endian, count,
+                               (const uint64_t *) values);
+}
+
 int
 ios_write_string (ios io, ios_off offset, int flags,
                   const char *value)
@@ -1573,8 +1340,8 @@ ios_write_string (ios io, ios_off offset, int flags,
       p = value;
       do
         {
-          int ret = io->dev_if->pwrite (io->dev, p, 1,
-                                        offset / 8 + p - value);
+          int ret = ios_pwrite (io, flags, p, 1,
+                                offset / 8 + p - value);
           if (ret != IOD_OK)
             return IOD_ERROR_TO_IOS_ERROR (ret);
         }
@@ -1607,15 +1374,573 @@ ios_write_string (ios io, ios_off offset, int flags,
 uint64_t
 ios_size (ios io)
 {
-  return io->dev_if->size (io->dev);
+  uint64_t size = io->dev_if->size (io->dev);
+
+  /* Pending writes past the end of the device will extend it once
+     written out.  */
+  if (io->wbuf)
+    {
+      ios_dev_off wbuf_end = ios_wbuf_end (io->wbuf);
+
+      if (wbuf_end > size)
+        size = wbuf_end;
+    }
+
+  return size;
+}
+
+uint64_t
+ios_mem_usage (ios io)
+{
+  if (io->dev_if == &ios_dev_mem)
+    return ios_dev_mem_usage (io->dev);
+
+  return 0;
 }
 
 int
 ios_flush (ios io, ios_off offset)
 {
+  if (io->wbuf)
+    {
+      int ret = ios_wbuf_flush (io->wbuf, ios_wbuf_write, io);
+
+      if (ret != IOD_OK)
+        return IOD_ERROR_TO_IOS_ERROR (ret);
+    }
+
+  if (io->cache)
+    {
+      int ret = ios_cache_flush (io->cache);
+
+      if (ret != IOD_OK)
+        return IOD_ERROR_TO_IOS_ERROR (ret);
+    }
+
+  /* Whoever flushes wants to see the current contents of the device
+     from now on.  */
+  io->ra.count = 0;
+  io->ra.window = 0;
+
   return io->dev_if->flush (io->dev, offset / 8);
 }
 
+int
+ios_configure_cache (ios io, size_t budget, int write_back)
+{
+  struct ios_cache *cache = NULL;
+
+  if (budget > 0)
+    {
+      if (!(io->dev_if->get_flags (io->dev) & IOS_F_READ))
+        return IOS_EPERM;
+
+      cache = ios_cache_new (io->dev_if, io->dev, IOS_CACHE_PAGE_SIZE,
+                             budget, write_back);
+      if (!cache)
+        return IOS_ENOMEM;
+    }
+
+  if (io->cache)
+    {
+      int ret = ios_cache_flush (io->cache);
+
+      if (ret != IOD_OK)
+        {
+          ios_cache_free (cache);
+          return IOD_ERROR_TO_IOS_ERROR (ret);
+        }
+      ios_cache_free (io->cache);
+    }
+
+  io->cache = cache;
+  io->ra.count = 0;
+  io->ra.window = 0;
+  ios_update_mem (io);
+  return IOS_OK;
+}
+
+int
+ios_configure_stream (ios io, size_t window)
+{
+  if (io->dev_if != &ios_dev_stream)
+    return IOS_EINVAL;
+
+  return IOD_ERROR_TO_IOS_ERROR (ios_dev_stream_set_window (io->dev,
+                                                           window));
+}
+
+int
+ios_overlay_commit (ios io)
+{
+  if (io->dev_if != &ios_dev_overlay)
+    return IOS_EINVAL;
+
+  return IOD_ERROR_TO_IOS_ERROR (ios_dev_overlay_commit (io->dev));
+}
+
+int
+ios_overlay_discard (ios io)
+{
+  if (io->dev_if != &ios_dev_overlay)
+    return IOS_EINVAL;
+
+  ios_dev_overlay_discard (io->dev);
+  return IOS_OK;
+}
+
+/* Read COUNT bytes at OFFSET from the cache of IO, or from its device
+   if the space is not cached.  The write buffer is not considered.  */
+
+static int
+ios_pread_1 (ios io, int flags, void *buf, size_t count, ios_dev_off offset)
+{
+  if (io->cache == NULL)
+    {
+      if (io->mem
+          && offset <= io->mem_size && count <= io->mem_size - offset)
+        {
+          memcpy (buf, io->mem + offset, count);
+          return IOD_OK;
+        }
+
+      if (!(flags & IOS_F_BYPASS_CACHE) && ios_dev_readahead_p (io))
+        return ios_readahead_pread (io, buf, count, offset);
+      return io->dev_if->pread (io->dev, buf, count, offset);
+    }
+
+  if (flags & IOS_F_BYPASS_CACHE)
+    {
+      /* The device must see any pending write before reading from
+         it directly.  */
+      int ret = ios_cache_sync (io->cache, offset, count);
+
+      if (ret != IOD_OK)
+        return ret;
+      return io->dev_if->pread (io->dev, buf, count, offset);
+    }
+
+  return ios_cache_pread (io->cache, buf, count, offset);
+}
+
+/* Write COUNT bytes at OFFSET to the cache of IO, or to its device if
+   the space is not cached.  The write buffer is not considered.  */
+
+static int
+ios_pwrite_1 (ios io, int flags, const void *buf, size_t count,
+              ios_dev_off offset)
+{
+  if (io->cache == NULL)
+    {
+      int ret;
+
+      if (io->mem && io->mem_write_p
+          && offset <= io->mem_size && count <= io->mem_size - offset)
+        {
+          memcpy (io->mem + offset, buf, count);
+          return IOD_OK;
+        }
+
+      ret = io->dev_if->pwrite (io->dev, buf, count, offset);
+      if (ret == IOD_OK)
+        ios_readahead_update (io, buf, count, offset);
+      else
+        io->ra.count = 0;
+      if (io->dev_if->get_mem)
+        ios_update_mem (io);
+      return ret;
+    }
+
+  if (flags & IOS_F_BYPASS_CACHE)
+    {
+      int ret = io->dev_if->pwrite (io->dev, buf, count, offset);
+
+      if (ret != IOD_OK)
+        return ret;
+      ios_cache_update (io->cache, buf, count, offset);
+      return IOD_OK;
+    }
+
+  return ios_cache_pwrite (io->cache, buf, count, offset);
+}
+
+int
+ios_pread (ios io, int flags, void *buf, size_t count, ios_dev_off offset)
+{
+  int ret;
+
+  if (io->wbuf == NULL)
+    return ios_pread_1 (io, flags, buf, count, offset);
+
+  if (flags & IOS_F_BYPASS_CACHE)
+    {
+      /* The device must see any pending write before reading from
+         it directly.  */
+      ret = ios_wbuf_flush (io->wbuf, ios_wbuf_write, io);
+      if (ret != IOD_OK)
+        return ret;
+      return ios_pread_1 (io, flags, buf, count, offset);
+    }
+
+  ret = ios_pread_1 (io, flags, buf, count, offset);
+  if (ret == IOD_EOF && ios_wbuf_end (io->wbuf) > offset)
+    {
+      /* The range lies, at least partially, past the current end of
+         the device, but pending writes will extend it.  Write them
+         out and try again.  */
+      ret = ios_wbuf_flush (io->wbuf, ios_wbuf_write, io);
+      if (ret != IOD_OK)
+        return ret;
+      return ios_pread_1 (io, flags, buf, count, offset);
+    }
+
+  if (ret == IOD_OK)
+    ios_wbuf_overlay (io->wbuf, buf, count, offset);
+  return ret;
+}
+
+int
+ios_pwrite (ios io, int flags, const void *buf, size_t count,
+            ios_dev_off offset)
+{
+  int ret;
+
+  if (io->wbuf == NULL)
+    return ios_pwrite_1 (io, flags, buf, count, offset);
+
+  if (flags & IOS_F_BYPASS_CACHE)
+    {
+      /* Pending writes are older than this one, so they must not be
+         written out after it.  */
+      ret = ios_wbuf_flush (io->wbuf, ios_wbuf_write, io);
+      if (ret != IOD_OK)
+        return ret;
+      return ios_pwrite_1 (io, flags, buf, count, offset);
+    }
+
+  ret = ios_wbuf_add (io->wbuf, buf, count, offset);
+  if (ret != IOD_OK)
+    return ret;
+
+  if (ios_wbuf_full_p (io->wbuf))
+    return ios_wbuf_flush (io->wbuf, ios_wbuf_write, io);
+  return IOD_OK;
+}
+
+int
+ios_seek_data (ios io, ios_dev_off offset,
+               ios_dev_off *begin, ios_dev_off *end)
+{
+  ios_dev_off size;
+  int ret;
+
+  /* Pending writes may fill holes, so the device must see them.  */
+  if (io->wbuf)
+    {
+      ret = ios_wbuf_flush (io->wbuf, ios_wbuf_write, io);
+      if (ret != IOD_OK)
+        return ret;
+    }
+  if (io->cache)
+    {
+      ret = ios_cache_flush (io->cache);
+      if (ret != IOD_OK)
+        return ret;
+    }
+
+  if (io->dev_if->next_data)
+    return io->dev_if->next_data (io->dev, offset, begin, end);
+
+  size = io->dev_if->size (io->dev);
+  if (offset >= size)
+    return IOD_EOF;
+
+  *begin = offset;
+  *end = size;
+  return IOD_OK;
+}
+
+int
+ios_next_data (ios io, ios_off offset, ios_off *begin, ios_off *end)
+{
+  ios_off bias = ios_get_bias (io);
+  ios_off dev_offset = offset + bias;
+  ios_dev_off dev_begin, dev_end;
+  int ret;
+
+  if (!(io->dev_if->get_flags (io->dev) & IOS_F_READ))
+    return IOS_EPERM;
+
+  if (dev_offset < 0)
+    dev_offset = 0;
+  ret = ios_seek_data (io, dev_offset / 8, &dev_begin, &dev_end);
+  if (ret != IOD_OK)
+    return IOD_ERROR_TO_IOS_ERROR (ret);
+
+  /* Devices like process memories are as big as they can be.  */
+  if (dev_begin >= INT64_MAX / 8)
+    return IOS_EOF;
+  if (dev_end > INT64_MAX / 8)
+    dev_end = INT64_MAX / 8;
+
+  *begin = (ios_off) dev_begin * 8 - bias;
+  if (*begin < offset)
+    *begin = offset;
+  *end = (ios_off) dev_end * 8 - bias;
+  return IOS_OK;
+}
+
+/* Ranges of IO spaces are copied in blocks of IOS_COPY_BLOCK bytes,
+   unless the kernel can copy them directly.  Ranges which are not
+   byte-aligned are copied in blocks of IOS_COPY_BITS_BLOCK bytes,
+   each of which is decoded into an uint64_t.  */
+
+#define IOS_COPY_BLOCK (1024 * 1024)
+#define IOS_COPY_BITS_BLOCK 4096
+
+#if defined HAVE_COPY_FILE_RANGE \
+  || (defined HAVE_SENDFILE && defined HAVE_SYS_SENDFILE_H)
+
+/* Return the file descriptor of the device operated by IO, or -1 if
+   it has none.  */
+
+static int
+ios_get_fd (ios io)
+{
+  return io->dev_if->get_fd ? io->dev_if->get_fd (io->dev) : -1;
+}
+
+/* Write out the pending writes of IO, and the dirty pages of its
+   cache overlapping with the range [OFFSET,OFFSET+COUNT) of the
+   device.  */
+
+static int
+ios_sync (ios io, ios_dev_off offset, uint64_t count)
+{
+  int ret;
+
+  if (io->wbuf)
+    {
+      ret = ios_wbuf_flush (io->wbuf, ios_wbuf_write, io);
+      if (ret != IOD_OK)
+        return ret;
+    }
+
+  if (io->cache)
+    return ios_cache_sync (io->cache, offset, count);
+  return IOD_OK;
+}
+
+/* Have the kernel copy COUNT bytes at the offset FROM of the file
+   IN_FD to the offset TO of the file OUT_FD.  Return the number of
+   bytes copied, which is less than COUNT if the kernel can't copy
+   between these files, or if something went wrong.  It is up to the
+   caller to copy the rest by other means, and to find out what went
+   wrong in that case.  */
+
+static uint64_t
+ios_copy_kernel (int in_fd, ios_dev_off from, int out_fd, ios_dev_off to,
+                 uint64_t count)
+{
+  uint64_t copied = 0;
+
+#ifdef HAVE_COPY_FILE_RANGE
+  while (copied < count)
+    {
+      off_t in_off = from + copied;
+      off_t out_off = to + copied;
+      ssize_t n = copy_file_range (in_fd, &in_off, out_fd, &out_off,
+                                   count - copied, 0);
+
+      if (n == -1 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      copied += n;
+    }
+#endif
+
+  /* Older kernels can't copy_file_range between different file
+     systems, but sendfile works everywhere.  */
+#if defined HAVE_SENDFILE && defined HAVE_SYS_SENDFILE_H
+  if (copied < count && lseek (out_fd, to + copied, SEEK_SET) != -1)
+    while (copied < count)
+      {
+        off_t in_off = from + copied;
+        ssize_t n = sendfile (out_fd, in_fd, &in_off, count - copied);
+
+        if (n == -1 && errno == EINTR)
+          continue;
+        if (n <= 0)
+          break;
+        copied += n;
+      }
+#endif
+
+  return copied;
+}
+
+#endif /* HAVE_COPY_FILE_RANGE || HAVE_SENDFILE */
+
+/* Copy COUNT bytes at the byte FROM of the device of FROM_IO to the
+   byte TO of the device of TO_IO, starting with the last block if
+   BACKWARDS is non-zero.  Return an IOD_* status code.  */
+
+static int
+ios_copy_bytes (ios from_io, ios_dev_off from, ios to_io, ios_dev_off to,
+                uint64_t count, int backwards)
+{
+  size_t block = count < IOS_COPY_BLOCK ? count : IOS_COPY_BLOCK;
+  uint8_t *buf = malloc (block);
+  int ret = IOD_OK;
+
+  if (!buf)
+    return IOD_ENOMEM;
+
+  /* Go straight to the devices, so the copied data doesn't evict
+     everything else from the caches.  */
+  while (count > 0)
+    {
+      size_t n = count < block ? count : block;
+      uint64_t pos = backwards ? count - n : 0;
+
+      ret = ios_pread (from_io, IOS_F_BYPASS_CACHE, buf, n, from + pos);
+      if (ret != IOD_OK)
+        break;
+      ret = ios_pwrite (to_io, IOS_F_BYPASS_CACHE, buf, n, to + pos);
+      if (ret != IOD_OK)
+        break;
+
+      if (!backwards)
+        {
+          from += n;
+          to += n;
+        }
+      count -= n;
+    }
+
+  free (buf);
+  return ret;
+}
+
+/* Likewise, but for the bit-offsets FROM and TO of the spaces, which
+   are not byte-aligned.  Return an IOS_* status code.  */
+
+static int
+ios_copy_bits (ios from_io, ios_off from, ios to_io, ios_off to,
+               uint64_t count, int backwards)
+{
+  uint64_t *values = malloc (IOS_COPY_BITS_BLOCK * sizeof (uint64_t));
+  int ret = IOS_OK;
+
+  if (!values)
+    return IOS_ENOMEM;
+
+  while (count > 0)
+    {
+      uint64_t n = count < IOS_COPY_BITS_BLOCK ? count : IOS_COPY_BITS_BLOCK;
+      ios_off pos = backwards ? (count - n) * 8 : 0;
+
+      ret = ios_read_uint_array (from_io, from + pos, 0, 8, IOS_ENDIAN_MSB,
+                                 n, values);
+      if (ret != IOS_OK)
+        break;
+      ret = ios_write_uint_array (to_io, to + pos, 0, 8, IOS_ENDIAN_MSB,
+                                  n, values);
+      if (ret != IOS_OK)
+        break;
+
+      if (!backwards)
+        {
+          from += n * 8;
+          to += n * 8;
+        }
+      count -= n;
+    }
+
+  free (values);
+  return ret;
+}
+
+int
+ios_copy (ios from_io, ios_off from, ios to_io, ios_off to, ios_off size)
+{
+  ios_off dev_from = from + ios_get_bias (from_io);
+  ios_off dev_to = to + ios_get_bias (to_io);
+  uint64_t count = size / 8;
+  int overlap_p, backwards;
+
+  if (!(from_io->dev_if->get_flags (from_io->dev) & IOS_F_READ)
+      || !(to_io->dev_if->get_flags (to_io->dev) & IOS_F_WRITE))
+    return IOS_EPERM;
+
+  if (size < 0)
+    return IOS_EINVAL;
+
+  if (count == 0 || (from_io == to_io && dev_from == dev_to))
+    return IOS_OK;
+
+  if (dev_from < 0 || dev_to < 0)
+    return IOS_EOF;
+
+  /* Overlapping ranges are copied as if the source was read before
+     writing anything, like memmove does.  If the destination comes
+     after the source, that means starting with the end of the
+     range.  */
+  overlap_p = (from_io == to_io
+               && (dev_from < dev_to
+                   ? (uint64_t) (dev_to - dev_from) < count * 8
+                   : (uint64_t) (dev_from - dev_to) < count * 8));
+  backwards = overlap_p && dev_to > dev_from;
+
+  if (dev_from % 8 != 0 || dev_to % 8 != 0)
+    return ios_copy_bits (from_io, from, to_io, to, count, backwards);
+
+  dev_from /= 8;
+  dev_to /= 8;
+
+#if defined HAVE_COPY_FILE_RANGE \
+  || (defined HAVE_SENDFILE && defined HAVE_SYS_SENDFILE_H)
+  if (!overlap_p)
+    {
+      int in_fd = ios_get_fd (from_io);
+      int out_fd = ios_get_fd (to_io);
+
+      if (in_fd != -1 && out_fd != -1)
+        {
+          uint64_t copied;
+          int ret;
+
+          /* The kernel only sees what is in the files.  */
+          ret = ios_sync (from_io, dev_from, count);
+          if (ret == IOD_OK)
+            ret = ios_sync (to_io, dev_to, count);
+          if (ret != IOD_OK)
+            return IOD_ERROR_TO_IOS_ERROR (ret);
+
+          copied = ios_copy_kernel (in_fd, dev_from, out_fd, dev_to, count);
+          if (copied > 0)
+            {
+              if (to_io->cache)
+                ios_cache_invalidate (to_io->cache, dev_to, copied);
+              to_io->ra.count = 0;
+              to_io->ra.window = 0;
+            }
+
+          dev_from += copied;
+          dev_to += copied;
+          count -= copied;
+          if (count == 0)
+            return IOS_OK;
+        }
+    }
+#endif
+
+  return IOD_ERROR_TO_IOS_ERROR (ios_copy_bytes (from_io, dev_from,
+                                                 to_io, dev_to,
+                                                 count, backwards));
+}
+
 void *
 ios_get_dev (ios ios)
 {
@@ -1629,17 +1954,17 @@ ios_get_dev_if (ios ios)
 }
 
 struct ios_dev_if *
-ios_foreign_iod (void)
+ios_foreign_iod (ios_context ios_ctx)
 {
-  return ios_dev_ifs[0];
+  return ios_ctx->dev_ifs[0];
 }
 
 int
-ios_register_foreign_iod (struct ios_dev_if *iod_if)
+ios_register_foreign_iod (ios_context ios_ctx, struct ios_dev_if *iod_if)
 {
-  if (ios_dev_ifs[0] != NULL)
+  if (ios_ctx->dev_ifs[0] != NULL)
     return IOS_ERROR;
 
-  ios_dev_ifs[0] = iod_if;
+  ios_ctx->dev_ifs[0] = iod_if;
   return IOS_OK;
 }
@@ -20,15 +20,24 @@
 #define IOS_H
 
 #include <config.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
-/* The following two functions intialize and shutdown the IO poke
-   subsystem.  */
+/* The IO spaces open at any given time, the current IO space and the
+   registered foreign IO device are kept in an "IO context".  Several
+   contexts can be used at the same time, each one having its own IO
+   spaces, which are not visible in the other contexts.  */
 
-void ios_init (void);
+typedef struct ios_context *ios_context;
 
-void ios_shutdown (void);
+/* The following two functions intialize and shutdown an IO context.
+   ios_init returns NULL if there is not enough memory.  ios_shutdown
+   closes all the IO spaces in the context.  */
+
+ios_context ios_init (void);
+
+void ios_shutdown (ios_context ios_ctx);
 
 /* "IO spaces" are the entities used in poke in order to abstract the
    heterogeneous devices that are suitable to be edited, such as
@@ -123,14 +132,41 @@ typedef int64_t ios_off;
 #define IOS_F_READ   1
 #define IOS_F_WRITE  2
 #define IOS_F_CREATE 16
+#define IOS_F_TRUNCATE 32
 
 #define IOS_M_RDONLY (IOS_F_READ)
 #define IOS_M_WRONLY (IOS_F_WRITE)
 #define IOS_M_RDWR (IOS_F_READ | IOS_F_WRITE)
 
+/* IOD-specific flags.  All but the last one are understood by file
+   devices.
+
+   IOS_F_MMAP maps the file in memory.
+
+   IOS_F_SEQUENTIAL, IOS_F_RANDOM and IOS_F_WILLNEED tell the system
+   how the file is going to be accessed, so it can adjust its
+   read-ahead and caching policies.  IOS_F_SEQUENTIAL and
+   IOS_F_RANDOM are mutually exclusive.
+
+   IOS_F_DIRECT requests to access the file avoiding the system's page
+   cache, if possible.  This flag is cleared in the flags of the IO
+   space if direct access is not supported for the file.
+
+   IOS_F_SAVE_INDEX is understood by compressed file devices, and
+   saves the index of the compressed file next to it, so it doesn't
+   need to be built again the next time the file is opened.  */
+
+#define IOS_F_MMAP       ((uint64_t) 1 << 32)
+#define IOS_F_SEQUENTIAL ((uint64_t) 1 << 33)
+#define IOS_F_RANDOM     ((uint64_t) 1 << 34)
+#define IOS_F_WILLNEED   ((uint64_t) 1 << 35)
+#define IOS_F_DIRECT     ((uint64_t) 1 << 36)
+#define IOS_F_SAVE_INDEX ((uint64_t) 1 << 37)
+
 /* **************** IO space collection API ****************
 
-   The collection of open IO spaces are organized in a global list.
+   The collection of open IO spaces are organized in a list, one per
+   IO context.
    At every moment some given space is the "current space", unless
    there are no spaces open:
 
@@ -157,13 +193,14 @@ typedef int64_t ios_off;
    If no IOS_F_READ or IOS_F_WRITE flags are specified, then the IOS
    will be opened in whatever mode makes more sense.  */
 
-int ios_open (const char *handler, uint64_t flags, int set_cur);
+int ios_open (ios_context ios_ctx, const char *handler, uint64_t flags,
+              int set_cur);
 
-/* Close the given IO space, freing all used resources and flushing
-   the space cache associated with the space.  Return IOS_OK on success
-   and the error code on failure.  */
+/* Close the given IO space of the context IOS_CTX, freing all used
+   resources and flushing the space cache associated with the space.
+   Return IOS_OK on success and the error code on failure.  */
 
-int ios_close (ios io);
+int ios_close (ios_context ios_ctx, ios io);
 
 /* Return the flags which are active in a given IO.  Note that this
    doesn't necessarily correspond to the flags passed when opening the
@@ -179,21 +216,21 @@ const char *ios_handler (ios io);
 /* Return the current IO space, or NULL if there are no open
    spaces.  */
 
-ios ios_cur (void);
+ios ios_cur (ios_context ios_ctx);
 
 /* Set the current IO space to IO.  */
 
-void ios_set_cur (ios io);
+void ios_set_cur (ios_context ios_ctx, ios io);
 
 /* Return the IO space operating the given HANDLER.  Return NULL if no
    such space exists.  */
 
-ios ios_search (const char *handler);
+ios ios_search (ios_context ios_ctx, const char *handler);
 
 /* Return the IO space having the given ID.  Return NULL if no such
    space exists.  */
 
-ios ios_search_by_id (int id);
+ios ios_search_by_id (ios_context ios_ctx, int id);
 
 /* Return the ID of the given IO space.  */
 
@@ -205,7 +242,7 @@ const char *ios_get_dev_if_name (ios io);
 
 /* Return the first IO space.  */
 
-ios ios_begin (void);
+ios ios_begin (ios_context ios_ctx);
 
 /* Return the space following IO.  */
 
@@ -219,7 +256,7 @@ bool ios_end (const ios io);
 
 typedef void (*ios_map_fn) (ios io, void *data);
 
-void ios_map (ios_map_fn cb, void *data);
+void ios_map (ios_context ios_ctx, ios_map_fn cb, void *data);
 
 /* **************** IOS properties************************  */
 
@@ -227,6 +264,12 @@ void ios_map (ios_map_fn cb, void *data);
 
 uint64_t ios_size (ios io);
 
+/* Return the number of bytes of memory used to hold the contents of
+   the given IO space, for devices that keep them in memory.  Return 0
+   for any other device.  */
+
+uint64_t ios_mem_usage (ios io);
+
 /* The IOS bias is added to every offset used in a read/write
    operation.  It is signed and measured in bits.  By default it is
    zero, i.e. no bias is applied.
@@ -299,6 +342,30 @@ int ios_read_uint (ios io, ios_off offset, int flags,
                    enum ios_endian endian,
                    uint64_t *value);
 
+/* Read COUNT contiguous unsigned integers of size BITS, the first of
+   which is located at the given OFFSET, and put their values in
+   VALUES.  It is assumed the integers are encoded using the ENDIAN
+   byte endianness.
+
+   If OFFSET and BITS are multiples of 8 the integers are read from
+   the device at once.  */
+
+int ios_read_uint_array (ios io, ios_off offset, int flags,
+                         int bits,
+                         enum ios_endian endian,
+                         uint64_t count,
+                         uint64_t *values);
+
+/* Likewise, but for signed integers encoded using the NENC negative
+   encoding.  */
+
+int ios_read_int_array (ios io, ios_off offset, int flags,
+                        int bits,
+                        enum ios_endian endian,
+                        enum ios_nenc nenc,
+                        uint64_t count,
+                        int64_t *values);
+
 /* Read a NULL-terminated string of bytes located at the given OFFSET,
    and put its value in VALUE.  It is up to the caller to free the
    memory occupied by the returned string, when no longer needed.  */
@@ -324,6 +391,29 @@ int ios_write_uint (ios io, ios_off offset, int flags,
                     enum ios_endian endian,
                     uint64_t value);
 
+/* Write the COUNT unsigned integers of size BITS in VALUES to the
+   space IO, contiguously, starting at the given OFFSET.  Use the byte
+   endianness ENDIAN when writing the values.
+
+   If OFFSET and BITS are multiples of 8 the integers are written to
+   the device in big blocks.  */
+
+int ios_write_uint_array (ios io, ios_off offset, int flags,
+                          int bits,
+                          enum ios_endian endian,
+                          uint64_t count,
+                          const uint64_t *values);
+
+/* Likewise, but for signed integers, using the NENC negative
+   encoding.  */
+
+int ios_write_int_array (ios io, ios_off offset, int flags,
+                         int bits,
+                         enum ios_endian endian,
+                         enum ios_nenc nenc,
+                         uint64_t count,
+                         const int64_t *values);
+
 /* Write the NULL-terminated string in VALUE to the space IO, at the
    given OFFSET.  */
 
@@ -336,6 +426,284 @@ int ios_write_string (ios io, ios_off offset, int flags, const char *value);
 
 int ios_flush (ios io, ios_off offset);
 
+/* Find the first extent of IO containing data that ends after the
+   bit-offset OFFSET, and set *BEGIN and *END to its boundaries.
+   *BEGIN is not lower than OFFSET.  Everything in [OFFSET,*BEGIN) is
+   in a hole, and reads as zeroes.  The bias of IO is applied.
+
+   Return IOS_OK on success, IOS_EOF if there is no data after OFFSET,
+   or another error code otherwise.  IO devices which don't know about
+   holes, like streams, report all their contents as data.  */
+
+int ios_next_data (ios io, ios_off offset, ios_off *begin, ios_off *end);
+
+/* Search the space IO for the LEN bytes in BYTES, starting at the
+   first byte boundary at or after the bit-offset FROM.  If MASK is
+   not NULL, it contains LEN masks, and only the bits set in them are
+   compared with the corresponding bytes.  Only the matches whose
+   bit-offset is a multiple of ALIGN are considered.  The bias of IO
+   is applied.
+
+   CB is called with the offset of every match, in ascending order,
+   and DATA.  The search stops if CB returns a non-zero value, or at
+   the end of the space.
+
+   Return IOS_OK on success, IOS_EINVAL if LEN or ALIGN are not
+   positive, or another error code otherwise.  */
+
+typedef int (*ios_match_fn) (ios_off offset, void *data);
+
+int ios_search_bytes (ios io, ios_off from, const uint8_t *bytes,
+                      const uint8_t *mask, size_t len, ios_off align,
+                      ios_match_fn cb, void *data);
+
+/* Scan the SIZE bits of the space IO starting at the first byte
+   boundary at or after the bit-offset FROM, or the rest of the space
+   if SIZE is zero, for the NPATTERNS byte strings in PATTERNS, whose
+   lengths are in LENS.  The bias of IO is applied.
+
+   CB is called with the index of the pattern and the offset of every
+   match, and DATA.  The matches are not reported in any particular
+   order.  The scan stops if CB returns a non-zero value, or at the
+   end of the range.
+
+   Return IOS_OK on success, IOS_EINVAL if there are no patterns or
+   some of them is empty, or another error code otherwise.  */
+
+typedef int (*ios_scan_fn) (size_t pattern, ios_off offset, void *data);
+
+int ios_scan (ios io, ios_off from, ios_off size,
+              const uint8_t *const *patterns, const size_t *lens,
+              size_t npatterns, ios_scan_fn cb, void *data);
+
+/* Copy the SIZE bits at the bit-offset FROM of the space FROM_IO to
+   the bit-offset TO of the space TO_IO.  SIZE is truncated to bytes.
+   The biases of both spaces are applied.  The spaces may be the same,
+   and the ranges may overlap, in which case the result is the same
+   as if the whole source range was read before writing anything.
+
+   Ranges of files are copied by the kernel when possible, without
+   passing the data through user space.
+
+   Return IOS_OK on success, IOS_EPERM if FROM_IO is not readable or
+   TO_IO is not writable, IOS_EOF if the source range extends past the
+   end of FROM_IO, or another error code otherwise.  Note that part
+   of the range may have been copied when an error is returned.  */
+
+int ios_copy (ios from_io, ios_off from, ios to_io, ios_off to,
+              ios_off size);
+
+/* Compare the SIZE bits at the bit-offset A_FROM of the space A_IO
+   with the SIZE bits at the bit-offset B_FROM of the space B_IO, or
+   the rest of both spaces if SIZE is zero.  SIZE is truncated to
+   bytes.  The biases of both spaces are applied, and the resulting
+   offsets must be byte-aligned.
+
+   CB is called with the offset and the size of every hunk of changed
+   bytes, in ascending order, and DATA.  The offsets are relative to
+   the beginning of the ranges.  Hunks include the bytes past the end
+   of one of the spaces, and short runs of equal bytes between
+   changes.  The comparison stops if CB returns a non-zero value.
+
+   Return IOS_OK on success, IOS_EPERM if any of the spaces is not
+   readable, IOS_EINVAL if the offsets are not byte-aligned, or
+   another error code otherwise.  */
+
+typedef int (*ios_diff_fn) (ios_off offset, ios_off size, void *data);
+
+int ios_diff (ios a_io, ios_off a_from, ios b_io, ios_off b_from,
+              ios_off size, ios_diff_fn cb, void *data);
+
+/* Compute the ALGO digest of the SIZE bits at the bit-offset FROM of
+   the space IO, or of the rest of the space if SIZE is zero.  The
+   bias of the space is applied, and both the resulting offset and
+   SIZE must be byte-aligned.
+
+   The digest is stored in DIGEST, which shall have room for at least
+   IOS_DIGEST_MAX_SIZE bytes, and its size in bytes is stored in
+   *LEN.  Digests which are integers, like CRCs, are stored with the
+   most significant byte first.
+
+   Return IOS_OK on success, IOS_EPERM if IO is not readable,
+   IOS_EINVAL if ALGO is not valid or the range is not byte-aligned,
+   IOS_EOF if the range extends past the end of IO, or another error
+   code otherwise.  */
+
+#define IOS_DIGEST_CRC32  0   /* ISO 3309 CRC-32.  */
+#define IOS_DIGEST_CRC32C 1   /* Castagnoli CRC-32.  */
+#define IOS_DIGEST_SHA1   2
+#define IOS_DIGEST_SHA256 3
+#define IOS_DIGEST_XXH64  4   /* XXH64 with a zero seed.  */
+
+#define IOS_DIGEST_MAX_SIZE 32
+
+int ios_digest (ios io, ios_off from, ios_off size, int algo,
+                uint8_t *digest, size_t *len);
+
+/* Find the strings of at least MIN_LEN printable characters, encoded
+   with ENCODING, in the SIZE bits at the bit-offset FROM of the space
+   IO, or in the rest of the space if SIZE is zero.  The bias of the
+   space is applied, and the resulting offset must be byte-aligned.
+   Printable characters are the ASCII graphic characters, space and
+   tab.  The code units of UTF-16 strings are aligned to FROM.
+
+   CB is called with the offset of every string, its characters as a
+   NULL-terminated string, its length and DATA, in ascending order of
+   offset.  The search stops if CB returns a non-zero value.
+
+   Return IOS_OK on success, IOS_EPERM if IO is not readable,
+   IOS_EINVAL if ENCODING is not valid, MIN_LEN is zero or the offset
+   is not byte-aligned, or another error code otherwise.  */
+
+#define IOS_STRINGS_ASCII   0
+#define IOS_STRINGS_UTF16LE 1
+#define IOS_STRINGS_UTF16BE 2
+
+typedef int (*ios_strings_fn) (ios_off offset, const char *str,
+                               size_t len, void *data);
+
+int ios_strings (ios io, ios_off from, ios_off size, int encoding,
+                 size_t min_len, ios_strings_fn cb, void *data);
+
+/* Count the occurrences of every byte value in the SIZE bits at the
+   bit-offset FROM of the space IO, or in the rest of the space if
+   SIZE is zero, and store them in COUNTS.  The bias of the space is
+   applied, and the resulting range must be byte-aligned.
+
+   Return IOS_OK on success, IOS_EPERM if IO is not readable,
+   IOS_EINVAL if the range is not byte-aligned, IOS_EOF if it extends
+   past the end of the space, or another error code otherwise.  */
+
+int ios_histogram (ios io, ios_off from, ios_off size,
+                   uint64_t counts[256]);
+
+/* Compute the Shannon entropy of the windows of WINDOW bits starting
+   every STEP bits in the SIZE bits at the bit-offset FROM of the
+   space IO, or in the rest of the space if SIZE is zero.  Only the
+   windows which fit entirely in the range are considered.  The bias
+   of the space is applied, and the resulting range, WINDOW and STEP
+   must be byte-aligned.
+
+   CB is called with the offset of every window, its entropy in bits
+   per byte, between 0 and 8, and DATA, in ascending order of offset.
+   The computation stops if CB returns a non-zero value.
+
+   Return IOS_OK on success, IOS_EPERM if IO is not readable,
+   IOS_EINVAL if WINDOW or STEP are not positive or something is not
+   byte-aligned, IOS_EOF if some window extends past the end of the
+   space, or another error code otherwise.  */
+
+typedef int (*ios_entropy_fn) (ios_off offset, double entropy, void *data);
+
+int ios_entropy (ios io, ios_off from, ios_off size, ios_off window,
+                 ios_off step, ios_entropy_fn cb, void *data);
+
+/* Print a dump of the bytes of the space IO between the bit-offsets
+   FROM, which is truncated to bytes, and TOP, to the libpoke
+   terminal.  The bytes are grouped every GROUP_BY bits, and the
+   groups are clustered every CLUSTER_BY groups.  If RULER is set a
+   ruler is printed first, and if ASCII is set the characters of the
+   bytes follow every row, printing NONPRINTABLE_CHAR for the
+   non-printable ones.  Bytes that can't be read are printed as
+   UNKNOWN_BYTE.  See ios_dump_bytes in pickles/ios.pk for the layout
+   of the dump.
+
+   Return IOS_OK on success, IOS_EPERM if IO is not readable,
+   IOS_EINVAL if GROUP_BY or CLUSTER_BY are not positive, or another
+   error code otherwise.  */
+
+int ios_dump (ios io, uint64_t from, uint64_t top, ios_off group_by,
+              int32_t cluster_by, int ruler, int ascii,
+              const char *unknown_byte, char nonprintable_char);
+
+/* Like ios_strings, but print the strings to the libpoke terminal,
+   one per line, preceded by their offsets if OFFSETS_P is set.  */
+
+int ios_print_strings (ios io, ios_off from, ios_off size, int encoding,
+                       size_t min_len, int offsets_p);
+
+/* **************** Cache API **************** */
+
+/* IO spaces operating devices that are expensive to access, like
+   files, keep a cache of fixed-size pages of the device.  The
+   read/write operations above go through the cache, unless
+   IOS_F_BYPASS_CACHE is passed in their flags.
+
+   By default caches use a write-through policy and a budget of
+   IOS_CACHE_DEFAULT_BUDGET bytes.  With a write-back policy, written
+   data stays in the cache until the pages are evicted, the space is
+   flushed with ios_flush, or the space is closed.  */
+
+#define IOS_CACHE_PAGE_SIZE 16384
+#define IOS_CACHE_DEFAULT_BUDGET (16 * 1024 * 1024)
+
+/* Replace the cache of IO with a new one holding up to BUDGET bytes
+   of data, using a write-back policy if WRITE_BACK is non-zero and a
+   write-through policy otherwise.  A BUDGET of zero leaves the space
+   uncached.  Pending data in the previous cache, if any, is written
+   back to the device.
+
+   Note that this can be used to cache any IO space, not just the
+   ones cached by default.  It is up to the caller to decide whether
+   doing so makes sense for the underlying device.
+
+   Return IOS_OK on success, IOS_EPERM if the space is not readable,
+   IOS_ENOMEM if there is not enough memory, or an error code if
+   writing back pending data fails.  */
+
+int ios_configure_cache (ios io, size_t budget, int write_back);
+
+/* **************** Read-ahead **************** */
+
+/* IO spaces detect when their device is being read sequentially, and
+   then read ahead the data following the requested ranges, in windows
+   that double in size on every sequential access, from
+   IOS_READAHEAD_MIN up to IOS_READAHEAD_MAX bytes.  Cached spaces
+   read ahead pages into their cache.  Uncached process and file
+   spaces keep the last window read ahead, which is discarded as soon
+   as the space is read anywhere else or flushed.
+
+   Reads passing IOS_F_BYPASS_CACHE always go to the device.  */
+
+#define IOS_READAHEAD_MIN (16 * 1024)
+#define IOS_READAHEAD_MAX (1024 * 1024)
+
+/* **************** Write buffer API **************** */
+
+/* IO spaces operating writable devices that are cached by default
+   also collect the written data in a write-combining buffer, merging
+   overlapping and adjacent writes.  The pending data is written out
+   in ascending offset order, one device write per contiguous range,
+   when the space is flushed with ios_flush, when it is closed, and
+   whenever the buffer holds more than IOS_WBUF_MAX_BYTES bytes or
+   more than IOS_WBUF_MAX_EXTENTS separate ranges.
+
+   Reads see the pending data.  Writes passing IOS_F_BYPASS_CACHE,
+   and reads passing it, write out the pending data first.
+
+   Note that errors writing out the pending data are reported by the
+   operation triggering the flush, not by the write that originated
+   the data.  */
+
+#define IOS_WBUF_MAX_BYTES (1024 * 1024)
+#define IOS_WBUF_MAX_EXTENTS 4096
+
+/* **************** Streams API **************** */
+
+/* IO spaces reading from streams, like <stdin>, keep the data read
+   from them so it can be read again, until it is forgotten by flushing
+   the space.  At most the last IOS_STREAM_DEFAULT_WINDOW bytes read
+   are kept by default; reading past that forgets the oldest data, and
+   reading it again results in IOS_EOF.  */
+
+#define IOS_STREAM_DEFAULT_WINDOW (16 * 1024 * 1024)
+
+/* Keep at least the last WINDOW bytes read from the stream operated by
+   IO.  Return IOS_OK on success, or IOS_EINVAL if IO doesn't read from
+   a stream.  */
+
+int ios_configure_stream (ios io, size_t window);
+
 /* **************** Update API **************** */
 
 /* XXX: writeme.  */
@@ -345,7 +713,23 @@ int ios_flush (ios io, ios_off offset);
 
 /* **************** Transaction API **************** */
 
-/* XXX: writeme.  */
+/* Overlay IO spaces, opened with a handler overlay://IOS/NAME, show
+   the contents of the IO space IOS but keep whatever is written to
+   them apart, in a journal.  The changes are written to IOS only when
+   the overlay is committed, and they can be discarded instead.  */
+
+/* Write the changes in the overlay IO to its base IO space, in order
+   of increasing offset, and empty its journal.  Return IOS_OK on
+   success, IOS_EINVAL if IO is not an overlay, or another error code
+   if writing to the base fails.  In that case some of the changes
+   may have been written, and the journal is kept.  */
+
+int ios_overlay_commit (ios io);
+
+/* Forget about the changes in the overlay IO.  Return IOS_OK on
+   success or IOS_EINVAL if IO is not an overlay.  */
+
+int ios_overlay_discard (ios io);
 
 /* **************** Foreign IO device **************** */
 
@@ -354,7 +738,7 @@ int ios_flush (ios io, ios_off offset);
    If no forereign IO device is registered, return NULL.
    Otherwise return a pointer to the interface.  */
 
-struct ios_dev_if *ios_foreign_iod (void);
+struct ios_dev_if *ios_foreign_iod (ios_context ios_ctx);
 
 /* Register a foreign IO device.
 
@@ -364,6 +748,7 @@ struct ios_dev_if *ios_foreign_iod (void);
    Return IOS_OK otherwise.  */
 
 struct ios_dev_if;
-int ios_register_foreign_iod (struct ios_dev_if *iod_if);
+int ios_register_foreign_iod (ios_context ios_ctx,
+                              struct ios_dev_if *iod_if);
 
 #endif /* ! IOS_H */
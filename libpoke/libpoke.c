@@ -35,6 +35,7 @@ struct _pk_compiler
 {
   pkl_compiler compiler;
   pvm vm;
+  struct ios_dev_if foreign_iod_if; /* Foreign IOD registered in the VM.  */
 
   int status;  /* Status of last API function call. Initialized with PK_OK */
   /* Data for completion machinery.  */
@@ -408,7 +409,8 @@ pk_ios_completion_function (pk_compiler pkc, const char *text, int state)
 
   int len  = strlen (text);
 
-  IO = state == 0 ?  ios_begin () : ios_next (IO);
+  IO = (state == 0
+        ? ios_begin (pvm_ios_context (pkc->vm)) : ios_next (IO));
   while (1)
     {
       if (ios_end (IO))
@@ -517,14 +519,13 @@ pk_ios
 pk_ios_cur (pk_compiler pkc)
 {
   pkc->status = PK_OK;
-  return (pk_ios) ios_cur ();
+  return (pk_ios) ios_cur (pvm_ios_context (pkc->vm));
 }
 
 void
 pk_ios_set_cur (pk_compiler pkc, pk_ios io)
 {
-  /* XXX use pkc */
-  ios_set_cur ((ios) io);
+  ios_set_cur (pvm_ios_context (pkc->vm), (ios) io);
   pkc->status = PK_OK;
 }
 
@@ -544,16 +545,14 @@ pk_ios
 pk_ios_search (pk_compiler pkc, const char *handler)
 {
   pkc->status = PK_OK;
-  /* XXX use pkc */
-  return (pk_ios) ios_search (handler);
+  return (pk_ios) ios_search (pvm_ios_context (pkc->vm), handler);
 }
 
 pk_ios
 pk_ios_search_by_id (pk_compiler pkc, int id)
 {
   pkc->status = PK_OK;
-  /* XXX use pkc */
-  return (pk_ios) ios_search_by_id (id);
+  return (pk_ios) ios_search_by_id (pvm_ios_context (pkc->vm), id);
 }
 
 int
@@ -562,8 +561,8 @@ pk_ios_open (pk_compiler pkc,
 {
   int ret;
 
-  /* XXX use pkc */
-  if ((ret = ios_open (handler, flags, set_cur_p)) >= 0)
+  ret = ios_open (pvm_ios_context (pkc->vm), handler, flags, set_cur_p);
+  if (ret >= 0)
     return ret;
 
   switch (ret)
@@ -584,8 +583,7 @@ pk_ios_open (pk_compiler pkc,
 void
 pk_ios_close (pk_compiler pkc, pk_ios io)
 {
-  /* XXX use pkc */
-  ios_close ((ios) io);
+  ios_close (pvm_ios_context (pkc->vm), (ios) io);
   pkc->status = PK_OK;
 }
 
@@ -607,6 +605,12 @@ pk_ios_size (pk_ios io)
   return ios_size ((ios) io);
 }
 
+uint64_t
+pk_ios_mem_usage (pk_ios io)
+{
+  return ios_mem_usage ((ios) io);
+}
+
 uint64_t
 pk_ios_get_bias (pk_ios io)
 {
@@ -631,8 +635,7 @@ pk_ios_map (pk_compiler pkc,
             pk_ios_map_fn cb, void *data)
 {
   struct ios_map_fn_payload payload = { cb, data };
-  /* XXX use pkc */
-  ios_map (my_ios_map_fn, (void *) &payload);
+  ios_map (pvm_ios_context (pkc->vm), my_ios_map_fn, (void *) &payload);
   pkc->status = PK_OK;
 }
 
@@ -1033,14 +1036,12 @@ pk_print_val_with_params (pk_compiler pkc, pk_val val,
                              exit_exception);
 }
 
-static struct ios_dev_if foreign_iod_if;
-
 int
 pk_register_iod (pk_compiler pkc, struct pk_iod_if *iod_if)
 {
   pkc->status = PK_OK;
 
-#define CF(FN) foreign_iod_if.FN = iod_if->FN
+#define CF(FN) pkc->foreign_iod_if.FN = iod_if->FN
   CF (get_if_name);
   CF (handler_normalize);
   CF (open);
@@ -1053,6 +1054,7 @@ pk_register_iod (pk_compiler pkc, struct pk_iod_if *iod_if)
   CF (data);
 #undef CF
 
-  (void) ios_register_foreign_iod (&foreign_iod_if);
+  (void) ios_register_foreign_iod (pvm_ios_context (pkc->vm),
+                                   &pkc->foreign_iod_if);
   return pkc->status;
 }
@@ -141,7 +141,8 @@ pk_compiler pk_compiler_new_with_flags (struct pk_term_if *term_if,
 
 /* Destroy an instance of a Poke incremental compiler.
 
-   PKC is a previously created incremental compiler.  */
+   PKC is a previously created incremental compiler.  The IO spaces
+   opened in it are closed.  */
 
 void pk_compiler_free (pk_compiler pkc) LIBPOKE_API;
 
@@ -397,6 +398,12 @@ const char *pk_ios_get_dev_if_name (pk_ios ios) LIBPOKE_API;
 
 uint64_t pk_ios_size (pk_ios ios) LIBPOKE_API;
 
+/* Return the number of bytes of memory used to hold the contents of
+   the given IO space, if it lives in memory, like the spaces opened
+   with `*name*' handlers.  Return 0 otherwise.  */
+
+uint64_t pk_ios_mem_usage (pk_ios ios) LIBPOKE_API;
+
 /* Return the bias of the given IO space, in bits.
 
    Each IO space has a bias associated with it, which by default is 0
@@ -410,6 +417,13 @@ uint64_t pk_ios_get_bias (pk_ios ios) LIBPOKE_API;
 #define PK_IOS_F_READ     1
 #define PK_IOS_F_WRITE    2
 #define PK_IOS_F_CREATE  16
+#define PK_IOS_F_TRUNCATE 32
+#define PK_IOS_F_MMAP       ((uint64_t) 1 << 32)
+#define PK_IOS_F_SEQUENTIAL ((uint64_t) 1 << 33)
+#define PK_IOS_F_RANDOM     ((uint64_t) 1 << 34)
+#define PK_IOS_F_WILLNEED   ((uint64_t) 1 << 35)
+#define PK_IOS_F_DIRECT     ((uint64_t) 1 << 36)
+#define PK_IOS_F_SAVE_INDEX ((uint64_t) 1 << 37)
 
 uint64_t pk_ios_flags (pk_ios ios) LIBPOKE_API;
 
@@ -1241,7 +1255,7 @@ struct pk_iod_if
    functions providing the IO device implementation.
 
    At the moment it is only supported to register just one foreign IO
-   device.
+   device in every compiler.
 
    Return PK_ERROR if some error occurs.
    Return PK_OK otherwise. */
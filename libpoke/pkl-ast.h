@@ -1579,6 +1579,20 @@ pkl_ast_node pkl_ast_make_incrdecr (pkl_ast ast,
 #define PKL_AST_BUILTIN_VM_SET_OMODE 40
 #define PKL_AST_BUILTIN_UNSAFE_STRING_SET 41
 #define PKL_AST_BUILTIN_IOHANDLER 42
+#define PKL_AST_BUILTIN_IOCOMMIT 43
+#define PKL_AST_BUILTIN_IODISCARD 44
+#define PKL_AST_BUILTIN_IODATA 45
+#define PKL_AST_BUILTIN_IOSEARCH 46
+#define PKL_AST_BUILTIN_IOSCAN 47
+#define PKL_AST_BUILTIN_IOCOPY 48
+#define PKL_AST_BUILTIN_IODUMP 49
+#define PKL_AST_BUILTIN_IODIFF 50
+#define PKL_AST_BUILTIN_IODIGEST 51
+#define PKL_AST_BUILTIN_IOSTRINGS 52
+#define PKL_AST_BUILTIN_IOHISTOGRAM 53
+#define PKL_AST_BUILTIN_IOENTROPY 54
+#define PKL_AST_BUILTIN_IOSETCACHE 55
+#define PKL_AST_BUILTIN_IOSETWINDOW 56
 
 struct pkl_ast_comp_stmt
 {
@@ -772,12 +772,54 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_ps_comp_stmt)
         case PKL_AST_BUILTIN_IOFLAGS:
           RAS_MACRO_BUILTIN_IOFLAGS;
           break;
+        case PKL_AST_BUILTIN_IOCOMMIT:
+          RAS_MACRO_BUILTIN_IOCOMMIT;
+          break;
+        case PKL_AST_BUILTIN_IODISCARD:
+          RAS_MACRO_BUILTIN_IODISCARD;
+          break;
+        case PKL_AST_BUILTIN_IODATA:
+          RAS_MACRO_BUILTIN_IODATA;
+          break;
+        case PKL_AST_BUILTIN_IOSEARCH:
+          RAS_MACRO_BUILTIN_IOSEARCH;
+          break;
+        case PKL_AST_BUILTIN_IOSCAN:
+          RAS_MACRO_BUILTIN_IOSCAN;
+          break;
+        case PKL_AST_BUILTIN_IOCOPY:
+          RAS_MACRO_BUILTIN_IOCOPY;
+          break;
+        case PKL_AST_BUILTIN_IODUMP:
+          RAS_MACRO_BUILTIN_IODUMP;
+          break;
+        case PKL_AST_BUILTIN_IODIFF:
+          RAS_MACRO_BUILTIN_IODIFF;
+          break;
+        case PKL_AST_BUILTIN_IODIGEST:
+          RAS_MACRO_BUILTIN_IODIGEST;
+          break;
+        case PKL_AST_BUILTIN_IOSTRINGS:
+          RAS_MACRO_BUILTIN_IOSTRINGS;
+          break;
+        case PKL_AST_BUILTIN_IOHISTOGRAM:
+          RAS_MACRO_BUILTIN_IOHISTOGRAM;
+          break;
+        case PKL_AST_BUILTIN_IOENTROPY:
+          RAS_MACRO_BUILTIN_IOENTROPY;
+          break;
         case PKL_AST_BUILTIN_IOGETB:
           RAS_MACRO_BUILTIN_IOBIAS;
           break;
         case PKL_AST_BUILTIN_IOSETB:
           RAS_MACRO_BUILTIN_IOSETBIAS;
           break;
+        case PKL_AST_BUILTIN_IOSETCACHE:
+          RAS_MACRO_BUILTIN_IOSETCACHE;
+          break;
+        case PKL_AST_BUILTIN_IOSETWINDOW:
+          RAS_MACRO_BUILTIN_IOSETWINDOW;
+          break;
         case PKL_AST_BUILTIN_FORGET:
           RAS_MACRO_BUILTIN_FLUSH;
           break;
@@ -447,6 +447,11 @@ token <integer> UNION    _("keyword `union'")
 %token BUILTIN_VM_OMODE BUILTIN_VM_SET_OMODE
 %token BUILTIN_VM_OPPRINT BUILTIN_VM_SET_OPPRINT
 %token BUILTIN_UNSAFE_STRING_SET BUILTIN_IOHANDLER
+%token BUILTIN_IOCOMMIT BUILTIN_IODISCARD BUILTIN_IODATA
+%token BUILTIN_IOSEARCH
+%token BUILTIN_IOSCAN BUILTIN_IOCOPY BUILTIN_IODUMP BUILTIN_IODIFF
+%token BUILTIN_IODIGEST BUILTIN_IOSTRINGS BUILTIN_IOHISTOGRAM
+%token BUILTIN_IOENTROPY BUILTIN_IOSETCACHE BUILTIN_IOSETWINDOW
 
 /* Compiler builtins.  */
 
@@ -2176,8 +2181,22 @@ builtin:
         | BUILTIN_IOSIZE        { $$ = PKL_AST_BUILTIN_IOSIZE; }
         | BUILTIN_IOHANDLER     { $$ = PKL_AST_BUILTIN_IOHANDLER; }
         | BUILTIN_IOFLAGS       { $$ = PKL_AST_BUILTIN_IOFLAGS; }
+        | BUILTIN_IOCOMMIT      { $$ = PKL_AST_BUILTIN_IOCOMMIT; }
+        | BUILTIN_IODISCARD     { $$ = PKL_AST_BUILTIN_IODISCARD; }
+        | BUILTIN_IODATA        { $$ = PKL_AST_BUILTIN_IODATA; }
+        | BUILTIN_IOSEARCH      { $$ = PKL_AST_BUILTIN_IOSEARCH; }
+        | BUILTIN_IOSCAN        { $$ = PKL_AST_BUILTIN_IOSCAN; }
+        | BUILTIN_IOCOPY        { $$ = PKL_AST_BUILTIN_IOCOPY; }
+        | BUILTIN_IODUMP        { $$ = PKL_AST_BUILTIN_IODUMP; }
+        | BUILTIN_IODIFF        { $$ = PKL_AST_BUILTIN_IODIFF; }
+        | BUILTIN_IODIGEST      { $$ = PKL_AST_BUILTIN_IODIGEST; }
+        | BUILTIN_IOSTRINGS     { $$ = PKL_AST_BUILTIN_IOSTRINGS; }
+        | BUILTIN_IOHISTOGRAM   { $$ = PKL_AST_BUILTIN_IOHISTOGRAM; }
+        | BUILTIN_IOENTROPY     { $$ = PKL_AST_BUILTIN_IOENTROPY; }
         | BUILTIN_IOGETB        { $$ = PKL_AST_BUILTIN_IOGETB; }
         | BUILTIN_IOSETB        { $$ = PKL_AST_BUILTIN_IOSETB; }
+        | BUILTIN_IOSETCACHE    { $$ = PKL_AST_BUILTIN_IOSETCACHE; }
+        | BUILTIN_IOSETWINDOW   { $$ = PKL_AST_BUILTIN_IOSETWINDOW; }
         | BUILTIN_GETENV        { $$ = PKL_AST_BUILTIN_GETENV; }
         | BUILTIN_FORGET        { $$ = PKL_AST_BUILTIN_FORGET; }
         | BUILTIN_GET_TIME      { $$ = PKL_AST_BUILTIN_GET_TIME; }
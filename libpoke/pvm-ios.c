@@ -0,0 +1,506 @@
+/* pvm-ios.c - Support for the IO instructions of the PVM.  */
+
+/* Copyright (C) 2026 Free Software Foundation, Inc. */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pvm.h"
+#include "pvm-val.h"
+#include "pvm-alloc.h"
+#include "pvm-ios.h"
+
+/* Matches collected by pvm_iosearch.  */
+
+struct pvm_iosearch_matches
+{
+  uint64_t limit;
+  uint64_t count;
+  uint64_t allocated;
+  ios_off *offsets;
+  int enomem_p;
+};
+
+static int
+pvm_iosearch_collect (ios_off offset, void *data)
+{
+  struct pvm_iosearch_matches *m = data;
+
+  if (m->count == m->allocated)
+    {
+      size_t allocated = m->allocated ? m->allocated * 2 : 16;
+      ios_off *offsets = realloc (m->offsets,
+                                  allocated * sizeof (ios_off));
+
+      if (!offsets)
+        {
+          m->enomem_p = 1;
+          return 1;
+        }
+      m->offsets = offsets;
+      m->allocated = allocated;
+    }
+
+  m->offsets[m->count++] = offset;
+  return m->limit != 0 && m->count == m->limit;
+}
+
+int
+pvm_iosearch (ios io, pvm_val pattern, ios_off from, uint64_t limit,
+              pvm_val mask, ios_off align, pvm_val *result)
+{
+  struct pvm_iosearch_matches m = { limit, 0, 0, NULL, 0 };
+  uint64_t len = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (pattern));
+  uint64_t mask_len = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (mask));
+  uint8_t *bytes, *masks = NULL;
+  pvm_val type;
+  uint64_t i;
+  int ret;
+
+  if (len == 0 || (mask_len != 0 && mask_len != len))
+    return IOS_EINVAL;
+
+  bytes = malloc (len * (mask_len ? 2 : 1));
+  if (!bytes)
+    return IOS_ENOMEM;
+  for (i = 0; i < len; ++i)
+    bytes[i] = PVM_VAL_UINT (PVM_VAL_ARR_ELEM_VALUE (pattern, i));
+  if (mask_len)
+    {
+      masks = bytes + len;
+      for (i = 0; i < len; ++i)
+        masks[i] = PVM_VAL_UINT (PVM_VAL_ARR_ELEM_VALUE (mask, i));
+    }
+
+  ret = ios_search_bytes (io, from, bytes, masks, len, align,
+                          pvm_iosearch_collect, &m);
+  free (bytes);
+  if (ret == IOS_OK && m.enomem_p)
+    ret = IOS_ENOMEM;
+
+  if (ret == IOS_OK)
+    {
+      type = pvm_make_integral_type (PVM_MAKE_ULONG (64, 64),
+                                     PVM_MAKE_INT (0, 32));
+      type = pvm_make_offset_type (type, PVM_MAKE_ULONG (1, 64));
+      *result = pvm_make_array (PVM_MAKE_ULONG (m.count, 64),
+                                pvm_make_array_type (type, PVM_NULL));
+      for (i = 0; i < m.count; ++i)
+        (void) pvm_array_insert (*result, PVM_MAKE_ULONG (i, 64),
+                                 pvm_make_offset (PVM_MAKE_ULONG (m.offsets[i],
+                                                                  64),
+                                                  PVM_MAKE_ULONG (1, 64)));
+    }
+
+  free (m.offsets);
+  return ret;
+}
+
+/* Matches collected by pvm_ioscan.  */
+
+struct pvm_ioscan_match
+{
+  uint64_t pattern;
+  ios_off offset;
+};
+
+struct pvm_ioscan_matches
+{
+  uint64_t count;
+  uint64_t allocated;
+  struct pvm_ioscan_match *matches;
+  int enomem_p;
+};
+
+static int
+pvm_ioscan_collect (size_t pattern, ios_off offset, void *data)
+{
+  struct pvm_ioscan_matches *m = data;
+
+  if (m->count == m->allocated)
+    {
+      size_t allocated = m->allocated ? m->allocated * 2 : 16;
+      struct pvm_ioscan_match *matches
+        = realloc (m->matches,
+                   allocated * sizeof (struct pvm_ioscan_match));
+
+      if (!matches)
+        {
+          m->enomem_p = 1;
+          return 1;
+        }
+      m->matches = matches;
+      m->allocated = allocated;
+    }
+
+  m->matches[m->count].pattern = pattern;
+  m->matches[m->count].offset = offset;
+  m->count++;
+  return 0;
+}
+
+static int
+pvm_ioscan_cmp (const void *a, const void *b)
+{
+  const struct pvm_ioscan_match *x = a;
+  const struct pvm_ioscan_match *y = b;
+
+  if (x->offset != y->offset)
+    return x->offset < y->offset ? -1 : 1;
+  return (x->pattern > y->pattern) - (x->pattern < y->pattern);
+}
+
+int
+pvm_ioscan (ios io, pvm_val patterns, ios_off from, ios_off size,
+            pvm_val *result)
+{
+  struct pvm_ioscan_matches m = { 0, 0, NULL, 0 };
+  uint64_t npatterns = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (patterns));
+  uint8_t **bytes;
+  size_t *lens;
+  uint64_t i, j;
+  int ret = IOS_OK;
+
+  bytes = calloc (npatterns ? npatterns : 1, sizeof (uint8_t *));
+  lens = malloc ((npatterns ? npatterns : 1) * sizeof (size_t));
+  if (!bytes || !lens)
+    {
+      ret = IOS_ENOMEM;
+      goto done;
+    }
+
+  for (i = 0; i < npatterns; ++i)
+    {
+      pvm_val pattern = PVM_VAL_ARR_ELEM_VALUE (patterns, i);
+
+      lens[i] = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (pattern));
+      bytes[i] = malloc (lens[i] ? lens[i] : 1);
+      if (!bytes[i])
+        {
+          ret = IOS_ENOMEM;
+          goto done;
+        }
+      for (j = 0; j < lens[i]; ++j)
+        bytes[i][j] = PVM_VAL_UINT (PVM_VAL_ARR_ELEM_VALUE (pattern, j));
+    }
+
+  ret = ios_scan (io, from, size, (const uint8_t *const *) bytes,
+                  lens, npatterns, pvm_ioscan_collect, &m);
+  if (ret == IOS_OK && m.enomem_p)
+    ret = IOS_ENOMEM;
+
+  if (ret == IOS_OK)
+    {
+      pvm_val type = pvm_make_integral_type (PVM_MAKE_ULONG (64, 64),
+                                             PVM_MAKE_INT (0, 32));
+
+      qsort (m.matches, m.count, sizeof (struct pvm_ioscan_match),
+             pvm_ioscan_cmp);
+      *result = pvm_make_array (PVM_MAKE_ULONG (2 * m.count, 64),
+                                pvm_make_array_type (type, PVM_NULL));
+      for (i = 0; i < m.count; ++i)
+        {
+          (void) pvm_array_insert (*result, PVM_MAKE_ULONG (2 * i, 64),
+                                   PVM_MAKE_ULONG (m.matches[i].pattern,
+                                                   64));
+          (void) pvm_array_insert (*result,
+                                   PVM_MAKE_ULONG (2 * i + 1, 64),
+                                   PVM_MAKE_ULONG (m.matches[i].offset,
+                                                   64));
+        }
+    }
+
+done:
+  if (bytes)
+    for (i = 0; i < npatterns; ++i)
+      free (bytes[i]);
+  free (bytes);
+  free (lens);
+  free (m.matches);
+  return ret;
+}
+
+/* Hunks collected by pvm_iodiff.  OFFSETS holds the offset and
+   the size of every hunk.  */
+
+struct pvm_iodiff_hunks
+{
+  uint64_t count;
+  uint64_t allocated;
+  uint64_t limit;
+  uint64_t *offsets;
+  int enomem_p;
+};
+
+static int
+pvm_iodiff_collect (ios_off offset, ios_off size, void *data)
+{
+  struct pvm_iodiff_hunks *h = data;
+
+  if (h->count == h->allocated)
+    {
+      size_t allocated = h->allocated ? h->allocated * 2 : 16;
+      uint64_t *offsets
+        = realloc (h->offsets, allocated * 2 * sizeof (uint64_t));
+
+      if (!offsets)
+        {
+          h->enomem_p = 1;
+          return 1;
+        }
+      h->offsets = offsets;
+      h->allocated = allocated;
+    }
+
+  h->offsets[2 * h->count] = offset;
+  h->offsets[2 * h->count + 1] = size;
+  h->count++;
+  return h->limit != 0 && h->count == h->limit;
+}
+
+int
+pvm_iodiff (ios a, ios_off a_from, ios b, ios_off b_from,
+            ios_off size, uint64_t limit, pvm_val *result)
+{
+  struct pvm_iodiff_hunks h = { 0, 0, limit, NULL, 0 };
+  uint64_t i;
+  int ret;
+
+  ret = ios_diff (a, a_from, b, b_from, size, pvm_iodiff_collect, &h);
+  if (ret == IOS_OK && h.enomem_p)
+    ret = IOS_ENOMEM;
+
+  if (ret == IOS_OK)
+    {
+      pvm_val type = pvm_make_integral_type (PVM_MAKE_ULONG (64, 64),
+                                             PVM_MAKE_INT (0, 32));
+
+      *result = pvm_make_array (PVM_MAKE_ULONG (2 * h.count, 64),
+                                pvm_make_array_type (type, PVM_NULL));
+      for (i = 0; i < 2 * h.count; ++i)
+        (void) pvm_array_insert (*result, PVM_MAKE_ULONG (i, 64),
+                                 PVM_MAKE_ULONG (h.offsets[i], 64));
+    }
+
+  free (h.offsets);
+  return ret;
+}
+
+int
+pvm_iodigest (ios io, ios_off from, ios_off size, int algo,
+              pvm_val *result)
+{
+  uint8_t digest[IOS_DIGEST_MAX_SIZE];
+  size_t len, i;
+  int ret;
+
+  ret = ios_digest (io, from, size, algo, digest, &len);
+  if (ret == IOS_OK)
+    {
+      pvm_val type = pvm_make_integral_type (PVM_MAKE_ULONG (8, 64),
+                                             PVM_MAKE_INT (0, 32));
+
+      *result = pvm_make_array (PVM_MAKE_ULONG (len, 64),
+                                pvm_make_array_type (type, PVM_NULL));
+      for (i = 0; i < len; ++i)
+        (void) pvm_array_insert (*result, PVM_MAKE_ULONG (i, 64),
+                                 PVM_MAKE_UINT (digest[i], 8));
+    }
+
+  return ret;
+}
+
+/* Strings found by pvm_iostrings.  OFFSETS and STRS hold the offset
+   and the characters of COUNT strings.  */
+
+struct pvm_iostrings_found
+{
+  uint64_t count;
+  uint64_t allocated;
+  uint64_t *offsets;
+  char **strs;
+  int enomem_p;
+};
+
+static int
+pvm_iostrings_collect (ios_off offset, const char *str, size_t len,
+                       void *data)
+{
+  struct pvm_iostrings_found *f = data;
+
+  if (f->count == f->allocated)
+    {
+      size_t allocated = f->allocated ? f->allocated * 2 : 16;
+      uint64_t *offsets
+        = realloc (f->offsets, allocated * sizeof (uint64_t));
+      char **strs;
+
+      if (!offsets)
+        {
+          f->enomem_p = 1;
+          return 1;
+        }
+      f->offsets = offsets;
+
+      strs = realloc (f->strs, allocated * sizeof (char *));
+      if (!strs)
+        {
+          f->enomem_p = 1;
+          return 1;
+        }
+      f->strs = strs;
+      f->allocated = allocated;
+    }
+
+  f->strs[f->count] = strdup (str);
+  if (!f->strs[f->count])
+    {
+      f->enomem_p = 1;
+      return 1;
+    }
+  f->offsets[f->count] = offset;
+  f->count++;
+  return 0;
+}
+
+int
+pvm_iostrings (ios io, ios_off from, ios_off size, uint64_t min_len,
+               int encoding, int print, pvm_val *result)
+{
+  struct pvm_iostrings_found f = { 0, 0, NULL, NULL, 0 };
+  uint64_t i;
+  int ret;
+
+  if (print)
+    ret = ios_print_strings (io, from, size, encoding, min_len,
+                             print == 2);
+  else
+    {
+      ret = ios_strings (io, from, size, encoding, min_len,
+                         pvm_iostrings_collect, &f);
+      if (ret == IOS_OK && f.enomem_p)
+        ret = IOS_ENOMEM;
+    }
+
+  if (ret == IOS_OK)
+    {
+      *result = pvm_make_array (PVM_MAKE_ULONG (2 * f.count, 64),
+                                pvm_make_array_type (pvm_make_any_type (),
+                                                     PVM_NULL));
+      for (i = 0; i < f.count; ++i)
+        {
+          (void) pvm_array_insert (*result, PVM_MAKE_ULONG (2 * i, 64),
+                                   PVM_MAKE_ULONG (f.offsets[i], 64));
+          (void) pvm_array_insert (*result,
+                                   PVM_MAKE_ULONG (2 * i + 1, 64),
+                                   pvm_make_string (f.strs[i]));
+        }
+    }
+
+  for (i = 0; i < f.count; ++i)
+    free (f.strs[i]);
+  free (f.strs);
+  free (f.offsets);
+  return ret;
+}
+
+int
+pvm_iohistogram (ios io, ios_off from, ios_off size, pvm_val *result)
+{
+  uint64_t counts[256];
+  int ret, i;
+
+  ret = ios_histogram (io, from, size, counts);
+  if (ret == IOS_OK)
+    {
+      pvm_val type = pvm_make_integral_type (PVM_MAKE_ULONG (64, 64),
+                                             PVM_MAKE_INT (0, 32));
+
+      *result = pvm_make_array (PVM_MAKE_ULONG (256, 64),
+                                pvm_make_array_type (type, PVM_NULL));
+      for (i = 0; i < 256; ++i)
+        (void) pvm_array_insert (*result, PVM_MAKE_ULONG (i, 64),
+                                 PVM_MAKE_ULONG (counts[i], 64));
+    }
+
+  return ret;
+}
+
+/* Entropies collected by pvm_ioentropy, in thousandths of bit per
+   byte.  */
+
+struct pvm_ioentropy_series
+{
+  uint64_t count;
+  uint64_t allocated;
+  uint32_t *values;
+  int enomem_p;
+};
+
+static int
+pvm_ioentropy_collect (ios_off offset, double entropy, void *data)
+{
+  struct pvm_ioentropy_series *e = data;
+
+  if (e->count == e->allocated)
+    {
+      size_t allocated = e->allocated ? e->allocated * 2 : 256;
+      uint32_t *values
+        = realloc (e->values, allocated * sizeof (uint32_t));
+
+      if (!values)
+        {
+          e->enomem_p = 1;
+          return 1;
+        }
+      e->values = values;
+      e->allocated = allocated;
+    }
+
+  e->values[e->count++] = (uint32_t) (entropy * 1000 + 0.5);
+  return 0;
+}
+
+int
+pvm_ioentropy (ios io, ios_off from, ios_off size, ios_off window,
+               ios_off step, pvm_val *result)
+{
+  struct pvm_ioentropy_series e = { 0, 0, NULL, 0 };
+  uint64_t i;
+  int ret;
+
+  ret = ios_entropy (io, from, size, window, step,
+                     pvm_ioentropy_collect, &e);
+  if (ret == IOS_OK && e.enomem_p)
+    ret = IOS_ENOMEM;
+
+  if (ret == IOS_OK)
+    {
+      pvm_val type = pvm_make_integral_type (PVM_MAKE_ULONG (32, 64),
+                                             PVM_MAKE_INT (0, 32));
+
+      *result = pvm_make_array (PVM_MAKE_ULONG (e.count, 64),
+                                pvm_make_array_type (type, PVM_NULL));
+      for (i = 0; i < e.count; ++i)
+        (void) pvm_array_insert (*result, PVM_MAKE_ULONG (i, 64),
+                                 PVM_MAKE_UINT (e.values[i], 32));
+    }
+
+  free (e.values);
+  return ret;
+}
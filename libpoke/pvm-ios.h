@@ -0,0 +1,89 @@
+/* pvm-ios.h - Support for the IO instructions of the PVM.  */
+
+/* Copyright (C) 2026 Free Software Foundation, Inc. */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PVM_IOS_H
+#define PVM_IOS_H
+
+#include <config.h>
+
+#include "pvm.h"
+#include "ios.h"
+
+/* The functions in this file run the IO space operations of the ios
+   module on behalf of the PVM instructions, and convert their results
+   to PVM values.  All of them return an IOS_* status code, and set
+   *RESULT only on success.  */
+
+/* Search IO for the bytes in the array PATTERN, masked with the bytes
+   in the array MASK unless it is empty, and set *RESULT to an array
+   with the offsets of the first LIMIT matches, or of all of them if
+   LIMIT is zero.  See ios_search_bytes for the meaning of FROM and
+   ALIGN.  */
+
+int pvm_iosearch (ios io, pvm_val pattern, ios_off from, uint64_t limit,
+                  pvm_val mask, ios_off align, pvm_val *result);
+
+/* Scan SIZE bits of IO starting at FROM for the arrays of bytes in
+   the array PATTERNS, and set *RESULT to an array of ulongs with the
+   index of the pattern and the offset of every match, sorted by
+   offset.  See ios_scan for the meaning of FROM and SIZE.  */
+
+int pvm_ioscan (ios io, pvm_val patterns, ios_off from, ios_off size,
+                pvm_val *result);
+
+/* Compare the ranges of A and B starting at A_FROM and B_FROM and
+   spanning SIZE bits, and set *RESULT to an array of ulongs with the
+   offset, relative to the beginning of the ranges, and the size of at
+   most LIMIT hunks of changed bytes.  If LIMIT is zero collect all
+   the hunks.  See ios_diff for the meaning of the arguments.  */
+
+int pvm_iodiff (ios a, ios_off a_from, ios b, ios_off b_from,
+                ios_off size, uint64_t limit, pvm_val *result);
+
+/* Compute the ALGO digest of SIZE bits of IO starting at FROM, and
+   set *RESULT to an array of bytes with it.  See ios_digest for the
+   meaning of the arguments.  */
+
+int pvm_iodigest (ios io, ios_off from, ios_off size, int algo,
+                  pvm_val *result);
+
+/* Find the strings in SIZE bits of IO starting at FROM, and set
+   *RESULT to an array with the offset, as an ulong, and the
+   characters of every string.  If PRINT is not zero, print the
+   strings instead, preceded by their offsets if PRINT is 2, and set
+   *RESULT to an empty array.  See ios_strings for the meaning of the
+   other arguments.  */
+
+int pvm_iostrings (ios io, ios_off from, ios_off size, uint64_t min_len,
+                   int encoding, int print, pvm_val *result);
+
+/* Count the occurrences of every byte value in SIZE bits of IO
+   starting at FROM, and set *RESULT to an array of 256 ulongs with
+   them.  See ios_histogram for the meaning of the arguments.  */
+
+int pvm_iohistogram (ios io, ios_off from, ios_off size, pvm_val *result);
+
+/* Compute the entropy of the windows of WINDOW bits starting every
+   STEP bits in SIZE bits of IO starting at FROM, and set *RESULT to
+   an array of uints with them, in thousandths of bit per byte.  See
+   ios_entropy for the meaning of the arguments.  */
+
+int pvm_ioentropy (ios io, ios_off from, ios_off size, ios_off window,
+                   ios_off step, pvm_val *result);
+
+#endif /* ! PVM_IOS_H */
@@ -233,6 +233,65 @@ pvm_array_insert (pvm_val arr, pvm_val idx, pvm_val val)
   return 1;
 }
 
+void
+pvm_array_append_integral (pvm_val arr, const uint64_t *values,
+                           size_t count)
+{
+  pvm_val etype = PVM_VAL_TYP_A_ETYPE (PVM_VAL_ARR_TYPE (arr));
+  int bits = PVM_VAL_ULONG (PVM_VAL_TYP_I_SIZE (etype));
+  int signed_p = PVM_VAL_INT (PVM_VAL_TYP_I_SIGNED_P (etype));
+  size_t nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr));
+  size_t nallocated = PVM_VAL_ARR_NALLOCATED (arr);
+  size_t elem_boffset
+    = (nelem > 0
+       ? (PVM_VAL_ULONG (PVM_VAL_ARR_ELEM_OFFSET (arr, nelem - 1))
+          + bits)
+       : PVM_VAL_ULONG (PVM_VAL_ARR_OFFSET (arr)));
+  size_t i;
+
+  /* Make room for the new elements.  The array is grown
+     geometrically, since this function is typically called several
+     times in a row while mapping big arrays.  */
+  if ((nallocated - nelem) < count)
+    {
+      size_t new_nallocated = nallocated * 2;
+
+      if (new_nallocated < nelem + count)
+        new_nallocated = nelem + count;
+
+      PVM_VAL_ARR_ELEMS (arr) = pvm_realloc (PVM_VAL_ARR_ELEMS (arr),
+                                             new_nallocated
+                                             * sizeof (struct pvm_array_elem));
+      for (i = nallocated; i < new_nallocated; ++i)
+        {
+          PVM_VAL_ARR_ELEM_VALUE (arr, i) = PVM_NULL;
+          PVM_VAL_ARR_ELEM_OFFSET (arr, i) = PVM_NULL;
+        }
+      PVM_VAL_ARR_NALLOCATED (arr) = new_nallocated;
+    }
+
+  for (i = 0; i < count; ++i)
+    {
+      pvm_val val;
+
+      if (bits <= 32)
+        val = (signed_p
+               ? pvm_make_int ((int32_t) values[i], bits)
+               : pvm_make_uint ((uint32_t) values[i], bits));
+      else
+        val = (signed_p
+               ? pvm_make_long ((int64_t) values[i], bits)
+               : pvm_make_ulong (values[i], bits));
+
+      PVM_VAL_ARR_ELEM_VALUE (arr, nelem + i) = val;
+      PVM_VAL_ARR_ELEM_OFFSET (arr, nelem + i)
+        = pvm_make_ulong (elem_boffset, 64);
+      elem_boffset += bits;
+    }
+
+  PVM_VAL_ARR_NELEM (arr) = pvm_make_ulong (nelem + count, 64);
+}
+
 int
 pvm_array_set (pvm_val arr, pvm_val idx, pvm_val val)
 {
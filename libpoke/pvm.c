@@ -40,6 +40,8 @@
   (PVM_STATE_BACKING_FIELD (& (PVM)->pvm_state, exit_code))
 #define PVM_STATE_VM(PVM)                               \
   (PVM_STATE_BACKING_FIELD (& (PVM)->pvm_state, vm))
+#define PVM_STATE_IOS_CTX(PVM)                          \
+  (PVM_STATE_BACKING_FIELD (& (PVM)->pvm_state, ios_ctx))
 #define PVM_STATE_ENV(PVM)                              \
   (PVM_STATE_RUNTIME_FIELD (& (PVM)->pvm_state, env))
 #define PVM_STATE_ENDIAN(PVM)                           \
@@ -110,9 +112,18 @@ pvm
 pvm_init (void)
 {
   pvm apvm = calloc (1, sizeof (struct pvm));
+  ios_context ios_ctx;
+
   if (!apvm)
     return NULL;
 
+  ios_ctx = ios_init ();
+  if (!ios_ctx)
+    {
+      free (apvm);
+      return NULL;
+    }
+
   /* Initialize the memory allocation subsystem.  */
   pvm_alloc_initialize ();
 
@@ -124,6 +135,7 @@ pvm_init (void)
 
   /* Initialize the VM state.  */
   pvm_initialize_state (apvm, &apvm->pvm_state);
+  PVM_STATE_IOS_CTX (apvm) = ios_ctx;
 
   /* Initialize pvm-program.  */
   pvm_program_init ();
@@ -224,6 +236,9 @@ pvm_shutdown (pvm apvm)
     = & PVM_STATE_BACKING_FIELD (& apvm->pvm_state,
                                  jitter_stack_exceptionstack_backing);
 
+  /* Close the IO spaces of the VM.  */
+  ios_shutdown (PVM_STATE_IOS_CTX (apvm));
+
   /* Finalize pvm-program.  */
   pvm_program_fini ();
 
@@ -371,6 +386,12 @@ pvm_set_compiler (pvm apvm, pkl_compiler compiler)
   apvm->compiler = compiler;
 }
 
+ios_context
+pvm_ios_context (pvm apvm)
+{
+  return PVM_STATE_IOS_CTX (apvm);
+}
+
 void
 pvm_assert (int expression, const char *expression_str,
             const char *filename, int line)
@@ -328,6 +328,16 @@ pvm_program pvm_val_cls_program (pvm_val cls);
 
 int pvm_array_insert (pvm_val arr, pvm_val idx, pvm_val val);
 
+/* Append COUNT elements at the end of the array ARR, whose elements
+   shall be of some integral type.  VALUES contains the values of the
+   new elements, which are interpreted as signed or unsigned integers
+   depending on that type.  The bit-offsets of the new elements are
+   set as if they were contiguous to the last element in the array,
+   or located at the offset of the array if it is empty.  */
+
+void pvm_array_append_integral (pvm_val arr, const uint64_t *values,
+                                size_t count);
+
 /* Set VAL as the value of the element occupying the position IDX in
    the array ARR.
 
@@ -586,7 +596,8 @@ enum pvm_exit_code
 
 typedef struct pvm *pvm;
 
-/* Initialize a new Poke Virtual Machine and return it.  */
+/* Initialize a new Poke Virtual Machine and return it.  Every VM
+   has its own IO context.  */
 
 pvm pvm_init (void);
 
@@ -721,6 +732,11 @@ pkl_compiler pvm_compiler (pvm vm);
 
 void pvm_set_compiler (pvm vm, pkl_compiler compiler);
 
+/* Get the IO context of a virtual machine, which holds the IO spaces
+   operated by the programs it runs.  */
+
+ios_context pvm_ios_context (pvm vm);
+
 /* The following function is to be used in pvm.jitter, because the
    system `assert' may expand to a macro and is therefore
    non-wrappeable.
@@ -150,8 +150,9 @@ pk_cmd_proc (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
 #endif /* HAVE_PROC */
 }
 
-#define PK_FILE_UFLAGS "c"
+#define PK_FILE_UFLAGS "cm"
 #define PK_FILE_F_CREATE 0x1
+#define PK_FILE_F_MMAP   0x2
 
 static int
 pk_cmd_file (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
@@ -165,6 +166,7 @@ pk_cmd_file (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
   const char *arg_str = PK_CMD_ARG_STR (argv[1]);
   const char *filename = arg_str;
   int create_p = uflags & PK_FILE_F_CREATE;
+  int mmap_p = uflags & PK_FILE_F_MMAP;
 
   if (access (filename, F_OK) == 0
       && create_p)
@@ -178,7 +180,8 @@ pk_cmd_file (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
       return 0;
     }
 
-  if (PK_IOS_NOID == pk_open_file (filename, 1 /* set_cur_p */, create_p))
+  if (PK_IOS_NOID == pk_open_file (filename, 1 /* set_cur_p */, create_p,
+                                   mmap_p))
     {
       pk_term_class ("error");
       pk_puts (_("error: "));
@@ -0,0 +1,180 @@
+/* pk-cmd-search.c - Commands for searching in IO spaces.  */
+
+/* Copyright (C) 2026 Free Software Foundation, Inc. */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <assert.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "xalloc.h"
+
+#include "poke.h"
+#include "pk-cmd.h"
+
+/* Parse the pattern in STR, which is a sequence of bytes written in
+   hexadecimal and strings between double quotes.  A `?' in place of
+   an hexadecimal digit matches any digit.
+
+   Store the bytes of the pattern and their masks in BYTES and MASK,
+   which shall have room for as many bytes as characters there are in
+   STR, set *LEN to the number of bytes and *MASKED_P to whether any
+   of the masks is not 0xff.  Return 1 if the pattern is valid, 0
+   otherwise.  */
+
+static int
+parse_pattern (const char *str, uint8_t *bytes, uint8_t *mask,
+               size_t *len, int *masked_p)
+{
+  const char *p = str;
+  size_t n = 0;
+
+  *masked_p = 0;
+  while (*p != '\0')
+    {
+      if (isspace ((unsigned char) *p))
+        p++;
+      else if (*p == '"')
+        {
+          for (p++; *p != '"'; p++)
+            {
+              if (*p == '\\' && (p[1] == '"' || p[1] == '\\'))
+                p++;
+              if (*p == '\0')
+                return 0;
+              bytes[n] = *p;
+              mask[n++] = 0xff;
+            }
+          p++;
+        }
+      else
+        {
+          int i;
+
+          bytes[n] = 0;
+          mask[n] = 0;
+          for (i = 0; i < 2; i++, p++)
+            {
+              bytes[n] <<= 4;
+              mask[n] <<= 4;
+              if (*p == '?')
+                *masked_p = 1;
+              else if (isxdigit ((unsigned char) *p))
+                {
+                  bytes[n] |= (isdigit ((unsigned char) *p)
+                               ? *p - '0'
+                               : tolower ((unsigned char) *p) - 'a' + 10);
+                  mask[n] |= 0xf;
+                }
+              else
+                return 0;
+            }
+          n++;
+        }
+    }
+
+  *len = n;
+  return n > 0;
+}
+
+static pk_val
+make_byte_array (const uint8_t *bytes, size_t len)
+{
+  pk_val type
+    = pk_make_array_type (pk_make_integral_type (pk_make_uint (8, 64),
+                                                 pk_make_int (0, 32)),
+                          PK_NULL);
+  pk_val array = pk_make_array (pk_make_uint (len, 64), type);
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    pk_array_insert_elem (array, i, pk_make_uint (bytes[i], 8));
+  return array;
+}
+
+static int
+pk_cmd_search (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
+{
+  /* search PATTERN [,LIMIT]  */
+
+  pk_val iosearch, matches, exit_exception;
+  const char *arg;
+  uint8_t *bytes, *mask;
+  uint64_t limit = 0, nelem, i;
+  size_t len;
+  int masked_p, ret;
+
+  assert (argc == 3);
+  assert (PK_CMD_ARG_TYPE (argv[1]) == PK_CMD_ARG_STR);
+
+  arg = PK_CMD_ARG_STR (argv[1]);
+  if (PK_CMD_ARG_TYPE (argv[2]) == PK_CMD_ARG_INT)
+    limit = PK_CMD_ARG_INT (argv[2]);
+
+  bytes = xmalloc (strlen (arg) * 2);
+  mask = bytes + strlen (arg);
+  ret = parse_pattern (arg, bytes, mask, &len, &masked_p);
+  if (!ret)
+    {
+      pk_term_class ("error");
+      pk_puts (_("error: "));
+      pk_term_end_class ("error");
+      pk_printf (_("invalid pattern `%s'\n"), arg);
+      free (bytes);
+      return 0;
+    }
+
+  iosearch = pk_decl_val (poke_compiler, "iosearch");
+  assert (iosearch != PK_NULL);
+
+  ret = pk_call (poke_compiler, iosearch, &matches, &exit_exception,
+                 6, make_byte_array (bytes, len), PK_NULL,
+                 pk_make_uint (limit, 64),
+                 masked_p ? make_byte_array (mask, len) : PK_NULL,
+                 PK_NULL, PK_NULL);
+  free (bytes);
+  if (ret == PK_ERROR)
+    assert (0); /* This shouldn't happen.  */
+  if (exit_exception != PK_NULL)
+    {
+      poke_handle_exception (exit_exception);
+      return 0;
+    }
+
+  nelem = pk_uint_value (pk_array_nelem (matches));
+  for (i = 0; i < nelem; i++)
+    {
+      uint64_t offset
+        = pk_uint_value (pk_offset_magnitude (pk_array_elem_value (matches,
+                                                                   i)));
+
+      pk_term_class ("offset");
+      if (offset % 8 == 0)
+        pk_printf ("0x%08" PRIx64 "#B", offset / 8);
+      else
+        pk_printf ("%" PRIu64 "#b", offset);
+      pk_term_end_class ("offset");
+      pk_puts ("\n");
+    }
+
+  return 1;
+}
+
+const struct pk_cmd search_cmd =
+  {"search", "s,?n", "", PK_CMD_F_REQ_IO, NULL, NULL, pk_cmd_search,
+   "search PATTERN [,LIMIT]", NULL};
@@ -0,0 +1,93 @@
+/* pk-cmd-strings.c - Commands for finding strings in IO spaces.  */
+
+/* Copyright (C) 2026 Free Software Foundation, Inc. */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <assert.h>
+
+#include "poke.h"
+#include "pk-cmd.h"
+
+#define PK_STRINGS_UFLAGS "olb"
+#define PK_STRINGS_F_OFFSETS 0x1
+#define PK_STRINGS_F_UTF16LE 0x2
+#define PK_STRINGS_F_UTF16BE 0x4
+
+static int
+pk_cmd_strings (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
+{
+  /* strings[/olb] [MIN_LEN]  */
+
+  pk_val print_strings, encoding, zero, retval, exit_exception;
+  uint64_t min_len = 4;
+  int ios_id, ret;
+
+  assert (argc == 2);
+
+  if (PK_CMD_ARG_TYPE (argv[1]) == PK_CMD_ARG_INT)
+    {
+      min_len = PK_CMD_ARG_INT (argv[1]);
+      if (min_len == 0)
+        {
+          pk_term_class ("error");
+          pk_puts (_("error: "));
+          pk_term_end_class ("error");
+          pk_puts (_("the minimum length shall be positive\n"));
+          return 0;
+        }
+    }
+
+  if ((uflags & PK_STRINGS_F_UTF16LE) && (uflags & PK_STRINGS_F_UTF16BE))
+    {
+      pk_term_class ("error");
+      pk_puts (_("error: "));
+      pk_term_end_class ("error");
+      pk_puts (_("only one of the flags `l' and `b' can be given\n"));
+      return 0;
+    }
+
+  if (uflags & PK_STRINGS_F_UTF16LE)
+    encoding = pk_decl_val (poke_compiler, "IOS_STRINGS_UTF16LE");
+  else if (uflags & PK_STRINGS_F_UTF16BE)
+    encoding = pk_decl_val (poke_compiler, "IOS_STRINGS_UTF16BE");
+  else
+    encoding = pk_decl_val (poke_compiler, "IOS_STRINGS_ASCII");
+  assert (encoding != PK_NULL);
+
+  print_strings = pk_decl_val (poke_compiler, "ios_print_strings");
+  assert (print_strings != PK_NULL);
+
+  ios_id = pk_ios_get_id (pk_ios_cur (poke_compiler));
+  zero = pk_make_offset (pk_make_int (0, 64), pk_make_uint (1, 64));
+  ret = pk_call (poke_compiler, print_strings, &retval, &exit_exception,
+                 6, pk_make_int (ios_id, 32), zero, zero,
+                 pk_make_uint (min_len, 64), encoding,
+                 pk_make_int (!!(uflags & PK_STRINGS_F_OFFSETS), 32));
+  if (ret == PK_ERROR)
+    assert (0); /* This shouldn't happen.  */
+  if (exit_exception != PK_NULL)
+    {
+      poke_handle_exception (exit_exception);
+      return 0;
+    }
+
+  return 1;
+}
+
+const struct pk_cmd strings_cmd =
+  {"strings", "?n", PK_STRINGS_UFLAGS, PK_CMD_F_REQ_IO, NULL, NULL,
+   pk_cmd_strings, "strings[/olb] [MIN_LEN]", NULL};
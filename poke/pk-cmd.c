@@ -63,6 +63,8 @@ extern const struct pk_cmd vm_cmd; /* pk-cmd-vm.c  */
 extern struct pk_cmd set_cmd; /* pk-cmd-set.c */
 extern const struct pk_cmd editor_cmd; /* pk-cmd-editor.c */
 extern const struct pk_cmd map_cmd; /* pk-cmd-map.c */
+extern const struct pk_cmd search_cmd; /* pk-cmd-search.c */
+extern const struct pk_cmd strings_cmd; /* pk-cmd-strings.c */
 
 const struct pk_cmd null_cmd = {};
 
@@ -87,6 +89,8 @@ static const struct pk_cmd *dot_cmds[] =
     &map_cmd,
     &editor_cmd,
     &mem_cmd,
+    &search_cmd,
+    &strings_cmd,
 #ifdef HAVE_LIBNBD
     &nbd_cmd,
 #endif
@@ -29,7 +29,8 @@
 #include "pk-map.h"
 
 int
-pk_open_file (const char *handler, int set_cur_p, int create_p)
+pk_open_file (const char *handler, int set_cur_p, int create_p,
+              int mmap_p)
 {
   int ios_id;
   uint64_t open_flags;
@@ -39,6 +40,9 @@ pk_open_file (const char *handler, int set_cur_p, int create_p)
   else
     open_flags = 0;
 
+  if (mmap_p)
+    open_flags |= PK_IOS_F_MMAP;
+
   ios_id = pk_ios_open (poke_compiler, handler,
                         open_flags, set_cur_p);
   if (ios_id == PK_IOS_NOID)
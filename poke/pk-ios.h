@@ -32,10 +32,15 @@
    CREATE_P is 1 if a file is to be created if HANDLER doesn't exist.
    The new file is created with read/write permissions.
 
+   MMAP_P is 1 if the file is to be mapped in memory rather than
+   accessed with reads and writes.  This is ignored if the file is
+   not a regular file.
+
    Return the IOS id of the newly opened IOS, or PK_IOS_ERROR if the
    given handler coulnd't be opened.  */
 
-int pk_open_file (const char *handler, int set_cur_p, int create_p);
+int pk_open_file (const char *handler, int set_cur_p, int create_p,
+                  int mmap_p);
 
 /* Open sub IO spaces for the given process PID maps, i.e. mapped
    regions in the process' virtual memory.  If the operation can't be
@@ -32,6 +32,7 @@
 #define USOCK_CHAN_OUT_DISASM 0x03
 #define USOCK_CHAN_OUT_TREEVU 0x04
 #define USOCK_CHAN_OUT_AUTOCMPL 0x05
+#define USOCK_CHAN_OUT_ENTROPY 0x06
 
 struct usock;
 
@@ -0,0 +1,113 @@
+/* proc.c -- Unit tests for process memory IO spaces.  */
+
+/* Copyright (C) 2026 Free Software Foundation, Inc. */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "libpoke.h"
+
+/* DejaGnu should not use gnulib's vsnprintf replacement here.  */
+#undef vsnprintf
+#include <dejagnu.h>
+
+#include "term-if.h"
+
+#ifdef HAVE_PROC
+
+/* The memory of this process which is read through a proc IO
+   space.  It is big enough to hold any read-ahead window.  */
+
+static volatile uint8_t data[1024 * 1024 + 64];
+
+/* Return the byte at data[INDEX], as read by PKC from the current IO
+   space, or -1 if it can't be read.  */
+
+static int
+read_data (pk_compiler pkc, int index)
+{
+  char expr[64];
+  pk_val val, exit_exception;
+
+  snprintf (expr, sizeof expr, "byte @ 0x%llxUL#B",
+            (unsigned long long) (uintptr_t) &data[index]);
+  if (pk_compile_expression (pkc, expr, NULL, &val,
+                             &exit_exception) != PK_OK
+      || exit_exception != PK_NULL)
+    return -1;
+  return pk_uint_value (val);
+}
+
+/* Reading the same address of a process twice gets the current
+   contents of its memory, even if the first read was part of a
+   sequential scan.  */
+
+static void
+test_proc_reread (void)
+{
+  pk_compiler pkc;
+  char handler[32];
+  int ok;
+
+  pkc = pk_compiler_new (&poke_term_if);
+  if (!pkc)
+    {
+      fail ("proc_reread: creating compiler");
+      return;
+    }
+
+  snprintf (handler, sizeof handler, "pid://%ld", (long) getpid ());
+  if (pk_ios_open (pkc, handler, 0, 1) == PK_IOS_NOID)
+    {
+      untested ("proc_reread: opening the memory of the process");
+      goto done;
+    }
+
+  memset ((void *) data, 1, 64);
+  ok = read_data (pkc, 0) == 1 && read_data (pkc, 1) == 1;
+
+  data[1] = 2;
+  data[2] = 3;
+  ok = ok && read_data (pkc, 1) == 2 && read_data (pkc, 2) == 3;
+
+  if (ok)
+    pass ("proc_reread");
+  else
+    fail ("proc_reread");
+
+ done:
+  pk_compiler_free (pkc);
+}
+
+#endif /* HAVE_PROC */
+
+int
+main (int argc, char *argv[])
+{
+#ifdef HAVE_PROC
+  test_proc_reread ();
+#else
+  untested ("proc_reread: no proc IO spaces");
+#endif
+
+  totals ();
+  return 0;
+}
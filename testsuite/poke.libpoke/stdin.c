@@ -0,0 +1,159 @@
+/* stdin.c -- Unit tests for the <stdin> IO space.  */
+
+/* Copyright (C) 2026 Free Software Foundation, Inc. */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include "libpoke.h"
+
+/* DejaGnu should not use gnulib's vsnprintf replacement here.  */
+#undef vsnprintf
+#include <dejagnu.h>
+
+#include "term-if.h"
+
+/* The data fed through stdin, which is much bigger than the
+   retention window set by the test.  */
+
+#define DATA_SIZE (512 * 1024)
+#define WINDOW_SIZE 4096
+
+static int
+data_byte (uint64_t offset)
+{
+  return (offset * 7 + (offset >> 9)) & 0xff;
+}
+
+/* Make stdin read DATA_SIZE bytes of data from a temporary file.
+   Return 0 on success, -1 otherwise.  */
+
+static int
+feed_stdin (void)
+{
+  FILE *file = tmpfile ();
+  uint64_t i;
+
+  if (!file)
+    return -1;
+  for (i = 0; i < DATA_SIZE; ++i)
+    putc (data_byte (i), file);
+  if (fflush (file) != 0
+      || fseek (file, 0, SEEK_SET) != 0
+      || dup2 (fileno (file), STDIN_FILENO) == -1)
+    return -1;
+  clearerr (stdin);
+  return 0;
+}
+
+/* Return the byte at OFFSET of the current IO space, as read by PKC,
+   -2 if reading it raises E_eof, or -1 if there is any other error.  */
+
+static int
+read_byte (pk_compiler pkc, uint64_t offset)
+{
+  char expr[64];
+  pk_val val, exit_exception;
+
+  snprintf (expr, sizeof expr, "read_byte (%" PRIu64 "UL)", offset);
+  if (pk_compile_expression (pkc, expr, NULL, &val,
+                             &exit_exception) != PK_OK
+      || exit_exception != PK_NULL)
+    return -1;
+  return pk_int_value (val);
+}
+
+/* The data read from stdin through its FILE before opening the IO
+   space is not lost, the bytes in the retention window can be read
+   again, and the bytes before it are forgotten.  */
+
+static void
+test_stdin_window (void)
+{
+  pk_compiler pkc;
+  pk_val val, exit_exception;
+  uint64_t offset;
+  int ok;
+
+  pkc = pk_compiler_new (&poke_term_if);
+  if (!pkc)
+    {
+      fail ("stdin_window: creating compiler");
+      return;
+    }
+
+  if (feed_stdin () != 0)
+    {
+      untested ("stdin_window: feeding stdin");
+      goto done;
+    }
+
+  /* This fills the buffer of the FILE of stdin.  */
+  ungetc (getc (stdin), stdin);
+
+  if (pk_compile_buffer (pkc,
+                         "fun read_byte = (uint<64> o) int<32>:\n"
+                         "{\n"
+                         "  try return byte @ o#B;\n"
+                         "  catch if E_eof { return -2; }\n"
+                         "}\n",
+                         NULL, &exit_exception) != PK_OK
+      || exit_exception != PK_NULL
+      || pk_ios_open (pkc, "<stdin>", 0, 1) == PK_IOS_NOID
+      || pk_compile_statement (pkc, "iosetwindow (4#KiB);", NULL, &val,
+                               &exit_exception) != PK_OK
+      || exit_exception != PK_NULL)
+    {
+      fail ("stdin_window: opening <stdin>");
+      goto done;
+    }
+
+  ok = 1;
+  for (offset = 0; offset < 64; ++offset)
+    ok = ok && read_byte (pkc, offset) == data_byte (offset);
+  for (offset = DATA_SIZE - WINDOW_SIZE; offset < DATA_SIZE; offset += 61)
+    ok = ok && read_byte (pkc, offset) == data_byte (offset);
+  if (ok)
+    pass ("stdin_window: reading the window");
+  else
+    fail ("stdin_window: reading the window");
+
+  offset = DATA_SIZE - WINDOW_SIZE;
+  if (read_byte (pkc, offset) == data_byte (offset)
+      && read_byte (pkc, 0) == -2
+      && read_byte (pkc, DATA_SIZE / 2) == -2)
+    pass ("stdin_window: reading before the window");
+  else
+    fail ("stdin_window: reading before the window");
+
+ done:
+  pk_compiler_free (pkc);
+}
+
+int
+main (int argc, char *argv[])
+{
+  test_stdin_window ();
+
+  totals ();
+  return 0;
+}